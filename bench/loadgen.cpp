@@ -0,0 +1,569 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include <random>
+#include <cmath>
+#include <cstdlib>
+#include <cstdint>
+#include <cstring>
+#include <cctype>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "redisnet.h"
+#include "latencyhistogram.h"
+
+#pragma comment(lib, "ws2_32.lib")
+
+// redisaiagent-bench: opens N connections to a running server, keeps each
+// one busy with batches of `pipeline` commands and records the latency of
+// every request from the moment its batch was sent until its reply parsed.
+
+typedef std::chrono::steady_clock benchclock;
+
+struct options {
+    std::string host = "127.0.0.1";
+    int port = 6379;
+    int connections = 50;
+    int threads = 0; // 0: one per core, at most one per connection
+    int pipeline = 1;
+    uint64_t requests = 100000;
+    uint64_t keyspace = 100000;
+    size_t valueSize = 16;
+    int fields = 16;      // HSET field names per hash
+    int readPercent = 80; // mixed workload: GETs, the rest SETs
+    bool zipf = false;
+    double theta = 0.99;
+    std::vector<std::string> workloads;
+};
+
+static void usage() {
+    std::cout <<
+        "Usage: redisaiagent-bench [options]\n"
+        "  -h <host>         server host (127.0.0.1)\n"
+        "  -p <port>         server port (6379)\n"
+        "  -c <conns>        parallel connections (50)\n"
+        "  -T <threads>      client threads (one per core, at most one per connection)\n"
+        "  -n <requests>     requests per workload (100000)\n"
+        "  -P <depth>        commands sent per batch on each connection (1)\n"
+        "  -r <keys>         key space size (100000)\n"
+        "  -d <bytes>        value size (16)\n"
+        "  --dist <d>        key distribution: uniform or zipf (uniform)\n"
+        "  --theta <t>       Zipfian skew, 0 < t < 1 (0.99)\n"
+        "  --read-pct <n>    GET share of the mixed workload (80)\n"
+        "  -t <list>         workloads, comma separated, from\n"
+        "                    set,get,lpush,lpop,hset,hgetall,mixed,popset,eval (all, in that order)\n"
+        "                    popset is LPOP then HSET, two round trips per request; eval\n"
+        "                    is the same pair as one EVAL\n";
+}
+
+// Key Distribution
+// Zipfian ranks after Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases" (the generator YCSB uses). zeta(n) is the only O(n)
+// step and is shared by every thread. Ranks are scrambled so the hot keys
+// spread over hash slots and shards instead of sitting next to each other.
+struct zipfparams {
+    uint64_t n = 1;
+    double theta = 0.99;
+    double zetan = 1.0;
+    double alpha = 0.0;
+    double eta = 0.0;
+
+    zipfparams(uint64_t items, double skew) : n(items), theta(skew) {
+        zetan = 0.0;
+        for (uint64_t i = 1; i <= n; ++i)
+            zetan += 1.0 / std::pow(static_cast<double>(i), theta);
+        double zeta2 = 1.0 + 1.0 / std::pow(2.0, theta);
+        alpha = 1.0 / (1.0 - theta);
+        eta = (1.0 - std::pow(2.0 / static_cast<double>(n), 1.0 - theta)) / (1.0 - zeta2 / zetan);
+    }
+};
+
+class keychooser {
+public:
+    keychooser(uint64_t keyspace, const zipfparams* zipf, uint64_t seed)
+        : n(keyspace), params(zipf), rng(seed), uniform(0, keyspace - 1) {}
+
+    uint64_t next() {
+        if (!params)
+            return uniform(rng);
+        double u = unit(rng);
+        double uz = u * params->zetan;
+        uint64_t rank;
+        if (uz < 1.0)
+            rank = 0;
+        else if (uz < 1.0 + std::pow(0.5, params->theta))
+            rank = 1;
+        else
+            rank = static_cast<uint64_t>(n * std::pow(params->eta * u - params->eta + 1.0, params->alpha));
+        return scramble(std::min<uint64_t>(rank, n - 1)) % n;
+    }
+
+    int percent() { return static_cast<int>(rng() % 100); }
+    uint64_t below(uint64_t limit) { return rng() % limit; }
+
+private:
+    static uint64_t scramble(uint64_t v) {
+        uint64_t h = 14695981039346656037ULL; // FNV-1a over the rank's bytes
+        for (int i = 0; i < 8; ++i) {
+            h ^= (v >> (i * 8)) & 0xff;
+            h *= 1099511628211ULL;
+        }
+        return h;
+    }
+
+    uint64_t n;
+    const zipfparams* params;
+    std::mt19937_64 rng;
+    std::uniform_int_distribution<uint64_t> uniform;
+    std::uniform_real_distribution<double> unit{ 0.0, 1.0 };
+};
+
+// Commands
+static void appendCommand(std::string& out, std::initializer_list<std::string> args) {
+    out += '*';
+    out += std::to_string(args.size());
+    out += "\r\n";
+    for (const auto& a : args) {
+        out += '$';
+        out += std::to_string(a.size());
+        out += "\r\n";
+        out += a;
+        out += "\r\n";
+    }
+}
+
+// The popset flow as a script: one round trip instead of two
+static const char* POPSET_SCRIPT =
+    "local v = redis.call('LPOP', KEYS[1]) "
+    "redis.call('HSET', KEYS[2], ARGV[1], v or ARGV[2]) "
+    "return v";
+
+static void appendWorkload(std::string& out, const std::string& workload, keychooser& keys,
+    const options& opt, const std::string& value) {
+    std::string id = std::to_string(keys.next());
+    if (workload == "set")
+        appendCommand(out, { "SET", "bench:key:" + id, value });
+    else if (workload == "get")
+        appendCommand(out, { "GET", "bench:key:" + id });
+    else if (workload == "lpush")
+        appendCommand(out, { "LPUSH", "bench:list:" + id, value });
+    else if (workload == "lpop")
+        appendCommand(out, { "LPOP", "bench:list:" + id });
+    else if (workload == "hset")
+        appendCommand(out, { "HSET", "bench:hash:" + id, "field:" + std::to_string(keys.below(opt.fields)), value });
+    else if (workload == "hgetall")
+        appendCommand(out, { "HGETALL", "bench:hash:" + id });
+    else if (workload == "eval")
+        appendCommand(out, { "EVAL", POPSET_SCRIPT, "2", "bench:list:" + id, "bench:hash:" + id,
+            "field:" + std::to_string(keys.below(opt.fields)), value });
+    else if (keys.percent() < opt.readPercent)
+        appendCommand(out, { "GET", "bench:key:" + id });
+    else
+        appendCommand(out, { "SET", "bench:key:" + id, value });
+}
+
+// Bytes taken by the complete reply at buf[pos], or 0 if more input is needed.
+static size_t replyLength(const std::string& buf, size_t pos) {
+    if (pos >= buf.size())
+        return 0;
+    size_t eol = buf.find("\r\n", pos);
+    if (eol == std::string::npos)
+        return 0;
+    size_t head = eol + 2 - pos;
+    char type = buf[pos];
+    if (type == '$' || type == '=' || type == '!') {
+        long long len = std::atoll(buf.c_str() + pos + 1);
+        if (len < 0)
+            return head;
+        size_t total = head + static_cast<size_t>(len) + 2;
+        return buf.size() - pos >= total ? total : 0;
+    }
+    if (type == '*' || type == '%' || type == '~' || type == '>') {
+        long long count = std::atoll(buf.c_str() + pos + 1);
+        if (count < 0)
+            return head;
+        if (type == '%')
+            count *= 2;
+        size_t total = head;
+        for (long long i = 0; i < count; ++i) {
+            size_t len = replyLength(buf, pos + total);
+            if (len == 0)
+                return 0;
+            total += len;
+        }
+        return total;
+    }
+    return head; // simple string, error, integer, null, double, boolean
+}
+
+// Client Threads
+struct connection {
+    SOCKET sock = INVALID_SOCKET;
+    std::string out;
+    size_t outPos = 0;
+    std::string in;
+    int outstanding = 0;
+    bool wantWrite = false;
+    benchclock::time_point sentAt;
+    // popset: the keys of the LPOPs in flight, whose HSETs go out once
+    // their replies are in; a request completes with its HSET
+    std::vector<std::string> popped;
+    bool secondStep = false;
+};
+
+struct threadresult {
+    latencyhistogram latency;
+    uint64_t completed = 0;
+    uint64_t errors = 0;
+    bool failed = false;
+};
+
+// Hands out the remaining requests of a run to whichever connection asks.
+class quota {
+public:
+    explicit quota(uint64_t total) : remaining(total) {}
+
+    int take(int want) {
+        uint64_t left = remaining.load(std::memory_order_relaxed);
+        while (left > 0) {
+            uint64_t n = std::min<uint64_t>(left, static_cast<uint64_t>(want));
+            if (remaining.compare_exchange_weak(left, left - n, std::memory_order_relaxed))
+                return static_cast<int>(n);
+        }
+        return 0;
+    }
+
+private:
+    std::atomic<uint64_t> remaining;
+};
+
+static SOCKET connectTo(const options& opt) {
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* res = nullptr;
+    if (getaddrinfo(opt.host.c_str(), std::to_string(opt.port).c_str(), &hints, &res) != 0)
+        return INVALID_SOCKET;
+    SOCKET sock = INVALID_SOCKET;
+    for (addrinfo* ai = res; ai; ai = ai->ai_next) {
+        sock = socket(ai->ai_family, ai->ai_socktype, ai->ai_protocol);
+        if (sock == INVALID_SOCKET)
+            continue;
+        if (connect(sock, ai->ai_addr, static_cast<int>(ai->ai_addrlen)) == 0)
+            break;
+        closesocket(sock);
+        sock = INVALID_SOCKET;
+    }
+    freeaddrinfo(res);
+    if (sock != INVALID_SOCKET) {
+        redisnet::setNoDelay(sock);
+        redisnet::setNonBlocking(sock);
+    }
+    return sock;
+}
+
+static bool flush(redispoller& poller, connection& c) {
+    while (c.outPos < c.out.size()) {
+        int n = send(c.sock, c.out.data() + c.outPos, static_cast<int>(c.out.size() - c.outPos),
+            redisnet::SEND_FLAGS);
+        if (n > 0) {
+            c.outPos += n;
+            continue;
+        }
+        if (n < 0 && redisnet::wouldBlock())
+            break;
+        return false;
+    }
+    if (c.outPos == c.out.size()) {
+        c.out.clear();
+        c.outPos = 0;
+    }
+    bool wantWrite = !c.out.empty();
+    if (wantWrite != c.wantWrite) {
+        c.wantWrite = wantWrite;
+        poller.modify(c.sock, &c, redispoller::READABLE | (wantWrite ? redispoller::WRITABLE : 0));
+    }
+    return true;
+}
+
+static bool issueBatch(redispoller& poller, connection& c, quota& work, const std::string& workload,
+    keychooser& keys, const options& opt, const std::string& value) {
+    int n = work.take(opt.pipeline);
+    for (int i = 0; i < n; ++i) {
+        if (workload == "popset") {
+            c.popped.push_back(std::to_string(keys.next()));
+            appendCommand(c.out, { "LPOP", "bench:list:" + c.popped.back() });
+        }
+        else {
+            appendWorkload(c.out, workload, keys, opt, value);
+        }
+    }
+    c.outstanding = n;
+    c.secondStep = false;
+    c.sentAt = benchclock::now();
+    return n == 0 || flush(poller, c);
+}
+
+// The HSETs of a popset batch, sent once its LPOPs have all been answered,
+// as a client that needs each popped value first would. The batch's
+// latency runs from its LPOPs.
+static bool issueSecondStep(redispoller& poller, connection& c, keychooser& keys, const options& opt,
+    const std::string& value) {
+    for (const auto& id : c.popped)
+        appendCommand(c.out, { "HSET", "bench:hash:" + id, "field:" + std::to_string(keys.below(opt.fields)), value });
+    c.outstanding = static_cast<int>(c.popped.size());
+    c.popped.clear();
+    c.secondStep = true;
+    return flush(poller, c);
+}
+
+static void runClient(const options& opt, const std::string& workload, std::vector<connection>& conns,
+    quota& work, const zipfparams* zipf, uint64_t seed, threadresult& result) {
+    keychooser keys(opt.keyspace, zipf, seed);
+    std::string value(opt.valueSize, 'x');
+    redispoller poller;
+    int active = 0;
+    for (auto& c : conns) {
+        poller.add(c.sock, &c, redispoller::READABLE);
+        c.wantWrite = false;
+        if (!issueBatch(poller, c, work, workload, keys, opt, value)) {
+            result.failed = true;
+            return;
+        }
+        if (c.outstanding > 0)
+            active++;
+    }
+
+    std::vector<redispoller::event> events;
+    char buffer[65536];
+    while (active > 0) {
+        poller.wait(events, 1000);
+        for (const auto& ev : events) {
+            connection& c = *static_cast<connection*>(ev.data);
+            if ((ev.events & redispoller::WRITABLE) && !flush(poller, c)) {
+                result.failed = true;
+                return;
+            }
+            if (!(ev.events & redispoller::READABLE) && !ev.hangup)
+                continue;
+            while (true) {
+                int n = recv(c.sock, buffer, sizeof(buffer), 0);
+                if (n > 0) {
+                    c.in.append(buffer, n);
+                    if (n < static_cast<int>(sizeof(buffer)))
+                        break;
+                    continue;
+                }
+                if (n < 0 && redisnet::wouldBlock())
+                    break;
+                std::cerr << "Connection closed by server\n";
+                result.failed = true;
+                return;
+            }
+
+            size_t pos = 0, len;
+            benchclock::time_point now = benchclock::now();
+            bool counted = workload != "popset" || c.secondStep;
+            while (c.outstanding > 0 && (len = replyLength(c.in, pos)) > 0) {
+                if (c.in[pos] == '-')
+                    result.errors++;
+                pos += len;
+                c.outstanding--;
+                if (!counted)
+                    continue;
+                result.completed++;
+                result.latency.record(static_cast<uint64_t>(
+                    std::chrono::duration_cast<std::chrono::nanoseconds>(now - c.sentAt).count()));
+            }
+            c.in.erase(0, pos);
+            if (c.outstanding > 0)
+                continue;
+            if (!counted) {
+                if (!issueSecondStep(poller, c, keys, opt, value)) {
+                    result.failed = true;
+                    return;
+                }
+                continue;
+            }
+            if (!issueBatch(poller, c, work, workload, keys, opt, value)) {
+                result.failed = true;
+                return;
+            }
+            if (c.outstanding == 0)
+                active--;
+        }
+    }
+    for (auto& c : conns)
+        poller.remove(c.sock);
+}
+
+// Reporting
+static std::string upper(std::string s) {
+    for (auto& ch : s)
+        ch = static_cast<char>(std::toupper(static_cast<unsigned char>(ch)));
+    return s;
+}
+
+static void report(const std::string& workload, const options& opt, const threadresult& total, double seconds) {
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    const latencyhistogram& h = total.latency;
+    std::cout << "====== " << upper(workload) << " ======\n";
+    std::cout << "  " << total.completed << " requests in " << std::fixed << std::setprecision(2) << seconds
+        << " s, " << opt.connections << " connections, pipeline " << opt.pipeline << ", "
+        << (opt.zipf ? "zipf keys" : "uniform keys") << " over " << opt.keyspace << "\n";
+    std::cout << "  throughput: " << std::setprecision(2)
+        << (seconds > 0 ? static_cast<double>(total.completed) / seconds : 0.0) << " ops/sec\n";
+    std::cout << "  latency (us): p50 " << us(h.percentile(50)) << "  p90 " << us(h.percentile(90))
+        << "  p99 " << us(h.percentile(99)) << "  p99.9 " << us(h.percentile(99.9))
+        << "  p99.99 " << us(h.percentile(99.99)) << "  max " << us(h.maximum())
+        << "  mean " << us(static_cast<uint64_t>(h.mean())) << "\n";
+    if (total.errors)
+        std::cout << "  error replies: " << total.errors << "\n";
+    std::cout.unsetf(std::ios::floatfield);
+}
+
+static bool runWorkload(const options& opt, const std::string& workload, const zipfparams* zipf) {
+    int threads = opt.threads > 0 ? opt.threads
+        : std::max<int>(1, static_cast<int>(std::thread::hardware_concurrency()));
+    threads = std::min<int>(threads, opt.connections);
+
+    std::vector<std::vector<connection>> groups(threads);
+    for (int i = 0; i < opt.connections; ++i) {
+        connection c;
+        c.sock = connectTo(opt);
+        if (c.sock == INVALID_SOCKET) {
+            std::cerr << "Could not connect to " << opt.host << ":" << opt.port << "\n";
+            for (auto& g : groups)
+                for (auto& open : g)
+                    closesocket(open.sock);
+            return false;
+        }
+        groups[i % threads].push_back(std::move(c));
+    }
+
+    quota work(opt.requests);
+    std::vector<threadresult> results(threads);
+    std::vector<std::thread> workers;
+    benchclock::time_point start = benchclock::now();
+    for (int t = 0; t < threads; ++t) {
+        workers.emplace_back([&, t]() {
+            runClient(opt, workload, groups[t], work, zipf, 0x9e3779b97f4a7c15ULL * (t + 1), results[t]);
+        });
+    }
+    for (auto& w : workers)
+        w.join();
+    double seconds = std::chrono::duration<double>(benchclock::now() - start).count();
+
+    threadresult total;
+    for (const auto& r : results) {
+        total.latency.merge(r.latency);
+        total.completed += r.completed;
+        total.errors += r.errors;
+        total.failed = total.failed || r.failed;
+    }
+    for (auto& g : groups)
+        for (auto& c : g)
+            closesocket(c.sock);
+    report(workload, opt, total, seconds);
+    return !total.failed;
+}
+
+int main(int argc, char* argv[]) {
+    WSADATA wsaData;
+    int wsaInit = WSAStartup(MAKEWORD(2, 2), &wsaData);
+    if (wsaInit != 0) {
+        std::cerr << "WSAStartup failed. Error: " << wsaInit << "\n";
+        return 1;
+    }
+
+    options opt;
+    std::string list = "set,get,lpush,lpop,hset,hgetall,mixed,popset,eval";
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool hasValue = i + 1 < argc;
+            if (arg == "--help") {
+                usage();
+                return 0;
+            }
+            if (!hasValue) {
+                std::cerr << "Missing value for " << arg << "\n";
+                usage();
+                return 1;
+            }
+            std::string value = argv[++i];
+            if (arg == "-h")
+                opt.host = value;
+            else if (arg == "-p")
+                opt.port = std::stoi(value);
+            else if (arg == "-c")
+                opt.connections = std::stoi(value);
+            else if (arg == "-T")
+                opt.threads = std::stoi(value);
+            else if (arg == "-n")
+                opt.requests = std::stoull(value);
+            else if (arg == "-P")
+                opt.pipeline = std::stoi(value);
+            else if (arg == "-r")
+                opt.keyspace = std::stoull(value);
+            else if (arg == "-d")
+                opt.valueSize = std::stoull(value);
+            else if (arg == "--dist")
+                opt.zipf = value == "zipf";
+            else if (arg == "--theta")
+                opt.theta = std::stod(value);
+            else if (arg == "--read-pct")
+                opt.readPercent = std::stoi(value);
+            else if (arg == "-t")
+                list = value;
+            else {
+                std::cerr << "Unknown option " << arg << "\n";
+                usage();
+                return 1;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "Invalid numeric option\n";
+        return 1;
+    }
+    if (opt.connections < 1 || opt.pipeline < 1 || opt.keyspace < 1 || opt.fields < 1
+        || opt.theta <= 0.0 || opt.theta >= 1.0) {
+        std::cerr << "Connections, pipeline and key space must be positive; theta must be in (0, 1)\n";
+        return 1;
+    }
+
+    size_t start = 0;
+    while (start <= list.size()) {
+        size_t comma = list.find(',', start);
+        std::string name = list.substr(start, comma == std::string::npos ? std::string::npos : comma - start);
+        if (name != "set" && name != "get" && name != "lpush" && name != "lpop" && name != "hset"
+            && name != "hgetall" && name != "mixed" && name != "popset" && name != "eval") {
+            std::cerr << "Unknown workload " << name << "\n";
+            return 1;
+        }
+        opt.workloads.push_back(name);
+        if (comma == std::string::npos)
+            break;
+        start = comma + 1;
+    }
+
+    std::unique_ptr<zipfparams> zipf;
+    if (opt.zipf)
+        zipf.reset(new zipfparams(opt.keyspace, opt.theta));
+
+    for (const auto& w : opt.workloads) {
+        if (!runWorkload(opt, w, zipf.get())) {
+            WSACleanup();
+            return 1;
+        }
+    }
+    WSACleanup();
+    return 0;
+}
@@ -0,0 +1,475 @@
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <functional>
+#include <chrono>
+#include <random>
+#include <cstdint>
+#include <unordered_map>
+#include <algorithm>
+#include <cstring>
+#include <bit>
+#include "redisdatabase.h"
+#include "redisdict.h"
+#include "latencyhistogram.h"
+#include "rediscommandhandler.h"
+#include "redisclient.h"
+#include "simdkernels.h"
+#include "redispubsub.h"
+#include "redisoutput.h"
+
+// redisaiagent-microbench: times the database and the RESP parser in-process,
+// with no sockets involved, so a change to either can be measured without
+// the noise of the network path. Each case reports ns/op and ops/sec.
+// Sections follow the case table, each sized by its own option and 0 to
+// skip: growth (-g), bitmap (-b), hll against a hash (-u), vsim recall and
+// QPS against TRUTH (-v, -d) and pub/sub fanout (-s). Scripted flows
+// against separate commands are in redisaiagent-bench (popset, eval).
+
+typedef std::chrono::steady_clock benchclock;
+
+struct benchcase {
+    std::string name;
+    std::function<void(uint64_t)> body; // one operation; the argument is the iteration
+};
+
+static std::string command(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& a : args)
+        out += "$" + std::to_string(a.size()) + "\r\n" + a + "\r\n";
+    return out;
+}
+
+// Times one pass over a bitmap of the given size, best of passes, as ms and
+// GB/s of bitmap bytes read.
+static void throughput(const char* name, size_t bytes, int passes, const std::function<void()>& body) {
+    double best = 0;
+    for (int p = 0; p < passes; ++p) {
+        benchclock::time_point start = benchclock::now();
+        body();
+        double seconds = std::chrono::duration<double>(benchclock::now() - start).count();
+        if (p == 0 || seconds < best)
+            best = seconds;
+    }
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+        << std::setw(10) << best * 1000 << " ms" << std::setw(10) << static_cast<double>(bytes) / best / 1e9
+        << " GB/s\n";
+}
+
+// Sections after the ns/op table run when the -f filter is empty or part of
+// their name.
+static bool selected(const std::string& filter, const char* section) {
+    return filter.empty() || std::string(section).find(filter) != std::string::npos;
+}
+
+// Keeps the optimizer from discarding results that are otherwise unused.
+static volatile size_t sink;
+
+// Tallies what a std::unordered_map allocates, for bytes per entry.
+static size_t countedBytes = 0;
+
+template <typename T>
+struct countingallocator {
+    typedef T value_type;
+    countingallocator() = default;
+    template <typename U>
+    countingallocator(const countingallocator<U>&) {}
+    T* allocate(size_t n) {
+        countedBytes += n * sizeof(T);
+        return std::allocator<T>().allocate(n);
+    }
+    void deallocate(T* p, size_t n) {
+        countedBytes -= n * sizeof(T);
+        std::allocator<T>().deallocate(p, n);
+    }
+    template <typename U>
+    bool operator==(const countingallocator<U>&) const { return true; }
+    template <typename U>
+    bool operator!=(const countingallocator<U>&) const { return false; }
+};
+
+// Inserts n keys one at a time and reports the latency of single inserts,
+// whose tail is where a table that rehashes everything at once shows its
+// resize pauses, and the table's own bytes per entry (key and value heap
+// allocations excluded; the keys here fit the small-string buffer).
+template <typename Map>
+static void growth(const char* name, Map& map, size_t n, const std::function<size_t()>& bytes) {
+    latencyhistogram h;
+    const std::string value(16, 'x');
+    benchclock::time_point start = benchclock::now();
+    for (size_t i = 0; i < n; ++i) {
+        std::string key = "key:" + std::to_string(i);
+        benchclock::time_point t0 = benchclock::now();
+        map[std::move(key)] = value;
+        h.record(static_cast<uint64_t>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(benchclock::now() - t0).count()));
+    }
+    double seconds = std::chrono::duration<double>(benchclock::now() - start).count();
+    auto us = [](uint64_t ns) { return static_cast<double>(ns) / 1000.0; };
+    std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(2)
+        << "p50 " << us(h.percentile(50)) << "us  p99 " << us(h.percentile(99)) << "us  p99.9 "
+        << us(h.percentile(99.9)) << "us  max " << us(h.maximum()) << "us  "
+        << std::setprecision(1) << static_cast<double>(bytes()) / static_cast<double>(map.size())
+        << " bytes/entry  " << std::setprecision(2) << seconds << " s\n";
+}
+
+int main(int argc, char* argv[]) {
+    uint64_t iterations = 1000000;
+    uint64_t keyspace = 100000;
+    uint64_t growthKeys = 2000000;
+    uint64_t bitmapMegabytes = 128;
+    uint64_t hllCardinality = 1000000;
+    uint64_t vectors = 100000;
+    uint64_t vectorDim = 128;
+    uint64_t subscribers = 10000;
+    std::string filter;
+    try {
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            if (arg == "-n" && i + 1 < argc)
+                iterations = std::stoull(argv[++i]);
+            else if (arg == "-r" && i + 1 < argc)
+                keyspace = std::stoull(argv[++i]);
+            else if (arg == "-f" && i + 1 < argc)
+                filter = argv[++i];
+            else if (arg == "-g" && i + 1 < argc)
+                growthKeys = std::stoull(argv[++i]);
+            else if (arg == "-b" && i + 1 < argc)
+                bitmapMegabytes = std::stoull(argv[++i]);
+            else if (arg == "-u" && i + 1 < argc)
+                hllCardinality = std::stoull(argv[++i]);
+            else if (arg == "-v" && i + 1 < argc)
+                vectors = std::stoull(argv[++i]);
+            else if (arg == "-d" && i + 1 < argc)
+                vectorDim = std::stoull(argv[++i]);
+            else if (arg == "-s" && i + 1 < argc)
+                subscribers = std::stoull(argv[++i]);
+            else {
+                std::cout << "Usage: redisaiagent-microbench [-n iterations] [-r keys] [-g growth-keys] [-b bitmap-mb] [-u hll-cardinality] [-v vectors] [-d dim] [-s subscribers] [-f name-substring]\n";
+                return arg == "--help" ? 0 : 1;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        std::cerr << "Invalid numeric option\n";
+        return 1;
+    }
+    if (iterations == 0 || keyspace == 0) {
+        std::cerr << "Iterations and key space must be positive\n";
+        return 1;
+    }
+
+    // Keys are drawn up front so the RNG stays out of the timed loops
+    std::vector<std::string> keys;
+    std::mt19937_64 rng(42);
+    const size_t KEY_SAMPLES = 1 << 16;
+    for (size_t i = 0; i < KEY_SAMPLES; ++i)
+        keys.push_back("key:" + std::to_string(rng() % keyspace));
+    auto key = [&](uint64_t i) -> const std::string& { return keys[i & (KEY_SAMPLES - 1)]; };
+
+    redisdatabase& db = redisdatabase::getInstance();
+    rediscommandhandler handler;
+    redisclient client;
+    const std::string value(16, 'x');
+
+    const std::string setFrame = command({ "SET", "key:12345", value });
+    const std::string hsetFrame = command({ "HSET", "hash:12345", "field:7", value });
+    std::string pipelined;
+    for (int i = 0; i < 64; ++i)
+        pipelined += command({ "SET", "key:" + std::to_string(i), value });
+    std::vector<std::string> setFrames, getFrames;
+    for (size_t i = 0; i < KEY_SAMPLES; ++i) {
+        setFrames.push_back(command({ "SET", keys[i], value }));
+        getFrames.push_back(command({ "GET", keys[i] }));
+    }
+
+    std::vector<benchcase> cases = {
+        // RESP parser
+        { "resp.parse.set", [&](uint64_t) { sink = rediscommandhandler::parseCommand(setFrame).size(); } },
+        { "resp.parse.hset", [&](uint64_t) { sink = rediscommandhandler::parseCommand(hsetFrame).size(); } },
+        { "resp.frame.pipeline64", [&](uint64_t) {
+            size_t pos = 0, len;
+            while ((len = rediscommandhandler::frameLength(pipelined, pos)) > 0)
+                pos += len;
+            sink = pos;
+        } },
+        // Database
+        { "db.set", [&](uint64_t i) { db.set(key(i), value); } },
+        { "db.get", [&](uint64_t i) { std::string v; sink = db.get(key(i), v); } },
+        { "db.lpush", [&](uint64_t i) { db.lpush("list:" + key(i), value); } },
+        { "db.lpop", [&](uint64_t i) { std::string v; sink = db.lpop("list:" + key(i), v); } },
+        { "db.hset", [&](uint64_t i) { sink = db.hset("hash:" + key(i), "field:" + std::to_string(i & 15), value); } },
+        { "db.hgetall", [&](uint64_t i) { sink = db.hgetall("hash:" + key(i)).size(); } },
+        { "db.pfadd", [&](uint64_t i) {
+            bool updated = false;
+            sink = db.pfadd("hll:" + std::to_string(i & 63), { key(i) }, updated);
+        } },
+        // Parse plus dispatch, as a connection runs a command
+        { "handler.set", [&](uint64_t i) { sink = handler.processCommand(setFrames[i & (KEY_SAMPLES - 1)], client).size(); } },
+        { "handler.get", [&](uint64_t i) { sink = handler.processCommand(getFrames[i & (KEY_SAMPLES - 1)], client).size(); } },
+    };
+
+    std::cout << std::left << std::setw(24) << "case" << std::right << std::setw(12) << "ns/op"
+        << std::setw(16) << "ops/sec" << "\n";
+    for (const auto& c : cases) {
+        if (!filter.empty() && c.name.find(filter) == std::string::npos)
+            continue;
+        benchclock::time_point start = benchclock::now();
+        for (uint64_t i = 0; i < iterations; ++i)
+            c.body(i);
+        double ns = static_cast<double>(
+            std::chrono::duration_cast<std::chrono::nanoseconds>(benchclock::now() - start).count());
+        double perOp = ns / static_cast<double>(iterations);
+        std::cout << std::left << std::setw(24) << c.name << std::right << std::fixed << std::setprecision(1)
+            << std::setw(12) << perOp << std::setprecision(0) << std::setw(16) << (perOp > 0 ? 1e9 / perOp : 0.0)
+            << "\n";
+    }
+    handler.closeClient(client);
+
+    if (growthKeys > 0 && selected(filter, "growth")) {
+        std::cout << "\ngrowth to " << growthKeys << " keys, per-insert latency\n";
+        {
+            redisdict<std::string, std::string> dict;
+            growth("growth.redisdict", dict, growthKeys, [&]() { return dict.memoryUsage(); });
+        }
+        {
+            typedef std::pair<const std::string, std::string> entry;
+            std::unordered_map<std::string, std::string, std::hash<std::string>, std::equal_to<std::string>,
+                countingallocator<entry>> map;
+            // Each node is one allocation; count malloc's usual 16-byte header too
+            growth("growth.unordered_map", map, growthKeys, [&]() { return countedBytes + map.size() * 16; });
+        }
+    }
+
+    if (bitmapMegabytes > 0 && selected(filter, "bitmap")) {
+        const size_t bytes = static_cast<size_t>(bitmapMegabytes) << 20;
+        const uint64_t bits = static_cast<uint64_t>(bytes) * 8;
+        const int passes = 5;
+        std::cout << "\nbitmaps of " << bitmapMegabytes << " MB, " << simdkernels::bitKernelName()
+            << " kernels, best of " << passes << "\n";
+        std::string random(bytes, '\0');
+        for (size_t i = 0; i + 8 <= bytes; i += 8) {
+            uint64_t r = rng();
+            std::memcpy(&random[i], &r, 8);
+        }
+        db.set("bitmap:a", random);
+        std::reverse(random.begin(), random.end());
+        db.set("bitmap:b", random);
+
+        // A byte at a time, for scale
+        throughput("bitmap.count.bytewise", bytes, passes, [&]() {
+            uint64_t c = 0;
+            for (unsigned char ch : random)
+                c += static_cast<uint64_t>(std::popcount(ch));
+            sink = static_cast<size_t>(c);
+        });
+        throughput("bitmap.bitcount", bytes, passes, [&]() { sink = db.bitcount("bitmap:a", 0, -1, false); });
+        throughput("bitmap.bitcount.bit", bytes, passes, [&]() {
+            sink = db.bitcount("bitmap:a", 3, static_cast<int64_t>(bits) - 5, true);
+        });
+        throughput("bitmap.bitop.and", bytes * 2, passes, [&]() {
+            sink = db.bitop(redisbitmap::AND, "bitmap:dest", { "bitmap:a", "bitmap:b" });
+        });
+        throughput("bitmap.bitop.or", bytes * 2, passes, [&]() {
+            sink = db.bitop(redisbitmap::OR, "bitmap:dest", { "bitmap:a", "bitmap:b" });
+        });
+        throughput("bitmap.bitop.xor", bytes * 2, passes, [&]() {
+            sink = db.bitop(redisbitmap::XOR, "bitmap:dest", { "bitmap:a", "bitmap:b" });
+        });
+        throughput("bitmap.bitop.not", bytes, passes, [&]() {
+            sink = db.bitop(redisbitmap::NOT, "bitmap:dest", { "bitmap:a" });
+        });
+        db.del("bitmap:dest");
+        random.clear();
+        random.shrink_to_fit();
+
+        // Grows a page at a time, setting only the last bit, then scans the
+        // zeros before it
+        const uint64_t page = 4096 * 8;
+        throughput("bitmap.setbit.grow", bytes, passes, [&]() {
+            db.del("bitmap:sparse");
+            for (uint64_t offset = page - 1; offset < bits; offset += page)
+                sink = static_cast<size_t>(db.setbit("bitmap:sparse", offset, offset == bits - 1));
+        });
+        throughput("bitmap.bitpos", bytes, passes, [&]() {
+            sink = static_cast<size_t>(db.bitpos("bitmap:sparse", 1, 1, -1, false, false));
+        });
+        throughput("bitmap.bitpos.bit", bytes, passes, [&]() {
+            sink = static_cast<size_t>(db.bitpos("bitmap:sparse", 1, 32769, static_cast<int64_t>(bits) - 1, true, true));
+        });
+        db.del("bitmap:a");
+        db.del("bitmap:b");
+        db.del("bitmap:sparse");
+    }
+
+    // Distinct counting two ways: a HyperLogLog, and a hash with one field
+    // per element counted by HLEN. Elements are added one at a time, as
+    // single-element PFADD and HSET commands would add them.
+    if (hllCardinality > 0 && selected(filter, "hll")) {
+        std::cout << "\nhll vs hash+HLEN, up to " << hllCardinality << " distinct elements\n";
+        std::cout << std::right << std::setw(12) << "cardinality" << std::setw(12) << "pfcount" << std::setw(10)
+            << "error %" << std::setw(12) << "pfadd ns" << std::setw(12) << "hll bytes" << std::setw(12) << "hset ns"
+            << std::setw(14) << "hash bytes" << "\n";
+        std::vector<std::string> element(1);
+        for (uint64_t n = 1000; n <= hllCardinality; n *= 10) {
+            db.del("hll:distinct");
+            db.del("hash:distinct");
+            benchclock::time_point start = benchclock::now();
+            for (uint64_t i = 0; i < n; ++i) {
+                element[0] = "element:" + std::to_string(i);
+                bool updated = false;
+                db.pfadd("hll:distinct", element, updated);
+            }
+            double hllNs = static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(benchclock::now() - start).count());
+            start = benchclock::now();
+            for (uint64_t i = 0; i < n; ++i)
+                db.hset("hash:distinct", "element:" + std::to_string(i), "1");
+            double hashNs = static_cast<double>(
+                std::chrono::duration_cast<std::chrono::nanoseconds>(benchclock::now() - start).count());
+            uint64_t estimate = 0, hllBytes = 0, hashBytes = 0;
+            db.pfcount({ "hll:distinct" }, estimate);
+            db.memoryUsage("hll:distinct", 0, hllBytes);
+            db.memoryUsage("hash:distinct", 0, hashBytes);
+            if (db.hlen("hash:distinct") != n)
+                std::cerr << "HLEN disagrees with the elements added\n";
+            double error = (static_cast<double>(estimate) - static_cast<double>(n)) / static_cast<double>(n) * 100;
+            std::cout << std::setw(12) << n << std::setw(12) << estimate << std::fixed << std::setprecision(2)
+                << std::setw(10) << error << std::setprecision(1) << std::setw(12) << hllNs / static_cast<double>(n)
+                << std::setw(12) << hllBytes << std::setw(12) << hashNs / static_cast<double>(n) << std::setw(14)
+                << hashBytes << "\n";
+        }
+        db.del("hll:distinct");
+        db.del("hash:distinct");
+    }
+
+    // HNSW against exact search on clustered synthetic vectors: recall@10
+    // and queries per second over a sweep of EF, then again with 40% of
+    // the set deleted (tombstones searched around) and with 60% deleted
+    // (past the point where the graph is rebuilt). -v 1000000 -d 768 is
+    // the full-size run; the default keeps it to a minute on one core.
+    if (vectors > 0 && vectorDim > 0 && selected(filter, "vsim")) {
+        const size_t k = 10, queryCount = 200, clusters = 256;
+        std::cout << "\nvsim over " << vectors << " x " << vectorDim << " vectors, "
+            << simdkernels::floatKernelName() << " kernels, recall@" << k << " against TRUTH\n";
+        std::normal_distribution<float> normal(0.0f, 1.0f);
+        std::vector<std::vector<float>> centers(clusters, std::vector<float>(vectorDim));
+        for (auto& c : centers) {
+            for (auto& x : c)
+                x = normal(rng);
+        }
+        auto draw = [&]() {
+            const auto& c = centers[rng() % clusters];
+            std::vector<float> v(vectorDim);
+            for (size_t d = 0; d < vectorDim; ++d)
+                v[d] = c[d] + 0.5f * normal(rng);
+            return v;
+        };
+        std::vector<std::vector<float>> queries;
+        for (size_t q = 0; q < queryCount; ++q)
+            queries.push_back(draw());
+
+        redisvectorset::config cfg;
+        std::string err;
+        benchclock::time_point start = benchclock::now();
+        for (uint64_t i = 0; i < vectors; ++i) {
+            bool added = false;
+            db.vadd("vset", draw(), "v" + std::to_string(i), cfg, added, err);
+        }
+        double buildSeconds = std::chrono::duration<double>(benchclock::now() - start).count();
+        std::cout << "build " << std::fixed << std::setprecision(1) << buildSeconds << " s, "
+            << std::setprecision(0) << static_cast<double>(vectors) / buildSeconds << " adds/s (M " << cfg.m
+            << ", EF construction " << cfg.efConstruction << ")\n";
+
+        auto sweep = [&](const char* label) {
+            std::vector<std::vector<std::pair<std::string, float>>> truth(queryCount);
+            start = benchclock::now();
+            for (size_t q = 0; q < queryCount; ++q)
+                db.vsim("vset", queries[q], "", k, 0, true, truth[q], err);
+            double exactSeconds = std::chrono::duration<double>(benchclock::now() - start).count();
+            std::cout << std::left << std::setw(20) << label << std::right << std::setw(8) << "TRUTH"
+                << std::setprecision(3) << std::setw(10) << 1.0 << std::setprecision(0) << std::setw(12)
+                << queryCount / exactSeconds << " qps\n";
+            for (size_t ef : { 10, 50, 100, 200, 400 }) {
+                size_t found = 0;
+                start = benchclock::now();
+                for (size_t q = 0; q < queryCount; ++q) {
+                    std::vector<std::pair<std::string, float>> result;
+                    db.vsim("vset", queries[q], "", k, ef, false, result, err);
+                    for (const auto& r : result) {
+                        for (const auto& t : truth[q])
+                            found += r.first == t.first;
+                    }
+                }
+                double seconds = std::chrono::duration<double>(benchclock::now() - start).count();
+                std::cout << std::setw(20) << "" << std::setw(8) << ("EF " + std::to_string(ef)) << std::setprecision(3)
+                    << std::setw(10) << static_cast<double>(found) / static_cast<double>(queryCount * k)
+                    << std::setprecision(0) << std::setw(12) << queryCount / seconds << " qps\n";
+            }
+        };
+        std::cout << std::left << std::setw(20) << "set" << std::right << std::setw(8) << "search" << std::setw(10)
+            << "recall" << std::setw(12) << "speed" << "\n";
+        sweep("full");
+        for (uint64_t i = 0; i < vectors * 4 / 10; ++i)
+            db.vrem("vset", "v" + std::to_string(i));
+        sweep("40% deleted");
+        for (uint64_t i = vectors * 4 / 10; i < vectors * 6 / 10; ++i)
+            db.vrem("vset", "v" + std::to_string(i));
+        sweep("60% deleted");
+        db.del("vset");
+    }
+
+    // PUBLISH fan-out to in-process subscriber queues, no sockets: 100-byte
+    // messages to one channel, then to one pattern, each with every
+    // subscriber listening. Queues are drained between rounds, outside the
+    // timing, as connection writers would drain them. fanout.copy pushes
+    // each subscriber its own copy of the encoded message, for scale.
+    if (subscribers > 0 && selected(filter, "fanout")) {
+        const int rounds = 20, perRound = 50;
+        std::cout << "\nfan-out to " << subscribers << " subscribers, " << rounds * perRound
+            << " publishes of 100 bytes\n";
+        redispubsub& pubsub = redispubsub::getInstance();
+        std::vector<redispubsub::subscriber> subs;
+        for (uint64_t i = 0; i < subscribers; ++i)
+            subs.push_back(std::make_shared<redisoutput>());
+        const std::string message(100, 'm');
+        std::vector<redisoutput::buffer> drained;
+        auto fanout = [&](const char* name, const std::function<size_t()>& publish) {
+            double seconds = 0;
+            uint64_t deliveries = 0;
+            for (int r = 0; r < rounds; ++r) {
+                benchclock::time_point start = benchclock::now();
+                for (int i = 0; i < perRound; ++i)
+                    deliveries += publish();
+                seconds += std::chrono::duration<double>(benchclock::now() - start).count();
+                for (const auto& sub : subs) {
+                    drained.clear();
+                    sub->tryTake(drained);
+                }
+            }
+            std::cout << std::left << std::setw(24) << name << std::right << std::fixed << std::setprecision(0)
+                << std::setw(12) << rounds * perRound / seconds << " publishes/s" << std::setw(14)
+                << static_cast<double>(deliveries) / seconds << " deliveries/s\n";
+        };
+
+        for (const auto& sub : subs)
+            pubsub.subscribe("news", sub);
+        fanout("fanout.channel", [&]() { return pubsub.publish("news", message); });
+        const std::string encoded = "*3\r\n$7\r\nmessage\r\n$4\r\nnews\r\n$100\r\n" + message + "\r\n";
+        fanout("fanout.copy", [&]() {
+            for (const auto& sub : subs)
+                sub->push(std::make_shared<const std::string>(encoded));
+            return subs.size();
+        });
+        for (const auto& sub : subs)
+            pubsub.unsubscribe("news", sub);
+
+        for (const auto& sub : subs)
+            pubsub.psubscribe("news.*", sub);
+        fanout("fanout.pattern", [&]() { return pubsub.publish("news.sport", message); });
+        for (const auto& sub : subs)
+            pubsub.punsubscribe("news.*", sub);
+    }
+    return 0;
+}
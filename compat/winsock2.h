@@ -0,0 +1,27 @@
+#ifndef REDIS_COMPAT_WINSOCK2_H
+#define REDIS_COMPAT_WINSOCK2_H
+
+// POSIX stand-in for the few Winsock names used outside _WIN32 blocks, so
+// the same sources build on Linux. Only reached through the compat include
+// directory the CMake build adds on non-Windows platforms.
+#include <cerrno>
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <unistd.h>
+
+typedef int SOCKET;
+#define INVALID_SOCKET (-1)
+#define SOCKET_ERROR (-1)
+#define SD_BOTH SHUT_RDWR
+#define MAKEWORD(a, b) ((unsigned short)(((unsigned char)(a)) | (((unsigned short)(unsigned char)(b)) << 8)))
+
+struct WSADATA {};
+
+inline int WSAStartup(unsigned short, WSADATA*) { return 0; }
+inline int WSACleanup() { return 0; }
+inline int WSAGetLastError() { return errno; }
+inline int closesocket(SOCKET s) { return ::close(s); }
+
+#endif
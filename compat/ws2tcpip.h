@@ -0,0 +1,8 @@
+#ifndef REDIS_COMPAT_WS2TCPIP_H
+#define REDIS_COMPAT_WS2TCPIP_H
+
+#include "winsock2.h"
+#include <netdb.h>
+#include <netinet/tcp.h>
+
+#endif
@@ -0,0 +1,75 @@
+#ifndef ACCESS_SKETCH_H
+#define ACCESS_SKETCH_H
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+
+// Approximate per-key access counts with no per-key storage: a count-min
+// sketch (4 rows of saturating 8-bit counters, as in TinyLFU) indexed by the
+// key's hash. Once the number of recorded accesses reaches ten times the
+// width, every counter is halved, so old popularity fades and the estimate
+// tracks recent frequency. Estimates never undercount until that halving.
+class accesssketch {
+public:
+    static const int ROWS = 4;
+
+    // width is rounded up to a power of two; memory is ROWS * width bytes
+    explicit accesssketch(size_t width = 1 << 20) {
+        size_t w = 64;
+        while (w < width)
+            w <<= 1;
+        mask = w - 1;
+        counters.assign(ROWS * w, 0);
+        resetAt = 10 * w;
+    }
+
+    // Counts one access and returns the new estimate.
+    uint32_t record(uint64_t hash) {
+        uint8_t low = 255;
+        for (int r = 0; r < ROWS; ++r)
+            low = std::min<uint8_t>(low, counters[slot(hash, r)]);
+        // Conservative update: only the counters at the minimum move
+        for (int r = 0; r < ROWS; ++r) {
+            uint8_t& c = counters[slot(hash, r)];
+            if (c == low && c < 255)
+                c++;
+        }
+        if (++additions >= resetAt)
+            age();
+        return low < 255 ? low + 1u : 255u;
+    }
+
+    uint32_t estimate(uint64_t hash) const {
+        uint8_t low = 255;
+        for (int r = 0; r < ROWS; ++r)
+            low = std::min<uint8_t>(low, counters[slot(hash, r)]);
+        return low;
+    }
+
+    size_t memoryUsage() const { return counters.size(); }
+
+private:
+    size_t slot(uint64_t hash, int row) const {
+        // One 64-bit hash, a different odd multiplier per row
+        static const uint64_t SEEDS[ROWS] = {
+            0x9e3779b97f4a7c15ULL, 0xc2b2ae3d27d4eb4fULL, 0x165667b19e3779f9ULL, 0xd6e8feb86659fd93ULL
+        };
+        uint64_t h = (hash ^ (hash >> 29)) * SEEDS[row];
+        return static_cast<size_t>(row) * (mask + 1) + static_cast<size_t>((h >> 32) & mask);
+    }
+
+    void age() {
+        for (uint8_t& c : counters)
+            c >>= 1;
+        additions /= 2;
+    }
+
+    std::vector<uint8_t> counters;
+    size_t mask = 0;
+    size_t additions = 0;
+    size_t resetAt = 0;
+};
+
+#endif
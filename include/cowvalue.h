@@ -0,0 +1,55 @@
+#ifndef REDIS_COW_VALUE_H
+#define REDIS_COW_VALUE_H
+
+#include <memory>
+#include <utility>
+
+// A container held through a shared pointer, so a reader can keep a
+// point-in-time view of it after the lock guarding it is released: view()
+// shares the current container, and write() copies it first while any view
+// is still alive. With no views out, write() is a plain dereference.
+//
+// An empty cowvalue allocates nothing; read() and view() then see a shared
+// empty T. Whoever calls write() or view() holds the lock that guards the
+// cowvalue; a view is read-only and needs no lock.
+template <typename T>
+class cowvalue {
+public:
+    cowvalue() = default;
+    explicit cowvalue(T&& value) : ptr(std::make_shared<T>(std::move(value))) {}
+    cowvalue(cowvalue&&) noexcept = default;
+    cowvalue& operator=(cowvalue&&) noexcept = default;
+    cowvalue& operator=(T&& value) {
+        ptr = std::make_shared<T>(std::move(value));
+        return *this;
+    }
+    // Copies share: both sides copy on their next write
+    cowvalue(const cowvalue&) = default;
+    cowvalue& operator=(const cowvalue&) = default;
+
+    const T& read() const { return ptr ? *ptr : empty(); }
+
+    T& write() {
+        if (!ptr)
+            ptr = std::make_shared<T>();
+        else if (ptr.use_count() > 1) // a view only ever drops its reference concurrently
+            ptr = std::make_shared<T>(*ptr);
+        return *ptr;
+    }
+
+    std::shared_ptr<const T> view() const {
+        if (ptr)
+            return ptr;
+        return std::shared_ptr<const T>(std::shared_ptr<const T>(), &empty());
+    }
+
+private:
+    static const T& empty() {
+        static const T none{};
+        return none;
+    }
+
+    std::shared_ptr<T> ptr;
+};
+
+#endif
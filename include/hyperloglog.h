@@ -0,0 +1,40 @@
+#ifndef HYPERLOGLOG_H
+#define HYPERLOGLOG_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// HyperLogLog values are plain strings in kv_store so they survive dump/load.
+// Layout: 16 byte header ("HYLL", encoding, 3 unused, 8 byte cached
+// cardinality) followed by either the sparse opcode stream or 16384 packed
+// 6 bit registers (12KB dense).
+class hyperloglog {
+public:
+    static const int P = 14;
+    static const int REGISTERS = 1 << P;
+    static const int BITS = 6;
+    static const size_t HEADER_SIZE = 16;
+    static const size_t DENSE_SIZE = HEADER_SIZE + (REGISTERS * BITS + 7) / 8;
+    static const size_t SPARSE_MAX_BYTES = 3000;
+
+    static std::string create();
+    static bool isValid(const std::string& hll);
+
+    // Returns true when a register changed.
+    static bool add(std::string& hll, const std::string& element);
+    // Uses and refreshes the cached cardinality stored in the header.
+    static uint64_t count(std::string& hll);
+
+    // Raw registers are one byte per register, used for PFCOUNT over several
+    // keys and PFMERGE.
+    static void mergeInto(uint8_t* raw, const std::string& hll);
+    static void maxRegisters(uint8_t* dst, const uint8_t* src, size_t n);
+    static uint64_t countRaw(const uint8_t* raw);
+    static std::string fromRaw(const uint8_t* raw);
+
+    static uint64_t murmurhash64a(const void* key, size_t len, uint64_t seed);
+};
+
+#endif
@@ -0,0 +1,78 @@
+#ifndef LATENCY_HISTOGRAM_H
+#define LATENCY_HISTOGRAM_H
+
+#include <cstdint>
+#include <cmath>
+#include <algorithm>
+
+// Log-linear histogram of durations in nanoseconds: each power of two is
+// split into 8 sub-buckets, so any percentile is reported within ~12%
+// using a fixed 4KB of counters and no allocation on record().
+class latencyhistogram {
+public:
+    static const int SUB_BUCKETS = 8;
+    static const int BUCKETS = 64 * SUB_BUCKETS;
+
+    void record(uint64_t ns) {
+        counts[bucketOf(ns)]++;
+        total++;
+        sum += ns;
+        maxValue = std::max<uint64_t>(maxValue, ns);
+    }
+
+    void merge(const latencyhistogram& o) {
+        for (int i = 0; i < BUCKETS; ++i)
+            counts[i] += o.counts[i];
+        total += o.total;
+        sum += o.sum;
+        maxValue = std::max<uint64_t>(maxValue, o.maxValue);
+    }
+
+    void reset() { *this = latencyhistogram(); }
+
+    uint64_t count() const { return total; }
+    uint64_t maximum() const { return maxValue; }
+    double mean() const { return total ? static_cast<double>(sum) / total : 0.0; }
+
+    // Upper bound of the bucket holding the given percentile (0-100).
+    uint64_t percentile(double p) const {
+        if (total == 0)
+            return 0;
+        uint64_t rank = static_cast<uint64_t>(std::ceil(p / 100.0 * total));
+        rank = std::max<uint64_t>(rank, 1);
+        uint64_t seen = 0;
+        for (int i = 0; i < BUCKETS; ++i) {
+            seen += counts[i];
+            if (seen >= rank)
+                return std::min<uint64_t>(upperBound(i), maxValue);
+        }
+        return maxValue;
+    }
+
+private:
+    static int bucketOf(uint64_t v) {
+        if (v < SUB_BUCKETS)
+            return static_cast<int>(v);
+        int log2 = 63;
+        while (!(v >> log2))
+            --log2;
+        int sub = static_cast<int>((v >> (log2 - 3)) & (SUB_BUCKETS - 1));
+        return std::min<int>((log2 - 2) * SUB_BUCKETS + sub, BUCKETS - 1);
+    }
+
+    static uint64_t upperBound(int bucket) {
+        if (bucket < SUB_BUCKETS)
+            return static_cast<uint64_t>(bucket);
+        int log2 = bucket / SUB_BUCKETS + 2;
+        uint64_t sub = static_cast<uint64_t>(bucket % SUB_BUCKETS);
+        uint64_t base = 1ULL << log2;
+        return base + ((sub + 1) << (log2 - 3)) - 1;
+    }
+
+    uint64_t counts[BUCKETS] = { 0 };
+    uint64_t total = 0;
+    uint64_t sum = 0;
+    uint64_t maxValue = 0;
+};
+
+#endif
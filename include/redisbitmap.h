@@ -0,0 +1,63 @@
+#ifndef REDIS_BITMAP_H
+#define REDIS_BITMAP_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+// Bitmaps are plain string values in kv_store, as in Redis: bit 0 is the
+// most significant bit of byte 0, and bits past the end of the string read
+// as 0. These work on the raw bytes; redisdatabase finds them and grows
+// the string. Counting, BITOP and scanning go through the SIMD kernels.
+class redisbitmap {
+public:
+    // Offsets stop at 2^32 bits, a 512MB string, as in Redis
+    static const uint64_t MAX_BITS = 1ull << 32;
+
+    enum op { AND, OR, XOR, NOT };
+    enum overflow { WRAP, SAT, FAIL };
+
+    // One BITFIELD subcommand. value is the SET value or INCRBY increment.
+    struct fieldop {
+        enum kind { GET, SET, INCRBY } kind = GET;
+        bool isSigned = false;
+        int bits = 0;        // 1..64 signed, 1..63 unsigned
+        uint64_t offset = 0; // in bits
+        int64_t value = 0;
+        overflow onOverflow = WRAP;
+    };
+
+    struct span {
+        const uint8_t* data;
+        size_t size;
+    };
+
+    static int getBit(const uint8_t* p, size_t n, uint64_t offset);
+    // Returns the bit's old value; p must hold the offset
+    static int setBit(uint8_t* p, uint64_t offset, int value);
+
+    // start and end are inclusive and count from the end when negative, in
+    // bytes or, with bitUnits, in bits.
+    static uint64_t count(const uint8_t* p, size_t n, int64_t start, int64_t end, bool bitUnits);
+    // First bit equal to bit within the range, or -1. Looking for a 0 with
+    // no end given finds the first bit past the string when all are 1.
+    static int64_t position(const uint8_t* p, size_t n, int bit, int64_t start, int64_t end, bool endGiven,
+        bool bitUnits);
+
+    // BITOP over sources; the result is as long as the longest, with the
+    // shorter ones read as zero-padded. NOT takes exactly one source. The
+    // result follows headroom zero bytes, room for the caller's header.
+    static std::string combine(op o, const std::vector<span>& sources, size_t headroom = 0);
+
+    // A BITFIELD GET
+    static int64_t get(const uint8_t* p, size_t n, const fieldop& f);
+    // Runs one BITFIELD subcommand. p holds at least n bytes, and every bit
+    // a SET or INCRBY writes. false for a nil reply: an overflow under FAIL,
+    // which writes nothing.
+    static bool apply(uint8_t* p, size_t n, const fieldop& f, int64_t& result);
+    // Bytes needed to hold the field
+    static size_t fieldEnd(const fieldop& f) { return static_cast<size_t>((f.offset + f.bits + 7) / 8); }
+};
+
+#endif
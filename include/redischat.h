@@ -0,0 +1,87 @@
+#ifndef REDIS_CHAT_H
+#define REDIS_CHAT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <functional>
+#include <cstdint>
+
+// Chat history for one agent session. Messages are packed into fixed-size
+// segments kept in a ring (oldest segment at the front), so appends and
+// evictions touch only the ends and tail reads decode only the messages they
+// return. Each message's token count is computed once on append.
+class redischat {
+public:
+    typedef std::function<size_t(const std::string&)> tokencounter;
+
+    struct message {
+        std::string role;
+        std::string content;
+        size_t tokens = 0;
+    };
+
+    // 0 means unlimited / no TTL.
+    struct limits {
+        size_t maxMessages = 0;
+        size_t maxBytes = 0;
+        int ttlSeconds = 0;
+    };
+
+    struct summary {
+        size_t messages = 0;
+        size_t bytes = 0;
+        size_t tokens = 0;
+        size_t segments = 0;
+        limits caps;
+    };
+
+    // Rough 4-bytes-per-token estimate used until a real tokenizer is plugged in.
+    static size_t approxTokens(const std::string& text);
+    static void setTokenCounter(tokencounter fn);
+    static size_t countTokens(const std::string& text);
+
+    void append(const std::string& role, const std::string& content);
+    // Newest messages in chronological order, bounded by lastN messages and
+    // maxTokens total tokens (0 disables a bound).
+    std::vector<message> tail(size_t lastN, size_t maxTokens) const;
+
+    const limits& getLimits() const { return caps; }
+    void setLimits(const limits& l);
+
+    size_t length() const { return count; }
+    size_t bytes() const { return totalBytes; }
+    size_t tokens() const { return totalTokens; }
+    size_t segmentCount() const { return segments.size(); }
+    // Bytes held by the segments and their indexes.
+    size_t memoryUsage() const;
+    summary getSummary() const;
+
+    void serialize(std::string& out) const;
+    bool deserialize(const std::string& in);
+
+    static const size_t SEGMENT_MAX_MESSAGES = 64;
+    static const size_t SEGMENT_MAX_BYTES = 8192;
+
+private:
+    struct segment {
+        std::string data;               // varint role len, role, varint content len, content
+        std::vector<uint32_t> offsets;
+        std::vector<uint32_t> tokens;
+        size_t head = 0;                // messages before head were evicted
+    };
+
+    static size_t encodedSize(const segment& s, size_t i);
+    static void decode(const segment& s, size_t i, message& out);
+    void push(const std::string& role, const std::string& content, size_t tokenCount);
+    void evictOldest();
+    void enforceLimits();
+
+    std::deque<segment> segments;
+    size_t count = 0;
+    size_t totalBytes = 0;
+    size_t totalTokens = 0;
+    limits caps;
+};
+
+#endif
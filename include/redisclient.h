@@ -0,0 +1,54 @@
+#ifndef REDIS_CLIENT_H
+#define REDIS_CLIENT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <utility>
+#include <set>
+#include <memory>
+#include <atomic>
+#include "redisoutput.h"
+
+// Per-connection state. One instance lives in each connection's thread and is
+// passed to every processCommand call on that connection.
+struct redisclient {
+    // CLIENT ID; never reused while the server runs
+    uint64_t id = nextId();
+
+    // MULTI/EXEC
+    bool inMulti = false;
+    bool queueError = false;      // a command failed to queue; EXEC must abort
+    bool lastExecAborted = false; // next EXEC counts as a retry
+    std::vector<std::vector<std::string>> queued;
+    std::vector<std::pair<std::string, uint64_t>> watched; // key -> version at WATCH
+
+    // Pub/Sub. output is created on the first subscription; from then on the
+    // server sends every reply for this connection through it.
+    std::shared_ptr<redisoutput> output;
+    std::set<std::string> channels;
+    std::set<std::string> patterns;
+
+    // Cluster: ASKING lets the next command use a slot being imported
+    bool asking = false;
+
+    // CLIENT TRACKING. Invalidations go to output, or to the REDIRECT client's.
+    bool tracking = false;
+    bool trackingBcast = false;
+
+    // Streamed replies. The server loop sets streamReplies when it can write
+    // a reply as it is produced; a big array reply then returns just its
+    // header and leaves the elements in stream, which the loop queues on
+    // output (created on first use) right behind the header.
+    bool streamReplies = false;
+    redisoutput::producer stream;
+
+    size_t subscriptions() const { return channels.size() + patterns.size(); }
+
+    static uint64_t nextId() {
+        static std::atomic<uint64_t> counter{ 0 };
+        return ++counter;
+    }
+};
+
+#endif
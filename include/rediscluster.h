@@ -0,0 +1,89 @@
+#ifndef REDIS_CLUSTER_H
+#define REDIS_CLUSTER_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+
+// Redis Cluster style partitioning: 16384 hash slots, CRC16 of the key (or
+// of its {hashtag}), each slot owned by one node. There is no gossip bus.
+// Every node is started from the same node file ("host:port slots..." per
+// line), and CLUSTER RESHARD pushes each slot move to every known node with
+// CLUSTER SETSLOT. Node 0 is always this node.
+class rediscluster {
+public:
+    static const int SLOTS = 16384;
+
+    struct node {
+        std::string id; // 40 hex characters derived from host:port
+        std::string host;
+        int port = 0;
+    };
+
+    struct stats {
+        uint64_t moved = 0;
+        uint64_t asked = 0;
+        uint64_t migratedKeys = 0;
+        uint64_t migratedSlots = 0;
+    };
+
+    static rediscluster& getInstance();
+    static uint16_t crc16(const char* buf, size_t len);
+    static int keySlot(const std::string& key);
+
+    // Reads the node file and enables cluster mode; the line naming port is
+    // this node. Blank lines and '#' comments are ignored.
+    bool configure(const std::string& filename, int port, std::string& err);
+    bool enabled() const { return isEnabled; }
+
+    // Slot state; node indexes, -1 when unset
+    int owner(int slot) const { return owners[slot].load(std::memory_order_acquire); }
+    int migrating(int slot) const { return migratingTo[slot].load(std::memory_order_acquire); }
+    int importing(int slot) const { return importingFrom[slot].load(std::memory_order_acquire); }
+    void setOwner(int slot, int index); // also ends any migration of the slot
+    void setMigrating(int slot, int index);
+    void setImporting(int slot, int index);
+    void setStable(int slot);
+
+    node nodeAt(int index);
+    int findNode(const std::string& id);
+    int addNode(const std::string& host, int port);
+    std::vector<node> nodes();
+
+    std::vector<std::string> keysInSlot(int slot, size_t count);
+
+    // Sends keys to host:port as pipelined RESTORE-ASKING commands while
+    // holding the db lock, then deletes them here unless copy is set.
+    bool migrate(const std::string& host, int port, const std::vector<std::string>& keys, int timeoutMs,
+        bool copy, bool replace, size_t& moved, std::string& err);
+    // Online move of one slot: IMPORTING on the target, MIGRATING here, keys
+    // moved batch keys at a time, then SETSLOT NODE on every known node.
+    bool reshard(int slot, int target, size_t batch, size_t& moved, std::string& err);
+
+    void countRedirect(bool ask) { (ask ? asked : moved)++; }
+    stats getStats() const;
+
+private:
+    rediscluster();
+    rediscluster(const rediscluster&) = delete;
+    rediscluster& operator=(const rediscluster&) = delete;
+
+    bool sendSetslot(int index, const std::vector<std::string>& args, std::string& err);
+
+    bool isEnabled = false;
+    std::mutex nodesMutex;
+    std::deque<node> nodeList; // append only, so indexes stay valid
+    std::mutex reshardMutex;
+    std::atomic<int> owners[SLOTS];
+    std::atomic<int> migratingTo[SLOTS];
+    std::atomic<int> importingFrom[SLOTS];
+    std::atomic<uint64_t> moved{ 0 };
+    std::atomic<uint64_t> asked{ 0 };
+    std::atomic<uint64_t> migratedKeys{ 0 };
+    std::atomic<uint64_t> migratedSlots{ 0 };
+};
+
+#endif
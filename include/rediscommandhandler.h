@@ -1,10 +1,31 @@
 #ifndef REDIS_COMMAND_HANDLER_H
 #define REDIS_COMMAND_HANDLER_H
 #include<string>
+#include<vector>
+#include "redisclient.h"
+class redisdatabase;
 class rediscommandhandler {
 public:
 	rediscommandhandler();
 	std::string processCommand(const std::string& commandLine);
+	// Connection-aware variant; MULTI/EXEC and WATCH state lives in client.
+	std::string processCommand(const std::string& commandLine, redisclient& client);
+	// Same, for a command already split into tokens (io-threads parse off the
+	// execution thread). tokens may be moved from.
+	std::string processCommand(std::vector<std::string>& tokens, redisclient& client);
+	static std::vector<std::string> parseCommand(const std::string& frame);
+	// Releases WATCHes and queued commands when a connection goes away.
+	void closeClient(redisclient& client);
+	// Bytes taken by the first complete command at buf[pos], or 0 if more
+	// input is needed. Lets a connection split pipelined and partial reads.
+	static size_t frameLength(const std::string& buf, size_t pos);
+	// Keys named by a table command, for routing it to the shard that owns
+	// them; false for commands outside the table (MULTI, SUBSCRIBE, ...).
+	static bool keysOf(const std::vector<std::string>& tokens, std::vector<std::string>& keys);
+	// Database used by commands on the calling thread; nullptr restores the
+	// default (redisdatabase::getInstance()).
+	static void bindDatabase(redisdatabase* db);
+	static redisdatabase& boundDatabase();
 };
 
 #endif
@@ -6,16 +6,61 @@
 #include <vector>
 #include <chrono>
 #include <unordered_map>
+#include <cstdint>
+#include <memory>
+#include <functional>
+#include "redisstream.h"
+#include "redisvectorset.h"
+#include "semanticcache.h"
+#include "redischat.h"
+#include "redisdict.h"
+#include "redistier.h"
+#include "accesssketch.h"
+#include "cowvalue.h"
+#include "redisbitmap.h"
 
 class redisdatabase {
 public:
     static redisdatabase& getInstance();
     bool flushall();
 
+    // Shards (thread-per-core mode). Shard 0 is getInstance(); the others are
+    // created on first use with the same keyspace listener.
+    static redisdatabase& shard(size_t index);
+    static size_t shardCount();
+    // Moves everything stored under name (any type, its TTL, a semantic
+    // cache index) into target, replacing what is there, without keyspace
+    // events. Locks both databases; a caller that needs several moves to look
+    // atomic holds their acquire() locks around them.
+    void moveKeyTo(const std::string& name, redisdatabase& target);
+    // Every name that moveKeyTo can move, for rebalancing after a load.
+    std::vector<std::string> storedNames();
+    // Writes every shard into one snapshot.
+    static bool dumpAll(const std::string& filename);
+
+    // Transaction Support
+    // Holding this lock makes a sequence of calls atomic (the mutex is recursive).
+    std::unique_lock<std::recursive_mutex> acquire();
+    // Versions are kept only for keys someone is watching; writes bump them.
+    uint64_t watch(const std::string& key);
+    void unwatch(const std::string& key);
+    bool unchanged(const std::vector<std::pair<std::string, uint64_t>>& watched);
+
+    // Keyspace Events
+    // Called with the db lock held for every modified key, with the event name
+    // ("set", "del", "expired", ...). touchAll reports an empty key and
+    // "flushall". The listener must not call back into the database.
+    typedef void (*keyspacelistener)(const std::string& key, const char* event);
+    void setKeyspaceListener(keyspacelistener listener);
+
     // Key/Value Operations
     void set(const std::string& key, const std::string& value);
     bool get(const std::string& key, std::string& value);
+    // Length of the value without decompressing it; 0 when key is missing.
+    size_t strlen(const std::string& key);
     std::vector<std::string> keys();
+    // Number of keys, without building the list; expires gets how many have a TTL.
+    size_t keyCount(size_t& expires);
     std::string type(const std::string& key);
     bool del(const std::string& key);
     bool expire(const std::string& key, int seconds);
@@ -41,7 +86,177 @@ public:
     size_t hlen(const std::string& key);
     bool hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fieldValues);
 
-    bool dump(const std::string& filename);
+    // Collection Views
+    // A point-in-time view of a list or hash that is read without the lock,
+    // for replies too big to copy: it shares the stored container, and a
+    // write to the key while the view is alive copies the container first
+    // (see cowvalue.h). Elements are as stored; unpacked() gives back the
+    // value that was written. nullptr when key holds no list (hash).
+    typedef redisdict<std::string, std::string> fieldmap;
+    typedef std::shared_ptr<const std::vector<std::string>> listview;
+    typedef std::shared_ptr<const fieldmap> hashview;
+    listview listView(const std::string& key);
+    hashview hashView(const std::string& key);
+    // stored itself, or its decoded value in scratch when it is packed
+    static const std::string& unpacked(const std::string& stored, std::string& scratch);
+
+    // HyperLogLog Operations (values live in kv_store as strings)
+    bool pfadd(const std::string& key, const std::vector<std::string>& elements, bool& updated);
+    bool pfcount(const std::vector<std::string>& keys, uint64_t& count);
+    bool pfmerge(const std::string& destKey, const std::vector<std::string>& sourceKeys);
+
+    // Bitmap Operations (string values; see redisbitmap.h)
+    // setbit returns the old bit
+    int setbit(const std::string& key, uint64_t offset, int value);
+    int getbit(const std::string& key, uint64_t offset);
+    uint64_t bitcount(const std::string& key, int64_t start, int64_t end, bool bitUnits);
+    int64_t bitpos(const std::string& key, int bit, int64_t start, int64_t end, bool endGiven, bool bitUnits);
+    // Returns the length of the result; an empty one deletes destKey
+    size_t bitop(redisbitmap::op o, const std::string& destKey, const std::vector<std::string>& keys);
+    // One (value, ok) per op; ok is false for a nil reply
+    std::vector<std::pair<int64_t, bool>> bitfield(const std::string& key,
+        const std::vector<redisbitmap::fieldop>& ops);
+
+    // Stream Operations
+    bool xadd(const std::string& key, const std::string& idSpec, const redisstream::fieldlist& fields,
+        size_t maxlen, bool approx, bool nomkstream, std::string& id, std::string& err);
+    std::vector<redisstream::entry> xrange(const std::string& key, const streamid& start, const streamid& end,
+        size_t count, bool reverse);
+    size_t xlen(const std::string& key);
+    size_t xtrim(const std::string& key, size_t maxlen, bool approx);
+    bool xread(const std::vector<std::string>& keys, const std::vector<std::string>& ids, size_t count,
+        std::vector<std::pair<std::string, std::vector<redisstream::entry>>>& result, std::string& err);
+    bool xgroupCreate(const std::string& key, const std::string& group, const std::string& id, bool mkstream, std::string& err);
+    bool xgroupDestroy(const std::string& key, const std::string& group);
+    bool xreadgroup(const std::string& group, const std::string& consumer, const std::vector<std::string>& keys,
+        const std::vector<std::string>& ids, size_t count, bool noack,
+        std::vector<std::pair<std::string, std::vector<redisstream::entry>>>& result, std::string& err);
+    size_t xack(const std::string& key, const std::string& group, const std::vector<streamid>& ids);
+    bool xpending(const std::string& key, const std::string& group, redisstream::pendingsummary& summary);
+    bool xpending(const std::string& key, const std::string& group, const streamid& start, const streamid& end,
+        size_t count, const std::string& consumer, std::vector<redisstream::pendingdetail>& out);
+
+    // Vector Set Operations
+    bool vadd(const std::string& key, const std::vector<float>& vec, const std::string& element,
+        const redisvectorset::config& cfg, bool& added, std::string& err);
+    bool vsim(const std::string& key, const std::vector<float>& query, const std::string& element, size_t k,
+        size_t ef, bool exact, std::vector<std::pair<std::string, float>>& result, std::string& err);
+    bool vrem(const std::string& key, const std::string& element);
+    bool vemb(const std::string& key, const std::string& element, std::vector<float>& vec);
+    size_t vcard(const std::string& key);
+    size_t vdim(const std::string& key);
+
+    // Semantic Cache Operations
+    bool scacheSet(const std::string& cache, const std::vector<float>& embedding, const std::string& completion,
+        int ttlSeconds, std::string& entryKey, std::string& err);
+    bool scacheGet(const std::string& cache, const std::vector<float>& embedding, float threshold,
+        std::string& completion, float& score, std::string& entryKey);
+    bool scacheStats(const std::string& cache, semanticcache::stats& stats);
+    size_t scacheDrop(const std::string& cache);
+
+    // Chat History Operations (every access refreshes the session TTL)
+    size_t chatAppend(const std::string& key, const std::vector<std::pair<std::string, std::string>>& messages);
+    bool chatRead(const std::string& key, size_t lastN, size_t maxTokens, std::vector<redischat::message>& out);
+    size_t chatLen(const std::string& key);
+    // Negative arguments leave that limit unchanged.
+    void chatConfig(const std::string& key, int64_t maxMessages, int64_t maxBytes, int ttlSeconds);
+    bool chatInfo(const std::string& key, redischat::summary& info);
+
+    // Key Migration (DUMP/RESTORE)
+    bool exists(const std::string& key);
+    // ttlMs is 0 for keys without an expiry.
+    bool dumpKey(const std::string& key, std::string& payload, int64_t& ttlMs);
+    bool restoreKey(const std::string& key, const std::string& payload, int64_t ttlMs, bool replace, std::string& err);
+
+    // Tiered Storage
+    // Once the string values held in memory (all shards together) pass
+    // maxMemory bytes, a background thread moves the least frequently used
+    // ones to an append-only log under dir, keeping the key and a file
+    // offset in memory; see redistier.h. GET reads a cold value without the
+    // database lock and brings it back into memory if it turns hot again.
+    // Enable before load() so a snapshot larger than memory can be loaded.
+    static bool enableTier(const std::string& dir, uint64_t maxMemory, std::string& err);
+    static bool tierEnabled();
+    static void setTierMaxMemory(uint64_t bytes);
+    static uint64_t tierMaxMemory();
+    struct tierstats {
+        std::string dir;
+        uint64_t maxMemory = 0;
+        uint64_t hotBytes = 0;  // string value bytes in memory
+        uint64_t coldKeys = 0;
+        uint64_t demotions = 0;
+        uint64_t promotions = 0;
+        redistier::stats log;
+    };
+    // Sums every shard.
+    static tierstats tierStatistics();
+
+    // Compression
+    // String values, list elements and hash values of at least minSize bytes
+    // are stored LZ-compressed (see redislz.h) when that makes them smaller,
+    // and decompressed as they are read. Snapshots keep them compressed.
+    // 0 turns compression off for new writes.
+    static void setCompressionMinSize(uint64_t bytes);
+    static uint64_t compressionMinSize();
+    struct compressionstats {
+        uint64_t minSize = 0;
+        uint64_t values = 0;      // compressed values in memory
+        uint64_t rawBytes = 0;    // their size uncompressed
+        uint64_t storedBytes = 0; // and as stored
+    };
+    // Sums every shard.
+    static compressionstats compressionStatistics();
+
+    // Memory Analysis
+    // Sizes are estimates of what a key holds in memory: its name, its
+    // value and its share of the keyspace tables (a TTL included). A list
+    // or hash with more elements than samples is estimated from its first
+    // samples elements; 0 reads them all. A cold string counts only what
+    // stays in memory.
+    static const size_t MEMORY_SAMPLES = 5;
+    enum keytype { KEY_STRING, KEY_LIST, KEY_HASH, KEY_STREAM, KEY_VECTORSET, KEY_CHAT, KEY_TYPES };
+    // As TYPE names it
+    static const char* typeName(keytype t);
+    // false when key does not exist
+    bool memoryUsage(const std::string& key, size_t samples, uint64_t& bytes);
+
+    struct memoryrow {
+        keytype type = KEY_STRING;
+        const char* encoding = ""; // raw, compressed, cold, array, hashtable, ...
+        uint64_t keys = 0;
+        uint64_t bytes = 0;
+    };
+    struct memorystats {
+        std::vector<memoryrow> rows;  // one per type and encoding held
+        uint64_t keys = 0;
+        uint64_t expires = 0;
+        uint64_t tableBytes = 0;      // the keyspace tables themselves
+    };
+    // Sums every shard. Key counts are exact; bytes are scaled up from up
+    // to MEMORY_STATS_SAMPLES keys of each type per shard, so this costs
+    // the same whatever the keyspace size.
+    static const size_t MEMORY_STATS_SAMPLES = 64;
+    static memorystats memoryStatistics();
+
+    // Resumable keyspace walk, for big-key scans that must not stall other
+    // commands: each call holds the lock for about budget. Every key that
+    // exists for the whole walk is visited at least once; one the tables
+    // moved while the walk went on may be visited twice.
+    struct keycursor {
+        static const int STORES = 7; // strings, cold strings, lists, hashes, streams, vector sets, chats
+        int store = 0;
+        dictcursor dict;
+        size_t bucket = 0;
+        size_t buckets = 0;
+        bool done() const { return store == STORES; }
+    };
+    typedef std::function<void(const std::string& key, keytype type, uint64_t bytes, uint64_t elements)> keyvisitor;
+    // Visits keys from cursor on with their memoryUsage() and element
+    // count (a string's is its length); false once the walk is done.
+    bool scanKeys(keycursor& cursor, std::chrono::microseconds budget, const keyvisitor& visit);
+
+    // append adds to an existing snapshot (used by dumpAll)
+    bool dump(const std::string& filename, bool append = false);
     bool load(const std::string& filename);
 
 private:
@@ -50,11 +265,84 @@ private:
     redisdatabase(const redisdatabase&) = delete;
     redisdatabase& operator=(const redisdatabase&) = delete;
 
-    std::mutex db_mutex;
-    std::unordered_map<std::string, std::string> kv_store;
-    std::unordered_map<std::string, std::vector<std::string>> list_store;
-    std::unordered_map<std::string, std::unordered_map<std::string, std::string>> hash_store;
-    std::unordered_map<std::string, std::chrono::steady_clock::time_point> expiry_map;
+    void dropCacheEntry(const std::string& key);
+    void refreshChatTtl(const std::string& key, const redischat& chat);
+    void touch(const std::string& key, const char* event);
+    void touchAll();
+
+    // String values. Every change to kv_store or cold_store goes through
+    // these so string_bytes stays exact and dead log records are released.
+    void storeString(const std::string& key, const std::string& value);
+    void storeString(const std::string& key, std::string&& value);
+    // key's kv_store slot with its cold copy dropped and its old size taken
+    // off string_bytes; the caller assigns it and adds the new size
+    std::string& stringSlot(const std::string& key);
+    bool eraseString(const std::string& key);
+    // Moves a cold value back into kv_store, reading it with the lock
+    // released. Commands that need a string's bytes under the lock call it
+    // first, before locking, so warm() and readString() find the value in
+    // memory.
+    void promote(const std::string& key);
+    // Reads a cold value back into kv_store and decompresses it, for
+    // commands that work on the stored bytes in place (PFADD, ...). Reads
+    // under the lock only when a demotion got in after promote().
+    void warm(const std::string& key);
+    // key's value as it was set; like warm(), reads a cold one under the
+    // lock only when promote() lost a race
+    bool readString(const std::string& key, std::string& value);
+    void releaseCold(const std::string& key, const redistier::ref& where);
+    // load() path: spills straight to the log once memory is over budget
+    void loadString(const std::string& key, std::string value);
+    uint32_t recordAccess(const std::string& key);
+    // Bitmaps. bitmapSlot gives key's string ready to change in place: warm,
+    // not compressed and at least minLength raw bytes long, zero-filled. The
+    // raw bytes start at base, 2 when the value is kept escaped. nullptr
+    // when key holds no string and minLength is 0.
+    std::string* bitmapSlot(const std::string& key, size_t minLength, size_t& base);
+    // Escapes the value once a change has left its first raw byte NUL
+    void sealBitmap(std::string& stored, size_t& base);
+    // key's raw bytes for a read: an uncompressed value in memory is used
+    // where it is, anything else is decoded into scratch. false when key
+    // holds no string.
+    bool bitmapBytes(const std::string& key, std::string& scratch, redisbitmap::span& bytes);
+    // Lists and hashes are erased through these to keep the compression
+    // totals exact.
+    bool eraseList(const std::string& key);
+    bool eraseHash(const std::string& key);
+    void uncountAll();
+    // Stores a DUMP payload (see dumpKey) under key; packed payloads from a
+    // snapshot hold values as stored, compressed or not.
+    bool decodePayload(const std::string& key, const std::string& payload, bool packed);
+    // One pass of the tier thread: demotions in each shard, then compaction.
+    static void tierCycle();
+    // Moves a batch of the coldest sampled values to the log; false when
+    // there was nothing to move.
+    bool demoteColdest(uint64_t budget);
+
+    struct watchedkey {
+        uint64_t version = 0;
+        size_t watchers = 0;
+    };
+
+    std::recursive_mutex db_mutex;
+    // The keyspace tables (and each hash's fields) are open-addressing
+    // redisdicts that resize incrementally; see redisdict.h. Lists and hashes
+    // are copy-on-write so views can outlive the lock.
+    redisdict<std::string, std::string> kv_store;
+    redisdict<std::string, cowvalue<std::vector<std::string>>> list_store;
+    redisdict<std::string, cowvalue<fieldmap>> hash_store;
+    std::unordered_map<std::string, redisstream> stream_store;
+    std::unordered_map<std::string, redisvectorset> vector_store;
+    std::unordered_map<std::string, redischat> chat_store;
+    redisdict<std::string, std::chrono::steady_clock::time_point> expiry_map;
+    // String keys whose values are in the tier log instead of kv_store
+    redisdict<std::string, redistier::ref> cold_store;
+    uint64_t string_bytes = 0; // payload bytes of the values in kv_store
+    std::unique_ptr<accesssketch> access; // created when tiering is enabled
+    std::unordered_map<std::string, semanticcache> semcache_store;
+    std::unordered_map<std::string, std::string> semcache_entries; // entry key -> cache name
+    std::unordered_map<std::string, watchedkey> watched_keys;
+    keyspacelistener keyspace_listener = nullptr;
 };
 
 #endif
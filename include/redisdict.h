@@ -0,0 +1,513 @@
+#ifndef REDIS_DICT_H
+#define REDIS_DICT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include <new>
+#include <tuple>
+#include <utility>
+#include <iterator>
+#include <stdexcept>
+#include <functional>
+#include <type_traits>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define REDIS_DICT_SSE2 1
+#endif
+
+// Open-addressing hash table in the SwissTable layout: one control byte per
+// slot holds 7 bits of the hash (or EMPTY / DELETED), and lookups compare a
+// whole 16-slot group of control bytes at once, touching the slots only for
+// candidates whose bytes match. Entries are stored inline, with no node per
+// entry.
+//
+// Growing never rehashes everything at once. The new table goes live next
+// to the old one, and each write then moves up to MIGRATE_STEP old slots
+// across, so the cost of a resize is spread over the writes that follow.
+// Lookups check both tables until the move is done.
+//
+// Unlike std::unordered_map, inserting or erasing by key may move other
+// entries (into the new table), which invalidates iterators and references
+// to them. erase(iterator) moves nothing, so erase-while-iterating works.
+// How far a redisdict::walk got; a fresh one starts a new walk.
+struct dictcursor {
+    uint64_t generation = 0;
+    int table = -1; // -1 before the first step, 2 once done
+    size_t pos = 0;
+    bool done() const { return table == 2; }
+};
+
+template <typename K, typename V, typename Hash = std::hash<K>, typename Eq = std::equal_to<K>>
+class redisdict {
+public:
+    typedef K key_type;
+    typedef V mapped_type;
+    typedef std::pair<K, V> value_type; // do not modify first through an iterator
+
+private:
+    static const int GROUP = 16;
+    static const int8_t EMPTY = -128;
+    static const int8_t DELETED = -2;
+    static const int8_t SENTINEL = -1; // control bytes past the end of a table smaller than a group
+    static const size_t MIN_CAPACITY = 2;
+    static const size_t NPOS = ~static_cast<size_t>(0);
+
+public:
+    // Old-table slots moved per write while a resize is in progress.
+    static const size_t MIGRATE_STEP = 32;
+
+    template <bool Const>
+    class iter {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef typename redisdict::value_type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::conditional_t<Const, const value_type*, value_type*> pointer;
+        typedef std::conditional_t<Const, const value_type&, value_type&> reference;
+
+        iter() = default;
+        template <bool C = Const, typename = std::enable_if_t<C>>
+        iter(const iter<false>& o) : d(o.d), t(o.t), i(o.i) {}
+
+        reference operator*() const { return d->tableAt(t).slots[i]; }
+        pointer operator->() const { return &d->tableAt(t).slots[i]; }
+        iter& operator++() {
+            ++i;
+            skip();
+            return *this;
+        }
+        iter operator++(int) {
+            iter copy = *this;
+            ++*this;
+            return copy;
+        }
+        bool operator==(const iter& o) const { return t == o.t && i == o.i; }
+        bool operator!=(const iter& o) const { return !(*this == o); }
+
+    private:
+        friend class redisdict;
+        template <bool> friend class iter;
+        typedef std::conditional_t<Const, const redisdict*, redisdict*> owner;
+
+        iter(owner dict, int table, size_t index) : d(dict), t(table), i(index) {}
+
+        // Table 0 is the current one, 1 the table being migrated, 2 the end
+        void skip() {
+            while (t < 2) {
+                const typename redisdict::table& tb = d->tableAt(t);
+                while (i < tb.capacity && tb.ctrl[i] < 0)
+                    ++i;
+                if (i < tb.capacity)
+                    return;
+                ++t;
+                i = 0;
+            }
+        }
+
+        owner d = nullptr;
+        int t = 2;
+        size_t i = 0;
+    };
+    typedef iter<false> iterator;
+    typedef iter<true> const_iterator;
+
+    redisdict() = default;
+    redisdict(const redisdict& o) {
+        for (const auto& v : o)
+            try_emplace(v.first, v.second);
+    }
+    redisdict(redisdict&& o) noexcept { steal(o); }
+    redisdict& operator=(const redisdict& o) {
+        if (this != &o) {
+            clear();
+            for (const auto& v : o)
+                try_emplace(v.first, v.second);
+        }
+        return *this;
+    }
+    redisdict& operator=(redisdict&& o) noexcept {
+        if (this != &o) {
+            clear();
+            steal(o);
+        }
+        return *this;
+    }
+    ~redisdict() { clear(); }
+
+    iterator begin() { return first<iterator>(this); }
+    iterator end() { return iterator(this, 2, 0); }
+    const_iterator begin() const { return first<const_iterator>(this); }
+    const_iterator end() const { return const_iterator(this, 2, 0); }
+
+    size_t size() const { return cur.size + old.size; }
+    bool empty() const { return size() == 0; }
+    bool rehashing() const { return old.capacity != 0; }
+
+    iterator find(const K& key) {
+        int t;
+        size_t i = locate(key, hashOf(key), t);
+        return i == NPOS ? end() : iterator(this, t, i);
+    }
+    const_iterator find(const K& key) const {
+        int t;
+        size_t i = locate(key, hashOf(key), t);
+        return i == NPOS ? end() : const_iterator(this, t, i);
+    }
+    size_t count(const K& key) const { return find(key) == end() ? 0 : 1; }
+    bool contains(const K& key) const { return find(key) != end(); }
+
+    V& at(const K& key) {
+        iterator it = find(key);
+        if (it == end())
+            throw std::out_of_range("redisdict::at");
+        return it->second;
+    }
+    const V& at(const K& key) const {
+        const_iterator it = find(key);
+        if (it == end())
+            throw std::out_of_range("redisdict::at");
+        return it->second;
+    }
+
+    V& operator[](const K& key) { return try_emplace(key).first->second; }
+    V& operator[](K&& key) { return try_emplace(std::move(key)).first->second; }
+
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(const K& key, Args&&... args) {
+        return emplaceKey(key, std::forward<Args>(args)...);
+    }
+    template <typename... Args>
+    std::pair<iterator, bool> try_emplace(K&& key, Args&&... args) {
+        return emplaceKey(std::move(key), std::forward<Args>(args)...);
+    }
+    template <typename KK, typename VV>
+    std::pair<iterator, bool> emplace(KK&& key, VV&& value) {
+        return try_emplace(K(std::forward<KK>(key)), std::forward<VV>(value));
+    }
+    std::pair<iterator, bool> insert(const value_type& v) { return try_emplace(v.first, v.second); }
+    std::pair<iterator, bool> insert(value_type&& v) { return try_emplace(std::move(v.first), std::move(v.second)); }
+
+    size_t erase(const K& key) {
+        int t;
+        size_t i = locate(key, hashOf(key), t);
+        if (i == NPOS)
+            return 0;
+        eraseAt(tableAt(t), i);
+        if (old.capacity)
+            migrate(MIGRATE_STEP);
+        return 1;
+    }
+    iterator erase(const_iterator pos) {
+        iterator next(this, pos.t, pos.i);
+        eraseAt(tableAt(pos.t), pos.i);
+        ++next;
+        return next;
+    }
+    iterator erase(iterator pos) { return erase(const_iterator(pos)); }
+
+    void clear() {
+        release(cur);
+        release(old);
+        migratePos = 0;
+        generation++;
+    }
+
+    void swap(redisdict& o) noexcept {
+        std::swap(cur, o.cur);
+        std::swap(old, o.old);
+        std::swap(migratePos, o.migratePos);
+        generation++;
+        o.generation++;
+    }
+
+    // Entry at a slot picked by r, for sampling keys; end() when empty. Not
+    // uniform: entries that follow runs of empty slots come up more often.
+    iterator sample(uint64_t r) {
+        if (empty())
+            return end();
+        int t = old.size > r % size() ? 1 : 0;
+        iterator it(this, t, static_cast<size_t>(r >> 8) & (tableAt(t).capacity - 1));
+        it.skip();
+        return it == end() ? begin() : it;
+    }
+
+    // Walks the table a slice at a time, for callers that drop their lock
+    // between slices: visits the entries in up to count slots from c on and
+    // returns false once the walk is done. The old table of a resize goes
+    // first, so an entry migrated mid-walk lands in a table still ahead; a
+    // resize that replaces the table being walked restarts it. Every entry
+    // present for the whole walk is visited at least once, and entries that
+    // moved may be visited twice. visit must not change the dict.
+    template <typename F>
+    bool walk(dictcursor& c, size_t count, F&& visit) const {
+        if (c.table < 0 || (c.table < 2 && c.generation != generation)) {
+            // One resize since the last slice leaves the table we were in
+            // (the current one) as the old table, still to be finished
+            if (c.table == 0 && generation == c.generation + 1)
+                c.table = 1;
+            else {
+                c.table = 1;
+                c.pos = 0;
+            }
+            c.generation = generation;
+        }
+        while (c.table < 2 && count > 0) {
+            const table& t = tableAt(c.table);
+            if (c.pos >= t.capacity) {
+                c.table = c.table == 1 ? 0 : 2;
+                c.pos = 0;
+                continue;
+            }
+            if (t.ctrl[c.pos] >= 0)
+                visit(t.slots[c.pos]);
+            ++c.pos;
+            --count;
+        }
+        return c.table < 2;
+    }
+
+    // Bytes held by the tables themselves (slots and control bytes), not
+    // counting what keys and values allocate on their own.
+    size_t memoryUsage() const { return tableBytes(cur) + tableBytes(old); }
+    size_t capacity() const { return cur.capacity + old.capacity; }
+
+private:
+    struct table {
+        int8_t* ctrl = nullptr;
+        value_type* slots = nullptr;
+        size_t capacity = 0;
+        size_t size = 0;
+        size_t growthLeft = 0; // EMPTY slots that may still be filled before growing
+    };
+
+    table& tableAt(int t) { return t == 0 ? cur : old; }
+    const table& tableAt(int t) const { return t == 0 ? cur : old; }
+
+    template <typename It, typename Owner>
+    static It first(Owner d) {
+        It it(d, 0, 0);
+        it.skip();
+        return it;
+    }
+
+    uint64_t hashOf(const K& key) const {
+        // Final mix of MurmurHash3: std::hash may leave the low bits weak
+        uint64_t h = static_cast<uint64_t>(hasher(key));
+        h ^= h >> 33;
+        h *= 0xff51afd7ed558ccdULL;
+        h ^= h >> 33;
+        return h;
+    }
+
+    static size_t groups(const table& t) { return t.capacity >= GROUP ? t.capacity / GROUP : 1; }
+    static uint32_t validMask(const table& t) {
+        return t.capacity >= GROUP ? 0xFFFFu : (1u << t.capacity) - 1;
+    }
+    static size_t maxLoad(size_t capacity) { return capacity - capacity / 8; }
+    static size_t ctrlBytes(size_t capacity) { return capacity < GROUP ? GROUP : capacity; }
+    static size_t tableBytes(const table& t) {
+        return t.capacity ? ctrlBytes(t.capacity) + t.capacity * sizeof(value_type) : 0;
+    }
+
+    // Bit i set for each control byte in the group equal to b
+    static uint32_t match(const int8_t* group, int8_t b) {
+#ifdef REDIS_DICT_SSE2
+        __m128i ctrl = _mm_loadu_si128(reinterpret_cast<const __m128i*>(group));
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(b))));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < GROUP; ++i)
+            mask |= static_cast<uint32_t>(group[i] == b) << i;
+        return mask;
+#endif
+    }
+
+    // EMPTY and DELETED (and SENTINEL) are the control bytes with the top bit set
+    static uint32_t matchFree(const int8_t* group) {
+#ifdef REDIS_DICT_SSE2
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(group))));
+#else
+        uint32_t mask = 0;
+        for (int i = 0; i < GROUP; ++i)
+            mask |= static_cast<uint32_t>(group[i] < 0) << i;
+        return mask;
+#endif
+    }
+
+    size_t findIn(const table& t, const K& key, uint64_t h) const {
+        if (t.capacity == 0)
+            return NPOS;
+        size_t mask = groups(t) - 1;
+        size_t g = static_cast<size_t>(h >> 7) & mask;
+        uint32_t valid = validMask(t);
+        int8_t h2 = static_cast<int8_t>(h & 0x7f);
+        // Triangular probing over a power-of-two group count visits each group once
+        for (size_t probe = 0; probe <= mask; ++probe) {
+            const int8_t* group = t.ctrl + g * GROUP;
+            for (uint32_t m = match(group, h2) & valid; m; m &= m - 1) {
+                size_t i = g * GROUP + std::countr_zero(m);
+                if (equal(t.slots[i].first, key))
+                    return i;
+            }
+            if (match(group, EMPTY) & valid)
+                return NPOS;
+            g = (g + probe + 1) & mask;
+        }
+        return NPOS;
+    }
+
+    size_t locate(const K& key, uint64_t h, int& t) const {
+        size_t i = findIn(cur, key, h);
+        t = 0;
+        if (i == NPOS && old.capacity) {
+            i = findIn(old, key, h);
+            t = 1;
+        }
+        return i;
+    }
+
+    // First EMPTY or DELETED slot on the key's probe path; the caller makes
+    // sure the table has room.
+    static size_t freeSlot(const table& t, uint64_t h) {
+        size_t mask = groups(t) - 1;
+        size_t g = static_cast<size_t>(h >> 7) & mask;
+        uint32_t valid = validMask(t);
+        for (size_t probe = 0;; ++probe) {
+            uint32_t m = matchFree(t.ctrl + g * GROUP) & valid;
+            if (m)
+                return g * GROUP + std::countr_zero(m);
+            g = (g + probe + 1) & mask;
+        }
+    }
+
+    static void commit(table& t, size_t i, uint64_t h) {
+        if (t.ctrl[i] == EMPTY)
+            t.growthLeft--;
+        t.ctrl[i] = static_cast<int8_t>(h & 0x7f);
+        t.size++;
+    }
+
+    template <typename KK, typename... Args>
+    std::pair<iterator, bool> emplaceKey(KK&& key, Args&&... args) {
+        uint64_t h = hashOf(key);
+        int t;
+        size_t i = locate(key, h, t);
+        if (i != NPOS)
+            return { iterator(this, t, i), false };
+        prepareInsert();
+        i = freeSlot(cur, h);
+        new (&cur.slots[i]) value_type(std::piecewise_construct, std::forward_as_tuple(std::forward<KK>(key)),
+            std::forward_as_tuple(std::forward<Args>(args)...));
+        commit(cur, i, h);
+        return { iterator(this, 0, i), true };
+    }
+
+    void prepareInsert() {
+        if (old.capacity)
+            migrate(MIGRATE_STEP);
+        if (cur.growthLeft > 0)
+            return;
+        if (old.capacity)
+            migrate(old.capacity); // the next resize cannot start until this one is done
+        if (cur.growthLeft == 0)
+            grow();
+    }
+
+    void grow() {
+        size_t capacity = MIN_CAPACITY;
+        if (cur.capacity) {
+            // Mostly tombstones: rebuild at the same size to clear them
+            capacity = cur.size < maxLoad(cur.capacity) / 2 ? cur.capacity : cur.capacity * 2;
+        }
+        table next = allocate(capacity);
+        old = cur;
+        cur = next;
+        migratePos = 0;
+        generation++;
+        if (old.capacity <= MIGRATE_STEP)
+            migrate(old.capacity);
+    }
+
+    static table allocate(size_t capacity) {
+        table t;
+        t.capacity = capacity;
+        t.growthLeft = maxLoad(capacity);
+        t.ctrl = new int8_t[ctrlBytes(capacity)];
+        std::memset(t.ctrl, EMPTY, capacity);
+        std::memset(t.ctrl + capacity, SENTINEL, ctrlBytes(capacity) - capacity);
+        t.slots = static_cast<value_type*>(::operator new(capacity * sizeof(value_type)));
+        return t;
+    }
+
+    // Moves up to n slots of the old table into the current one.
+    void migrate(size_t n) {
+        size_t stop = std::min<size_t>(old.capacity, migratePos + n);
+        for (; migratePos < stop && old.size > 0; ++migratePos) {
+            if (old.ctrl[migratePos] < 0)
+                continue;
+            value_type& v = old.slots[migratePos];
+            uint64_t h = hashOf(v.first);
+            size_t i = freeSlot(cur, h);
+            new (&cur.slots[i]) value_type(std::move(v));
+            commit(cur, i, h);
+            v.~value_type();
+            old.ctrl[migratePos] = EMPTY;
+            old.size--;
+        }
+        if (migratePos >= old.capacity || old.size == 0) {
+            release(old);
+            migratePos = 0;
+        }
+    }
+
+    void eraseAt(table& t, size_t i) {
+        t.slots[i].~value_type();
+        // A probe only runs past a group with no EMPTY byte, so if the group
+        // already has one, no lookup can depend on this slot being occupied.
+        size_t g = (t.capacity >= GROUP ? i / GROUP : 0) * GROUP;
+        if (match(t.ctrl + g, EMPTY) & validMask(t)) {
+            t.ctrl[i] = EMPTY;
+            t.growthLeft++;
+        }
+        else {
+            t.ctrl[i] = DELETED;
+        }
+        t.size--;
+    }
+
+    static void release(table& t) {
+        if (!t.capacity)
+            return;
+        for (size_t i = 0; i < t.capacity; ++i) {
+            if (t.ctrl[i] >= 0)
+                t.slots[i].~value_type();
+        }
+        delete[] t.ctrl;
+        ::operator delete(t.slots);
+        t = table();
+    }
+
+    void steal(redisdict& o) {
+        cur = o.cur;
+        old = o.old;
+        migratePos = o.migratePos;
+        o.cur = table();
+        o.old = table();
+        o.migratePos = 0;
+        generation++;
+        o.generation++;
+    }
+
+    table cur;
+    table old; // capacity != 0 while a resize is moving entries out of it
+    size_t migratePos = 0;
+    uint64_t generation = 0; // resizes and clears, for walk()
+    Hash hasher;
+    Eq equal;
+};
+
+#endif
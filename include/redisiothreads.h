@@ -0,0 +1,109 @@
+#ifndef REDIS_IO_THREADS_H
+#define REDIS_IO_THREADS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <cstdint>
+#include <winsock2.h>
+#include "spscqueue.h"
+#include "redisnet.h"
+#include "redisoutput.h"
+
+class rediscommandhandler;
+
+// io-threads mode, in the spirit of Redis 6. Each I/O thread owns a share of
+// the connections: it polls them, reads, frames and parses commands, and
+// writes replies. A single execution thread runs every command, so the
+// database sees the same one-at-a-time order as before. The stages are
+// linked by SPSC rings: acceptor -> I/O (new sockets), I/O -> exec (parsed
+// commands), exec -> I/O (replies); one set per I/O thread.
+class redisiothreads {
+public:
+    struct stats {
+        uint64_t commands = 0;
+        uint64_t pollCalls = 0;
+        uint64_t readCalls = 0;
+        uint64_t writeCalls = 0;
+        uint64_t wakeups = 0; // exec -> I/O signals
+    };
+
+    redisiothreads(rediscommandhandler& handler, int threads);
+    ~redisiothreads();
+
+    void start();
+    void stop();
+    // Called from the accepting thread only (it is the rings' one producer).
+    void addConnection(SOCKET sock);
+    int threadCount() const { return static_cast<int>(workers.size()); }
+    stats getStats() const;
+
+private:
+    struct connection;
+
+    struct request {
+        connection* conn = nullptr;
+        std::vector<std::string> tokens;
+        bool close = false;
+    };
+
+    struct reply {
+        connection* conn = nullptr;
+        std::string data;
+        bool close = false;
+    };
+
+    struct iothread {
+        iothread();
+        std::thread thread;
+        redispoller poller;
+        rediswakeup wakeup;
+        spscqueue<SOCKET> accepted;
+        spscqueue<request> inbound;
+        spscqueue<reply> outbound;
+        std::atomic<bool> polling{ false };
+        std::unordered_map<uint64_t, connection*> conns;
+        // Connections whose pushed-message queue has data; filled by any
+        // publisher thread, so it is a locked list rather than a ring.
+        std::mutex readyMutex;
+        std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> ready;
+        std::vector<connection*> dirty;     // have unsent output
+        std::vector<connection*> graveyard; // freed at the end of the loop pass
+        uint64_t nextConnId = 0;
+        std::atomic<uint64_t> pollCalls{ 0 };
+        std::atomic<uint64_t> readCalls{ 0 };
+        std::atomic<uint64_t> writeCalls{ 0 };
+    };
+
+    void ioLoop(iothread& t);
+    void readConnection(iothread& t, connection* c);
+    void flushConnection(iothread& t, connection* c);
+    void beginClose(iothread& t, connection* c);
+    void drainReplies(iothread& t);
+    void flushDirty(iothread& t);
+    void wakeExec();
+    void pushRequest(iothread& t, request&& r);
+
+    void execLoop();
+    void execute(iothread& t, request& r);
+    void pushReply(iothread& t, reply&& r);
+
+    rediscommandhandler& cmdHandler;
+    std::vector<std::unique_ptr<iothread>> workers;
+    std::thread executor;
+    std::atomic<bool> running{ false };
+    size_t nextWorker = 0;
+
+    std::mutex execMutex;
+    std::condition_variable execCv;
+    std::atomic<bool> execSleeping{ false };
+    std::atomic<uint64_t> commands{ 0 };
+    std::atomic<uint64_t> wakeups{ 0 };
+};
+
+#endif
@@ -0,0 +1,22 @@
+#ifndef REDIS_LZ_H
+#define REDIS_LZ_H
+
+#include <string>
+#include <cstddef>
+
+// Built-in LZ77 codec writing the LZ4 block format: sequences of literals
+// followed by a back-reference (2-byte offset, length >= 4) into the last
+// 64KB, found through a hash table of 4-byte prefixes. Favors speed over
+// ratio; JSON and other text typically shrink 3-8x. Blocks carry no length
+// header; the caller stores the raw length next to them.
+class redislz {
+public:
+    // Appends the compressed form of src to out. false (out unchanged) when
+    // the input is too short or would not get smaller.
+    static bool compress(const char* src, size_t n, std::string& out);
+    // Decodes a block that expands to exactly rawLength bytes into dst;
+    // false on malformed input, without writing past dst + rawLength.
+    static bool decompress(const char* src, size_t n, char* dst, size_t rawLength);
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef REDIS_MEMORY_H
+#define REDIS_MEMORY_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "redisdatabase.h"
+
+// Keyspace analysis behind MEMORY BIGKEYS and MEMORY HOTKEYS, both safe to
+// run at full load. The big-key scan walks every shard on its own thread in
+// slices of SCAN_SLICE, holding one shard's lock at a time, and rests
+// SCAN_PAUSE between slices, so it takes about 0.5% of one core and never
+// holds up a command for longer than a slice. Hot keys come from one command
+// in HOT_SAMPLE_EVERY: its keys feed an access sketch, and the keys the
+// sketch counts highest are kept by name.
+namespace redismemory {
+    // Big-Key Scan
+    // Starts a scan that keeps the top biggest keys of each type; false when
+    // one is already running.
+    bool startScan(size_t top);
+    // false when no scan was running
+    bool stopScan();
+
+    struct keyentry {
+        std::string key;
+        redisdatabase::keytype type = redisdatabase::KEY_STRING;
+        uint64_t bytes = 0;
+        uint64_t elements = 0;
+    };
+    struct typetotal {
+        uint64_t keys = 0;
+        uint64_t bytes = 0;
+        uint64_t elements = 0;
+    };
+    struct scanreport {
+        const char* state = "idle"; // idle, running, done or stopped
+        int64_t startTime = 0;      // unix seconds
+        uint64_t elapsedMs = 0;
+        uint64_t keys = 0;          // keys visited; one the tables moved may count twice
+        uint64_t slices = 0;
+        uint64_t busyUs = 0;        // time spent in slices, waits for a shard's lock included
+        uint64_t maxSliceUs = 0;
+        typetotal totals[redisdatabase::KEY_TYPES];
+        std::vector<keyentry> biggest; // the top of each type, biggest first
+    };
+    // The running scan's findings so far, or the last one's.
+    scanreport scanReport();
+
+    // Hot Keys
+    static const uint32_t HOT_SAMPLE_EVERY = 16; // a power of two
+    // Counts one command on this thread; true for the one in
+    // HOT_SAMPLE_EVERY whose keys should go to recordAccess.
+    inline bool sampleCommand() {
+        thread_local uint32_t commands = 0;
+        return (++commands & (HOT_SAMPLE_EVERY - 1)) == 0;
+    }
+    void recordAccess(const std::string& key);
+
+    struct hotkey {
+        std::string key;
+        uint64_t accesses = 0; // estimated, over the recent past; see redismemory.cpp
+    };
+    // Hottest first, at most count of them.
+    std::vector<hotkey> hotKeys(size_t count);
+}
+
+#endif
@@ -0,0 +1,94 @@
+#ifndef REDIS_NET_H
+#define REDIS_NET_H
+
+#include <string>
+#include <vector>
+#include <functional>
+#include <cstdint>
+#include <unordered_map>
+#include <winsock2.h>
+
+// Portability layer for the event-driven server paths: readiness polling is
+// epoll on Linux and WSAPoll on Windows, behind one small interface.
+namespace redisnet {
+    // Flags for send(): a peer that hung up must not raise SIGPIPE on Linux.
+#ifdef _WIN32
+    const int SEND_FLAGS = 0;
+#else
+    const int SEND_FLAGS = MSG_NOSIGNAL;
+#endif
+
+    bool setNonBlocking(SOCKET sock);
+    bool setNoDelay(SOCKET sock);
+    // True when the last socket call failed only because it would block.
+    bool wouldBlock();
+
+    // What INFO reports for the active server loop. syscalls counts the
+    // calls made on the request path (poll, recv, send, ring enters, wakeups).
+    struct netstats {
+        std::string backend = "threads";
+        int threads = 0;
+        uint64_t commands = 0;
+        uint64_t syscalls = 0;
+        uint64_t forwarded = 0;   // shard mode: ran on another core
+        uint64_t coordinated = 0; // shard mode: spanned cores
+    };
+    // The server loop installs a source once it starts; without one the
+    // thread-per-connection defaults are reported.
+    void setStatsSource(std::function<netstats()> source);
+    netstats currentStats();
+}
+
+class redispoller {
+public:
+    enum { READABLE = 1, WRITABLE = 2 };
+
+    struct event {
+        void* data;
+        int events;
+        bool hangup;
+    };
+
+    redispoller();
+    ~redispoller();
+
+    bool add(SOCKET sock, void* data, int events);
+    bool modify(SOCKET sock, void* data, int events);
+    void remove(SOCKET sock);
+    // Returns the number of events stored in out; timeoutMs < 0 waits forever.
+    int wait(std::vector<event>& out, int timeoutMs);
+
+private:
+    redispoller(const redispoller&) = delete;
+    redispoller& operator=(const redispoller&) = delete;
+
+#ifdef _WIN32
+    std::vector<WSAPOLLFD> fds;
+    std::vector<void*> fdData;
+    std::unordered_map<SOCKET, size_t> index;
+#else
+    int epfd;
+    std::vector<char> raw; // epoll_event buffer
+#endif
+};
+
+// Lets another thread interrupt redispoller::wait. Its socket is registered
+// with the poller like any connection; signal() makes it readable.
+class rediswakeup {
+public:
+    rediswakeup();
+    ~rediswakeup();
+
+    SOCKET handle() const { return readEnd; }
+    void signal();
+    void drain();
+
+private:
+    rediswakeup(const rediswakeup&) = delete;
+    rediswakeup& operator=(const rediswakeup&) = delete;
+
+    SOCKET readEnd = INVALID_SOCKET;
+    SOCKET writeEnd = INVALID_SOCKET;
+};
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef REDIS_OUTPUT_H
+#define REDIS_OUTPUT_H
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#include <functional>
+
+// Outbound queue for one connection that can receive pushed data. Buffers
+// are shared and immutable, so a message fanned out to many clients is
+// encoded once and only its reference count changes per subscriber.
+//
+// A reply too big to build in memory is queued as a producer instead: the
+// connection pulls it a piece at a time, as it takes from the queue, so
+// only the piece being written exists at once.
+class redisoutput {
+public:
+    typedef std::shared_ptr<const std::string> buffer;
+    // Appends the next piece of a streamed reply to chunk; false when that
+    // was the last piece. Called by the thread taking from the queue,
+    // without the queue lock.
+    typedef std::function<bool(std::string& chunk)> producer;
+
+    // Same shape as Redis' pubsub client-output-buffer-limit: over hardBytes,
+    // or over softBytes for softSeconds, and the client is disconnected.
+    struct limits {
+        size_t hardBytes = 32 * 1024 * 1024;
+        size_t softBytes = 8 * 1024 * 1024;
+        int softSeconds = 60;
+    };
+
+    redisoutput() = default;
+    explicit redisoutput(const limits& l) : lim(l) {}
+
+    enum pushresult { QUEUED, CLOSED, OVERFLOWED };
+
+    // OVERFLOWED means this push put the client over its limits; the queue is
+    // then closed and the connection should be dropped.
+    pushresult push(const buffer& b);
+    // Pieces of a producer do not count against the limits: the next one is
+    // made only once the connection has taken the last.
+    pushresult push(producer p);
+    // Blocks until data is queued; returns false once the queue is closed.
+    // A take returns the buffers queued ahead of the first producer, or else
+    // that producer's next piece.
+    bool take(std::vector<buffer>& out);
+    // Non-blocking take for event-driven writers; false when nothing is queued.
+    bool tryTake(std::vector<buffer>& out);
+    // True when a take left data queued: a producer's next piece, or what
+    // was queued behind it. Notify does not run for it, as the queue never
+    // emptied; an event-driven writer calls resume() once it has sent what
+    // it took, and notify runs then. Writing at the socket's pace is the
+    // flow control.
+    bool pending() const;
+    void resume();
+    // Called (under the queue lock) when a push makes the queue non-empty or
+    // closes it; lets an event loop learn that this connection has data.
+    void setNotify(std::function<void()> fn);
+    void close();
+
+    bool closed() const;
+    bool overflowed() const;
+    size_t pendingBytes() const;
+
+private:
+    struct entry {
+        buffer data;
+        producer more; // set instead of data for a streamed reply
+    };
+
+    // Moves queued buffers (or one produced piece) to out; false when the
+    // queue was closed meanwhile.
+    bool collect(std::unique_lock<std::mutex>& lock, std::vector<buffer>& out);
+
+    mutable std::mutex mtx;
+    std::condition_variable cv;
+    std::deque<entry> queue;
+    size_t bytes = 0;
+    bool isClosed = false;
+    bool isOverflowed = false;
+    bool overSoft = false;
+    std::chrono::steady_clock::time_point softSince;
+    limits lim;
+    std::function<void()> notify;
+};
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef REDIS_PUBSUB_H
+#define REDIS_PUBSUB_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <shared_mutex>
+#include <unordered_map>
+#include <cstdint>
+#include "redisoutput.h"
+
+// Channel and pattern subscriptions. PUBLISH encodes each outgoing message
+// once and pushes the same buffer to every matching subscriber. Patterns are
+// kept in a trie keyed by their literal prefix (the part before the first
+// glob character), so a publish only tests the patterns whose prefix is a
+// prefix of the channel instead of every pattern.
+class redispubsub {
+public:
+    typedef std::shared_ptr<redisoutput> subscriber;
+
+    struct stats {
+        uint64_t published = 0;
+        uint64_t delivered = 0;
+        uint64_t droppedClients = 0;
+    };
+
+    static redispubsub& getInstance();
+
+    // Both return false if the subscriber was already registered.
+    bool subscribe(const std::string& channel, const subscriber& s);
+    bool unsubscribe(const std::string& channel, const subscriber& s);
+    bool psubscribe(const std::string& pattern, const subscriber& s);
+    bool punsubscribe(const std::string& pattern, const subscriber& s);
+
+    // Returns the number of clients that received the message.
+    size_t publish(const std::string& channel, const std::string& message);
+
+    std::vector<std::string> channels(const std::string& pattern);
+    size_t numsub(const std::string& channel);
+    size_t numpat();
+    stats getStats() const;
+
+    // Redis-style glob: *, ?, [abc], [^a-z] and backslash escapes.
+    static bool globmatch(const char* pattern, size_t plen, const char* str, size_t slen);
+
+private:
+    redispubsub() = default;
+    redispubsub(const redispubsub&) = delete;
+    redispubsub& operator=(const redispubsub&) = delete;
+
+    typedef std::unordered_map<redisoutput*, subscriber> subscriberset;
+
+    struct patternnode {
+        std::unordered_map<char, std::unique_ptr<patternnode>> children;
+        std::unordered_map<std::string, subscriberset> patterns; // patterns whose literal prefix ends here
+    };
+
+    static size_t literalPrefix(const std::string& pattern);
+    size_t deliver(const subscriberset& subs, const redisoutput::buffer& msg);
+
+    mutable std::shared_mutex mtx;
+    std::unordered_map<std::string, subscriberset> channelSubs;
+    patternnode patternRoot;
+    size_t patternCount = 0;
+    std::atomic<uint64_t> published{ 0 };
+    std::atomic<uint64_t> delivered{ 0 };
+    std::atomic<uint64_t> droppedClients{ 0 };
+};
+
+#endif
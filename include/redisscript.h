@@ -0,0 +1,91 @@
+#ifndef REDIS_SCRIPT_H
+#define REDIS_SCRIPT_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unordered_map>
+#include <cstdint>
+
+// Small Lua-subset used by EVAL. Scripts are compiled once into bytecode for a
+// stack VM and cached by SHA1; redis.call() goes straight to a host callback
+// with already-split arguments, so nothing is re-encoded as RESP on the way in.
+//
+// Supported: local/global variables, if/elseif/else, while, numeric for,
+// break, return, tables ({...}, t[k], t.k, #t), arithmetic, comparisons,
+// .. concatenation, and/or/not, and the builtins redis.call, redis.pcall,
+// redis.error_reply, redis.status_reply, redis.sha1hex, tonumber, tostring,
+// type and table.insert. User-defined functions are not supported.
+
+struct scripttable;
+
+struct scriptvalue {
+    enum kind { NIL, BOOLEAN, NUMBER, STRING, TABLE };
+
+    kind type = NIL;
+    bool b = false;
+    double n = 0;
+    std::string s;
+    std::shared_ptr<scripttable> t;
+
+    static scriptvalue boolean(bool v) { scriptvalue r; r.type = BOOLEAN; r.b = v; return r; }
+    static scriptvalue number(double v) { scriptvalue r; r.type = NUMBER; r.n = v; return r; }
+    static scriptvalue string(std::string v) { scriptvalue r; r.type = STRING; r.s = std::move(v); return r; }
+    static scriptvalue table();
+    // {err = msg} / {ok = msg}, the script-side form of error and status replies
+    static scriptvalue errorReply(const std::string& msg);
+    static scriptvalue statusReply(const std::string& msg);
+
+    bool truthy() const { return type != NIL && !(type == BOOLEAN && !b); }
+    std::string toString() const;
+    // A number as a RESP integer: truncated toward zero, clamped to the
+    // int64 range, and 0 for NaN
+    int64_t toInteger() const;
+};
+
+struct scripttable {
+    std::vector<scriptvalue> array; // array[i] holds t[i + 1]
+    std::unordered_map<std::string, scriptvalue> hash;
+
+    scripttable() = default;
+    scripttable(const scripttable&) = delete;
+    scripttable& operator=(const scripttable&) = delete;
+    ~scripttable();
+
+    scriptvalue get(const scriptvalue& key) const;
+    bool set(const scriptvalue& key, const scriptvalue& value, std::string& err);
+    const scriptvalue* field(const std::string& name) const;
+    size_t length() const { return array.size(); }
+};
+
+struct scriptchunk {
+    struct instr {
+        uint8_t op;
+        int32_t a;
+        int32_t b;
+    };
+    std::vector<instr> code;
+    std::vector<scriptvalue> constants;
+    std::vector<int> lines;
+    size_t localSlots = 0;
+};
+
+class redisscript {
+public:
+    // Runs one redis.call; returns false (with reply holding the error text)
+    // when the command failed.
+    typedef std::function<bool(const std::vector<std::string>& args, scriptvalue& reply)> commandcallback;
+
+    static const uint64_t DEFAULT_BUDGET = 10000000;
+    // Longest string a script may build, the same 512MB cap as Redis values
+    static const size_t MAX_STRING = 512 * 1024 * 1024;
+
+    static bool compile(const std::string& source, scriptchunk& chunk, std::string& err);
+    static bool run(const scriptchunk& chunk, const std::vector<std::string>& keys, const std::vector<std::string>& argv,
+        const commandcallback& call, uint64_t budget, scriptvalue& result, std::string& err);
+
+    static std::string sha1hex(const std::string& data);
+};
+
+#endif
@@ -0,0 +1,42 @@
+#ifndef REDIS_SERIALIZE_H
+#define REDIS_SERIALIZE_H
+
+#include <string>
+#include <cstdint>
+
+// Varint and length-prefixed string helpers shared by the snapshot encoders
+// of the non-trivial value types.
+inline void putVarint(std::string& out, uint64_t v) {
+    while (v >= 0x80) {
+        out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+        v >>= 7;
+    }
+    out.push_back(static_cast<char>(v));
+}
+
+inline bool getVarint(const std::string& in, size_t& pos, uint64_t& v) {
+    v = 0;
+    for (int shift = 0; shift < 64 && pos < in.size(); shift += 7) {
+        uint8_t b = static_cast<uint8_t>(in[pos++]);
+        v |= static_cast<uint64_t>(b & 0x7f) << shift;
+        if ((b & 0x80) == 0)
+            return true;
+    }
+    return false;
+}
+
+inline void putString(std::string& out, const std::string& s) {
+    putVarint(out, s.size());
+    out.append(s);
+}
+
+inline bool getString(const std::string& in, size_t& pos, std::string& s) {
+    uint64_t len;
+    if (!getVarint(in, pos, len) || len > in.size() - pos)
+        return false;
+    s.assign(in, pos, len);
+    pos += len;
+    return true;
+}
+
+#endif
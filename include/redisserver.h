@@ -17,11 +17,20 @@ public:
     redisserver(int port);
     void run();
     void shutdown();
+    // 0 keeps one thread per connection; N > 0 serves through N I/O threads
+    void setIoThreads(int n) { ioThreads = n; }
+    // "uring" tries the io_uring loop first and falls back to epoll I/O threads
+    void setIoBackend(const std::string& backend) { ioBackend = backend; }
+    // N > 0 partitions the keyspace over N thread-per-core shards
+    void setShards(int n) { shardCount = n; }
 
 private:
     int port;
     SOCKET server_socket; 
     bool running;
+    int ioThreads = 0;
+    std::string ioBackend;
+    int shardCount = 0;
 
    
     void setupSignalHandler();
@@ -0,0 +1,130 @@
+#ifndef REDIS_SHARDS_H
+#define REDIS_SHARDS_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include <winsock2.h>
+#include "spscqueue.h"
+#include "redisnet.h"
+#include "redisoutput.h"
+
+class rediscommandhandler;
+class redisdatabase;
+
+// Shared-nothing thread-per-core mode. Each shard thread owns one
+// redisdatabase partition and runs its own event loop over the connections
+// it accepted. A command whose keys live on another shard is forwarded over
+// that pair's SPSC ring; everything bound for one shard during a loop pass
+// travels as a single batch, and the replies come back the same way.
+// Commands spanning shards are coordinated by the connection's shard: it
+// locks the shards involved in index order, gathers the keys into one of
+// them, runs the command there and moves the keys back. EVAL is routed by
+// its KEYS alone, so a script must declare every key it touches; redis.call
+// on any other key fails unless the script's shard happens to own it.
+class redisshards {
+public:
+    struct stats {
+        uint64_t commands = 0;
+        uint64_t forwarded = 0;   // ran on another shard
+        uint64_t batches = 0;     // request batches sent between shards
+        uint64_t coordinated = 0; // spanned shards, or needed the client on another shard
+        uint64_t stalls = 0;      // pipelines paused to keep command order
+        uint64_t syscalls = 0;
+    };
+
+    redisshards(rediscommandhandler& handler, int shards);
+    ~redisshards();
+
+    void start();
+    void stop();
+    // Called from the accepting thread only.
+    void addConnection(SOCKET sock);
+    int shardCount() const { return static_cast<int>(shards.size()); }
+    stats getStats() const;
+
+    // The cluster hash slot modulo the shard count, so hash tags keep
+    // related keys on one shard.
+    size_t ownerOf(const std::string& key) const;
+
+private:
+    struct connection;
+
+    // One forwarded command; reply is filled in by the owning shard.
+    struct envelope {
+        uint64_t conn = 0;
+        uint64_t seq = 0;
+        std::vector<std::string> tokens;
+        std::string reply;
+    };
+    typedef std::vector<envelope> batch;
+
+    // Rings for one ordered pair of shards: requests flow from -> to,
+    // replies to -> from.
+    struct link {
+        link();
+        spscqueue<batch> requests;
+        spscqueue<batch> replies;
+    };
+
+    struct alignas(64) counters {
+        std::atomic<uint64_t> commands{ 0 };
+        std::atomic<uint64_t> forwarded{ 0 };
+        std::atomic<uint64_t> batches{ 0 };
+        std::atomic<uint64_t> coordinated{ 0 };
+        std::atomic<uint64_t> stalls{ 0 };
+        std::atomic<uint64_t> syscalls{ 0 };
+    };
+
+    struct shard {
+        shard();
+        size_t index = 0;
+        redisdatabase* db = nullptr;
+        std::thread thread;
+        redispoller poller;
+        rediswakeup wakeup;
+        spscqueue<SOCKET> accepted;
+        std::atomic<bool> polling{ false };
+        std::unordered_map<uint64_t, connection*> conns;
+        uint64_t nextConnId = 0;
+        std::vector<batch> outbox;   // per destination shard, filled this pass
+        std::vector<batch> replyBox; // per source shard, waiting for ring space
+        std::vector<connection*> dirty;
+        std::vector<connection*> resumable; // stalled connections whose replies arrived
+        std::vector<connection*> graveyard;
+        std::mutex readyMutex;
+        std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> ready;
+        counters stats;
+    };
+
+    link& linkFor(size_t from, size_t to) { return *links[from * shards.size() + to]; }
+
+    void loop(shard& s);
+    bool hasWork(shard& s);
+    void readConnection(shard& s, connection* c);
+    void dispatch(shard& s, connection* c);
+    bool route(shard& s, connection* c, std::vector<std::string>& tokens);
+    std::string coordinate(shard& s, connection* c, std::vector<std::string>& tokens,
+        const std::vector<std::string>& keys, const std::string& cmd);
+    void complete(shard& s, connection* c, uint64_t seq, std::string&& reply);
+    void emit(shard& s, connection* c, std::string&& data);
+    void serviceLinks(shard& s);
+    void sendBatches(shard& s);
+    void drainPushed(shard& s);
+    void flushConnection(shard& s, connection* c);
+    void closeConnection(shard& s, connection* c);
+    void signal(shard& target);
+
+    rediscommandhandler& cmdHandler;
+    std::vector<std::unique_ptr<shard>> shards;
+    std::vector<std::unique_ptr<link>> links;
+    std::atomic<bool> running{ false };
+    size_t nextShard = 0;
+};
+
+#endif
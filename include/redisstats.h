@@ -0,0 +1,116 @@
+#ifndef REDIS_STATS_H
+#define REDIS_STATS_H
+
+#include <string>
+#include <vector>
+#include <chrono>
+#include <cstdint>
+#include "latencyhistogram.h"
+
+// Server instrumentation behind INFO, SLOWLOG and LATENCY. Hot-path counters
+// live in a per-thread block aligned to a cache line; only the owning thread
+// writes it (plain load + store, no locked instructions) and readers sum the
+// blocks. A thread's totals are folded into a shared block when it exits.
+namespace redisstats {
+    enum counter {
+        CONNECTIONS,    // connections accepted
+        DISCONNECTIONS,
+        COMMANDS,
+        ERROR_REPLIES,
+        WRITES,         // successful write commands, for changes since the last save
+        EXPIRED_KEYS,
+        TIER_MEMORY_HITS, // string reads served from memory while tiering is on
+        TIER_DISK_READS,  // string reads of cold values from the tier log
+        COMPRESS_CALLS,   // values big enough to try compressing
+        COMPRESS_SKIPPED, // of those, values that did not get smaller
+        COMPRESS_NS,
+        DECOMPRESS_CALLS,
+        DECOMPRESS_NS,
+        COUNTER_COUNT
+    };
+    void add(counter c, uint64_t n = 1);
+    uint64_t total(counter c);
+
+    // Command Statistics
+    // Slots are handed out while the command table is built, before any
+    // command runs; commandSlot is a lock-free read after that.
+    int registerCommand(const std::string& name);
+    int commandSlot(const std::string& name);
+
+    struct commandstat {
+        std::string name; // lower case, as INFO commandstats prints it
+        uint64_t calls = 0;
+        uint64_t usec = 0;
+        uint64_t failed = 0;
+    };
+    // Commands called at least once.
+    std::vector<commandstat> commandStats();
+
+    // Records one finished command: its slot's calls and time, the global
+    // counters, and a SLOWLOG entry when it ran longer than the threshold.
+    void commandDone(int slot, const std::vector<std::string>& tokens,
+        std::chrono::steady_clock::time_point start, bool failed, bool write);
+
+    // Server
+    void setPort(int port);
+    int port();
+    int processId();
+    int64_t uptimeSeconds();
+
+    // Persistence
+    struct persistence {
+        uint64_t saves = 0;
+        uint64_t failedSaves = 0;
+        int64_t lastSaveTime = 0; // unix seconds of the last successful save
+        bool lastSaveOk = true;
+        uint64_t lastSaveMs = 0;
+        uint64_t changesSinceSave = 0;
+    };
+    void recordSave(bool ok, uint64_t ms);
+    persistence persistenceStats();
+
+    // Slow Log
+    struct slowentry {
+        uint64_t id = 0;
+        int64_t time = 0; // unix seconds
+        uint64_t usec = 0;
+        std::vector<std::string> args; // trimmed as in Redis: 32 args, 128 bytes each
+    };
+    // usec; negative disables the log, 0 records every command.
+    void setSlowlogThreshold(int64_t usec);
+    int64_t slowlogThreshold();
+    void setSlowlogMaxLen(size_t n);
+    size_t slowlogMaxLen();
+    // Newest first; count < 0 returns everything.
+    std::vector<slowentry> slowlog(int64_t count);
+    size_t slowlogLen();
+    void slowlogReset();
+
+    // Latency Monitor
+    // Events of at least thresholdMs are kept (0 turns monitoring off), up
+    // to 160 samples per event, as Redis' LATENCY does.
+    void setLatencyThreshold(uint64_t ms);
+    uint64_t latencyThreshold();
+    void latencySample(const char* event, uint64_t ms);
+
+    struct latencyevent {
+        std::string name;
+        int64_t latestTime = 0;
+        uint64_t latestMs = 0;
+        uint64_t maxMs = 0;
+        std::vector<std::pair<int64_t, uint64_t>> history; // (unix seconds, ms), oldest first
+    };
+    std::vector<latencyevent> latencyEvents();
+    // Clears the named events, or all when names is empty; returns how many were cleared.
+    size_t latencyReset(const std::vector<std::string>& names);
+
+    // Tiered Storage
+    // One read of a cold value from the log; also a "cold-read" latency event.
+    void coldRead(uint64_t ns);
+    latencyhistogram coldReadLatency();
+
+    // Resident set size of the process and its peak, in bytes.
+    void memoryUsage(uint64_t& rss, uint64_t& peakRss);
+}
+
+#endif
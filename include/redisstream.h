@@ -0,0 +1,113 @@
+#ifndef REDIS_STREAM_H
+#define REDIS_STREAM_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <cstdint>
+#include <utility>
+
+struct streamid {
+    uint64_t ms = 0;
+    uint64_t seq = 0;
+
+    bool operator<(const streamid& o) const { return ms < o.ms || (ms == o.ms && seq < o.seq); }
+    bool operator==(const streamid& o) const { return ms == o.ms && seq == o.seq; }
+    bool operator!=(const streamid& o) const { return !(*this == o); }
+    bool operator<=(const streamid& o) const { return !(o < *this); }
+    bool operator>(const streamid& o) const { return o < *this; }
+
+    std::string toString() const;
+    static streamid min() { return streamid{ 0, 0 }; }
+    static streamid max() { return streamid{ UINT64_MAX, UINT64_MAX }; }
+    // Parses "ms-seq" or "ms" (seq defaults to missingSeq).
+    static bool parse(const std::string& s, streamid& id, uint64_t missingSeq);
+    // Parses XRANGE bounds: "-", "+", and "(" for exclusive bounds.
+    static bool parseRange(const std::string& s, bool isStart, streamid& id);
+};
+
+// Append-only log. Entries are packed into blocks of contiguous memory and the
+// blocks are indexed by their first ID, so a range read finds its starting
+// block once and then walks neighbouring blocks in order.
+class redisstream {
+public:
+    typedef std::vector<std::pair<std::string, std::string>> fieldlist;
+
+    struct entry {
+        streamid id;
+        fieldlist fields;
+        bool deleted = false; // pending entry that has since been trimmed
+    };
+
+    struct pendingentry {
+        std::string consumer;
+        int64_t deliveryTime = 0;
+        uint64_t deliveryCount = 0;
+    };
+
+    struct group {
+        streamid lastDelivered;
+        std::map<streamid, pendingentry> pel;
+        std::map<std::string, int64_t> consumers; // name -> last seen (ms)
+    };
+
+    struct pendingsummary {
+        size_t count = 0;
+        streamid smallest;
+        streamid greatest;
+        std::vector<std::pair<std::string, size_t>> consumers;
+    };
+
+    struct pendingdetail {
+        streamid id;
+        std::string consumer;
+        int64_t idle = 0;
+        uint64_t deliveryCount = 0;
+    };
+
+    // idSpec is "*", "ms-*" or an explicit "ms-seq".
+    bool add(const std::string& idSpec, const fieldlist& fields, streamid& added, std::string& err);
+    size_t trim(size_t maxlen, bool approx);
+    std::vector<entry> range(const streamid& start, const streamid& end, size_t count, bool reverse) const;
+    size_t length() const { return entries; }
+    streamid lastId() const { return last_id; }
+    // Bytes held, blocks and consumer groups included; walks the blocks.
+    size_t memoryUsage() const;
+
+    bool createGroup(const std::string& name, const streamid& start);
+    bool destroyGroup(const std::string& name);
+    bool hasGroup(const std::string& name) const { return groups.count(name) > 0; }
+    // startId ">" delivers new entries; any other ID replays the consumer's
+    // pending entries after that ID.
+    bool readGroup(const std::string& groupName, const std::string& consumer, const std::string& startId,
+        size_t count, bool noack, std::vector<entry>& out, std::string& err);
+    size_t ack(const std::string& groupName, const std::vector<streamid>& ids);
+    bool pending(const std::string& groupName, pendingsummary& summary) const;
+    bool pending(const std::string& groupName, const streamid& start, const streamid& end, size_t count,
+        const std::string& consumer, std::vector<pendingdetail>& out) const;
+
+    void serialize(std::string& out) const;
+    bool deserialize(const std::string& in);
+
+    static const size_t BLOCK_MAX_ENTRIES = 128;
+    static const size_t BLOCK_MAX_BYTES = 4096;
+
+private:
+    struct block {
+        std::vector<streamid> ids;
+        std::vector<uint32_t> offsets;
+        std::string data;
+        size_t head = 0; // entries before head were trimmed
+    };
+
+    void append(const streamid& id, const fieldlist& fields);
+    bool lookup(const streamid& id, entry& out) const;
+    static void decode(const block& b, size_t i, entry& out);
+
+    std::map<streamid, block> blocks; // keyed by the first ID stored in the block
+    size_t entries = 0;
+    streamid last_id;
+    std::map<std::string, group> groups;
+};
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef REDIS_TIER_H
+#define REDIS_TIER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <cstdint>
+
+// Cold tier for string values: an append-only log on local disk, split into
+// segments. A record is [key length][value length][key][value]; the database
+// keeps a ref (segment, offset, length) for each cold key and only the
+// compactor ever looks at the keys in the log.
+//
+// Records are immutable, and a segment stays open while anyone holds its
+// handle, so a value can be read without the database lock: take the handle
+// under the lock, read after releasing it. A segment that compaction drops
+// is deleted when its last handle goes away. The log is scratch space, not
+// persistence: snapshots read cold values back and write them out inline.
+class redistier {
+public:
+    struct ref {
+        uint32_t segment = 0;
+        uint32_t length = 0; // value bytes
+        uint64_t offset = 0; // of the value within the segment
+    };
+
+    class segment;
+    typedef std::shared_ptr<segment> handle;
+
+    struct record {
+        std::string key;
+        std::string value;
+        ref where;
+    };
+
+    struct stats {
+        uint64_t segments = 0;
+        uint64_t fileBytes = 0;
+        uint64_t liveBytes = 0; // record bytes still referenced
+        uint64_t compactions = 0;
+        uint64_t compactedBytes = 0; // live record bytes rewritten by compaction
+    };
+
+    // Segments are written as <dir>/<name>-<id>.log
+    redistier(const std::string& dir, const std::string& name);
+    ~redistier();
+    redistier(const redistier&) = delete;
+    redistier& operator=(const redistier&) = delete;
+
+    bool append(const std::string& key, const std::string& value, ref& out, std::string& err);
+    // nullptr when the segment is gone (the ref is stale)
+    handle open(uint32_t segment);
+    static bool read(const handle& h, const ref& r, std::string& value);
+    // The record at r, whose key is keyBytes long, is no longer referenced
+    void release(const ref& r, size_t keyBytes);
+
+    // Compaction
+    // A sealed segment that is mostly dead records, or 0.
+    uint32_t compactionCandidate();
+    // Reads about maxBytes of records from pos on and advances pos; out is
+    // empty at the end of the segment. false on a read error.
+    static bool scan(const handle& h, uint64_t& pos, size_t maxBytes, std::vector<record>& out);
+    // Counts live bytes that compaction copied into the active segment
+    void moved(uint64_t bytes);
+    // Drops a compacted segment; its file goes when the last handle does.
+    void drop(uint32_t segment);
+
+    stats statistics();
+
+    static const uint64_t SEGMENT_BYTES = 64ULL * 1024 * 1024;
+    static const size_t HEADER_BYTES = 8;
+
+private:
+    bool roll(std::string& err);
+    std::string pathOf(uint32_t id) const;
+
+    std::mutex mtx;
+    std::string dir;
+    std::string name;
+    std::map<uint32_t, handle> segments;
+    std::map<uint32_t, uint64_t> live; // record bytes still referenced, per segment
+    handle active;
+    uint32_t nextId = 1;
+    uint64_t compactions = 0;
+    uint64_t compactedBytes = 0;
+};
+
+#endif
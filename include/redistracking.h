@@ -0,0 +1,100 @@
+#ifndef REDIS_TRACKING_H
+#define REDIS_TRACKING_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <atomic>
+#include <condition_variable>
+#include <unordered_map>
+#include <unordered_set>
+#include <map>
+#include <cstdint>
+#include "redisoutput.h"
+
+// Server-assisted client side caching (CLIENT TRACKING). In the default mode
+// the table remembers which clients read each key; in BCAST mode clients
+// register key prefixes instead and hear about every matching write.
+// Invalidations are not sent from the write path: they are collected per
+// client and a flusher thread sends one message per client per interval, so
+// repeated writes to a hot key collapse into a single invalidation.
+class redistracking {
+public:
+    struct stats {
+        size_t clients = 0;
+        size_t trackedKeys = 0;
+        size_t prefixes = 0;
+        uint64_t invalidatedKeys = 0; // keys sent to clients
+        uint64_t messages = 0;        // invalidation messages pushed
+        uint64_t coalesced = 0;       // invalidations merged into a pending one
+        uint64_t evictions = 0;       // keys dropped to stay under maxKeys
+    };
+
+    static redistracking& getInstance();
+
+    // Re-enabling replaces the client's previous options.
+    void enable(uint64_t client, const std::shared_ptr<redisoutput>& target, bool bcast, bool noloop,
+        const std::vector<std::string>& prefixes);
+    void disable(uint64_t client);
+    bool active() const { return trackingClients.load(std::memory_order_relaxed) > 0; }
+
+    // Default mode: client has read key and wants to hear when it changes.
+    void remember(uint64_t client, const std::string& key);
+    void invalidate(const std::string& key);
+    void invalidateAll();
+
+    // Identifies the client issuing commands on this thread, for NOLOOP.
+    static void setCaller(uint64_t client);
+
+    // Outputs that REDIRECT may target, keyed by client id.
+    void registerOutput(uint64_t client, const std::shared_ptr<redisoutput>& output);
+    void unregisterOutput(uint64_t client);
+    std::shared_ptr<redisoutput> findOutput(uint64_t client);
+
+    void setMaxKeys(size_t n);
+    size_t maxKeys();
+    stats getStats();
+
+    ~redistracking();
+
+private:
+    redistracking() = default;
+    redistracking(const redistracking&) = delete;
+    redistracking& operator=(const redistracking&) = delete;
+
+    struct trackedclient {
+        std::weak_ptr<redisoutput> target;
+        bool bcast = false;
+        bool noloop = false;
+        std::vector<std::string> prefixes;
+        std::unordered_set<std::string> pending;
+        bool pendingAll = false;
+    };
+
+    void queue(uint64_t client, const std::string& key);
+    void evict();
+    void flushLoop();
+
+    std::mutex mtx;
+    std::condition_variable cv;
+    std::thread flusher;
+    bool stopping = false;
+
+    std::unordered_map<uint64_t, trackedclient> clients;
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> table;          // key -> readers
+    std::unordered_map<std::string, std::unordered_set<uint64_t>> prefixTable;    // prefix -> BCAST clients
+    std::map<size_t, size_t> prefixLengths; // distinct prefix lengths -> number of prefixes
+    std::vector<uint64_t> dirty;            // clients with pending invalidations
+    std::unordered_map<uint64_t, std::weak_ptr<redisoutput>> outputs;
+    size_t max = 1000000;
+    std::atomic<size_t> trackingClients{ 0 };
+
+    uint64_t invalidatedKeys = 0;
+    uint64_t messages = 0;
+    uint64_t coalesced = 0;
+    uint64_t evictions = 0;
+};
+
+#endif
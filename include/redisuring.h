@@ -0,0 +1,88 @@
+#ifndef REDIS_URING_H
+#define REDIS_URING_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <cstdint>
+#include <winsock2.h>
+#include "redisoutput.h"
+
+// Built on Linux whenever the kernel headers know io_uring; whether the
+// running kernel allows it is checked at startup by available().
+#if !defined(REDIS_HAVE_IO_URING) && defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define REDIS_HAVE_IO_URING 1
+#endif
+#endif
+
+class rediscommandhandler;
+
+// io_uring server loop. One thread owns the ring and runs commands inline:
+// a multishot accept feeds new connections, each connection keeps one
+// multishot recv drawing from a provided buffer ring (PROVIDE_BUFFERS where
+// the ring does not work), and replies are copied into registered buffers
+// and written with WRITE_FIXED. Everything queued during a pass goes out
+// with the io_uring_enter that waits for the next completions, so a busy
+// server makes about one syscall per batch.
+class redisuring {
+public:
+    struct stats {
+        uint64_t commands = 0;
+        uint64_t enters = 0;
+        uint64_t otherCalls = 0; // eventfd reads and writes
+        uint64_t fixedSends = 0;
+        uint64_t plainSends = 0;
+    };
+
+    // False when the kernel lacks multishot recv or io_uring is disabled.
+    static bool available();
+
+    explicit redisuring(rediscommandhandler& handler);
+    ~redisuring();
+
+    // Serves the listening socket; returns false if the ring cannot be set up.
+    bool run(SOCKET listener);
+    stats getStats() const;
+
+private:
+    struct ring;
+    struct connection;
+
+    void armAccept();
+    void armRecv(connection* c);
+    void armWakeup();
+    void onAccept(int res, uint32_t flags);
+    void onRecv(uint64_t id, int res, uint32_t flags);
+    void onSend(uint64_t id, int res);
+    void onWakeup(uint32_t flags);
+    void execute(connection* c);
+    void startSend(connection* c);
+    void closeConnection(connection* c);
+    void release(connection* c);
+    void markDirty(connection* c);
+
+    rediscommandhandler& cmdHandler;
+    std::unique_ptr<ring> r;
+    SOCKET listenSock = INVALID_SOCKET;
+    int wakeFd = -1;
+    uint64_t nextConnId = 0;
+    std::unordered_map<uint64_t, connection*> conns;
+    std::vector<connection*> dirty;
+    std::vector<uint64_t> starved; // recv ended with ENOBUFS
+
+    // Connections with pushed messages; filled by publisher threads.
+    std::mutex readyMutex;
+    std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> ready;
+
+    std::atomic<uint64_t> commands{ 0 };
+    std::atomic<uint64_t> enters{ 0 };
+    std::atomic<uint64_t> otherCalls{ 0 };
+    std::atomic<uint64_t> fixedSends{ 0 };
+    std::atomic<uint64_t> plainSends{ 0 };
+};
+
+#endif
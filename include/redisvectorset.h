@@ -0,0 +1,89 @@
+#ifndef REDIS_VECTOR_SET_H
+#define REDIS_VECTOR_SET_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <utility>
+
+// A named collection of float32 vectors of one dimension. Vectors live in one
+// contiguous array so exact KNN is a linear SIMD scan; an HNSW graph over the
+// same array answers approximate queries once the set grows large.
+class redisvectorset {
+public:
+    enum metric { COSINE, L2, IP };
+
+    struct config {
+        metric kind = COSINE;
+        size_t m = 16;                // links per node on upper levels (2*m on level 0)
+        size_t efConstruction = 200;
+    };
+
+    // Sets below this size are always searched exactly.
+    static const size_t EXACT_THRESHOLD = 1024;
+
+    redisvectorset() = default;
+    explicit redisvectorset(const config& cfg) : cfg(cfg) {}
+
+    // Returns false (with err) on a dimension mismatch. added is false when an
+    // existing element was updated in place.
+    bool add(const std::string& element, const std::vector<float>& vec, bool& added, std::string& err);
+    bool remove(const std::string& element);
+    bool get(const std::string& element, std::vector<float>& vec) const;
+    bool contains(const std::string& element) const { return index.count(element) > 0; }
+
+    // Results are (element, score) ordered best first. Score is cosine
+    // similarity, inner product or euclidean distance depending on the metric.
+    std::vector<std::pair<std::string, float>> search(const std::vector<float>& query, size_t k, size_t ef, bool exact) const;
+
+    size_t size() const { return index.size(); }
+    size_t dimension() const { return dim; }
+    const config& settings() const { return cfg; }
+    static const char* metricName(metric m);
+    static bool parseMetric(const std::string& name, metric& m);
+    size_t memoryUsage() const;
+
+    void serialize(std::string& out) const;
+    bool deserialize(const std::string& in);
+
+private:
+    typedef std::pair<float, uint32_t> candidate; // (distance, node)
+
+    float distance(const float* a, const float* b) const;
+    float scoreOf(float dist) const;
+    const float* vectorOf(uint32_t node) const { return &data[static_cast<size_t>(node) * dim]; }
+    uint32_t* linksOf(uint32_t node, int level);
+    const uint32_t* linksOf(uint32_t node, int level) const;
+    size_t maxLinks(int level) const { return level == 0 ? 2 * cfg.m : cfg.m; }
+
+    int randomLevel();
+    void insertNode(uint32_t node);
+    uint32_t greedyClosest(const float* q, uint32_t entry, int fromLevel, int toLevel) const;
+    std::vector<candidate> searchLayer(const float* q, uint32_t entry, size_t ef, int level) const;
+    std::vector<uint32_t> selectNeighbors(const float* base, std::vector<candidate> candidates, size_t m) const;
+    void connect(uint32_t node, uint32_t neighbor, int level);
+    void rebuild();
+
+    config cfg;
+    size_t dim = 0;
+    std::vector<float> data;                      // node * dim
+    std::vector<std::string> names;               // node -> element
+    std::vector<uint8_t> deleted;                 // tombstones, compacted by rebuild()
+    std::unordered_map<std::string, uint32_t> index;
+
+    // HNSW graph. Level 0 links are one flat array of (count, 2*m ids) per
+    // node; upper levels are per node since few nodes have them.
+    std::vector<int> levels;
+    std::vector<uint32_t> links0;
+    std::vector<std::vector<uint32_t>> upperLinks;
+    uint32_t entryPoint = 0;
+    int maxLevel = -1;
+    size_t tombstones = 0;
+    uint64_t rngState = 0x9e3779b97f4a7c15ULL;
+
+    mutable std::vector<uint32_t> visitedTag;
+    mutable uint32_t visitedEpoch = 0;
+};
+
+#endif
@@ -0,0 +1,69 @@
+#ifndef SEMANTIC_CACHE_H
+#define SEMANTIC_CACHE_H
+
+#include <string>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+#include <cstdint>
+#include "latencyhistogram.h"
+
+// Prompt-similarity index for one named cache. Completions themselves are
+// ordinary string keys ("scache:{<cache>}:<n>", hash-tagged so a cluster
+// keeps them in the cache name's slot) so they expire through expiry_map
+// like any other key; this class only maps prompt embeddings to
+// those keys. Embeddings are normalized and quantized to int8 with one scale
+// per entry, and lookups are a linear int8 SIMD scan over packed codes.
+class semanticcache {
+public:
+    typedef std::function<std::vector<float>(const std::string&)> embedder;
+
+    struct stats {
+        size_t entries = 0;
+        size_t dimension = 0;
+        uint64_t hits = 0;
+        uint64_t misses = 0;
+        uint64_t p50 = 0; // lookup latency, ns
+        uint64_t p95 = 0;
+        uint64_t p99 = 0;
+        size_t indexBytes = 0;
+    };
+
+    static const size_t DEFAULT_DIMENSION = 256;
+
+    // Deterministic feature-hashing embedding over lowercased words; used
+    // when the client does not send its own vector and as the test stub.
+    static std::vector<float> hashEmbedding(const std::string& text);
+    static void setEmbedder(embedder fn);
+    static std::vector<float> embed(const std::string& text);
+
+    std::string nextEntryKey(const std::string& cacheName);
+    bool insert(const std::string& entryKey, const std::vector<float>& embedding, std::string& err);
+    bool remove(const std::string& entryKey);
+    // Best entry whose cosine similarity is at least threshold.
+    bool lookup(const std::vector<float>& embedding, float threshold, std::string& entryKey, float& score);
+
+    size_t size() const { return keys.size(); }
+    size_t dimension() const { return dim; }
+    const std::vector<std::string>& entryKeys() const { return keys; }
+    size_t memoryUsage() const;
+    stats getStats() const;
+
+    void serialize(std::string& out) const;
+    bool deserialize(const std::string& in);
+
+private:
+    static void quantize(const std::vector<float>& v, std::vector<int8_t>& codes, float& scale);
+
+    size_t dim = 0;
+    std::vector<int8_t> codes;   // entry * dim
+    std::vector<float> scales;
+    std::vector<std::string> keys;
+    std::unordered_map<std::string, size_t> slots;
+    uint64_t nextId = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;
+    latencyhistogram lookupLatency;
+};
+
+#endif
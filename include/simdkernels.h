@@ -0,0 +1,44 @@
+#ifndef SIMD_KERNELS_H
+#define SIMD_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// CPU features detected once at startup; kernels are picked from these at
+// runtime so one binary runs everywhere and still uses AVX2/AVX-512 when the
+// host has them.
+struct cpufeatures {
+    bool sse42 = false;
+    bool avx2 = false;
+    bool fma = false;
+    bool avx512f = false;
+    bool avx512bw = false;
+    bool avx512vpopcntdq = false;
+    bool neon = false;
+
+    static const cpufeatures& get();
+};
+
+class simdkernels {
+public:
+    static float dot(const float* a, const float* b, size_t n);
+    static float l2sq(const float* a, const float* b, size_t n);
+    static int32_t dotInt8(const int8_t* a, const int8_t* b, size_t n);
+
+    // Name of the float kernel family in use ("avx512", "avx2", "neon", "scalar").
+    static const char* floatKernelName();
+
+    // Bitmaps
+    enum bitop { BIT_AND, BIT_OR, BIT_XOR };
+    static uint64_t popcount(const uint8_t* p, size_t n);
+    // dst[i] = dst[i] op src[i]
+    static void bitwise(bitop op, uint8_t* dst, const uint8_t* src, size_t n);
+    // dst[i] = ~src[i]; dst may be src
+    static void bitNot(uint8_t* dst, const uint8_t* src, size_t n);
+    // Index of the first byte that is not skip; n when there is none.
+    static size_t findNot(const uint8_t* p, size_t n, uint8_t skip);
+    // Same names as floatKernelName, for the popcount kernel.
+    static const char* bitKernelName();
+};
+
+#endif
@@ -0,0 +1,61 @@
+#ifndef REDIS_SPSC_QUEUE_H
+#define REDIS_SPSC_QUEUE_H
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+#include <utility>
+
+// Bounded single-producer single-consumer ring. push and pop never block or
+// lock; each side caches the other's index and only re-reads the shared
+// atomic when the ring looks full (or empty), so in steady state a transfer
+// touches no cache line the other thread is writing.
+template <typename T>
+class spscqueue {
+public:
+    explicit spscqueue(size_t capacity) {
+        size_t cap = 2;
+        while (cap < capacity)
+            cap <<= 1;
+        slots.resize(cap);
+        mask = cap - 1;
+    }
+
+    bool push(T&& value) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - headCache > mask) {
+            headCache = head.load(std::memory_order_acquire);
+            if (t - headCache > mask)
+                return false;
+        }
+        slots[t & mask] = std::move(value);
+        tail.store(t + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& value) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tailCache) {
+            tailCache = tail.load(std::memory_order_acquire);
+            if (h == tailCache)
+                return false;
+        }
+        value = std::move(slots[h & mask]);
+        head.store(h + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool empty() const {
+        return head.load(std::memory_order_acquire) == tail.load(std::memory_order_acquire);
+    }
+
+private:
+    std::vector<T> slots;
+    size_t mask = 0;
+    alignas(64) std::atomic<size_t> head{ 0 }; // consumer side
+    size_t tailCache = 0;
+    alignas(64) std::atomic<size_t> tail{ 0 }; // producer side
+    size_t headCache = 0;
+};
+
+#endif
@@ -6,6 +6,7 @@
 #include<chrono>
 #include<rediscommandhandler.h>
 #include<redisdatabase.h>
+#include<rediscluster.h>
 #pragma comment(lib, "ws2_32.lib")
 using namespace std;
 int main(int argc, char* argv[]) {
@@ -16,9 +17,57 @@ int main(int argc, char* argv[]) {
 		return 1;
 	}
 	int port = 6379;
-	if (argc >= 2) {
-		port = std::stoi(argv[1]);
+	std::string clusterFile;
+	int ioThreads = 0;
+	std::string ioBackend;
+	int shards = 0;
+	std::string tierDir;
+	uint64_t tierMaxMemory = 0;
+	uint64_t compressionMinSize = 0;
+	for (int i = 1; i < argc; ++i) {
+		std::string arg = argv[i];
+		if (arg == "--cluster" && i + 1 < argc)
+			clusterFile = argv[++i];
+		else if (arg == "--io-threads" && i + 1 < argc)
+			ioThreads = std::stoi(argv[++i]);
+		else if (arg == "--io-backend" && i + 1 < argc)
+			ioBackend = argv[++i];
+		else if (arg == "--shards" && i + 1 < argc)
+			shards = std::stoi(argv[++i]);
+		else if (arg == "--tier-dir" && i + 1 < argc)
+			tierDir = argv[++i];
+		else if (arg == "--tier-max-memory" && i + 1 < argc)
+			tierMaxMemory = std::stoull(argv[++i]);
+		else if (arg == "--compression-min-size" && i + 1 < argc)
+			compressionMinSize = std::stoull(argv[++i]);
+		else
+			port = std::stoi(arg);
 	}
+	if (shards > 0 && !clusterFile.empty()) {
+		std::cerr << "--shards and --cluster cannot be combined\n";
+		return 1;
+	}
+	if (!clusterFile.empty()) {
+		std::string err;
+		if (!rediscluster::getInstance().configure(clusterFile, port, err)) {
+			std::cerr << "Cluster configuration failed: " << err << "\n";
+			return 1;
+		}
+		std::cout << "Cluster mode, node " << rediscluster::getInstance().nodeAt(0).id << "\n";
+	}
+
+	// Before the load, so a snapshot larger than memory spills as it loads
+	if (!tierDir.empty()) {
+		std::string err;
+		if (!redisdatabase::enableTier(tierDir, tierMaxMemory, err)) {
+			std::cerr << "Tiered storage failed: " << err << "\n";
+			return 1;
+		}
+		std::cout << "Tiered storage in " << tierDir << ", " << tierMaxMemory << " bytes of string values in memory\n";
+	}
+
+	// Also before the load: values in an older snapshot are compressed as they load
+	redisdatabase::setCompressionMinSize(compressionMinSize);
 
 	if (redisdatabase::getInstance().load("dump.my_rdb"))
 		std::cout << "Database Loaded From dump.my_rdb\n";
@@ -26,13 +75,16 @@ int main(int argc, char* argv[]) {
 		std::cout << "No dump found or load failed; starting with an empty database.\n";
 
 	redisserver server(port);
+	server.setIoThreads(ioThreads);
+	server.setIoBackend(ioBackend);
+	server.setShards(shards);
 
 	//backgrounud dump for 300 ever seconds
 	std::thread persistanceThread([]() {
 		while (true) {
 			std::this_thread::sleep_for(std::chrono::seconds(300));
 			//dump the database
-			if (!redisdatabase::getInstance().dump("dump.my_rdb"))
+			if (!redisdatabase::dumpAll("dump.my_rdb"))
 				std::cerr << "Error Dumping Database\n";
 			else
 				std::cout << "Database Dumped to dump.my_rdb\n";
@@ -0,0 +1,511 @@
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cstring>
+#include <cstdint>
+#include <algorithm>
+#include "../include/hyperloglog.h"
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HLL_SSE2 1
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#define HLL_NEON 1
+#endif
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+namespace {
+
+const char HLL_MAGIC[4] = { 'H', 'Y', 'L', 'L' };
+const uint8_t HLL_DENSE = 0;
+const uint8_t HLL_SPARSE = 1;
+const int HLL_Q = 64 - hyperloglog::P;
+const uint64_t HLL_P_MASK = hyperloglog::REGISTERS - 1;
+const uint8_t HLL_REGISTER_MAX = (1 << hyperloglog::BITS) - 1;
+const double HLL_ALPHA_INF = 0.721347520444481703680;
+
+// Sparse opcodes (same scheme as Redis):
+//   ZERO  00xxxxxx           run of 1..64 zero registers
+//   XZERO 01xxxxxx yyyyyyyy  run of 1..16384 zero registers
+//   VAL   1vvvvvxx           run of 1..4 registers set to 1..32
+const int SPARSE_VAL_MAX_VALUE = 32;
+const int SPARSE_VAL_MAX_LEN = 4;
+const int SPARSE_ZERO_MAX_LEN = 64;
+const int SPARSE_XZERO_MAX_LEN = 16384;
+
+inline bool isZeroOp(uint8_t b) { return (b & 0xc0) == 0x00; }
+inline bool isXZeroOp(uint8_t b) { return (b & 0xc0) == 0x40; }
+inline int zeroLen(uint8_t b) { return (b & 0x3f) + 1; }
+inline int xzeroLen(uint8_t b0, uint8_t b1) { return (((b0 & 0x3f) << 8) | b1) + 1; }
+inline int valValue(uint8_t b) { return ((b >> 2) & 0x1f) + 1; }
+inline int valLen(uint8_t b) { return (b & 0x3) + 1; }
+
+inline int countTrailingZeros(uint64_t v) {
+#if defined(_MSC_VER)
+    unsigned long idx;
+    _BitScanForward64(&idx, v);
+    return static_cast<int>(idx);
+#else
+    return __builtin_ctzll(v);
+#endif
+}
+
+uint8_t* registersOf(std::string& hll) {
+    return reinterpret_cast<uint8_t*>(&hll[hyperloglog::HEADER_SIZE]);
+}
+
+const uint8_t* registersOf(const std::string& hll) {
+    return reinterpret_cast<const uint8_t*>(hll.data() + hyperloglog::HEADER_SIZE);
+}
+
+uint8_t denseGet(const uint8_t* regs, int idx) {
+    size_t bit = static_cast<size_t>(idx) * hyperloglog::BITS;
+    size_t byte = bit >> 3;
+    unsigned fb = bit & 7;
+    unsigned v = regs[byte] >> fb;
+    if (fb > 8 - hyperloglog::BITS)
+        v |= static_cast<unsigned>(regs[byte + 1]) << (8 - fb);
+    return static_cast<uint8_t>(v & HLL_REGISTER_MAX);
+}
+
+void denseSet(uint8_t* regs, int idx, uint8_t val) {
+    size_t bit = static_cast<size_t>(idx) * hyperloglog::BITS;
+    size_t byte = bit >> 3;
+    unsigned fb = bit & 7;
+    regs[byte] &= static_cast<uint8_t>(~(HLL_REGISTER_MAX << fb));
+    regs[byte] |= static_cast<uint8_t>(val << fb);
+    if (fb > 8 - hyperloglog::BITS) {
+        unsigned fb8 = 8 - fb;
+        regs[byte + 1] &= static_cast<uint8_t>(~(HLL_REGISTER_MAX >> fb8));
+        regs[byte + 1] |= static_cast<uint8_t>(val >> fb8);
+    }
+}
+
+// Unpacks four 6 bit registers out of every three bytes.
+void denseUnpack(const uint8_t* regs, uint8_t* raw) {
+    for (int i = 0; i < hyperloglog::REGISTERS; i += 4, regs += 3) {
+        uint32_t w = regs[0] | (regs[1] << 8) | (regs[2] << 16);
+        raw[i] = w & 63;
+        raw[i + 1] = (w >> 6) & 63;
+        raw[i + 2] = (w >> 12) & 63;
+        raw[i + 3] = (w >> 18) & 63;
+    }
+}
+
+void densePack(const uint8_t* raw, uint8_t* regs) {
+    for (int i = 0; i < hyperloglog::REGISTERS; i += 4, regs += 3) {
+        uint32_t w = raw[i] | (raw[i + 1] << 6) | (raw[i + 2] << 12) | (raw[i + 3] << 18);
+        regs[0] = w & 0xff;
+        regs[1] = (w >> 8) & 0xff;
+        regs[2] = (w >> 16) & 0xff;
+    }
+}
+
+void invalidateCache(std::string& hll) {
+    hll[15] = static_cast<char>(static_cast<uint8_t>(hll[15]) | 0x80);
+}
+
+bool cacheValid(const std::string& hll) {
+    return (static_cast<uint8_t>(hll[15]) & 0x80) == 0;
+}
+
+uint64_t cachedCount(const std::string& hll) {
+    uint64_t c = 0;
+    for (int i = 0; i < 8; ++i)
+        c |= static_cast<uint64_t>(static_cast<uint8_t>(hll[8 + i])) << (8 * i);
+    return c;
+}
+
+void storeCount(std::string& hll, uint64_t c) {
+    for (int i = 0; i < 8; ++i)
+        hll[8 + i] = static_cast<char>((c >> (8 * i)) & 0xff);
+    hll[15] = static_cast<char>(static_cast<uint8_t>(hll[15]) & 0x7f);
+}
+
+void appendZeroRun(std::string& out, int len) {
+    while (len > 0) {
+        if (len <= SPARSE_ZERO_MAX_LEN) {
+            out.push_back(static_cast<char>(len - 1));
+            return;
+        }
+        int run = std::min(len, SPARSE_XZERO_MAX_LEN);
+        out.push_back(static_cast<char>(0x40 | ((run - 1) >> 8)));
+        out.push_back(static_cast<char>((run - 1) & 0xff));
+        len -= run;
+    }
+}
+
+void appendValRun(std::string& out, int value, int len) {
+    while (len > 0) {
+        int run = std::min(len, SPARSE_VAL_MAX_LEN);
+        out.push_back(static_cast<char>(0x80 | ((value - 1) << 2) | (run - 1)));
+        len -= run;
+    }
+}
+
+void appendRun(std::string& out, int value, int len) {
+    if (value == 0)
+        appendZeroRun(out, len);
+    else
+        appendValRun(out, value, len);
+}
+
+template <typename Fn>
+bool walkSparse(const uint8_t* p, const uint8_t* end, Fn&& fn) {
+    int idx = 0;
+    while (p < end) {
+        int value = 0, len;
+        if (isZeroOp(*p)) {
+            len = zeroLen(*p);
+            p += 1;
+        }
+        else if (isXZeroOp(*p)) {
+            if (p + 1 >= end) return false;
+            len = xzeroLen(p[0], p[1]);
+            p += 2;
+        }
+        else {
+            value = valValue(*p);
+            len = valLen(*p);
+            p += 1;
+        }
+        if (idx + len > hyperloglog::REGISTERS) return false;
+        fn(idx, value, len);
+        idx += len;
+    }
+    return idx == hyperloglog::REGISTERS;
+}
+
+void sparseToRaw(const std::string& hll, uint8_t* raw) {
+    const uint8_t* p = registersOf(hll);
+    walkSparse(p, p + (hll.size() - hyperloglog::HEADER_SIZE), [raw](int idx, int value, int len) {
+        if (value == 0) return;
+        for (int i = 0; i < len; ++i)
+            raw[idx + i] = std::max<uint8_t>(raw[idx + i], static_cast<uint8_t>(value));
+    });
+}
+
+void promoteToDense(std::string& hll) {
+    std::vector<uint8_t> raw(hyperloglog::REGISTERS, 0);
+    sparseToRaw(hll, raw.data());
+    std::string dense(hll, 0, hyperloglog::HEADER_SIZE);
+    dense.resize(hyperloglog::DENSE_SIZE, '\0');
+    dense[4] = static_cast<char>(HLL_DENSE);
+    densePack(raw.data(), registersOf(dense));
+    hll.swap(dense);
+}
+
+int opcodeLength(uint8_t op) {
+    return isXZeroOp(op) ? 2 : 1;
+}
+
+// Re-encodes the opcodes in hll[from, to) so adjacent runs with the same
+// value share opcodes again after a split. Only the split run and its
+// neighbours can have changed, so that window is all a set re-encodes.
+void sparseNormalize(std::string& hll, size_t from, size_t to) {
+    std::string out;
+    int curValue = -1, curLen = 0;
+    const uint8_t* p = reinterpret_cast<const uint8_t*>(hll.data());
+    for (size_t at = from; at < to; ) {
+        int value = 0, len;
+        if (isZeroOp(p[at])) {
+            len = zeroLen(p[at]);
+        }
+        else if (isXZeroOp(p[at])) {
+            len = xzeroLen(p[at], p[at + 1]);
+        }
+        else {
+            value = valValue(p[at]);
+            len = valLen(p[at]);
+        }
+        at += opcodeLength(p[at]);
+        if (value == curValue) {
+            curLen += len;
+            continue;
+        }
+        if (curLen > 0)
+            appendRun(out, curValue, curLen);
+        curValue = value;
+        curLen = len;
+    }
+    if (curLen > 0)
+        appendRun(out, curValue, curLen);
+    hll.replace(from, to - from, out);
+}
+
+// Returns 1 if the register changed, 0 if not, -1 if the caller must retry on
+// the promoted dense representation.
+int sparseSet(std::string& hll, int index, uint8_t count) {
+    if (count > SPARSE_VAL_MAX_VALUE) {
+        promoteToDense(hll);
+        return -1;
+    }
+
+    const uint8_t* base = registersOf(hll);
+    const uint8_t* p = base;
+    const uint8_t* end = base + (hll.size() - hyperloglog::HEADER_SIZE);
+    const uint8_t* prev = p;
+    int idx = 0;
+    while (p < end) {
+        int value = 0, len, oplen = 1;
+        if (isZeroOp(*p)) {
+            len = zeroLen(*p);
+        }
+        else if (isXZeroOp(*p)) {
+            len = xzeroLen(p[0], p[1]);
+            oplen = 2;
+        }
+        else {
+            value = valValue(*p);
+            len = valLen(*p);
+        }
+
+        if (index < idx + len) {
+            if (value >= count)
+                return 0;
+            std::string seq;
+            appendRun(seq, value, index - idx);
+            appendValRun(seq, count, 1);
+            appendRun(seq, value, idx + len - index - 1);
+
+            size_t offset = hyperloglog::HEADER_SIZE + (p - base);
+            size_t from = hyperloglog::HEADER_SIZE + (prev - base);
+            size_t to = offset + seq.size();
+            if (p + oplen < end)
+                to += opcodeLength(p[oplen]);
+            hll.replace(offset, oplen, seq);
+            sparseNormalize(hll, from, to);
+            if (hll.size() - hyperloglog::HEADER_SIZE > hyperloglog::SPARSE_MAX_BYTES)
+                promoteToDense(hll);
+            return 1;
+        }
+        idx += len;
+        prev = p;
+        p += oplen;
+    }
+    return 0;
+}
+
+void denseHisto(const uint8_t* regs, int* histo) {
+    for (int i = 0; i < hyperloglog::REGISTERS; i += 16, regs += 12) {
+        uint64_t lo, hi32;
+        uint32_t hi;
+        std::memcpy(&lo, regs, 8);
+        std::memcpy(&hi, regs + 8, 4);
+        hi32 = hi;
+        histo[lo & 63]++;
+        histo[(lo >> 6) & 63]++;
+        histo[(lo >> 12) & 63]++;
+        histo[(lo >> 18) & 63]++;
+        histo[(lo >> 24) & 63]++;
+        histo[(lo >> 30) & 63]++;
+        histo[(lo >> 36) & 63]++;
+        histo[(lo >> 42) & 63]++;
+        histo[(lo >> 48) & 63]++;
+        histo[(lo >> 54) & 63]++;
+        histo[((lo >> 60) | (hi32 << 4)) & 63]++;
+        histo[(hi32 >> 2) & 63]++;
+        histo[(hi32 >> 8) & 63]++;
+        histo[(hi32 >> 14) & 63]++;
+        histo[(hi32 >> 20) & 63]++;
+        histo[(hi32 >> 26) & 63]++;
+    }
+}
+
+double hllSigma(double x) {
+    if (x == 1.)
+        return INFINITY;
+    double zPrime;
+    double y = 1;
+    double z = x;
+    do {
+        x *= x;
+        zPrime = z;
+        z += x * y;
+        y += y;
+    } while (zPrime != z);
+    return z;
+}
+
+double hllTau(double x) {
+    if (x == 0. || x == 1.)
+        return 0.;
+    double zPrime;
+    double y = 1.0;
+    double z = 1 - x;
+    do {
+        x = std::sqrt(x);
+        zPrime = z;
+        y *= 0.5;
+        z -= std::pow(1 - x, 2) * y;
+    } while (zPrime != z);
+    return z / 3;
+}
+
+// Ertl's improved estimator works on the register histogram instead of
+// summing 2^-register per register, so the inner loop is a table walk.
+uint64_t estimate(const int* histo) {
+    double m = hyperloglog::REGISTERS;
+    double z = m * hllTau((m - histo[HLL_Q + 1]) / m);
+    for (int j = HLL_Q; j >= 1; --j) {
+        z += histo[j];
+        z *= 0.5;
+    }
+    z += m * hllSigma(histo[0] / m);
+    return static_cast<uint64_t>(std::llround(HLL_ALPHA_INF * m * m / z));
+}
+
+} // namespace
+
+uint64_t hyperloglog::murmurhash64a(const void* key, size_t len, uint64_t seed) {
+    const uint64_t m = 0xc6a4a7935bd1e995ULL;
+    const int r = 47;
+    uint64_t h = seed ^ (len * m);
+    const uint8_t* data = static_cast<const uint8_t*>(key);
+    const uint8_t* end = data + (len - (len & 7));
+
+    while (data != end) {
+        uint64_t k;
+        std::memcpy(&k, data, 8);
+        k *= m;
+        k ^= k >> r;
+        k *= m;
+        h ^= k;
+        h *= m;
+        data += 8;
+    }
+
+    switch (len & 7) {
+    case 7: h ^= static_cast<uint64_t>(data[6]) << 48; // fallthrough
+    case 6: h ^= static_cast<uint64_t>(data[5]) << 40; // fallthrough
+    case 5: h ^= static_cast<uint64_t>(data[4]) << 32; // fallthrough
+    case 4: h ^= static_cast<uint64_t>(data[3]) << 24; // fallthrough
+    case 3: h ^= static_cast<uint64_t>(data[2]) << 16; // fallthrough
+    case 2: h ^= static_cast<uint64_t>(data[1]) << 8;  // fallthrough
+    case 1: h ^= static_cast<uint64_t>(data[0]);
+        h *= m;
+    }
+
+    h ^= h >> r;
+    h *= m;
+    h ^= h >> r;
+    return h;
+}
+
+std::string hyperloglog::create() {
+    std::string hll(HEADER_SIZE, '\0');
+    std::memcpy(&hll[0], HLL_MAGIC, 4);
+    hll[4] = static_cast<char>(HLL_SPARSE);
+    appendZeroRun(hll, REGISTERS);
+    return hll;
+}
+
+bool hyperloglog::isValid(const std::string& hll) {
+    if (hll.size() < HEADER_SIZE || std::memcmp(hll.data(), HLL_MAGIC, 4) != 0)
+        return false;
+    uint8_t encoding = static_cast<uint8_t>(hll[4]);
+    if (encoding == HLL_DENSE)
+        return hll.size() == DENSE_SIZE;
+    if (encoding != HLL_SPARSE)
+        return false;
+    const uint8_t* p = registersOf(hll);
+    return walkSparse(p, p + (hll.size() - HEADER_SIZE), [](int, int, int) {});
+}
+
+bool hyperloglog::add(std::string& hll, const std::string& element) {
+    uint64_t hash = murmurhash64a(element.data(), element.size(), 0xadc83b19ULL);
+    int index = static_cast<int>(hash & HLL_P_MASK);
+    hash >>= P;
+    hash |= 1ULL << HLL_Q;
+    uint8_t count = static_cast<uint8_t>(countTrailingZeros(hash) + 1);
+
+    if (static_cast<uint8_t>(hll[4]) == HLL_SPARSE) {
+        int res = sparseSet(hll, index, count);
+        if (res >= 0) {
+            if (res)
+                invalidateCache(hll);
+            return res == 1;
+        }
+    }
+
+    uint8_t* regs = registersOf(hll);
+    if (denseGet(regs, index) >= count)
+        return false;
+    denseSet(regs, index, count);
+    invalidateCache(hll);
+    return true;
+}
+
+uint64_t hyperloglog::count(std::string& hll) {
+    if (cacheValid(hll))
+        return cachedCount(hll);
+
+    int histo[64] = { 0 };
+    if (static_cast<uint8_t>(hll[4]) == HLL_DENSE) {
+        denseHisto(registersOf(hll), histo);
+    }
+    else {
+        const uint8_t* p = registersOf(hll);
+        walkSparse(p, p + (hll.size() - HEADER_SIZE), [&histo](int, int value, int len) {
+            histo[value] += len;
+        });
+    }
+    uint64_t c = estimate(histo);
+    storeCount(hll, c);
+    return c;
+}
+
+void hyperloglog::maxRegisters(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+#if defined(__AVX2__)
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_max_epu8(a, b));
+    }
+#elif defined(HLL_SSE2)
+    for (; i + 16 <= n; i += 16) {
+        __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(dst + i));
+        __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + i), _mm_max_epu8(a, b));
+    }
+#elif defined(HLL_NEON)
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+#endif
+    for (; i < n; ++i)
+        dst[i] = std::max(dst[i], src[i]);
+}
+
+void hyperloglog::mergeInto(uint8_t* raw, const std::string& hll) {
+    if (static_cast<uint8_t>(hll[4]) == HLL_DENSE) {
+        std::vector<uint8_t> unpacked(REGISTERS);
+        denseUnpack(registersOf(hll), unpacked.data());
+        maxRegisters(raw, unpacked.data(), REGISTERS);
+    }
+    else {
+        sparseToRaw(hll, raw);
+    }
+}
+
+uint64_t hyperloglog::countRaw(const uint8_t* raw) {
+    int histo[64] = { 0 };
+    for (int i = 0; i < REGISTERS; ++i)
+        histo[raw[i] & 63]++;
+    return estimate(histo);
+}
+
+std::string hyperloglog::fromRaw(const uint8_t* raw) {
+    std::string hll(DENSE_SIZE, '\0');
+    std::memcpy(&hll[0], HLL_MAGIC, 4);
+    hll[4] = static_cast<char>(HLL_DENSE);
+    densePack(raw, registersOf(hll));
+    invalidateCache(hll);
+    return hll;
+}
@@ -0,0 +1,184 @@
+#include <string>
+#include <vector>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include "../include/redisbitmap.h"
+#include "../include/simdkernels.h"
+
+// Resolves a Redis start/end pair against length, as BITCOUNT does; false
+// when nothing is left.
+static bool resolveRange(int64_t& start, int64_t& end, int64_t length) {
+    if (start < 0)
+        start += length;
+    if (end < 0)
+        end += length;
+    if (start < 0)
+        start = 0;
+    if (end < 0)
+        end = 0;
+    if (end >= length)
+        end = length - 1;
+    return length > 0 && start <= end;
+}
+
+int redisbitmap::getBit(const uint8_t* p, size_t n, uint64_t offset) {
+    uint64_t byte = offset >> 3;
+    if (byte >= n)
+        return 0;
+    return (p[byte] >> (7 - (offset & 7))) & 1;
+}
+
+int redisbitmap::setBit(uint8_t* p, uint64_t offset, int value) {
+    uint8_t& byte = p[offset >> 3];
+    uint8_t mask = static_cast<uint8_t>(0x80 >> (offset & 7));
+    int old = (byte & mask) ? 1 : 0;
+    if (value)
+        byte |= mask;
+    else
+        byte &= static_cast<uint8_t>(~mask);
+    return old;
+}
+
+uint64_t redisbitmap::count(const uint8_t* p, size_t n, int64_t start, int64_t end, bool bitUnits) {
+    int64_t length = static_cast<int64_t>(bitUnits ? n * 8 : n);
+    if (!resolveRange(start, end, length))
+        return 0;
+    if (!bitUnits)
+        return simdkernels::popcount(p + start, static_cast<size_t>(end - start + 1));
+
+    // Whole bytes, less the bits of the end bytes that fall outside the range
+    size_t first = static_cast<size_t>(start >> 3), last = static_cast<size_t>(end >> 3);
+    uint64_t c = simdkernels::popcount(p + first, last - first + 1);
+    unsigned before = p[first] & ~(0xffu >> (start & 7)) & 0xffu;
+    unsigned after = p[last] & ((1u << (7 - (end & 7))) - 1);
+    return c - std::popcount(before) - std::popcount(after);
+}
+
+int64_t redisbitmap::position(const uint8_t* p, size_t n, int bit, int64_t start, int64_t end, bool endGiven,
+    bool bitUnits) {
+    int64_t length = static_cast<int64_t>(bitUnits ? n * 8 : n);
+    if (!resolveRange(start, end, length))
+        return -1;
+    uint64_t firstBit = static_cast<uint64_t>(bitUnits ? start : start * 8);
+    uint64_t lastBit = static_cast<uint64_t>(bitUnits ? end : end * 8 + 7);
+
+    // Bit by bit up to a byte boundary, whole bytes through the kernel, then
+    // the bits of a partial last byte
+    uint64_t i = firstBit;
+    for (; i <= lastBit && (i & 7); ++i) {
+        if (getBit(p, n, i) == bit)
+            return static_cast<int64_t>(i);
+    }
+    size_t byte = static_cast<size_t>(i >> 3), stop = static_cast<size_t>((lastBit + 1) >> 3);
+    if (i <= lastBit && byte < stop) {
+        byte += simdkernels::findNot(p + byte, stop - byte, bit ? 0x00 : 0xff);
+        if (byte < stop) {
+            int j = 0;
+            while (((p[byte] >> (7 - j)) & 1) != bit)
+                j++;
+            return static_cast<int64_t>(byte * 8 + j);
+        }
+        i = static_cast<uint64_t>(stop) * 8;
+    }
+    for (; i <= lastBit; ++i) {
+        if (getBit(p, n, i) == bit)
+            return static_cast<int64_t>(i);
+    }
+    // With no end the string counts as padded with zeros on the right
+    if (bit == 0 && !endGiven)
+        return static_cast<int64_t>(lastBit + 1);
+    return -1;
+}
+
+std::string redisbitmap::combine(op o, const std::vector<span>& sources, size_t headroom) {
+    size_t length = 0;
+    for (const auto& s : sources)
+        length = std::max(length, s.size);
+    std::string out(headroom + length, '\0');
+    if (sources.empty() || length == 0)
+        return out;
+    uint8_t* dst = reinterpret_cast<uint8_t*>(&out[headroom]);
+    if (o == NOT) {
+        simdkernels::bitNot(dst, sources[0].data, sources[0].size);
+        return out;
+    }
+    std::memcpy(dst, sources[0].data, sources[0].size);
+    simdkernels::bitop k = o == AND ? simdkernels::BIT_AND : o == OR ? simdkernels::BIT_OR : simdkernels::BIT_XOR;
+    for (size_t i = 1; i < sources.size(); ++i) {
+        const span& s = sources[i];
+        simdkernels::bitwise(k, dst, s.data, s.size);
+        if (o == AND && s.size < length)
+            std::memset(dst + s.size, 0, length - s.size);
+    }
+    return out;
+}
+
+// BITFIELD
+static uint64_t getField(const uint8_t* p, size_t n, uint64_t offset, int bits) {
+    uint64_t v = 0;
+    for (int i = 0; i < bits; ++i)
+        v = (v << 1) | static_cast<uint64_t>(redisbitmap::getBit(p, n, offset + i));
+    return v;
+}
+
+static void setField(uint8_t* p, uint64_t offset, int bits, uint64_t v) {
+    for (int i = 0; i < bits; ++i)
+        redisbitmap::setBit(p, offset + i, static_cast<int>((v >> (bits - 1 - i)) & 1));
+}
+
+static int64_t signExtend(uint64_t v, int bits) {
+    if (bits < 64 && ((v >> (bits - 1)) & 1))
+        v |= ~0ull << bits;
+    return static_cast<int64_t>(v);
+}
+
+int64_t redisbitmap::get(const uint8_t* p, size_t n, const fieldop& f) {
+    uint64_t raw = getField(p, n, f.offset, f.bits);
+    return f.isSigned ? signExtend(raw, f.bits) : static_cast<int64_t>(raw);
+}
+
+bool redisbitmap::apply(uint8_t* p, size_t n, const fieldop& f, int64_t& result) {
+    uint64_t mask = f.bits == 64 ? ~0ull : (1ull << f.bits) - 1;
+    uint64_t raw = getField(p, n, f.offset, f.bits);
+    int64_t old = f.isSigned ? signExtend(raw, f.bits) : static_cast<int64_t>(raw);
+    if (f.kind == fieldop::GET) {
+        result = old;
+        return true;
+    }
+
+    // Overflow is checked in unsigned arithmetic, which cannot itself overflow
+    int64_t min = f.bits == 64 ? INT64_MIN : -(1ll << (f.bits - 1));
+    int64_t max = f.bits == 64 ? INT64_MAX : (1ll << (f.bits - 1)) - 1;
+    uint64_t wrapped;
+    int direction = 0; // 1 past the top of the type, -1 below the bottom
+    if (f.kind == fieldop::SET) {
+        wrapped = static_cast<uint64_t>(f.value);
+        if (f.isSigned)
+            direction = f.value > max ? 1 : f.value < min ? -1 : 0;
+        else
+            direction = static_cast<uint64_t>(f.value) > mask ? 1 : 0;
+    }
+    else {
+        wrapped = raw + static_cast<uint64_t>(f.value);
+        uint64_t up = f.isSigned ? static_cast<uint64_t>(max) - static_cast<uint64_t>(old) : mask - raw;
+        uint64_t down = f.isSigned ? static_cast<uint64_t>(old) - static_cast<uint64_t>(min) : raw;
+        if (f.value > 0 && static_cast<uint64_t>(f.value) > up)
+            direction = 1;
+        else if (f.value < 0 && 0 - static_cast<uint64_t>(f.value) > down)
+            direction = -1;
+    }
+
+    uint64_t next;
+    if (direction == 0 || f.onOverflow == WRAP)
+        next = wrapped & mask;
+    else if (f.onOverflow == FAIL)
+        return false;
+    else if (f.isSigned)
+        next = static_cast<uint64_t>(direction > 0 ? max : min) & mask;
+    else
+        next = direction > 0 ? mask : 0;
+    setField(p, f.offset, f.bits, next);
+    result = f.kind == fieldop::SET ? old : f.isSigned ? signExtend(next, f.bits) : static_cast<int64_t>(next);
+    return true;
+}
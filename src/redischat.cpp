@@ -0,0 +1,165 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <algorithm>
+#include "../include/redischat.h"
+#include "../include/redisserialize.h"
+
+static redischat::tokencounter& currentCounter() {
+    static redischat::tokencounter fn = redischat::approxTokens;
+    return fn;
+}
+
+size_t redischat::approxTokens(const std::string& text) {
+    return (text.size() + 3) / 4;
+}
+
+void redischat::setTokenCounter(tokencounter fn) {
+    currentCounter() = fn ? fn : tokencounter(approxTokens);
+}
+
+size_t redischat::countTokens(const std::string& text) {
+    return currentCounter()(text);
+}
+
+size_t redischat::encodedSize(const segment& s, size_t i) {
+    size_t end = (i + 1 < s.offsets.size()) ? s.offsets[i + 1] : s.data.size();
+    return end - s.offsets[i];
+}
+
+void redischat::decode(const segment& s, size_t i, message& out) {
+    size_t pos = s.offsets[i];
+    getString(s.data, pos, out.role);
+    getString(s.data, pos, out.content);
+    out.tokens = s.tokens[i];
+}
+
+void redischat::push(const std::string& role, const std::string& content, size_t tokenCount) {
+    if (segments.empty() || segments.back().offsets.size() >= SEGMENT_MAX_MESSAGES ||
+        segments.back().data.size() >= SEGMENT_MAX_BYTES) {
+        segments.emplace_back();
+    }
+    segment& s = segments.back();
+    size_t before = s.data.size();
+    s.offsets.push_back(static_cast<uint32_t>(before));
+    s.tokens.push_back(static_cast<uint32_t>(tokenCount));
+    putString(s.data, role);
+    putString(s.data, content);
+    count++;
+    totalBytes += s.data.size() - before;
+    totalTokens += tokenCount;
+}
+
+void redischat::append(const std::string& role, const std::string& content) {
+    push(role, content, countTokens(content));
+    enforceLimits();
+}
+
+void redischat::evictOldest() {
+    segment& s = segments.front();
+    totalBytes -= encodedSize(s, s.head);
+    totalTokens -= s.tokens[s.head];
+    count--;
+    if (++s.head == s.offsets.size())
+        segments.pop_front();
+}
+
+void redischat::enforceLimits() {
+    // The newest message is always kept, even if it alone exceeds maxBytes
+    while (count > 1 && ((caps.maxMessages && count > caps.maxMessages) ||
+        (caps.maxBytes && totalBytes > caps.maxBytes))) {
+        evictOldest();
+    }
+}
+
+void redischat::setLimits(const limits& l) {
+    caps = l;
+    enforceLimits();
+}
+
+std::vector<redischat::message> redischat::tail(size_t lastN, size_t maxTokens) const {
+    // Walk back from the newest message only as far as the bounds allow, then
+    // decode that suffix in order.
+    size_t n = 0, used = 0;
+    size_t firstSeg = segments.size(), firstIdx = 0;
+    bool stop = false;
+    for (size_t si = segments.size(); si > 0 && !stop; --si) {
+        const segment& s = segments[si - 1];
+        for (size_t i = s.offsets.size(); i > s.head; --i) {
+            if ((lastN && n == lastN) || (maxTokens && used + s.tokens[i - 1] > maxTokens)) {
+                stop = true;
+                break;
+            }
+            used += s.tokens[i - 1];
+            n++;
+            firstSeg = si - 1;
+            firstIdx = i - 1;
+        }
+    }
+
+    std::vector<message> out;
+    out.reserve(n);
+    for (size_t si = firstSeg; si < segments.size(); ++si) {
+        const segment& s = segments[si];
+        for (size_t i = (si == firstSeg) ? firstIdx : s.head; i < s.offsets.size(); ++i) {
+            out.emplace_back();
+            decode(s, i, out.back());
+        }
+    }
+    return out;
+}
+
+redischat::summary redischat::getSummary() const {
+    summary s;
+    s.messages = count;
+    s.bytes = totalBytes;
+    s.tokens = totalTokens;
+    s.segments = segments.size();
+    s.caps = caps;
+    return s;
+}
+
+size_t redischat::memoryUsage() const {
+    size_t bytes = sizeof(*this);
+    for (const auto& s : segments) {
+        bytes += sizeof(s) + s.data.capacity();
+        bytes += (s.offsets.capacity() + s.tokens.capacity()) * sizeof(uint32_t);
+    }
+    return bytes;
+}
+
+void redischat::serialize(std::string& out) const {
+    putVarint(out, caps.maxMessages);
+    putVarint(out, caps.maxBytes);
+    putVarint(out, static_cast<uint64_t>(std::max<int>(caps.ttlSeconds, 0)));
+    putVarint(out, count);
+    for (const auto& s : segments) {
+        for (size_t i = s.head; i < s.offsets.size(); ++i) {
+            message m;
+            decode(s, i, m);
+            putVarint(out, m.tokens);
+            putString(out, m.role);
+            putString(out, m.content);
+        }
+    }
+}
+
+bool redischat::deserialize(const std::string& in) {
+    *this = redischat();
+    size_t pos = 0;
+    uint64_t maxMessages, maxBytes, ttl, n;
+    if (!getVarint(in, pos, maxMessages) || !getVarint(in, pos, maxBytes) ||
+        !getVarint(in, pos, ttl) || !getVarint(in, pos, n))
+        return false;
+    caps.maxMessages = maxMessages;
+    caps.maxBytes = maxBytes;
+    caps.ttlSeconds = static_cast<int>(ttl);
+    for (uint64_t i = 0; i < n; ++i) {
+        uint64_t tokenCount;
+        std::string role, content;
+        if (!getVarint(in, pos, tokenCount) || !getString(in, pos, role) || !getString(in, pos, content))
+            return false;
+        push(role, content, tokenCount);
+    }
+    return true;
+}
@@ -0,0 +1,430 @@
+#include <string>
+#include <vector>
+#include <fstream>
+#include <sstream>
+#include <mutex>
+#include <algorithm>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "../include/rediscluster.h"
+#include "../include/redisdatabase.h"
+#include "../include/redisscript.h"
+
+// CRC16-CCITT (XMODEM), the variant Redis Cluster uses for key slots
+static const uint16_t* crc16Table() {
+    static uint16_t table[256];
+    static bool init = [] {
+        for (int i = 0; i < 256; ++i) {
+            uint16_t crc = static_cast<uint16_t>(i << 8);
+            for (int b = 0; b < 8; ++b)
+                crc = (crc & 0x8000) ? static_cast<uint16_t>((crc << 1) ^ 0x1021) : static_cast<uint16_t>(crc << 1);
+            table[i] = crc;
+        }
+        return true;
+    }();
+    (void)init;
+    return table;
+}
+
+static std::string encodeCommand(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& a : args) {
+        out += "$" + std::to_string(a.size()) + "\r\n";
+        out += a;
+        out += "\r\n";
+    }
+    return out;
+}
+
+// Blocking connection to another node, used for migrations and SETSLOT
+// broadcasts. Replies are returned as raw RESP.
+class clusterlink {
+public:
+    ~clusterlink() {
+        if (sock != INVALID_SOCKET)
+            closesocket(sock);
+    }
+
+    bool open(const std::string& host, int port, int timeoutMs, std::string& err) {
+        sockaddr_in addr{};
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(static_cast<u_short>(port));
+        if (inet_pton(AF_INET, host.c_str(), &addr.sin_addr) != 1) {
+            err = "IOERR invalid node address " + host;
+            return false;
+        }
+        sock = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (sock == INVALID_SOCKET) {
+            err = "IOERR socket creation failed";
+            return false;
+        }
+#ifdef _WIN32
+        DWORD tv = static_cast<DWORD>(timeoutMs);
+#else
+        timeval tv{ timeoutMs / 1000, (timeoutMs % 1000) * 1000 };
+#endif
+        setsockopt(sock, SOL_SOCKET, SO_RCVTIMEO, (const char*)&tv, sizeof(tv));
+        setsockopt(sock, SOL_SOCKET, SO_SNDTIMEO, (const char*)&tv, sizeof(tv));
+        if (connect(sock, (sockaddr*)&addr, sizeof(addr)) == SOCKET_ERROR) {
+            err = "IOERR error connecting to " + host + ":" + std::to_string(port);
+            return false;
+        }
+        return true;
+    }
+
+    bool write(const std::string& data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            int n = send(sock, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+            if (n == SOCKET_ERROR || n == 0)
+                return false;
+            sent += n;
+        }
+        return true;
+    }
+
+    bool readReply(std::string& reply) {
+        reply.clear();
+        return readValue(reply);
+    }
+
+private:
+    bool fill() {
+        char chunk[16384];
+        int n = recv(sock, chunk, sizeof(chunk), 0);
+        if (n <= 0)
+            return false;
+        buf.append(chunk, n);
+        return true;
+    }
+
+    bool readLine(std::string& line) {
+        size_t crlf;
+        while ((crlf = buf.find("\r\n", pos)) == std::string::npos) {
+            if (!fill())
+                return false;
+        }
+        line.assign(buf, pos, crlf + 2 - pos);
+        pos = crlf + 2;
+        return true;
+    }
+
+    bool readValue(std::string& out) {
+        std::string line;
+        if (!readLine(line))
+            return false;
+        out += line;
+        long long n = line.size() > 3 ? std::atoll(line.c_str() + 1) : 0;
+        if (line[0] == '$' && n >= 0) {
+            while (buf.size() - pos < static_cast<size_t>(n) + 2) {
+                if (!fill())
+                    return false;
+            }
+            out.append(buf, pos, static_cast<size_t>(n) + 2);
+            pos += static_cast<size_t>(n) + 2;
+        }
+        else if (line[0] == '*') {
+            for (long long i = 0; i < n; ++i) {
+                if (!readValue(out))
+                    return false;
+            }
+        }
+        if (pos == buf.size()) {
+            buf.clear();
+            pos = 0;
+        }
+        return true;
+    }
+
+    SOCKET sock = INVALID_SOCKET;
+    std::string buf;
+    size_t pos = 0;
+};
+
+static const int LINK_TIMEOUT_MS = 5000;
+
+rediscluster& rediscluster::getInstance() {
+    static rediscluster instance;
+    return instance;
+}
+
+rediscluster::rediscluster() {
+    for (int i = 0; i < SLOTS; ++i) {
+        owners[i] = -1;
+        migratingTo[i] = -1;
+        importingFrom[i] = -1;
+    }
+}
+
+uint16_t rediscluster::crc16(const char* buf, size_t len) {
+    const uint16_t* table = crc16Table();
+    uint16_t crc = 0;
+    for (size_t i = 0; i < len; ++i)
+        crc = static_cast<uint16_t>((crc << 8) ^ table[((crc >> 8) ^ static_cast<uint8_t>(buf[i])) & 0xff]);
+    return crc;
+}
+
+int rediscluster::keySlot(const std::string& key) {
+    // Only the part between the first '{' and the next '}' is hashed, if non-empty
+    size_t open = key.find('{');
+    if (open != std::string::npos) {
+        size_t close = key.find('}', open + 1);
+        if (close != std::string::npos && close != open + 1)
+            return crc16(key.data() + open + 1, close - open - 1) & (SLOTS - 1);
+    }
+    return crc16(key.data(), key.size()) & (SLOTS - 1);
+}
+
+bool rediscluster::configure(const std::string& filename, int port, std::string& err) {
+    std::ifstream ifs(filename);
+    if (!ifs) {
+        err = "cannot open " + filename;
+        return false;
+    }
+    struct entry {
+        std::string host;
+        int port;
+        std::vector<std::pair<int, int>> ranges;
+    };
+    std::vector<entry> entries;
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(ifs, line)) {
+        lineNo++;
+        size_t hash = line.find('#');
+        if (hash != std::string::npos)
+            line.erase(hash);
+        std::istringstream iss(line);
+        std::string addr, range;
+        if (!(iss >> addr))
+            continue;
+        entry e;
+        size_t colon = addr.rfind(':');
+        if (colon == std::string::npos) {
+            err = filename + ":" + std::to_string(lineNo) + ": expected host:port";
+            return false;
+        }
+        e.host = addr.substr(0, colon);
+        if (e.host == "localhost")
+            e.host = "127.0.0.1";
+        e.port = std::atoi(addr.c_str() + colon + 1);
+        while (iss >> range) {
+            size_t dash = range.find('-');
+            int lo = std::atoi(range.c_str());
+            int hi = dash == std::string::npos ? lo : std::atoi(range.c_str() + dash + 1);
+            if (lo < 0 || hi >= SLOTS || lo > hi) {
+                err = filename + ":" + std::to_string(lineNo) + ": bad slot range " + range;
+                return false;
+            }
+            e.ranges.emplace_back(lo, hi);
+        }
+        entries.push_back(e);
+    }
+
+    // This node first, so that it gets index 0
+    size_t self = entries.size();
+    for (size_t i = 0; i < entries.size(); ++i) {
+        if (entries[i].port == port)
+            self = i;
+    }
+    if (self == entries.size()) {
+        err = filename + " has no entry for port " + std::to_string(port);
+        return false;
+    }
+    std::swap(entries[0], entries[self]);
+    for (const auto& e : entries) {
+        int index = addNode(e.host, e.port);
+        for (const auto& r : e.ranges) {
+            for (int s = r.first; s <= r.second; ++s)
+                owners[s] = index;
+        }
+    }
+    isEnabled = true;
+    return true;
+}
+
+void rediscluster::setOwner(int slot, int index) {
+    owners[slot].store(index, std::memory_order_release);
+    migratingTo[slot].store(-1, std::memory_order_release);
+    importingFrom[slot].store(-1, std::memory_order_release);
+}
+
+void rediscluster::setMigrating(int slot, int index) {
+    migratingTo[slot].store(index, std::memory_order_release);
+}
+
+void rediscluster::setImporting(int slot, int index) {
+    importingFrom[slot].store(index, std::memory_order_release);
+}
+
+void rediscluster::setStable(int slot) {
+    migratingTo[slot].store(-1, std::memory_order_release);
+    importingFrom[slot].store(-1, std::memory_order_release);
+}
+
+rediscluster::node rediscluster::nodeAt(int index) {
+    std::lock_guard<std::mutex> lock(nodesMutex);
+    return nodeList.at(index);
+}
+
+int rediscluster::findNode(const std::string& id) {
+    std::lock_guard<std::mutex> lock(nodesMutex);
+    for (size_t i = 0; i < nodeList.size(); ++i) {
+        if (nodeList[i].id == id)
+            return static_cast<int>(i);
+    }
+    return -1;
+}
+
+int rediscluster::addNode(const std::string& host, int port) {
+    node n;
+    n.host = host;
+    n.port = port;
+    n.id = redisscript::sha1hex(host + ":" + std::to_string(port));
+    std::lock_guard<std::mutex> lock(nodesMutex);
+    for (size_t i = 0; i < nodeList.size(); ++i) {
+        if (nodeList[i].id == n.id)
+            return static_cast<int>(i);
+    }
+    nodeList.push_back(n);
+    return static_cast<int>(nodeList.size() - 1);
+}
+
+std::vector<rediscluster::node> rediscluster::nodes() {
+    std::lock_guard<std::mutex> lock(nodesMutex);
+    return std::vector<node>(nodeList.begin(), nodeList.end());
+}
+
+std::vector<std::string> rediscluster::keysInSlot(int slot, size_t count) {
+    std::vector<std::string> result;
+    for (auto& key : redisdatabase::getInstance().keys()) {
+        if (keySlot(key) != slot)
+            continue;
+        result.push_back(std::move(key));
+        if (count && result.size() == count)
+            break;
+    }
+    return result;
+}
+
+bool rediscluster::migrate(const std::string& host, int port, const std::vector<std::string>& keys, int timeoutMs,
+    bool copy, bool replace, size_t& count, std::string& err) {
+    count = 0;
+    clusterlink link;
+    if (!link.open(host, port, timeoutMs, err))
+        return false;
+
+    redisdatabase& db = redisdatabase::getInstance();
+    // Writers to these keys wait for the batch rather than race the move
+    auto lock = db.acquire();
+    std::string out, payload;
+    std::vector<const std::string*> sent;
+    for (const auto& key : keys) {
+        int64_t ttl = 0;
+        if (!db.dumpKey(key, payload, ttl))
+            continue;
+        std::vector<std::string> args = { "RESTORE-ASKING", key, std::to_string(ttl), payload };
+        if (replace)
+            args.push_back("REPLACE");
+        out += encodeCommand(args);
+        sent.push_back(&key);
+    }
+    if (sent.empty())
+        return true;
+    if (!link.write(out)) {
+        err = "IOERR error writing to target node";
+        return false;
+    }
+    std::string reply;
+    for (const std::string* key : sent) {
+        if (!link.readReply(reply)) {
+            err = "IOERR error or timeout reading from target node";
+            return false;
+        }
+        if (reply[0] == '-') {
+            err = reply.substr(1, reply.size() - 3);
+            return false;
+        }
+        if (!copy)
+            db.del(*key);
+        count++;
+    }
+    migratedKeys += count;
+    return true;
+}
+
+bool rediscluster::sendSetslot(int index, const std::vector<std::string>& args, std::string& err) {
+    node n = nodeAt(index);
+    clusterlink link;
+    if (!link.open(n.host, n.port, LINK_TIMEOUT_MS, err))
+        return false;
+    std::vector<std::string> cmd = { "CLUSTER", "SETSLOT" };
+    cmd.insert(cmd.end(), args.begin(), args.end());
+    std::string reply;
+    if (!link.write(encodeCommand(cmd)) || !link.readReply(reply)) {
+        err = "IOERR no reply from " + n.host + ":" + std::to_string(n.port);
+        return false;
+    }
+    if (reply[0] == '-') {
+        err = reply.substr(1, reply.size() - 3);
+        return false;
+    }
+    return true;
+}
+
+bool rediscluster::reshard(int slot, int target, size_t batch, size_t& count, std::string& err) {
+    std::lock_guard<std::mutex> guard(reshardMutex);
+    count = 0;
+    if (owner(slot) != 0) {
+        err = "I'm not the owner of hash slot " + std::to_string(slot);
+        return false;
+    }
+    if (target <= 0) {
+        err = "Target node must be another known node";
+        return false;
+    }
+    node to = nodeAt(target);
+    std::string slotArg = std::to_string(slot);
+    if (!sendSetslot(target, { slotArg, "IMPORTING", nodeAt(0).id }, err))
+        return false;
+    setMigrating(slot, target);
+
+    // From here on, new keys in the slot are sent to the target with ASK, so
+    // the rescan only picks up keys written while the first pass ran.
+    for (int pass = 0; pass < 8; ++pass) {
+        std::vector<std::string> keys = keysInSlot(slot, 0);
+        if (keys.empty())
+            break;
+        for (size_t i = 0; i < keys.size(); i += batch) {
+            std::vector<std::string> part(keys.begin() + i, keys.begin() + std::min<size_t>(keys.size(), i + batch));
+            size_t n = 0;
+            if (!migrate(to.host, to.port, part, LINK_TIMEOUT_MS, false, true, n, err)) {
+                count += n;
+                return false; // slot stays MIGRATING; rerun RESHARD to finish
+            }
+            count += n;
+        }
+    }
+
+    // The target must serve the slot before this node starts redirecting
+    if (!sendSetslot(target, { slotArg, "NODE", to.id }, err))
+        return false;
+    setOwner(slot, target);
+    std::vector<node> all = nodes();
+    for (size_t i = 1; i < all.size(); ++i) {
+        std::string ignored;
+        if (static_cast<int>(i) != target)
+            sendSetslot(static_cast<int>(i), { slotArg, "NODE", to.id }, ignored);
+    }
+    migratedSlots++;
+    return true;
+}
+
+rediscluster::stats rediscluster::getStats() const {
+    stats s;
+    s.moved = moved;
+    s.asked = asked;
+    s.migratedKeys = migratedKeys;
+    s.migratedSlots = migratedSlots;
+    return s;
+}
@@ -6,7 +6,24 @@
 #include<sstream>
 #include<exception>
 #include<iostream>
+#include<cstring>
+#include<atomic>
+#include<mutex>
+#include<memory>
+#include<unordered_map>
+#include<tuple>
 #include <rediscommandhandler.h>
+#include <simdkernels.h>
+#include <redisscript.h>
+#include <redispubsub.h>
+#include <redistracking.h>
+#include <rediscluster.h>
+#include <redisnet.h>
+#include <redisstats.h>
+#include <redismemory.h>
+#include<chrono>
+#include<cerrno>
+#include<cstdlib>
 
 
 static::std::vector<std::string> parseRespcommand(const std::string& input) {
@@ -45,6 +62,44 @@ static::std::vector<std::string> parseRespcommand(const std::string& input) {
 	}
 	return tokens;
 }
+// Streamed Replies
+// Arrays of at least STREAM_MIN_ELEMENTS are produced STREAM_CHUNK bytes at
+// a time as the connection writes them, when it can stream (replyStream is
+// set by runTracked for those); others, and every reply inside EXEC or a
+// script, are built in full.
+static const size_t STREAM_MIN_ELEMENTS = 1024;
+static const size_t STREAM_CHUNK = 64 * 1024;
+static thread_local redisoutput::producer* replyStream = nullptr;
+
+static void appendBulk(std::string& out, const std::string& s) {
+    out += '$';
+    out += std::to_string(s.size());
+    out += "\r\n";
+    out += s;
+    out += "\r\n";
+}
+
+// Replies with an n-element array; next appends one element per call and
+// returns false once none are left. It must own whatever it reads, since a
+// streamed reply outlives the command.
+template <typename Cursor>
+static std::string arrayReply(size_t n, Cursor next) {
+    std::string reply = "*" + std::to_string(n) + "\r\n";
+    if (!replyStream || n < STREAM_MIN_ELEMENTS) {
+        while (next(reply)) {
+        }
+        return reply;
+    }
+    *replyStream = [next](std::string& chunk) mutable {
+        while (chunk.size() < STREAM_CHUNK) {
+            if (!next(chunk))
+                return false;
+        }
+        return true;
+    };
+    return reply;
+}
+
 static std::string handlePing(const std::vector<std::string>& tokens, redisdatabase& db) {
     return "+PONG\r\n";
 }
@@ -65,13 +120,20 @@ static std::string handleGet(const std::vector<std::string>& tokens,redisdatabas
         return "$" + std::to_string(value.size()) + "\r\n" + value + "\r\n";
     return "$-1\r\n";
 }
+static std::string handleStrlen(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: STRLEN requires key\r\n";
+    return ":" + std::to_string(db.strlen(tokens[1])) + "\r\n";
+}
 static std::string handleKeys(const std::vector<std::string>& tokens, redisdatabase& db) {
-    auto allKeys = db.keys();
-    std::ostringstream oss;
-    oss << "*" << allKeys.size() << "\r\n";
-    for (const auto& key : allKeys)
-        oss << "$" << key.size() << "\r\n" << key << "\r\n";
-    return oss.str();
+    auto allKeys = std::make_shared<const std::vector<std::string>>(db.keys());
+    size_t i = 0;
+    return arrayReply(allKeys->size(), [allKeys, i](std::string& out) mutable {
+        if (i == allKeys->size())
+            return false;
+        appendBulk(out, (*allKeys)[i++]);
+        return true;
+    });
 }
 static std::string handleSet(const std::vector<std::string>& tokens, redisdatabase& db) {
     if (tokens.size() < 3)
@@ -120,14 +182,17 @@ static std::string handleLget(const std::vector<std::string>& tokens, redisdatab
     if (tokens.size() < 2)
         return "-Error: LGET requires a key\r\n";
 
-    auto elems = db.lget(tokens[1]);
-    std::ostringstream oss;
-    oss << "*" << elems.size() << "\r\n";
-    for (const auto& e : elems) {
-        oss << "$" << e.size() << "\r\n"
-            << e << "\r\n";
-    }
-    return oss.str();
+    auto list = db.listView(tokens[1]);
+    if (!list)
+        return "*0\r\n";
+    size_t i = 0;
+    std::string scratch;
+    return arrayReply(list->size(), [list, i, scratch](std::string& out) mutable {
+        if (i == list->size())
+            return false;
+        appendBulk(out, redisdatabase::unpacked((*list)[i++], scratch));
+        return true;
+    });
 }
 
 static std::string handleLlen(const std::vector<std::string>& tokens, redisdatabase& db) {
@@ -253,38 +318,52 @@ static std::string handleHdel(const std::vector<std::string>& tokens, redisdatab
 static std::string handleHgetall(const std::vector<std::string>& tokens, redisdatabase& db) {
     if (tokens.size() < 2)
         return "-Error: HGETALL requires key\r\n";
-    auto hash = db.hgetall(tokens[1]);
-    std::ostringstream oss;
-    oss << "*" << hash.size() * 2 << "\r\n";
-    for (const auto& pair : hash) {
-        oss << "$" << pair.first.size() << "\r\n" << pair.first << "\r\n";
-        oss << "$" << pair.second.size() << "\r\n" << pair.second << "\r\n";
-    }
-    return oss.str();
+    auto hash = db.hashView(tokens[1]);
+    if (!hash)
+        return "*0\r\n";
+    auto it = hash->begin();
+    std::string scratch;
+    return arrayReply(hash->size() * 2, [hash, it, scratch](std::string& out) mutable {
+        if (it == hash->end())
+            return false;
+        appendBulk(out, it->first);
+        appendBulk(out, redisdatabase::unpacked(it->second, scratch));
+        ++it;
+        return true;
+    });
 }
 
 static std::string handleHkeys(const std::vector<std::string>& tokens, redisdatabase& db) {
     if (tokens.size() < 2)
         return "-Error: HKEYS requires key\r\n";
-    auto keys = db.hkeys(tokens[1]);
-    std::ostringstream oss;
-    oss << "*" << keys.size() << "\r\n";
-    for (const auto& key : keys) {
-        oss << "$" << key.size() << "\r\n" << key << "\r\n";
-    }
-    return oss.str();
+    auto hash = db.hashView(tokens[1]);
+    if (!hash)
+        return "*0\r\n";
+    auto it = hash->begin();
+    return arrayReply(hash->size(), [hash, it](std::string& out) mutable {
+        if (it == hash->end())
+            return false;
+        appendBulk(out, it->first);
+        ++it;
+        return true;
+    });
 }
 
 static std::string handleHvals(const std::vector<std::string>& tokens, redisdatabase& db) {
     if (tokens.size() < 2)
         return "-Error: HVALS requires key\r\n";
-    auto values = db.hvals(tokens[1]);
-    std::ostringstream oss;
-    oss << "*" << values.size() << "\r\n";
-    for (const auto& val : values) {
-        oss << "$" << val.size() << "\r\n" << val << "\r\n";
-    }
-    return oss.str();
+    auto hash = db.hashView(tokens[1]);
+    if (!hash)
+        return "*0\r\n";
+    auto it = hash->begin();
+    std::string scratch;
+    return arrayReply(hash->size(), [hash, it, scratch](std::string& out) mutable {
+        if (it == hash->end())
+            return false;
+        appendBulk(out, redisdatabase::unpacked(it->second, scratch));
+        ++it;
+        return true;
+    });
 }
 
 static std::string handleHlen(const std::vector<std::string>& tokens, redisdatabase& db) {
@@ -305,72 +384,2774 @@ static std::string handleHmset(const std::vector<std::string>& tokens, redisdata
     return "+OK\r\n";
 }
 
-rediscommandhandler::rediscommandhandler() {}
-std::string rediscommandhandler::processCommand(const std::string& commandLine) {
-	auto tokens = parseRespcommand(commandLine);
-	if (tokens.empty())return "error empty command";
-	std::string cmd = tokens[0];
-	std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
-    redisdatabase& db = redisdatabase::getInstance();
-    if (cmd == "PING")
-        return handlePing(tokens, db);
-    else if (cmd == "ECHO")
-        return handleEcho(tokens, db);
-    else if (cmd == "FLUSHALL")
-        return handleFlushAll(tokens, db);
-    // Key/Value Operations
-    else if (cmd == "SET")
-        return handleSet(tokens, db);
-    else if (cmd == "GET")
-        return handleGet(tokens, db);
-    else if (cmd == "KEYS")
-        return handleKeys(tokens, db);
-    else if (cmd == "TYPE")
-        return handleType(tokens, db);
-    else if (cmd == "DEL" || cmd == "UNLINK")
-        return handleDel(tokens, db);
-    else if (cmd == "EXPIRE")
-        return handleExpire(tokens, db);
-    else if (cmd == "RENAME")
-        return handleRename(tokens, db);
-    // List Operations
-    else if (cmd == "LGET")
-        return handleLget(tokens, db);
-    else if (cmd == "LLEN")
-        return handleLlen(tokens, db);
-    else if (cmd == "LPUSH")
-        return handleLpush(tokens, db);
-    else if (cmd == "RPUSH")
-        return handleRpush(tokens, db);
-    else if (cmd == "LPOP")
-        return handleLpop(tokens, db);
-    else if (cmd == "RPOP")
-        return handleRpop(tokens, db);
-    else if (cmd == "LREM")
-        return handleLrem(tokens, db);
-    else if (cmd == "LINDEX")
-        return handleLindex(tokens, db);
-    else if (cmd == "LSET")
-        return handleLset(tokens, db);
-    // Hash Operations
-    else if (cmd == "HSET")
-        return handleHset(tokens, db);
-    else if (cmd == "HGET")
-        return handleHget(tokens, db);
-    else if (cmd == "HEXISTS")
-        return handleHexists(tokens, db);
-    else if (cmd == "HDEL") 
-        return handleHdel(tokens, db);
-    else if (cmd == "HGETALL")
-        return handleHgetall(tokens, db);
-    else if (cmd == "HKEYS")
-        return handleHkeys(tokens, db);
-    else if (cmd == "HVALS")
-        return handleHvals(tokens, db);
-    else if (cmd == "HLEN")
-        return handleHlen(tokens, db);
-    else if (cmd == "HMSET")
-        return handleHmset(tokens, db);
+// HyperLogLog Operations
+static std::string handlePfadd(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: PFADD requires key\r\n";
+    std::vector<std::string> elements(tokens.begin() + 2, tokens.end());
+    bool updated = false;
+    if (!db.pfadd(tokens[1], elements, updated))
+        return "-WRONGTYPE Key is not a valid HyperLogLog string value.\r\n";
+    return ":" + std::to_string(updated ? 1 : 0) + "\r\n";
+}
+
+static std::string handlePfcount(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: PFCOUNT requires at least one key\r\n";
+    std::vector<std::string> keys(tokens.begin() + 1, tokens.end());
+    uint64_t count = 0;
+    if (!db.pfcount(keys, count))
+        return "-WRONGTYPE Key is not a valid HyperLogLog string value.\r\n";
+    return ":" + std::to_string(count) + "\r\n";
+}
+
+static std::string handlePfmerge(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: PFMERGE requires destination key\r\n";
+    std::vector<std::string> sources(tokens.begin() + 2, tokens.end());
+    if (!db.pfmerge(tokens[1], sources))
+        return "-WRONGTYPE Key is not a valid HyperLogLog string value.\r\n";
+    return "+OK\r\n";
+}
+
+// Bitmap Operations
+static const char* const BIT_OFFSET_ERROR = "-Error: bit offset is not an integer or out of range\r\n";
+static const char* const SYNTAX_ERROR = "-Error: syntax error\r\n";
+
+static bool parseInteger(const std::string& token, int64_t& value) {
+    if (token.empty())
+        return false;
+    char* end = nullptr;
+    errno = 0;
+    long long v = std::strtoll(token.c_str(), &end, 10);
+    if (*end != '\0' || errno == ERANGE)
+        return false;
+    value = v;
+    return true;
+}
+
+static bool parseBitOffset(const std::string& token, uint64_t& offset) {
+    int64_t v = 0;
+    if (!parseInteger(token, v) || v < 0 || static_cast<uint64_t>(v) >= redisbitmap::MAX_BITS)
+        return false;
+    offset = static_cast<uint64_t>(v);
+    return true;
+}
+
+// Optional trailing BYTE | BIT of BITCOUNT and BITPOS
+static bool parseBitUnits(const std::string& token, bool& bitUnits) {
+    std::string unit = token;
+    std::transform(unit.begin(), unit.end(), unit.begin(), ::toupper);
+    if (unit != "BYTE" && unit != "BIT")
+        return false;
+    bitUnits = unit == "BIT";
+    return true;
+}
+
+static std::string handleSetbit(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: SETBIT requires key, offset and value\r\n";
+    uint64_t offset = 0;
+    if (!parseBitOffset(tokens[2], offset))
+        return BIT_OFFSET_ERROR;
+    if (tokens[3] != "0" && tokens[3] != "1")
+        return "-Error: bit is not an integer or out of range\r\n";
+    return ":" + std::to_string(db.setbit(tokens[1], offset, tokens[3][0] - '0')) + "\r\n";
+}
+
+static std::string handleGetbit(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: GETBIT requires key and offset\r\n";
+    uint64_t offset = 0;
+    if (!parseBitOffset(tokens[2], offset))
+        return BIT_OFFSET_ERROR;
+    return ":" + std::to_string(db.getbit(tokens[1], offset)) + "\r\n";
+}
+
+// BITCOUNT key [start end [BYTE | BIT]]
+static std::string handleBitcount(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: BITCOUNT requires key\r\n";
+    int64_t start = 0, end = -1;
+    bool bitUnits = false;
+    if (tokens.size() == 3 || tokens.size() > 5)
+        return SYNTAX_ERROR;
+    if (tokens.size() >= 4 && (!parseInteger(tokens[2], start) || !parseInteger(tokens[3], end)))
+        return "-Error: value is not an integer or out of range\r\n";
+    if (tokens.size() == 5 && !parseBitUnits(tokens[4], bitUnits))
+        return SYNTAX_ERROR;
+    return ":" + std::to_string(db.bitcount(tokens[1], start, end, bitUnits)) + "\r\n";
+}
+
+// BITPOS key bit [start [end [BYTE | BIT]]]
+static std::string handleBitpos(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: BITPOS requires key and bit\r\n";
+    if (tokens[2] != "0" && tokens[2] != "1")
+        return "-Error: The bit argument must be 1 or 0.\r\n";
+    int64_t start = 0, end = -1;
+    bool bitUnits = false;
+    if (tokens.size() > 6)
+        return SYNTAX_ERROR;
+    if (tokens.size() >= 4 && !parseInteger(tokens[3], start))
+        return "-Error: value is not an integer or out of range\r\n";
+    if (tokens.size() >= 5 && !parseInteger(tokens[4], end))
+        return "-Error: value is not an integer or out of range\r\n";
+    if (tokens.size() == 6 && !parseBitUnits(tokens[5], bitUnits))
+        return SYNTAX_ERROR;
+    int64_t pos = db.bitpos(tokens[1], tokens[2][0] - '0', start, end, tokens.size() >= 5, bitUnits);
+    return ":" + std::to_string(pos) + "\r\n";
+}
+
+// BITOP AND | OR | XOR | NOT destkey key [key ...]
+static std::string handleBitop(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: BITOP requires operation, destination key and source keys\r\n";
+    std::string name = tokens[1];
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    redisbitmap::op o;
+    if (name == "AND")
+        o = redisbitmap::AND;
+    else if (name == "OR")
+        o = redisbitmap::OR;
+    else if (name == "XOR")
+        o = redisbitmap::XOR;
+    else if (name == "NOT")
+        o = redisbitmap::NOT;
     else
-        return "-Error: Unknown command\r\n";
+        return SYNTAX_ERROR;
+    if (o == redisbitmap::NOT && tokens.size() != 4)
+        return "-Error: BITOP NOT must be called with a single source key.\r\n";
+    std::vector<std::string> keys(tokens.begin() + 3, tokens.end());
+    return ":" + std::to_string(db.bitop(o, tokens[2], keys)) + "\r\n";
+}
+
+// "i<bits>" (1..64) or "u<bits>" (1..63)
+static bool parseFieldType(const std::string& token, redisbitmap::fieldop& f) {
+    if (token.size() < 2)
+        return false;
+    char sign = static_cast<char>(::tolower(static_cast<unsigned char>(token[0])));
+    int64_t bits = 0;
+    if ((sign != 'i' && sign != 'u') || !parseInteger(token.substr(1), bits))
+        return false;
+    f.isSigned = sign == 'i';
+    if (bits < 1 || bits > (f.isSigned ? 64 : 63))
+        return false;
+    f.bits = static_cast<int>(bits);
+    return true;
+}
+
+// A bit offset, or "#n" for the n-th field of the type's width
+static bool parseFieldOffset(const std::string& token, redisbitmap::fieldop& f) {
+    bool scaled = !token.empty() && token[0] == '#';
+    uint64_t v = 0;
+    if (!parseBitOffset(scaled ? token.substr(1) : token, v))
+        return false;
+    f.offset = scaled ? v * static_cast<uint64_t>(f.bits) : v;
+    return f.offset + f.bits <= redisbitmap::MAX_BITS;
+}
+
+// BITFIELD key [GET type offset] [SET type offset value]
+//   [INCRBY type offset increment] [OVERFLOW WRAP | SAT | FAIL] ...
+// BITFIELD_RO takes GET only.
+static std::string runBitfield(const std::vector<std::string>& tokens, redisdatabase& db, bool readOnly) {
+    if (tokens.size() < 2)
+        return "-Error: BITFIELD requires key\r\n";
+    std::vector<redisbitmap::fieldop> ops;
+    redisbitmap::overflow onOverflow = redisbitmap::WRAP;
+    size_t i = 2;
+    while (i < tokens.size()) {
+        std::string sub = tokens[i];
+        std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+        redisbitmap::fieldop f;
+        if (readOnly && sub != "GET")
+            return "-Error: BITFIELD_RO only supports the GET subcommand\r\n";
+        if (sub == "OVERFLOW") {
+            if (i + 1 >= tokens.size())
+                return SYNTAX_ERROR;
+            std::string mode = tokens[i + 1];
+            std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+            if (mode == "WRAP")
+                onOverflow = redisbitmap::WRAP;
+            else if (mode == "SAT")
+                onOverflow = redisbitmap::SAT;
+            else if (mode == "FAIL")
+                onOverflow = redisbitmap::FAIL;
+            else
+                return "-Error: Invalid OVERFLOW type specified\r\n";
+            i += 2;
+            continue;
+        }
+        if (sub == "GET")
+            f.kind = redisbitmap::fieldop::GET;
+        else if (sub == "SET")
+            f.kind = redisbitmap::fieldop::SET;
+        else if (sub == "INCRBY")
+            f.kind = redisbitmap::fieldop::INCRBY;
+        else
+            return SYNTAX_ERROR;
+        size_t args = f.kind == redisbitmap::fieldop::GET ? 2 : 3;
+        if (i + args >= tokens.size())
+            return SYNTAX_ERROR;
+        if (!parseFieldType(tokens[i + 1], f))
+            return "-Error: Invalid bitfield type. Use something like i16 u8. Note that u64 is not supported but i64 is.\r\n";
+        if (!parseFieldOffset(tokens[i + 2], f))
+            return BIT_OFFSET_ERROR;
+        if (args == 3 && !parseInteger(tokens[i + 3], f.value))
+            return "-Error: value is not an integer or out of range\r\n";
+        f.onOverflow = onOverflow;
+        ops.push_back(f);
+        i += args + 1;
+    }
+    if (ops.empty())
+        return "*0\r\n";
+
+    auto results = db.bitfield(tokens[1], ops);
+    std::string reply = "*" + std::to_string(results.size()) + "\r\n";
+    for (const auto& r : results)
+        reply += r.second ? ":" + std::to_string(r.first) + "\r\n" : "$-1\r\n";
+    return reply;
+}
+
+static std::string handleBitfield(const std::vector<std::string>& tokens, redisdatabase& db) {
+    return runBitfield(tokens, db, false);
+}
+
+static std::string handleBitfieldRo(const std::vector<std::string>& tokens, redisdatabase& db) {
+    return runBitfield(tokens, db, true);
+}
+
+// Stream Operations
+static void appendStreamEntries(std::ostringstream& oss, const std::vector<redisstream::entry>& entries) {
+    oss << "*" << entries.size() << "\r\n";
+    for (const auto& e : entries) {
+        std::string id = e.id.toString();
+        oss << "*2\r\n$" << id.size() << "\r\n" << id << "\r\n";
+        if (e.deleted) {
+            oss << "*-1\r\n";
+            continue;
+        }
+        oss << "*" << e.fields.size() * 2 << "\r\n";
+        for (const auto& fv : e.fields) {
+            oss << "$" << fv.first.size() << "\r\n" << fv.first << "\r\n";
+            oss << "$" << fv.second.size() << "\r\n" << fv.second << "\r\n";
+        }
+    }
+}
+
+static std::string streamReadReply(const std::vector<std::pair<std::string, std::vector<redisstream::entry>>>& result) {
+    if (result.empty())
+        return "*-1\r\n";
+    std::ostringstream oss;
+    oss << "*" << result.size() << "\r\n";
+    for (const auto& kv : result) {
+        oss << "*2\r\n$" << kv.first.size() << "\r\n" << kv.first << "\r\n";
+        appendStreamEntries(oss, kv.second);
+    }
+    return oss.str();
+}
+
+static bool parseCount(const std::string& token, size_t& count) {
+    try {
+        long long v = std::stoll(token);
+        if (v < 0)
+            return false;
+        count = static_cast<size_t>(v);
+        return true;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+// Parses "MAXLEN [=|~] n" starting at tokens[i]; advances i past it.
+static bool parseMaxlen(const std::vector<std::string>& tokens, size_t& i, size_t& maxlen, bool& approx) {
+    i++;
+    approx = false;
+    if (i < tokens.size() && (tokens[i] == "~" || tokens[i] == "=")) {
+        approx = tokens[i] == "~";
+        i++;
+    }
+    if (i >= tokens.size() || !parseCount(tokens[i], maxlen))
+        return false;
+    i++;
+    return true;
+}
+
+static std::string handleXadd(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 5)
+        return "-Error: XADD requires key, id and field value pairs\r\n";
+    size_t i = 2;
+    bool nomkstream = false, approx = false;
+    size_t maxlen = SIZE_MAX;
+    while (i < tokens.size()) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "NOMKSTREAM") {
+            nomkstream = true;
+            i++;
+        }
+        else if (opt == "MAXLEN") {
+            if (!parseMaxlen(tokens, i, maxlen, approx))
+                return "-Error: Invalid MAXLEN\r\n";
+        }
+        else {
+            break;
+        }
+    }
+    if (i >= tokens.size() || (tokens.size() - i - 1) == 0 || (tokens.size() - i - 1) % 2 != 0)
+        return "-Error: XADD requires field value pairs\r\n";
+    std::string idSpec = tokens[i++];
+    redisstream::fieldlist fields;
+    for (; i < tokens.size(); i += 2)
+        fields.emplace_back(tokens[i], tokens[i + 1]);
+
+    std::string id, err;
+    if (!db.xadd(tokens[1], idSpec, fields, maxlen, approx, nomkstream, id, err))
+        return err.empty() ? "$-1\r\n" : "-Error: " + err + "\r\n";
+    return "$" + std::to_string(id.size()) + "\r\n" + id + "\r\n";
+}
+
+static std::string handleXrangeGeneric(const std::vector<std::string>& tokens, redisdatabase& db, bool reverse) {
+    if (tokens.size() < 4)
+        return "-Error: XRANGE requires key, start and end\r\n";
+    streamid start, end;
+    const std::string& startTok = reverse ? tokens[3] : tokens[2];
+    const std::string& endTok = reverse ? tokens[2] : tokens[3];
+    if (!streamid::parseRange(startTok, true, start) || !streamid::parseRange(endTok, false, end))
+        return "-Error: Invalid stream ID specified as stream command argument\r\n";
+    size_t count = 0;
+    if (tokens.size() >= 6) {
+        std::string opt = tokens[4];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt != "COUNT" || !parseCount(tokens[5], count))
+            return "-Error: Invalid COUNT\r\n";
+        if (count == 0)
+            return "*0\r\n";
+    }
+    std::ostringstream oss;
+    appendStreamEntries(oss, db.xrange(tokens[1], start, end, count, reverse));
+    return oss.str();
+}
+
+static std::string handleXrange(const std::vector<std::string>& tokens, redisdatabase& db) {
+    return handleXrangeGeneric(tokens, db, false);
+}
+
+static std::string handleXrevrange(const std::vector<std::string>& tokens, redisdatabase& db) {
+    return handleXrangeGeneric(tokens, db, true);
+}
+
+static std::string handleXlen(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: XLEN requires key\r\n";
+    return ":" + std::to_string(db.xlen(tokens[1])) + "\r\n";
+}
+
+static std::string handleXtrim(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: XTRIM requires key and MAXLEN\r\n";
+    std::string opt = tokens[2];
+    std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+    size_t i = 2, maxlen = 0;
+    bool approx = false;
+    if (opt != "MAXLEN" || !parseMaxlen(tokens, i, maxlen, approx))
+        return "-Error: Invalid MAXLEN\r\n";
+    return ":" + std::to_string(db.xtrim(tokens[1], maxlen, approx)) + "\r\n";
+}
+
+// Splits "STREAMS k1 k2 ... id1 id2 ..." found at tokens[i].
+static bool parseStreamsArgs(const std::vector<std::string>& tokens, size_t i,
+    std::vector<std::string>& keys, std::vector<std::string>& ids) {
+    size_t n = tokens.size() - i;
+    if (n == 0 || n % 2 != 0)
+        return false;
+    keys.assign(tokens.begin() + i, tokens.begin() + i + n / 2);
+    ids.assign(tokens.begin() + i + n / 2, tokens.end());
+    return true;
+}
+
+static std::string handleXread(const std::vector<std::string>& tokens, redisdatabase& db) {
+    size_t i = 1, count = 0;
+    while (i < tokens.size()) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "COUNT" && i + 1 < tokens.size()) {
+            if (!parseCount(tokens[i + 1], count))
+                return "-Error: Invalid COUNT\r\n";
+            i += 2;
+        }
+        else if (opt == "BLOCK") {
+            return "-Error: XREAD BLOCK is not supported\r\n";
+        }
+        else if (opt == "STREAMS") {
+            i++;
+            break;
+        }
+        else {
+            return "-Error: XREAD requires STREAMS\r\n";
+        }
+    }
+    std::vector<std::string> keys, ids;
+    if (!parseStreamsArgs(tokens, i, keys, ids))
+        return "-Error: Unbalanced XREAD list of streams\r\n";
+    std::vector<std::pair<std::string, std::vector<redisstream::entry>>> result;
+    std::string err;
+    if (!db.xread(keys, ids, count, result, err))
+        return "-Error: " + err + "\r\n";
+    return streamReadReply(result);
+}
+
+static std::string handleXgroup(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: XGROUP requires subcommand, key and group\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "CREATE") {
+        if (tokens.size() < 5)
+            return "-Error: XGROUP CREATE requires key, group and id\r\n";
+        bool mkstream = false;
+        if (tokens.size() >= 6) {
+            std::string opt = tokens[5];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            mkstream = opt == "MKSTREAM";
+        }
+        std::string err;
+        if (!db.xgroupCreate(tokens[2], tokens[3], tokens[4], mkstream, err))
+            return "-" + err + "\r\n";
+        return "+OK\r\n";
+    }
+    if (sub == "DESTROY")
+        return ":" + std::to_string(db.xgroupDestroy(tokens[2], tokens[3]) ? 1 : 0) + "\r\n";
+    return "-Error: Unknown XGROUP subcommand\r\n";
+}
+
+static std::string handleXreadgroup(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 7)
+        return "-Error: XREADGROUP requires GROUP group consumer STREAMS key id\r\n";
+    std::string opt = tokens[1];
+    std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+    if (opt != "GROUP")
+        return "-Error: XREADGROUP requires GROUP\r\n";
+    size_t i = 4, count = 0;
+    bool noack = false;
+    while (i < tokens.size()) {
+        opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "COUNT" && i + 1 < tokens.size()) {
+            if (!parseCount(tokens[i + 1], count))
+                return "-Error: Invalid COUNT\r\n";
+            i += 2;
+        }
+        else if (opt == "NOACK") {
+            noack = true;
+            i++;
+        }
+        else if (opt == "BLOCK") {
+            return "-Error: XREADGROUP BLOCK is not supported\r\n";
+        }
+        else if (opt == "STREAMS") {
+            i++;
+            break;
+        }
+        else {
+            return "-Error: XREADGROUP requires STREAMS\r\n";
+        }
+    }
+    std::vector<std::string> keys, ids;
+    if (!parseStreamsArgs(tokens, i, keys, ids))
+        return "-Error: Unbalanced XREADGROUP list of streams\r\n";
+    std::vector<std::pair<std::string, std::vector<redisstream::entry>>> result;
+    std::string err;
+    if (!db.xreadgroup(tokens[2], tokens[3], keys, ids, count, noack, result, err))
+        return "-" + err + "\r\n";
+    return streamReadReply(result);
+}
+
+static std::string handleXack(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: XACK requires key, group and id\r\n";
+    std::vector<streamid> ids;
+    for (size_t i = 3; i < tokens.size(); ++i) {
+        streamid id;
+        if (!streamid::parse(tokens[i], id, 0))
+            return "-Error: Invalid stream ID specified as stream command argument\r\n";
+        ids.push_back(id);
+    }
+    return ":" + std::to_string(db.xack(tokens[1], tokens[2], ids)) + "\r\n";
+}
+
+static std::string handleXpending(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: XPENDING requires key and group\r\n";
+    std::ostringstream oss;
+    if (tokens.size() == 3) {
+        redisstream::pendingsummary summary;
+        if (!db.xpending(tokens[1], tokens[2], summary))
+            return "-NOGROUP No such key '" + tokens[1] + "' or consumer group '" + tokens[2] + "'\r\n";
+        oss << "*4\r\n:" << summary.count << "\r\n";
+        if (summary.count == 0) {
+            oss << "$-1\r\n$-1\r\n*-1\r\n";
+            return oss.str();
+        }
+        std::string lo = summary.smallest.toString(), hi = summary.greatest.toString();
+        oss << "$" << lo.size() << "\r\n" << lo << "\r\n$" << hi.size() << "\r\n" << hi << "\r\n";
+        oss << "*" << summary.consumers.size() << "\r\n";
+        for (const auto& c : summary.consumers) {
+            std::string n = std::to_string(c.second);
+            oss << "*2\r\n$" << c.first.size() << "\r\n" << c.first << "\r\n$" << n.size() << "\r\n" << n << "\r\n";
+        }
+        return oss.str();
+    }
+
+    if (tokens.size() < 6)
+        return "-Error: XPENDING requires start, end and count\r\n";
+    streamid start, end;
+    size_t count = 0;
+    if (!streamid::parseRange(tokens[3], true, start) || !streamid::parseRange(tokens[4], false, end))
+        return "-Error: Invalid stream ID specified as stream command argument\r\n";
+    if (!parseCount(tokens[5], count))
+        return "-Error: Invalid COUNT\r\n";
+    std::string consumer = tokens.size() >= 7 ? tokens[6] : "";
+    std::vector<redisstream::pendingdetail> details;
+    if (count > 0 && !db.xpending(tokens[1], tokens[2], start, end, count, consumer, details))
+        return "-NOGROUP No such key '" + tokens[1] + "' or consumer group '" + tokens[2] + "'\r\n";
+    oss << "*" << details.size() << "\r\n";
+    for (const auto& d : details) {
+        std::string id = d.id.toString();
+        oss << "*4\r\n$" << id.size() << "\r\n" << id << "\r\n";
+        oss << "$" << d.consumer.size() << "\r\n" << d.consumer << "\r\n";
+        oss << ":" << d.idle << "\r\n:" << d.deliveryCount << "\r\n";
+    }
+    return oss.str();
+}
+
+// Vector Set Operations
+// Parses "FP32 <blob>" or "VALUES <n> <v1> ... <vn>" at tokens[i]; advances i.
+static bool parseVectorArg(const std::vector<std::string>& tokens, size_t& i, std::vector<float>& vec) {
+    if (i >= tokens.size())
+        return false;
+    std::string kind = tokens[i];
+    std::transform(kind.begin(), kind.end(), kind.begin(), ::toupper);
+    if (kind == "FP32") {
+        if (i + 1 >= tokens.size() || tokens[i + 1].size() % sizeof(float) != 0)
+            return false;
+        vec.resize(tokens[i + 1].size() / sizeof(float));
+        std::memcpy(vec.data(), tokens[i + 1].data(), tokens[i + 1].size());
+        i += 2;
+        return true;
+    }
+    if (kind != "VALUES" || i + 1 >= tokens.size())
+        return false;
+    try {
+        size_t n = std::stoul(tokens[i + 1]);
+        if (i + 2 + n > tokens.size())
+            return false;
+        vec.resize(n);
+        for (size_t j = 0; j < n; ++j)
+            vec[j] = std::stof(tokens[i + 2 + j]);
+        i += 2 + n;
+        return true;
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+}
+
+static std::string handleVadd(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: VADD requires key, vector and element\r\n";
+    size_t i = 2;
+    std::vector<float> vec;
+    if (!parseVectorArg(tokens, i, vec) || i >= tokens.size())
+        return "-Error: VADD requires FP32 blob or VALUES n v1 ... vn followed by element\r\n";
+    std::string element = tokens[i++];
+    redisvectorset::config cfg;
+    try {
+        while (i + 1 < tokens.size()) {
+            std::string opt = tokens[i];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            if (opt == "METRIC") {
+                if (!redisvectorset::parseMetric(tokens[i + 1], cfg.kind))
+                    return "-Error: METRIC must be COSINE, L2 or IP\r\n";
+            }
+            else if (opt == "M") {
+                cfg.m = std::max<size_t>(2, std::stoul(tokens[i + 1]));
+            }
+            else if (opt == "EF") {
+                cfg.efConstruction = std::max<size_t>(1, std::stoul(tokens[i + 1]));
+            }
+            else {
+                return "-Error: Unknown VADD option\r\n";
+            }
+            i += 2;
+        }
+    }
+    catch (const std::exception&) {
+        return "-Error: Invalid VADD option value\r\n";
+    }
+    bool added = false;
+    std::string err;
+    if (!db.vadd(tokens[1], vec, element, cfg, added, err))
+        return "-Error: " + err + "\r\n";
+    return ":" + std::to_string(added ? 1 : 0) + "\r\n";
+}
+
+static std::string handleVsim(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: VSIM requires key and ELE element, FP32 blob or VALUES\r\n";
+    size_t i = 2;
+    std::vector<float> query;
+    std::string element;
+    std::string kind = tokens[i];
+    std::transform(kind.begin(), kind.end(), kind.begin(), ::toupper);
+    if (kind == "ELE") {
+        element = tokens[i + 1];
+        i += 2;
+    }
+    else if (!parseVectorArg(tokens, i, query)) {
+        return "-Error: VSIM requires ELE element, FP32 blob or VALUES n v1 ... vn\r\n";
+    }
+
+    size_t count = 10, ef = 0;
+    bool withScores = false, exact = false;
+    try {
+        while (i < tokens.size()) {
+            std::string opt = tokens[i];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            if (opt == "WITHSCORES") {
+                withScores = true;
+                i++;
+            }
+            else if (opt == "TRUTH") {
+                exact = true;
+                i++;
+            }
+            else if (opt == "COUNT" && i + 1 < tokens.size()) {
+                count = std::stoul(tokens[i + 1]);
+                i += 2;
+            }
+            else if (opt == "EF" && i + 1 < tokens.size()) {
+                ef = std::stoul(tokens[i + 1]);
+                i += 2;
+            }
+            else {
+                return "-Error: Unknown VSIM option\r\n";
+            }
+        }
+    }
+    catch (const std::exception&) {
+        return "-Error: Invalid VSIM option value\r\n";
+    }
+    if (ef == 0)
+        ef = std::max<size_t>(100, count);
+
+    std::vector<std::pair<std::string, float>> result;
+    std::string err;
+    if (!db.vsim(tokens[1], query, element, count, ef, exact, result, err))
+        return "-Error: " + err + "\r\n";
+    std::ostringstream oss;
+    oss << "*" << (withScores ? result.size() * 2 : result.size()) << "\r\n";
+    for (const auto& r : result) {
+        oss << "$" << r.first.size() << "\r\n" << r.first << "\r\n";
+        if (withScores) {
+            std::string score = std::to_string(r.second);
+            oss << "$" << score.size() << "\r\n" << score << "\r\n";
+        }
+    }
+    return oss.str();
+}
+
+static std::string handleVrem(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: VREM requires key and element\r\n";
+    return ":" + std::to_string(db.vrem(tokens[1], tokens[2]) ? 1 : 0) + "\r\n";
+}
+
+static std::string handleVemb(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: VEMB requires key and element\r\n";
+    std::vector<float> vec;
+    if (!db.vemb(tokens[1], tokens[2], vec))
+        return "*-1\r\n";
+    std::ostringstream oss;
+    oss << "*" << vec.size() << "\r\n";
+    for (float v : vec) {
+        std::string s = std::to_string(v);
+        oss << "$" << s.size() << "\r\n" << s << "\r\n";
+    }
+    return oss.str();
+}
+
+static std::string handleVcard(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: VCARD requires key\r\n";
+    return ":" + std::to_string(db.vcard(tokens[1])) + "\r\n";
+}
+
+static std::string handleVdim(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: VDIM requires key\r\n";
+    size_t dim = db.vdim(tokens[1]);
+    if (dim == 0)
+        return "-Error: Key not found\r\n";
+    return ":" + std::to_string(dim) + "\r\n";
+}
+
+// Semantic Cache Operations
+// Options shared by SCACHE.SET and SCACHE.GET; a client supplied vector wins
+// over embedding the prompt server side.
+static bool parseScacheOptions(const std::vector<std::string>& tokens, size_t i, std::vector<float>& embedding,
+    int& ttl, float& threshold, bool& withScore) {
+    try {
+        while (i < tokens.size()) {
+            std::string opt = tokens[i];
+            std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+            if (opt == "VALUES" || opt == "FP32") {
+                if (!parseVectorArg(tokens, i, embedding))
+                    return false;
+            }
+            else if (opt == "TTL" && i + 1 < tokens.size()) {
+                ttl = std::stoi(tokens[i + 1]);
+                i += 2;
+            }
+            else if (opt == "THRESHOLD" && i + 1 < tokens.size()) {
+                threshold = std::stof(tokens[i + 1]);
+                i += 2;
+            }
+            else if (opt == "WITHSCORE") {
+                withScore = true;
+                i++;
+            }
+            else {
+                return false;
+            }
+        }
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+static std::string handleScacheSet(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4)
+        return "-Error: SCACHE.SET requires cache, prompt and completion\r\n";
+    std::vector<float> embedding;
+    int ttl = 0;
+    float threshold = 0;
+    bool withScore = false;
+    if (!parseScacheOptions(tokens, 4, embedding, ttl, threshold, withScore))
+        return "-Error: SCACHE.SET options are TTL seconds and VALUES n v1 ... vn or FP32 blob\r\n";
+    if (embedding.empty())
+        embedding = semanticcache::embed(tokens[2]);
+    std::string entryKey, err;
+    if (!db.scacheSet(tokens[1], embedding, tokens[3], ttl, entryKey, err))
+        return "-Error: " + err + "\r\n";
+    return "$" + std::to_string(entryKey.size()) + "\r\n" + entryKey + "\r\n";
+}
+
+static std::string handleScacheGet(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: SCACHE.GET requires cache and prompt\r\n";
+    std::vector<float> embedding;
+    int ttl = 0;
+    float threshold = 0.9f;
+    bool withScore = false;
+    if (!parseScacheOptions(tokens, 3, embedding, ttl, threshold, withScore))
+        return "-Error: SCACHE.GET options are THRESHOLD t, WITHSCORE and VALUES n v1 ... vn or FP32 blob\r\n";
+    if (embedding.empty())
+        embedding = semanticcache::embed(tokens[2]);
+    std::string completion, entryKey;
+    float score = 0;
+    if (!db.scacheGet(tokens[1], embedding, threshold, completion, score, entryKey))
+        return withScore ? "*-1\r\n" : "$-1\r\n";
+    if (!withScore)
+        return "$" + std::to_string(completion.size()) + "\r\n" + completion + "\r\n";
+    std::string s = std::to_string(score);
+    std::ostringstream oss;
+    oss << "*3\r\n$" << completion.size() << "\r\n" << completion << "\r\n";
+    oss << "$" << s.size() << "\r\n" << s << "\r\n";
+    oss << "$" << entryKey.size() << "\r\n" << entryKey << "\r\n";
+    return oss.str();
+}
+
+static std::string handleScacheStats(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: SCACHE.STATS requires cache\r\n";
+    semanticcache::stats st;
+    if (!db.scacheStats(tokens[1], st))
+        return "*-1\r\n";
+    uint64_t lookups = st.hits + st.misses;
+    std::vector<std::pair<std::string, std::string>> fields = {
+        { "entries", std::to_string(st.entries) },
+        { "dimension", std::to_string(st.dimension) },
+        { "hits", std::to_string(st.hits) },
+        { "misses", std::to_string(st.misses) },
+        { "hit_rate", std::to_string(lookups ? static_cast<double>(st.hits) / lookups : 0.0) },
+        { "lookup_p50_us", std::to_string(st.p50 / 1000.0) },
+        { "lookup_p95_us", std::to_string(st.p95 / 1000.0) },
+        { "lookup_p99_us", std::to_string(st.p99 / 1000.0) },
+        { "index_memory_bytes", std::to_string(st.indexBytes) },
+        { "kernel", simdkernels::floatKernelName() },
+    };
+    std::ostringstream oss;
+    oss << "*" << fields.size() * 2 << "\r\n";
+    for (const auto& f : fields) {
+        oss << "$" << f.first.size() << "\r\n" << f.first << "\r\n";
+        oss << "$" << f.second.size() << "\r\n" << f.second << "\r\n";
+    }
+    return oss.str();
+}
+
+static std::string handleScacheDrop(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: SCACHE.DROP requires cache\r\n";
+    return ":" + std::to_string(db.scacheDrop(tokens[1])) + "\r\n";
+}
+
+// Chat History Operations
+static std::string handleChatAppend(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4 || tokens.size() % 2 != 0)
+        return "-Error: CHAT.APPEND requires key and role content pairs\r\n";
+    std::vector<std::pair<std::string, std::string>> messages;
+    for (size_t i = 2; i + 1 < tokens.size(); i += 2)
+        messages.emplace_back(tokens[i], tokens[i + 1]);
+    return ":" + std::to_string(db.chatAppend(tokens[1], messages)) + "\r\n";
+}
+
+static std::string handleChatRead(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: CHAT.READ requires key\r\n";
+    size_t lastN = 0, maxTokens = 0;
+    bool withTokens = false;
+    for (size_t i = 2; i < tokens.size(); ) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "WITHTOKENS") {
+            withTokens = true;
+            i++;
+        }
+        else if ((opt == "LAST" || opt == "TOKENS") && i + 1 < tokens.size()) {
+            size_t v;
+            if (!parseCount(tokens[i + 1], v))
+                return "-Error: CHAT.READ " + opt + " must be a non-negative integer\r\n";
+            (opt == "LAST" ? lastN : maxTokens) = v;
+            i += 2;
+        }
+        else {
+            return "-Error: CHAT.READ options are LAST n, TOKENS k and WITHTOKENS\r\n";
+        }
+    }
+    std::vector<redischat::message> messages;
+    if (!db.chatRead(tokens[1], lastN, maxTokens, messages))
+        return "*0\r\n";
+    std::ostringstream oss;
+    oss << "*" << messages.size() * (withTokens ? 3 : 2) << "\r\n";
+    for (const auto& m : messages) {
+        oss << "$" << m.role.size() << "\r\n" << m.role << "\r\n";
+        oss << "$" << m.content.size() << "\r\n" << m.content << "\r\n";
+        if (withTokens)
+            oss << ":" << m.tokens << "\r\n";
+    }
+    return oss.str();
+}
+
+static std::string handleChatLen(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: CHAT.LEN requires key\r\n";
+    return ":" + std::to_string(db.chatLen(tokens[1])) + "\r\n";
+}
+
+static std::string handleChatConfig(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 4 || tokens.size() % 2 != 0)
+        return "-Error: CHAT.CONFIG requires key and MAXMSGS n, MAXBYTES n or TTL seconds\r\n";
+    int64_t maxMessages = -1, maxBytes = -1;
+    int ttl = -1;
+    for (size_t i = 2; i + 1 < tokens.size(); i += 2) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        size_t v;
+        if (!parseCount(tokens[i + 1], v))
+            return "-Error: CHAT.CONFIG " + opt + " must be a non-negative integer\r\n";
+        if (opt == "MAXMSGS")
+            maxMessages = static_cast<int64_t>(v);
+        else if (opt == "MAXBYTES")
+            maxBytes = static_cast<int64_t>(v);
+        else if (opt == "TTL")
+            ttl = static_cast<int>(std::min<size_t>(v, INT32_MAX));
+        else
+            return "-Error: CHAT.CONFIG options are MAXMSGS, MAXBYTES and TTL\r\n";
+    }
+    db.chatConfig(tokens[1], maxMessages, maxBytes, ttl);
+    return "+OK\r\n";
+}
+
+static std::string handleChatInfo(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: CHAT.INFO requires key\r\n";
+    redischat::summary info;
+    if (!db.chatInfo(tokens[1], info))
+        return "*-1\r\n";
+    std::vector<std::pair<std::string, size_t>> fields = {
+        { "messages", info.messages },
+        { "bytes", info.bytes },
+        { "tokens", info.tokens },
+        { "segments", info.segments },
+        { "max_messages", info.caps.maxMessages },
+        { "max_bytes", info.caps.maxBytes },
+        { "ttl", static_cast<size_t>(info.caps.ttlSeconds) },
+    };
+    std::ostringstream oss;
+    oss << "*" << fields.size() * 2 << "\r\n";
+    for (const auto& f : fields) {
+        oss << "$" << f.first.size() << "\r\n" << f.first << "\r\n";
+        oss << ":" << f.second << "\r\n";
+    }
+    return oss.str();
+}
+
+// Server Info
+struct transactionstats {
+    std::atomic<uint64_t> committed{ 0 };
+    std::atomic<uint64_t> aborted{ 0 };   // a watched key changed
+    std::atomic<uint64_t> execAborts{ 0 }; // EXECABORT after a queueing error
+    std::atomic<uint64_t> discarded{ 0 };
+    std::atomic<uint64_t> retries{ 0 };   // EXEC following an aborted EXEC
+};
+
+static transactionstats txStats;
+
+static std::string bytesHuman(uint64_t bytes) {
+    static const char* const units[] = { "B", "K", "M", "G", "T" };
+    double v = static_cast<double>(bytes);
+    int u = 0;
+    while (v >= 1024.0 && u < 4) {
+        v /= 1024.0;
+        u++;
+    }
+    std::ostringstream out;
+    out.setf(std::ios::fixed);
+    out.precision(2);
+    out << v << units[u];
+    return out.str();
+}
+
+// INFO [section ...]. With no section (or "default") every section but
+// commandstats is returned; "all" and "everything" include it.
+static std::string handleInfo(const std::vector<std::string>& tokens, redisdatabase& db) {
+    std::vector<std::string> wanted;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        std::string name = tokens[i];
+        std::transform(name.begin(), name.end(), name.begin(), ::tolower);
+        wanted.push_back(name);
+    }
+    auto named = [&](const char* name) { return std::find(wanted.begin(), wanted.end(), name) != wanted.end(); };
+    bool all = named("all") || named("everything");
+    bool defaults = wanted.empty() || named("default") || all;
+    auto want = [&](const char* name, bool byDefault = true) { return named(name) || (byDefault ? defaults : all); };
+
+    std::ostringstream info;
+    auto section = [&](const char* title) {
+        if (info.tellp() > 0)
+            info << "\r\n";
+        info << "# " << title << "\r\n";
+    };
+    redisnet::netstats ns = redisnet::currentStats();
+    if (want("server")) {
+        int64_t uptime = redisstats::uptimeSeconds();
+        section("Server");
+        info << "server_name:redisaiagent\r\n";
+#ifdef _WIN32
+        info << "os:Windows\r\n";
+#else
+        info << "os:Linux\r\n";
+#endif
+        info << "arch_bits:" << sizeof(void*) * 8 << "\r\n";
+        info << "bitmap_kernel:" << simdkernels::bitKernelName() << "\r\n";
+        info << "server_mode:" << (rediscluster::getInstance().enabled() ? "cluster" : "standalone") << "\r\n";
+        info << "multiplexing_api:" << ns.backend << "\r\n";
+        info << "process_id:" << redisstats::processId() << "\r\n";
+        info << "tcp_port:" << redisstats::port() << "\r\n";
+        info << "uptime_in_seconds:" << uptime << "\r\n";
+        info << "uptime_in_days:" << uptime / 86400 << "\r\n";
+    }
+    if (want("clients")) {
+        uint64_t opened = redisstats::total(redisstats::CONNECTIONS);
+        uint64_t closed = redisstats::total(redisstats::DISCONNECTIONS);
+        section("Clients");
+        info << "connected_clients:" << (opened - std::min<uint64_t>(opened, closed)) << "\r\n";
+    }
+    if (want("memory")) {
+        uint64_t rss = 0, peak = 0;
+        redisstats::memoryUsage(rss, peak);
+        section("Memory");
+        info << "used_memory_rss:" << rss << "\r\n";
+        info << "used_memory_rss_human:" << bytesHuman(rss) << "\r\n";
+        info << "used_memory_peak:" << peak << "\r\n";
+        info << "used_memory_peak_human:" << bytesHuman(peak) << "\r\n";
+    }
+    if (want("persistence")) {
+        redisstats::persistence p = redisstats::persistenceStats();
+        section("Persistence");
+        info << "rdb_changes_since_last_save:" << p.changesSinceSave << "\r\n";
+        info << "rdb_saves:" << p.saves << "\r\n";
+        info << "rdb_failed_saves:" << p.failedSaves << "\r\n";
+        info << "rdb_last_save_time:" << p.lastSaveTime << "\r\n";
+        info << "rdb_last_save_status:" << (p.lastSaveOk ? "ok" : "err") << "\r\n";
+        info << "rdb_last_save_duration_ms:" << p.lastSaveMs << "\r\n";
+    }
+    if (want("stats")) {
+        section("Stats");
+        info << "total_connections_received:" << redisstats::total(redisstats::CONNECTIONS) << "\r\n";
+        info << "total_commands_processed:" << redisstats::total(redisstats::COMMANDS) << "\r\n";
+        info << "total_error_replies:" << redisstats::total(redisstats::ERROR_REPLIES) << "\r\n";
+        info << "expired_keys:" << redisstats::total(redisstats::EXPIRED_KEYS) << "\r\n";
+        info << "slowlog_len:" << redisstats::slowlogLen() << "\r\n";
+    }
+    if (want("transactions")) {
+        uint64_t committed = txStats.committed, aborted = txStats.aborted, retries = txStats.retries;
+        uint64_t attempts = committed + aborted;
+        section("Transactions");
+        info << "tx_committed:" << committed << "\r\n";
+        info << "tx_aborted:" << aborted << "\r\n";
+        info << "tx_execabort:" << txStats.execAborts << "\r\n";
+        info << "tx_discarded:" << txStats.discarded << "\r\n";
+        info << "tx_retries:" << retries << "\r\n";
+        info << "tx_abort_rate:" << (attempts ? static_cast<double>(aborted) / attempts : 0.0) << "\r\n";
+        info << "tx_retry_rate:" << (attempts ? static_cast<double>(retries) / attempts : 0.0) << "\r\n";
+    }
+    if (want("pubsub")) {
+        redispubsub::stats ps = redispubsub::getInstance().getStats();
+        section("Pubsub");
+        info << "pubsub_channels:" << redispubsub::getInstance().channels("").size() << "\r\n";
+        info << "pubsub_patterns:" << redispubsub::getInstance().numpat() << "\r\n";
+        info << "pubsub_published:" << ps.published << "\r\n";
+        info << "pubsub_delivered:" << ps.delivered << "\r\n";
+        info << "pubsub_dropped_clients:" << ps.droppedClients << "\r\n";
+    }
+    if (want("tracking")) {
+        redistracking::stats ts = redistracking::getInstance().getStats();
+        section("Tracking");
+        info << "tracking_clients:" << ts.clients << "\r\n";
+        info << "tracking_total_keys:" << ts.trackedKeys << "\r\n";
+        info << "tracking_total_prefixes:" << ts.prefixes << "\r\n";
+        info << "tracking_invalidated_keys:" << ts.invalidatedKeys << "\r\n";
+        info << "tracking_invalidation_messages:" << ts.messages << "\r\n";
+        info << "tracking_coalesced:" << ts.coalesced << "\r\n";
+        info << "tracking_evicted_keys:" << ts.evictions << "\r\n";
+    }
+    if (want("network")) {
+        section("Network");
+        info << "io_backend:" << ns.backend << "\r\n";
+        info << "io_threads:" << ns.threads << "\r\n";
+        info << "io_commands:" << ns.commands << "\r\n";
+        info << "io_syscalls:" << ns.syscalls << "\r\n";
+        info << "io_syscalls_per_command:" << (ns.commands ? static_cast<double>(ns.syscalls) / ns.commands : 0.0) << "\r\n";
+        info << "io_forwarded:" << ns.forwarded << "\r\n";
+        info << "io_coordinated:" << ns.coordinated << "\r\n";
+    }
+    if (want("tiering") && redisdatabase::tierEnabled()) {
+        redisdatabase::tierstats ts = redisdatabase::tierStatistics();
+        uint64_t hits = redisstats::total(redisstats::TIER_MEMORY_HITS);
+        uint64_t reads = redisstats::total(redisstats::TIER_DISK_READS);
+        latencyhistogram cold = redisstats::coldReadLatency();
+        section("Tiering");
+        info << "tier_dir:" << ts.dir << "\r\n";
+        info << "tier_max_memory:" << ts.maxMemory << "\r\n";
+        info << "tier_hot_bytes:" << ts.hotBytes << "\r\n";
+        info << "tier_cold_keys:" << ts.coldKeys << "\r\n";
+        info << "tier_log_segments:" << ts.log.segments << "\r\n";
+        info << "tier_log_bytes:" << ts.log.fileBytes << "\r\n";
+        info << "tier_log_live_bytes:" << ts.log.liveBytes << "\r\n";
+        info << "tier_memory_hits:" << hits << "\r\n";
+        info << "tier_disk_reads:" << reads << "\r\n";
+        info << "tier_hit_ratio:" << (hits + reads ? static_cast<double>(hits) / (hits + reads) : 0.0) << "\r\n";
+        info << "tier_cold_read_p50_usec:" << cold.percentile(50) / 1000 << "\r\n";
+        info << "tier_cold_read_p99_usec:" << cold.percentile(99) / 1000 << "\r\n";
+        info << "tier_cold_read_max_usec:" << cold.maximum() / 1000 << "\r\n";
+        info << "tier_demotions:" << ts.demotions << "\r\n";
+        info << "tier_promotions:" << ts.promotions << "\r\n";
+        info << "tier_compactions:" << ts.log.compactions << "\r\n";
+        info << "tier_compacted_bytes:" << ts.log.compactedBytes << "\r\n";
+    }
+    if (want("compression")) {
+        redisdatabase::compressionstats cs = redisdatabase::compressionStatistics();
+        uint64_t calls = redisstats::total(redisstats::COMPRESS_CALLS);
+        uint64_t decompressions = redisstats::total(redisstats::DECOMPRESS_CALLS);
+        section("Compression");
+        info << "compression_min_size:" << cs.minSize << "\r\n";
+        info << "compressed_values:" << cs.values << "\r\n";
+        info << "compressed_raw_bytes:" << cs.rawBytes << "\r\n";
+        info << "compressed_stored_bytes:" << cs.storedBytes << "\r\n";
+        info << "compression_saved_bytes:" << cs.rawBytes - cs.storedBytes << "\r\n";
+        info << "compression_ratio:" << (cs.storedBytes ? static_cast<double>(cs.rawBytes) / cs.storedBytes : 0.0) << "\r\n";
+        info << "compress_calls:" << calls << "\r\n";
+        info << "compress_skipped:" << redisstats::total(redisstats::COMPRESS_SKIPPED) << "\r\n";
+        info << "compress_usec:" << redisstats::total(redisstats::COMPRESS_NS) / 1000 << "\r\n";
+        info << "decompress_calls:" << decompressions << "\r\n";
+        info << "decompress_usec:" << redisstats::total(redisstats::DECOMPRESS_NS) / 1000 << "\r\n";
+    }
+    if (want("commandstats", false)) {
+        section("Commandstats");
+        for (const auto& c : redisstats::commandStats()) {
+            info << "cmdstat_" << c.name << ":calls=" << c.calls << ",usec=" << c.usec << ",usec_per_call=";
+            info << std::fixed;
+            info.precision(2);
+            info << static_cast<double>(c.usec) / c.calls << ",failed_calls=" << c.failed << "\r\n";
+            info.unsetf(std::ios::floatfield);
+            info.precision(6);
+        }
+    }
+    if (want("keyspace")) {
+        size_t keys = 0, expires = 0;
+        for (size_t i = 0; i < redisdatabase::shardCount(); ++i) {
+            size_t e = 0;
+            keys += redisdatabase::shard(i).keyCount(e);
+            expires += e;
+        }
+        section("Keyspace");
+        if (keys > 0)
+            info << "db0:keys=" << keys << ",expires=" << expires << "\r\n";
+    }
+    std::string body = info.str();
+    return "$" + std::to_string(body.size()) + "\r\n" + body + "\r\n";
+}
+
+// SLOWLOG GET [count] | LEN | RESET. Entries follow Redis' layout; the
+// client address and name fields are sent empty.
+static std::string handleSlowlog(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: SLOWLOG requires GET, LEN or RESET\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "LEN")
+        return ":" + std::to_string(redisstats::slowlogLen()) + "\r\n";
+    if (sub == "RESET") {
+        redisstats::slowlogReset();
+        return "+OK\r\n";
+    }
+    if (sub != "GET")
+        return "-Error: SLOWLOG subcommands are GET, LEN and RESET\r\n";
+    int64_t count = 10;
+    if (tokens.size() > 2) {
+        try {
+            count = std::stoll(tokens[2]);
+        }
+        catch (const std::exception&) {
+            return "-Error: SLOWLOG GET count must be an integer\r\n";
+        }
+    }
+    std::vector<redisstats::slowentry> entries = redisstats::slowlog(count);
+    std::ostringstream out;
+    out << "*" << entries.size() << "\r\n";
+    for (const auto& e : entries) {
+        out << "*6\r\n:" << e.id << "\r\n:" << e.time << "\r\n:" << e.usec << "\r\n*" << e.args.size() << "\r\n";
+        for (const auto& a : e.args)
+            out << "$" << a.size() << "\r\n" << a << "\r\n";
+        out << "$0\r\n\r\n$0\r\n\r\n";
+    }
+    return out.str();
+}
+
+// LATENCY LATEST | HISTORY event | RESET [event ...]
+static std::string handleLatency(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: LATENCY requires LATEST, HISTORY or RESET\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "RESET")
+        return ":" + std::to_string(redisstats::latencyReset(
+            std::vector<std::string>(tokens.begin() + 2, tokens.end()))) + "\r\n";
+    std::vector<redisstats::latencyevent> events = redisstats::latencyEvents();
+    std::ostringstream out;
+    if (sub == "LATEST") {
+        out << "*" << events.size() << "\r\n";
+        for (const auto& e : events) {
+            out << "*4\r\n$" << e.name.size() << "\r\n" << e.name << "\r\n:" << e.latestTime << "\r\n:"
+                << e.latestMs << "\r\n:" << e.maxMs << "\r\n";
+        }
+        return out.str();
+    }
+    if (sub == "HISTORY" && tokens.size() == 3) {
+        for (const auto& e : events) {
+            if (e.name != tokens[2])
+                continue;
+            out << "*" << e.history.size() << "\r\n";
+            for (const auto& sample : e.history)
+                out << "*2\r\n:" << sample.first << "\r\n:" << sample.second << "\r\n";
+            return out.str();
+        }
+        return "*0\r\n";
+    }
+    return "-Error: LATENCY subcommands are LATEST, HISTORY event and RESET [event ...]\r\n";
+}
+
+// MEMORY USAGE key [SAMPLES n] | STATS | BIGKEYS [START [COUNT n] | STOP] | HOTKEYS [COUNT n]
+static const size_t MEMORY_TOP_MAX = 1000;
+
+// An optional "<option> n" at tokens[at]; false when it is malformed.
+static bool parseMemoryOption(const std::vector<std::string>& tokens, size_t at, const char* option, size_t& n) {
+    if (tokens.size() <= at)
+        return true;
+    std::string name = tokens[at];
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    if (name != option || tokens.size() != at + 2)
+        return false;
+    int64_t value = 0;
+    if (!parseInteger(tokens[at + 1], value) || value < 0)
+        return false;
+    n = static_cast<size_t>(value);
+    return true;
+}
+
+static std::string memoryStats() {
+    uint64_t rss = 0, peak = 0;
+    redisstats::memoryUsage(rss, peak);
+    redisdatabase::memorystats m = redisdatabase::memoryStatistics();
+    uint64_t dataset = 0;
+    for (const auto& row : m.rows)
+        dataset += row.bytes;
+    std::vector<std::pair<std::string, uint64_t>> fields = {
+        { "rss.bytes", rss }, { "peak.rss.bytes", peak }, { "keys.count", m.keys }, { "expires.count", m.expires },
+        { "keyspace.tables.bytes", m.tableBytes }, { "dataset.bytes", dataset },
+    };
+    for (const auto& row : m.rows) {
+        std::string name = std::string(redisdatabase::typeName(row.type)) + "." + row.encoding;
+        fields.emplace_back(name + ".keys", row.keys);
+        fields.emplace_back(name + ".bytes", row.bytes);
+    }
+    std::ostringstream out;
+    out << "*" << fields.size() * 2 << "\r\n";
+    for (const auto& f : fields)
+        out << "$" << f.first.size() << "\r\n" << f.first << "\r\n:" << f.second << "\r\n";
+    return out.str();
+}
+
+static std::string bigKeysReport() {
+    redismemory::scanreport r = redismemory::scanReport();
+    std::ostringstream out;
+    auto name = [&](const std::string& s) { out << "$" << s.size() << "\r\n" << s << "\r\n"; };
+    auto number = [&](const char* field, uint64_t n) {
+        name(field);
+        out << ":" << n << "\r\n";
+    };
+    out << "*18\r\n";
+    name("state");
+    name(r.state);
+    number("start_time", static_cast<uint64_t>(r.startTime));
+    number("elapsed_ms", r.elapsedMs);
+    number("scanned_keys", r.keys);
+    number("slices", r.slices);
+    number("busy_us", r.busyUs);
+    number("max_slice_us", r.maxSliceUs);
+    name("types");
+    out << "*" << static_cast<int>(redisdatabase::KEY_TYPES) << "\r\n";
+    for (int t = 0; t < redisdatabase::KEY_TYPES; ++t) {
+        out << "*4\r\n";
+        name(redisdatabase::typeName(static_cast<redisdatabase::keytype>(t)));
+        out << ":" << r.totals[t].keys << "\r\n:" << r.totals[t].bytes << "\r\n:" << r.totals[t].elements << "\r\n";
+    }
+    name("biggest");
+    out << "*" << r.biggest.size() << "\r\n";
+    for (const auto& e : r.biggest) {
+        out << "*4\r\n";
+        name(redisdatabase::typeName(e.type));
+        name(e.key);
+        out << ":" << e.bytes << "\r\n:" << e.elements << "\r\n";
+    }
+    return out.str();
+}
+
+static std::string handleMemory(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: MEMORY requires a subcommand\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "USAGE") {
+        size_t samples = redisdatabase::MEMORY_SAMPLES;
+        if (tokens.size() < 3 || !parseMemoryOption(tokens, 3, "SAMPLES", samples))
+            return "-Error: MEMORY USAGE key [SAMPLES count]\r\n";
+        uint64_t bytes = 0;
+        if (!db.memoryUsage(tokens[2], samples, bytes))
+            return "$-1\r\n";
+        return ":" + std::to_string(bytes) + "\r\n";
+    }
+    if (sub == "STATS" && tokens.size() == 2)
+        return memoryStats();
+    if (sub == "BIGKEYS") {
+        std::string action = tokens.size() > 2 ? tokens[2] : "";
+        std::transform(action.begin(), action.end(), action.begin(), ::toupper);
+        if (action.empty())
+            return bigKeysReport();
+        if (action == "START") {
+            size_t top = 10;
+            if (!parseMemoryOption(tokens, 3, "COUNT", top) || top == 0 || top > MEMORY_TOP_MAX)
+                return "-Error: MEMORY BIGKEYS START [COUNT 1-" + std::to_string(MEMORY_TOP_MAX) + "]\r\n";
+            if (!redismemory::startScan(top))
+                return "-Error: a big-key scan is already running\r\n";
+            return "+OK\r\n";
+        }
+        if (action == "STOP" && tokens.size() == 3) {
+            if (!redismemory::stopScan())
+                return "-Error: no big-key scan is running\r\n";
+            return "+OK\r\n";
+        }
+        return "-Error: MEMORY BIGKEYS [START [COUNT n] | STOP]\r\n";
+    }
+    if (sub == "HOTKEYS") {
+        size_t count = 10;
+        if (!parseMemoryOption(tokens, 2, "COUNT", count))
+            return "-Error: MEMORY HOTKEYS [COUNT n]\r\n";
+        std::vector<redismemory::hotkey> hot = redismemory::hotKeys(count);
+        std::ostringstream out;
+        out << "*" << hot.size() << "\r\n";
+        for (const auto& h : hot)
+            out << "*2\r\n$" << h.key.size() << "\r\n" << h.key << "\r\n:" << h.accesses << "\r\n";
+        return out.str();
+    }
+    return "-Error: MEMORY subcommands are USAGE, STATS, BIGKEYS and HOTKEYS\r\n";
+}
+
+// Keyspace Notifications
+enum keyspaceflag : uint32_t { NOTIFY_KEYSPACE = 1, NOTIFY_KEYEVENT = 2 };
+static const char* const NOTIFY_CLASSES = "g$lhxtd"; // A is an alias for all of them
+static std::atomic<uint32_t> keyspaceEvents{ 0 };   // NOTIFY_* bits, then one bit per class
+
+// Event classes as in Redis; vector set and chat events count as 'd'
+// (module key types).
+static char eventClass(const char* event) {
+    static const std::pair<const char*, char> classes[] = {
+        { "set", '$' }, { "pfadd", '$' }, { "del", 'g' }, { "expire", 'g' }, { "rename_from", 'g' },
+        { "rename_to", 'g' }, { "restore", 'g' }, { "expired", 'x' }, { "hset", 'h' }, { "hdel", 'h' },
+    };
+    for (const auto& c : classes) {
+        if (std::strcmp(c.first, event) == 0)
+            return c.second;
+    }
+    if (event[0] == 'l' || event[0] == 'r')
+        return 'l';
+    if (event[0] == 'x')
+        return 't';
+    return 'd';
+}
+
+static bool parseKeyspaceEvents(const std::string& spec, uint32_t& flags) {
+    flags = 0;
+    std::string classes = NOTIFY_CLASSES;
+    for (char c : spec) {
+        if (c == 'K')
+            flags |= NOTIFY_KEYSPACE;
+        else if (c == 'E')
+            flags |= NOTIFY_KEYEVENT;
+        else if (c == 'A')
+            flags |= ((1u << classes.size()) - 1) << 2;
+        else if (classes.find(c) != std::string::npos)
+            flags |= 1u << (2 + classes.find(c));
+        else
+            return false;
+    }
+    return true;
+}
+
+static std::string keyspaceEventsString(uint32_t flags) {
+    std::string classes = NOTIFY_CLASSES, out;
+    for (size_t i = 0; i < classes.size(); ++i) {
+        if (flags & (1u << (2 + i)))
+            out += classes[i];
+    }
+    if (out.size() == classes.size())
+        out = "A";
+    if (flags & NOTIFY_KEYSPACE)
+        out += 'K';
+    if (flags & NOTIFY_KEYEVENT)
+        out += 'E';
+    return out;
+}
+
+// Registered with the database; runs under its lock for every modified key.
+static void onKeyspaceEvent(const std::string& key, const char* event) {
+    redistracking& tracking = redistracking::getInstance();
+    if (key.empty()) {
+        if (tracking.active())
+            tracking.invalidateAll();
+        return;
+    }
+    if (tracking.active())
+        tracking.invalidate(key);
+
+    uint32_t flags = keyspaceEvents.load(std::memory_order_relaxed);
+    if (!(flags & (NOTIFY_KEYSPACE | NOTIFY_KEYEVENT)))
+        return;
+    const char* classes = NOTIFY_CLASSES;
+    if (!(flags & (1u << (2 + (std::strchr(classes, eventClass(event)) - classes)))))
+        return;
+    redispubsub& pubsub = redispubsub::getInstance();
+    if (flags & NOTIFY_KEYSPACE)
+        pubsub.publish("__keyspace@0__:" + key, event);
+    if (flags & NOTIFY_KEYEVENT)
+        pubsub.publish(std::string("__keyevent@0__:") + event, key);
+}
+
+static std::string handleConfig(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: CONFIG requires GET or SET and a parameter\r\n";
+    std::string sub = tokens[1], param = tokens[2];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    std::transform(param.begin(), param.end(), param.begin(), ::tolower);
+    redistracking& tracking = redistracking::getInstance();
+    if (sub == "GET") {
+        std::string value;
+        if (param == "notify-keyspace-events")
+            value = keyspaceEventsString(keyspaceEvents);
+        else if (param == "tracking-table-max-keys")
+            value = std::to_string(tracking.maxKeys());
+        else if (param == "slowlog-log-slower-than")
+            value = std::to_string(redisstats::slowlogThreshold());
+        else if (param == "slowlog-max-len")
+            value = std::to_string(redisstats::slowlogMaxLen());
+        else if (param == "latency-monitor-threshold")
+            value = std::to_string(redisstats::latencyThreshold());
+        else if (param == "tier-max-memory" && redisdatabase::tierEnabled())
+            value = std::to_string(redisdatabase::tierMaxMemory());
+        else if (param == "compression-min-size")
+            value = std::to_string(redisdatabase::compressionMinSize());
+        else
+            return "*0\r\n";
+        return "*2\r\n$" + std::to_string(param.size()) + "\r\n" + param + "\r\n$" +
+            std::to_string(value.size()) + "\r\n" + value + "\r\n";
+    }
+    if (sub == "SET" && tokens.size() == 4) {
+        if (param == "notify-keyspace-events") {
+            uint32_t flags = 0;
+            if (!parseKeyspaceEvents(tokens[3], flags))
+                return "-Error: Invalid event class character. Use 'g$lhxtdKEA'.\r\n";
+            keyspaceEvents = flags;
+            return "+OK\r\n";
+        }
+        if (param == "tracking-table-max-keys") {
+            try {
+                long long n = std::stoll(tokens[3]);
+                if (n < 0)
+                    throw std::invalid_argument("negative");
+                tracking.setMaxKeys(static_cast<size_t>(n));
+            }
+            catch (const std::exception&) {
+                return "-Error: tracking-table-max-keys must be a non-negative integer\r\n";
+            }
+            return "+OK\r\n";
+        }
+        if (param == "slowlog-log-slower-than" || param == "slowlog-max-len" || param == "latency-monitor-threshold") {
+            long long n = 0;
+            try {
+                n = std::stoll(tokens[3]);
+            }
+            catch (const std::exception&) {
+                return "-Error: " + param + " must be an integer\r\n";
+            }
+            if (param == "slowlog-log-slower-than") {
+                redisstats::setSlowlogThreshold(n);
+                return "+OK\r\n";
+            }
+            if (n < 0)
+                return "-Error: " + param + " must be a non-negative integer\r\n";
+            if (param == "slowlog-max-len")
+                redisstats::setSlowlogMaxLen(static_cast<size_t>(n));
+            else
+                redisstats::setLatencyThreshold(static_cast<uint64_t>(n));
+            return "+OK\r\n";
+        }
+        if (param == "tier-max-memory") {
+            if (!redisdatabase::tierEnabled())
+                return "-Error: tiered storage is off; start the server with --tier-dir\r\n";
+            try {
+                long long n = std::stoll(tokens[3]);
+                if (n < 0)
+                    throw std::invalid_argument("negative");
+                redisdatabase::setTierMaxMemory(static_cast<uint64_t>(n));
+            }
+            catch (const std::exception&) {
+                return "-Error: tier-max-memory must be a non-negative integer\r\n";
+            }
+            return "+OK\r\n";
+        }
+        if (param == "compression-min-size") {
+            try {
+                long long n = std::stoll(tokens[3]);
+                if (n < 0)
+                    throw std::invalid_argument("negative");
+                redisdatabase::setCompressionMinSize(static_cast<uint64_t>(n));
+            }
+            catch (const std::exception&) {
+                return "-Error: compression-min-size must be a non-negative integer\r\n";
+            }
+            return "+OK\r\n";
+        }
+        return "-Error: Unsupported CONFIG parameter\r\n";
+    }
+    return "-Error: CONFIG subcommands are GET and SET\r\n";
+}
+
+// Pub/Sub Operations
+static std::string subscriptionReply(const char* kind, const std::string* name, size_t count) {
+    std::ostringstream oss;
+    oss << "*3\r\n$" << std::strlen(kind) << "\r\n" << kind << "\r\n";
+    if (name)
+        oss << "$" << name->size() << "\r\n" << *name << "\r\n";
+    else
+        oss << "$-1\r\n";
+    oss << ":" << count << "\r\n";
+    return oss.str();
+}
+
+static std::string handleSubscribe(const std::vector<std::string>& tokens, redisclient& client, bool pattern) {
+    if (tokens.size() < 2)
+        return pattern ? "-Error: PSUBSCRIBE requires pattern\r\n" : "-Error: SUBSCRIBE requires channel\r\n";
+    redispubsub& pubsub = redispubsub::getInstance();
+    if (!client.output) {
+        client.output = std::make_shared<redisoutput>();
+        redistracking::getInstance().registerOutput(client.id, client.output);
+    }
+    std::string reply;
+    for (size_t i = 1; i < tokens.size(); ++i) {
+        if (pattern) {
+            if (client.patterns.insert(tokens[i]).second)
+                pubsub.psubscribe(tokens[i], client.output);
+        }
+        else if (client.channels.insert(tokens[i]).second) {
+            pubsub.subscribe(tokens[i], client.output);
+        }
+        reply += subscriptionReply(pattern ? "psubscribe" : "subscribe", &tokens[i], client.subscriptions());
+    }
+    return reply;
+}
+
+static std::string handleUnsubscribe(const std::vector<std::string>& tokens, redisclient& client, bool pattern) {
+    redispubsub& pubsub = redispubsub::getInstance();
+    std::set<std::string>& subs = pattern ? client.patterns : client.channels;
+    const char* kind = pattern ? "punsubscribe" : "unsubscribe";
+    std::vector<std::string> names(tokens.begin() + 1, tokens.end());
+    if (names.empty())
+        names.assign(subs.begin(), subs.end());
+    if (names.empty())
+        return subscriptionReply(kind, nullptr, client.subscriptions());
+    std::string reply;
+    for (const auto& name : names) {
+        if (subs.erase(name) && client.output) {
+            if (pattern)
+                pubsub.punsubscribe(name, client.output);
+            else
+                pubsub.unsubscribe(name, client.output);
+        }
+        reply += subscriptionReply(kind, &name, client.subscriptions());
+    }
+    return reply;
+}
+
+static std::string handlePublish(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: PUBLISH requires channel and message\r\n";
+    return ":" + std::to_string(redispubsub::getInstance().publish(tokens[1], tokens[2])) + "\r\n";
+}
+
+static std::string handlePubsub(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: PUBSUB requires a subcommand\r\n";
+    redispubsub& pubsub = redispubsub::getInstance();
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    std::ostringstream oss;
+    if (sub == "CHANNELS") {
+        auto names = pubsub.channels(tokens.size() > 2 ? tokens[2] : "");
+        oss << "*" << names.size() << "\r\n";
+        for (const auto& n : names)
+            oss << "$" << n.size() << "\r\n" << n << "\r\n";
+    }
+    else if (sub == "NUMSUB") {
+        oss << "*" << (tokens.size() - 2) * 2 << "\r\n";
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            oss << "$" << tokens[i].size() << "\r\n" << tokens[i] << "\r\n";
+            oss << ":" << pubsub.numsub(tokens[i]) << "\r\n";
+        }
+    }
+    else if (sub == "NUMPAT") {
+        oss << ":" << pubsub.numpat() << "\r\n";
+    }
+    else {
+        return "-Error: PUBSUB subcommands are CHANNELS, NUMSUB and NUMPAT\r\n";
+    }
+    return oss.str();
+}
+
+// Cluster Operations
+static bool parseSlot(const std::string& token, int& slot) {
+    char* end = nullptr;
+    long v = std::strtol(token.c_str(), &end, 10);
+    if (token.empty() || *end != '\0' || v < 0 || v >= rediscluster::SLOTS)
+        return false;
+    slot = static_cast<int>(v);
+    return true;
+}
+
+static std::string bulkString(const std::string& s) {
+    return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+// Contiguous runs of slots with the same owner, as (start, end, node)
+static std::vector<std::tuple<int, int, int>> slotRanges(rediscluster& cluster) {
+    std::vector<std::tuple<int, int, int>> ranges;
+    for (int slot = 0; slot < rediscluster::SLOTS; ++slot) {
+        int owner = cluster.owner(slot);
+        if (owner < 0)
+            continue;
+        if (!ranges.empty() && std::get<1>(ranges.back()) == slot - 1 && std::get<2>(ranges.back()) == owner)
+            std::get<1>(ranges.back()) = slot;
+        else
+            ranges.emplace_back(slot, slot, owner);
+    }
+    return ranges;
+}
+
+static std::string clusterInfo(rediscluster& cluster) {
+    auto ranges = slotRanges(cluster);
+    size_t assigned = 0;
+    std::set<int> owners;
+    for (const auto& r : ranges) {
+        assigned += std::get<1>(r) - std::get<0>(r) + 1;
+        owners.insert(std::get<2>(r));
+    }
+    rediscluster::stats st = cluster.getStats();
+    std::ostringstream info;
+    info << "cluster_enabled:1\r\n";
+    info << "cluster_state:" << (assigned == rediscluster::SLOTS ? "ok" : "fail") << "\r\n";
+    info << "cluster_slots_assigned:" << assigned << "\r\n";
+    info << "cluster_known_nodes:" << cluster.nodes().size() << "\r\n";
+    info << "cluster_size:" << owners.size() << "\r\n";
+    info << "cluster_redirects_moved:" << st.moved << "\r\n";
+    info << "cluster_redirects_ask:" << st.asked << "\r\n";
+    info << "cluster_migrated_keys:" << st.migratedKeys << "\r\n";
+    info << "cluster_migrated_slots:" << st.migratedSlots << "\r\n";
+    return bulkString(info.str());
+}
+
+static std::string clusterNodes(rediscluster& cluster) {
+    auto all = cluster.nodes();
+    std::vector<std::string> lines(all.size());
+    for (size_t i = 0; i < all.size(); ++i) {
+        lines[i] = all[i].id + " " + all[i].host + ":" + std::to_string(all[i].port) + "@" +
+            std::to_string(all[i].port + 10000) + (i == 0 ? " myself,master" : " master") + " - 0 0 0 connected";
+    }
+    for (const auto& r : slotRanges(cluster)) {
+        std::string& line = lines[std::get<2>(r)];
+        line += " " + std::to_string(std::get<0>(r));
+        if (std::get<1>(r) != std::get<0>(r))
+            line += "-" + std::to_string(std::get<1>(r));
+    }
+    for (int slot = 0; slot < rediscluster::SLOTS; ++slot) {
+        if (cluster.migrating(slot) >= 0)
+            lines[0] += " [" + std::to_string(slot) + "->-" + all[cluster.migrating(slot)].id + "]";
+        if (cluster.importing(slot) >= 0)
+            lines[0] += " [" + std::to_string(slot) + "-<-" + all[cluster.importing(slot)].id + "]";
+    }
+    std::string text;
+    for (const auto& line : lines)
+        text += line + "\n";
+    return bulkString(text);
+}
+
+static std::string handleCluster(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: CLUSTER requires a subcommand\r\n";
+    rediscluster& cluster = rediscluster::getInstance();
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "KEYSLOT") {
+        if (tokens.size() != 3)
+            return "-Error: CLUSTER KEYSLOT requires key\r\n";
+        return ":" + std::to_string(rediscluster::keySlot(tokens[2])) + "\r\n";
+    }
+    if (!cluster.enabled())
+        return "-Error: This instance has cluster support disabled\r\n";
+
+    int slot = 0;
+    if (sub == "INFO")
+        return clusterInfo(cluster);
+    if (sub == "MYID")
+        return bulkString(cluster.nodeAt(0).id);
+    if (sub == "NODES")
+        return clusterNodes(cluster);
+    if (sub == "SLOTS") {
+        auto ranges = slotRanges(cluster);
+        std::ostringstream oss;
+        oss << "*" << ranges.size() << "\r\n";
+        for (const auto& r : ranges) {
+            rediscluster::node n = cluster.nodeAt(std::get<2>(r));
+            oss << "*3\r\n:" << std::get<0>(r) << "\r\n:" << std::get<1>(r) << "\r\n";
+            oss << "*3\r\n" << bulkString(n.host) << ":" << n.port << "\r\n" << bulkString(n.id);
+        }
+        return oss.str();
+    }
+    if (sub == "COUNTKEYSINSLOT" || sub == "GETKEYSINSLOT") {
+        if (tokens.size() < 3 || !parseSlot(tokens[2], slot))
+            return "-Error: Invalid or out of range slot\r\n";
+        if (sub == "COUNTKEYSINSLOT")
+            return ":" + std::to_string(cluster.keysInSlot(slot, 0).size()) + "\r\n";
+        size_t count = 0;
+        if (tokens.size() != 4 || !parseCount(tokens[3], count))
+            return "-Error: CLUSTER GETKEYSINSLOT requires slot and count\r\n";
+        auto keys = cluster.keysInSlot(slot, count);
+        std::string reply = "*" + std::to_string(keys.size()) + "\r\n";
+        for (const auto& k : keys)
+            reply += bulkString(k);
+        return reply;
+    }
+    if (sub == "MEET") {
+        if (tokens.size() != 4)
+            return "-Error: CLUSTER MEET requires host and port\r\n";
+        cluster.addNode(tokens[2] == "localhost" ? "127.0.0.1" : tokens[2], std::atoi(tokens[3].c_str()));
+        return "+OK\r\n";
+    }
+    if (sub == "ADDSLOTS" || sub == "DELSLOTS" || sub == "ADDSLOTSRANGE") {
+        std::vector<int> slots;
+        bool range = sub == "ADDSLOTSRANGE";
+        if (tokens.size() < 3 || (range && tokens.size() % 2 != 0))
+            return "-Error: wrong number of arguments for CLUSTER " + sub + "\r\n";
+        for (size_t i = 2; i < tokens.size(); i += range ? 2 : 1) {
+            int lo = 0, hi = 0;
+            if (!parseSlot(tokens[i], lo) || (range && !parseSlot(tokens[i + 1], hi)))
+                return "-Error: Invalid or out of range slot\r\n";
+            for (int s = lo; s <= (range ? hi : lo); ++s)
+                slots.push_back(s);
+        }
+        bool add = sub != "DELSLOTS";
+        for (int s : slots) {
+            if (add && cluster.owner(s) >= 0)
+                return "-Error: Slot " + std::to_string(s) + " is already busy\r\n";
+        }
+        for (int s : slots)
+            cluster.setOwner(s, add ? 0 : -1);
+        return "+OK\r\n";
+    }
+    if (sub == "SETSLOT") {
+        if (tokens.size() < 4 || !parseSlot(tokens[2], slot))
+            return "-Error: CLUSTER SETSLOT requires slot and action\r\n";
+        std::string action = tokens[3];
+        std::transform(action.begin(), action.end(), action.begin(), ::toupper);
+        if (action == "STABLE") {
+            cluster.setStable(slot);
+            return "+OK\r\n";
+        }
+        int index = tokens.size() == 5 ? cluster.findNode(tokens[4]) : -1;
+        if (index < 0)
+            return "-Error: Unknown node\r\n";
+        if (action == "NODE")
+            cluster.setOwner(slot, index);
+        else if (action == "MIGRATING" && cluster.owner(slot) == 0)
+            cluster.setMigrating(slot, index);
+        else if (action == "IMPORTING" && cluster.owner(slot) != 0)
+            cluster.setImporting(slot, index);
+        else
+            return "-Error: CLUSTER SETSLOT " + action + " is not valid for slot " + std::to_string(slot) + "\r\n";
+        return "+OK\r\n";
+    }
+    if (sub == "RESHARD") {
+        // CLUSTER RESHARD slot node-id [BATCH n]
+        size_t batch = 100;
+        if (tokens.size() < 4 || !parseSlot(tokens[2], slot))
+            return "-Error: CLUSTER RESHARD requires slot and target node\r\n";
+        if (tokens.size() == 6 && (!parseCount(tokens[5], batch) || batch == 0))
+            return "-Error: BATCH must be a positive integer\r\n";
+        size_t moved = 0;
+        std::string err;
+        if (!cluster.reshard(slot, cluster.findNode(tokens[3]), batch, moved, err))
+            return "-Error: " + err + " (" + std::to_string(moved) + " keys moved)\r\n";
+        return ":" + std::to_string(moved) + "\r\n";
+    }
+    return "-Error: Unknown CLUSTER subcommand\r\n";
+}
+
+static std::string handleDump(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() != 2)
+        return "-Error: DUMP requires key\r\n";
+    std::string payload;
+    int64_t ttl = 0;
+    if (!db.dumpKey(tokens[1], payload, ttl))
+        return "$-1\r\n";
+    return bulkString(payload);
+}
+
+static std::string handleRestore(const std::vector<std::string>& tokens, redisdatabase& db) {
+    // RESTORE key ttl payload [REPLACE]
+    if (tokens.size() < 4)
+        return "-Error: RESTORE requires key, ttl and payload\r\n";
+    char* end = nullptr;
+    long long ttl = std::strtoll(tokens[2].c_str(), &end, 10);
+    if (*end != '\0' || ttl < 0)
+        return "-Error: Invalid TTL value, must be >= 0\r\n";
+    bool replace = false;
+    for (size_t i = 4; i < tokens.size(); ++i) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt != "REPLACE")
+            return "-Error: syntax error\r\n";
+        replace = true;
+    }
+    std::string err;
+    if (!db.restoreKey(tokens[1], tokens[3], ttl, replace, err))
+        return "-" + err + "\r\n";
+    return "+OK\r\n";
+}
+
+static std::string handleMigrate(const std::vector<std::string>& tokens, redisdatabase& db) {
+    // MIGRATE host port key|"" destination-db timeout [COPY] [REPLACE] [KEYS key ...]
+    if (tokens.size() < 6)
+        return "-Error: MIGRATE requires host, port, key, db and timeout\r\n";
+    bool copy = false, replace = false;
+    std::vector<std::string> keys;
+    if (!tokens[3].empty())
+        keys.push_back(tokens[3]);
+    for (size_t i = 6; i < tokens.size(); ++i) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "COPY")
+            copy = true;
+        else if (opt == "REPLACE")
+            replace = true;
+        else if (opt == "KEYS" && tokens[3].empty()) {
+            keys.assign(tokens.begin() + i + 1, tokens.end());
+            break;
+        }
+        else
+            return "-Error: syntax error\r\n";
+    }
+    int timeout = std::atoi(tokens[5].c_str());
+    size_t moved = 0;
+    std::string err;
+    if (!rediscluster::getInstance().migrate(tokens[1], std::atoi(tokens[2].c_str()), keys,
+        timeout > 0 ? timeout : 1000, copy, replace, moved, err))
+        return "-" + err + "\r\n";
+    return moved ? "+OK\r\n" : "+NOKEY\r\n";
+}
+
+static std::string handleEval(const std::vector<std::string>& tokens, redisdatabase& db);
+static std::string handleEvalsha(const std::vector<std::string>& tokens, redisdatabase& db);
+static std::string handleScript(const std::vector<std::string>& tokens, redisdatabase& db);
+
+typedef std::string (*commandfn)(const std::vector<std::string>& tokens, redisdatabase& db);
+
+enum commandflag { CMD_READONLY = 1, CMD_WRITE = 2 };
+
+// Key positions use Redis' (first, last, step) triple, with a negative last
+// counting from the end and firstKey 0 meaning the command takes no keys.
+static const int KEYS_NUMKEYS = -1; // EVAL style: count at tokens[2], keys follow
+static const int KEYS_STREAMS = -2; // XREAD style: first half of the args after STREAMS
+static const int KEYS_MIGRATE = -3; // tokens[3], or everything after KEYS when that is empty
+static const int KEYS_MEMORY = -4;  // tokens[2] of MEMORY USAGE; other subcommands take none
+
+struct commanddef {
+    commandfn fn;
+    int flags;
+    int firstKey;
+    int lastKey;
+    int keyStep;
+    int statsSlot = -1; // INFO commandstats, assigned when the table is built
+};
+
+// Connection-state commands handled before the table lookup; they get
+// commandstats slots too.
+static const char* const CONNECTION_COMMANDS[] = {
+    "MULTI", "EXEC", "DISCARD", "WATCH", "UNWATCH", "SUBSCRIBE", "PSUBSCRIBE",
+    "UNSUBSCRIBE", "PUNSUBSCRIBE", "CLIENT", "ASKING",
+};
+
+static std::unordered_map<std::string, commanddef> withStatsSlots(std::unordered_map<std::string, commanddef> table) {
+    std::vector<std::string> names;
+    for (const auto& entry : table)
+        names.push_back(entry.first);
+    std::sort(names.begin(), names.end());
+    for (const auto& name : names)
+        table[name].statsSlot = redisstats::registerCommand(name);
+    for (const char* name : CONNECTION_COMMANDS)
+        redisstats::registerCommand(name);
+    return table;
+}
+
+// Command name -> handler, flags and key positions. Looked up once per command
+// instead of walking a chain of string compares, and used by MULTI to
+// validate queued commands.
+static const std::unordered_map<std::string, commanddef>& commandTable() {
+    static const std::unordered_map<std::string, commanddef> table = withStatsSlots({
+        { "PING", { handlePing, 0, 0, 0, 0 } },
+        { "ECHO", { handleEcho, 0, 0, 0, 0 } },
+        { "FLUSHALL", { handleFlushAll, CMD_WRITE, 0, 0, 0 } },
+        { "INFO", { handleInfo, 0, 0, 0, 0 } },
+        { "CONFIG", { handleConfig, 0, 0, 0, 0 } },
+        { "SLOWLOG", { handleSlowlog, 0, 0, 0, 0 } },
+        { "LATENCY", { handleLatency, 0, 0, 0, 0 } },
+        { "MEMORY", { handleMemory, CMD_READONLY, KEYS_MEMORY, 0, 0 } },
+        { "CLUSTER", { handleCluster, 0, 0, 0, 0 } },
+        // Key/Value Operations
+        { "SET", { handleSet, CMD_WRITE, 1, 1, 1 } },
+        { "GET", { handleGet, CMD_READONLY, 1, 1, 1 } },
+        { "STRLEN", { handleStrlen, CMD_READONLY, 1, 1, 1 } },
+        { "KEYS", { handleKeys, CMD_READONLY, 0, 0, 0 } },
+        { "TYPE", { handleType, CMD_READONLY, 1, 1, 1 } },
+        { "DEL", { handleDel, CMD_WRITE, 1, 1, 1 } },
+        { "UNLINK", { handleDel, CMD_WRITE, 1, 1, 1 } },
+        { "EXPIRE", { handleExpire, CMD_WRITE, 1, 1, 1 } },
+        { "RENAME", { handleRename, CMD_WRITE, 1, 2, 1 } },
+        { "DUMP", { handleDump, CMD_READONLY, 1, 1, 1 } },
+        { "RESTORE", { handleRestore, CMD_WRITE, 1, 1, 1 } },
+        { "RESTORE-ASKING", { handleRestore, CMD_WRITE, 1, 1, 1 } },
+        { "MIGRATE", { handleMigrate, CMD_WRITE, KEYS_MIGRATE, 0, 0 } },
+        // List Operations
+        { "LGET", { handleLget, CMD_READONLY, 1, 1, 1 } },
+        { "LLEN", { handleLlen, CMD_READONLY, 1, 1, 1 } },
+        { "LPUSH", { handleLpush, CMD_WRITE, 1, 1, 1 } },
+        { "RPUSH", { handleRpush, CMD_WRITE, 1, 1, 1 } },
+        { "LPOP", { handleLpop, CMD_WRITE, 1, 1, 1 } },
+        { "RPOP", { handleRpop, CMD_WRITE, 1, 1, 1 } },
+        { "LREM", { handleLrem, CMD_WRITE, 1, 1, 1 } },
+        { "LINDEX", { handleLindex, CMD_READONLY, 1, 1, 1 } },
+        { "LSET", { handleLset, CMD_WRITE, 1, 1, 1 } },
+        // Hash Operations
+        { "HSET", { handleHset, CMD_WRITE, 1, 1, 1 } },
+        { "HGET", { handleHget, CMD_READONLY, 1, 1, 1 } },
+        { "HEXISTS", { handleHexists, CMD_READONLY, 1, 1, 1 } },
+        { "HDEL", { handleHdel, CMD_WRITE, 1, 1, 1 } },
+        { "HGETALL", { handleHgetall, CMD_READONLY, 1, 1, 1 } },
+        { "HKEYS", { handleHkeys, CMD_READONLY, 1, 1, 1 } },
+        { "HVALS", { handleHvals, CMD_READONLY, 1, 1, 1 } },
+        { "HLEN", { handleHlen, CMD_READONLY, 1, 1, 1 } },
+        { "HMSET", { handleHmset, CMD_WRITE, 1, 1, 1 } },
+        // HyperLogLog Operations
+        { "PFADD", { handlePfadd, CMD_WRITE, 1, 1, 1 } },
+        { "PFCOUNT", { handlePfcount, CMD_READONLY, 1, -1, 1 } },
+        { "PFMERGE", { handlePfmerge, CMD_WRITE, 1, -1, 1 } },
+        // Bitmap Operations
+        { "SETBIT", { handleSetbit, CMD_WRITE, 1, 1, 1 } },
+        { "GETBIT", { handleGetbit, CMD_READONLY, 1, 1, 1 } },
+        { "BITCOUNT", { handleBitcount, CMD_READONLY, 1, 1, 1 } },
+        { "BITPOS", { handleBitpos, CMD_READONLY, 1, 1, 1 } },
+        { "BITOP", { handleBitop, CMD_WRITE, 2, -1, 1 } },
+        { "BITFIELD", { handleBitfield, CMD_WRITE, 1, 1, 1 } },
+        { "BITFIELD_RO", { handleBitfieldRo, CMD_READONLY, 1, 1, 1 } },
+        // Stream Operations
+        { "XADD", { handleXadd, CMD_WRITE, 1, 1, 1 } },
+        { "XRANGE", { handleXrange, CMD_READONLY, 1, 1, 1 } },
+        { "XREVRANGE", { handleXrevrange, CMD_READONLY, 1, 1, 1 } },
+        { "XLEN", { handleXlen, CMD_READONLY, 1, 1, 1 } },
+        { "XTRIM", { handleXtrim, CMD_WRITE, 1, 1, 1 } },
+        { "XREAD", { handleXread, CMD_READONLY, KEYS_STREAMS, 0, 0 } },
+        { "XGROUP", { handleXgroup, CMD_WRITE, 2, 2, 1 } },
+        { "XREADGROUP", { handleXreadgroup, CMD_WRITE, KEYS_STREAMS, 0, 0 } },
+        { "XACK", { handleXack, CMD_WRITE, 1, 1, 1 } },
+        { "XPENDING", { handleXpending, CMD_READONLY, 1, 1, 1 } },
+        // Vector Set Operations
+        { "VADD", { handleVadd, CMD_WRITE, 1, 1, 1 } },
+        { "VSIM", { handleVsim, CMD_READONLY, 1, 1, 1 } },
+        { "VREM", { handleVrem, CMD_WRITE, 1, 1, 1 } },
+        { "VEMB", { handleVemb, CMD_READONLY, 1, 1, 1 } },
+        { "VCARD", { handleVcard, CMD_READONLY, 1, 1, 1 } },
+        { "VDIM", { handleVdim, CMD_READONLY, 1, 1, 1 } },
+        // Semantic Cache Operations
+        { "SCACHE.SET", { handleScacheSet, CMD_WRITE, 1, 1, 1 } },
+        { "SCACHE.GET", { handleScacheGet, 0, 1, 1, 1 } },
+        { "SCACHE.STATS", { handleScacheStats, 0, 1, 1, 1 } },
+        { "SCACHE.DROP", { handleScacheDrop, CMD_WRITE, 1, 1, 1 } },
+        // Chat History Operations
+        { "CHAT.APPEND", { handleChatAppend, CMD_WRITE, 1, 1, 1 } },
+        { "CHAT.READ", { handleChatRead, CMD_READONLY, 1, 1, 1 } },
+        { "CHAT.LEN", { handleChatLen, CMD_READONLY, 1, 1, 1 } },
+        { "CHAT.CONFIG", { handleChatConfig, CMD_WRITE, 1, 1, 1 } },
+        { "CHAT.INFO", { handleChatInfo, CMD_READONLY, 1, 1, 1 } },
+        // Pub/Sub Operations
+        { "PUBLISH", { handlePublish, 0, 0, 0, 0 } },
+        { "PUBSUB", { handlePubsub, 0, 0, 0, 0 } },
+        // Scripting Operations
+        { "EVAL", { handleEval, CMD_WRITE, KEYS_NUMKEYS, 0, 0 } },
+        { "EVALSHA", { handleEvalsha, CMD_WRITE, KEYS_NUMKEYS, 0, 0 } },
+        { "SCRIPT", { handleScript, 0, 0, 0, 0 } },
+    });
+    return table;
+}
+
+// Indexes into tokens of the keys a command touches.
+static std::vector<size_t> commandKeys(const commanddef& def, const std::vector<std::string>& tokens) {
+    std::vector<size_t> keys;
+    if (def.firstKey == KEYS_NUMKEYS) {
+        if (tokens.size() < 3)
+            return keys;
+        size_t numkeys = std::strtoul(tokens[2].c_str(), nullptr, 10);
+        for (size_t i = 3; i < tokens.size() && i < 3 + numkeys; ++i)
+            keys.push_back(i);
+    }
+    else if (def.firstKey == KEYS_STREAMS) {
+        for (size_t i = 1; i < tokens.size(); ++i) {
+            std::string t = tokens[i];
+            std::transform(t.begin(), t.end(), t.begin(), ::toupper);
+            if (t == "STREAMS") {
+                size_t n = (tokens.size() - i - 1) / 2;
+                for (size_t k = i + 1; k <= i + n; ++k)
+                    keys.push_back(k);
+                break;
+            }
+        }
+    }
+    else if (def.firstKey == KEYS_MIGRATE) {
+        if (tokens.size() > 3 && !tokens[3].empty()) {
+            keys.push_back(3);
+            return keys;
+        }
+        for (size_t i = 6; i < tokens.size(); ++i) {
+            std::string t = tokens[i];
+            std::transform(t.begin(), t.end(), t.begin(), ::toupper);
+            if (t == "KEYS") {
+                for (size_t k = i + 1; k < tokens.size(); ++k)
+                    keys.push_back(k);
+                break;
+            }
+        }
+    }
+    else if (def.firstKey == KEYS_MEMORY) {
+        if (tokens.size() > 2) {
+            std::string sub = tokens[1];
+            std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+            if (sub == "USAGE")
+                keys.push_back(2);
+        }
+    }
+    else if (def.firstKey > 0) {
+        int last = def.lastKey < 0 ? static_cast<int>(tokens.size()) + def.lastKey : def.lastKey;
+        for (int i = def.firstKey; i <= last && i < static_cast<int>(tokens.size()); i += def.keyStep)
+            keys.push_back(static_cast<size_t>(i));
+    }
+    return keys;
+}
+
+// Cluster routing: returns an error/redirect reply when this node must not
+// run the command. While the slot is migrating the db lock is left held in
+// lock, so the keys checked here cannot be moved away before the command runs.
+static std::string clusterRoute(const commanddef& def, const std::vector<std::string>& tokens, bool asking,
+    redisdatabase& db, std::unique_lock<std::recursive_mutex>& lock) {
+    std::vector<size_t> keys = commandKeys(def, tokens);
+    if (keys.empty())
+        return std::string();
+    int slot = rediscluster::keySlot(tokens[keys[0]]);
+    for (size_t i = 1; i < keys.size(); ++i) {
+        if (rediscluster::keySlot(tokens[keys[i]]) != slot)
+            return "-CROSSSLOT Keys in request don't hash to the same slot\r\n";
+    }
+
+    rediscluster& cluster = rediscluster::getInstance();
+    int owner = cluster.owner(slot);
+    if (owner == 0) {
+        int target = cluster.migrating(slot);
+        if (target < 0)
+            return std::string();
+        lock = db.acquire();
+        size_t missing = 0;
+        for (size_t k : keys)
+            missing += db.exists(tokens[k]) ? 0 : 1;
+        if (missing == 0)
+            return std::string();
+        lock.unlock();
+        if (missing < keys.size())
+            return "-TRYAGAIN Multiple keys request during rehashing of slot\r\n";
+        rediscluster::node n = cluster.nodeAt(target);
+        cluster.countRedirect(true);
+        return "-ASK " + std::to_string(slot) + " " + n.host + ":" + std::to_string(n.port) + "\r\n";
+    }
+    if (asking && cluster.importing(slot) >= 0)
+        return std::string();
+    if (owner < 0)
+        return "-CLUSTERDOWN Hash slot not served\r\n";
+    rediscluster::node n = cluster.nodeAt(owner);
+    cluster.countRedirect(false);
+    return "-MOVED " + std::to_string(slot) + " " + n.host + ":" + std::to_string(n.port) + "\r\n";
+}
+
+// Scripting Operations
+static std::mutex scriptMutex;
+static std::unordered_map<std::string, std::shared_ptr<const scriptchunk>> scriptCache;
+
+static std::string bulk(const std::string& s) {
+    return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+// RESP reply -> script value, following the usual Redis/Lua conversion rules
+static bool respToScript(const std::string& resp, size_t& pos, scriptvalue& out, std::string& err) {
+    if (pos >= resp.size())
+        return false;
+    char type = resp[pos];
+    size_t crlf = resp.find("\r\n", pos);
+    if (crlf == std::string::npos)
+        return false;
+    std::string line = resp.substr(pos + 1, crlf - pos - 1);
+    pos = crlf + 2;
+    switch (type) {
+    case '+':
+        out = scriptvalue::statusReply(line);
+        return true;
+    case '-':
+        err = line;
+        out = scriptvalue::errorReply(line);
+        return true;
+    case ':':
+        out = scriptvalue::number(std::stod(line));
+        return true;
+    case '$': {
+        long long len = std::stoll(line);
+        if (len < 0) {
+            out = scriptvalue::boolean(false);
+            return true;
+        }
+        out = scriptvalue::string(resp.substr(pos, static_cast<size_t>(len)));
+        pos += static_cast<size_t>(len) + 2;
+        return true;
+    }
+    case '*': {
+        long long n = std::stoll(line);
+        if (n < 0) {
+            out = scriptvalue::boolean(false);
+            return true;
+        }
+        out = scriptvalue::table();
+        for (long long i = 0; i < n; ++i) {
+            scriptvalue item;
+            std::string ignored;
+            if (!respToScript(resp, pos, item, ignored))
+                return false;
+            out.t->array.push_back(std::move(item));
+        }
+        return true;
+    }
+    }
+    return false;
+}
+
+// Nested tables are walked with an explicit stack, since a script can nest
+// them far deeper than the native stack would allow recursion
+static void scriptToResp(const scriptvalue& root, std::ostringstream& oss) {
+    struct frame {
+        const scripttable* t;
+        size_t next;
+        size_t count;
+    };
+    std::vector<frame> open;
+    const scriptvalue* v = &root;
+    while (true) {
+        switch (v->type) {
+        case scriptvalue::NUMBER:
+            oss << ":" << v->toInteger() << "\r\n";
+            break;
+        case scriptvalue::STRING:
+            oss << "$" << v->s.size() << "\r\n" << v->s << "\r\n";
+            break;
+        case scriptvalue::BOOLEAN:
+            oss << (v->b ? ":1\r\n" : "$-1\r\n");
+            break;
+        case scriptvalue::TABLE: {
+            if (const scriptvalue* e = v->t->field("err")) {
+                oss << "-" << e->toString() << "\r\n";
+                break;
+            }
+            if (const scriptvalue* ok = v->t->field("ok")) {
+                oss << "+" << ok->toString() << "\r\n";
+                break;
+            }
+            // Arrays end at the first nil, as in Lua
+            size_t n = 0;
+            while (n < v->t->array.size() && v->t->array[n].type != scriptvalue::NIL)
+                n++;
+            oss << "*" << n << "\r\n";
+            open.push_back(frame{ v->t.get(), 0, n });
+            break;
+        }
+        case scriptvalue::NIL:
+            oss << "$-1\r\n";
+            break;
+        }
+        while (!open.empty() && open.back().next == open.back().count)
+            open.pop_back();
+        if (open.empty())
+            return;
+        v = &open.back().t->array[open.back().next++];
+    }
+}
+
+// Keys a running script may reach. The declared KEYS were routed before
+// the script started; any other key must belong where the script runs, or
+// a write would land somewhere nobody routes that key to. In shard mode
+// that is a key this shard owns (the slot modulo the shard count, as in
+// redisshards::ownerOf); in cluster mode a key in a slot this node serves,
+// and not one already migrated away.
+struct scriptscope {
+    std::vector<std::string> declared;
+    bool cluster = false;
+    size_t shards = 1;
+    size_t shard = 0;
+
+    explicit scriptscope(const std::vector<std::string>& keys, redisdatabase& db) : declared(keys) {
+        cluster = rediscluster::getInstance().enabled();
+        shards = redisdatabase::shardCount();
+        while (shard < shards && &redisdatabase::shard(shard) != &db)
+            shard++;
+    }
+
+    bool limited() const { return cluster || shards > 1; }
+
+    bool allows(const std::string& key, redisdatabase& db) const {
+        if (std::find(declared.begin(), declared.end(), key) != declared.end())
+            return true;
+        int slot = rediscluster::keySlot(key);
+        if (cluster) {
+            rediscluster& nodes = rediscluster::getInstance();
+            return nodes.owner(slot) == 0 && (nodes.migrating(slot) < 0 || db.exists(key));
+        }
+        return static_cast<size_t>(slot) % shards == shard;
+    }
+};
+
+// redis.call() bridge. The hottest commands go straight to redisdatabase;
+// everything else runs its handler with the already-split arguments and the
+// reply is converted back.
+static bool scriptCommand(const std::vector<std::string>& args, const scriptscope& scope, scriptvalue& reply,
+    redisdatabase& db) {
+    std::string cmd = args[0];
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    const auto& table = commandTable();
+    if (scope.limited()) {
+        auto entry = table.find(cmd);
+        if (entry != table.end()) {
+            for (size_t k : commandKeys(entry->second, args)) {
+                if (scope.allows(args[k], db))
+                    continue;
+                if (scope.cluster)
+                    reply.s = "Script attempted to access a non local key in a cluster node";
+                else
+                    reply.s = "Script attempted to access key '" + args[k] +
+                        "' on another shard; pass every key the script uses in KEYS";
+                return false;
+            }
+        }
+    }
+    std::string value;
+    if (cmd == "GET" && args.size() == 2) {
+        reply = db.get(args[1], value) ? scriptvalue::string(value) : scriptvalue::boolean(false);
+        return true;
+    }
+    if (cmd == "SET" && args.size() == 3) {
+        db.set(args[1], args[2]);
+        reply = scriptvalue::statusReply("OK");
+        return true;
+    }
+    if (cmd == "DEL" && args.size() == 2) {
+        reply = scriptvalue::number(db.del(args[1]) ? 1 : 0);
+        return true;
+    }
+    if (cmd == "HGET" && args.size() == 3) {
+        reply = db.hget(args[1], args[2], value) ? scriptvalue::string(value) : scriptvalue::boolean(false);
+        return true;
+    }
+    if (cmd == "HSET" && args.size() == 4) {
+        db.hset(args[1], args[2], args[3]);
+        reply = scriptvalue::number(1);
+        return true;
+    }
+    if ((cmd == "LPOP" || cmd == "RPOP") && args.size() == 2) {
+        bool found = cmd == "LPOP" ? db.lpop(args[1], value) : db.rpop(args[1], value);
+        reply = found ? scriptvalue::string(value) : scriptvalue::boolean(false);
+        return true;
+    }
+    if ((cmd == "LPUSH" || cmd == "RPUSH") && args.size() >= 3) {
+        for (size_t i = 2; i < args.size(); ++i) {
+            if (cmd == "LPUSH")
+                db.lpush(args[1], args[i]);
+            else
+                db.rpush(args[1], args[i]);
+        }
+        reply = scriptvalue::number(static_cast<double>(db.llen(args[1])));
+        return true;
+    }
+    if (cmd == "LLEN" && args.size() == 2) {
+        reply = scriptvalue::number(static_cast<double>(db.llen(args[1])));
+        return true;
+    }
+
+    if (cmd == "EVAL" || cmd == "EVALSHA" || cmd == "SCRIPT") {
+        reply.s = "This Redis command is not allowed from scripts";
+        return false;
+    }
+    auto it = table.find(cmd);
+    if (it == table.end()) {
+        reply.s = "Unknown Redis command called from script";
+        return false;
+    }
+    // The script consumes the reply, so it is never streamed
+    redisoutput::producer* stream = replyStream;
+    replyStream = nullptr;
+    std::string resp = it->second.fn(args, db);
+    replyStream = stream;
+    size_t pos = 0;
+    std::string err;
+    if (!respToScript(resp, pos, reply, err)) {
+        reply.s = "Unparseable reply from " + cmd;
+        return false;
+    }
+    if (!err.empty()) {
+        reply.s = err;
+        return false;
+    }
+    return true;
+}
+
+static std::shared_ptr<const scriptchunk> loadScript(const std::string& source, std::string& sha, std::string& err) {
+    sha = redisscript::sha1hex(source);
+    {
+        std::lock_guard<std::mutex> lock(scriptMutex);
+        auto it = scriptCache.find(sha);
+        if (it != scriptCache.end())
+            return it->second;
+    }
+    auto chunk = std::make_shared<scriptchunk>();
+    if (!redisscript::compile(source, *chunk, err))
+        return nullptr;
+    std::lock_guard<std::mutex> lock(scriptMutex);
+    scriptCache[sha] = chunk;
+    return chunk;
+}
+
+static std::string runScript(const scriptchunk& chunk, const std::vector<std::string>& tokens, redisdatabase& db) {
+    size_t numkeys;
+    if (!parseCount(tokens[2], numkeys) || numkeys > tokens.size() - 3)
+        return "-Error: Number of keys can't be greater than number of args\r\n";
+    std::vector<std::string> keys(tokens.begin() + 3, tokens.begin() + 3 + numkeys);
+    std::vector<std::string> argv(tokens.begin() + 3 + numkeys, tokens.end());
+
+    scriptvalue result;
+    std::string err;
+    // The whole script runs under one database lock, so it is atomic
+    auto lock = db.acquire();
+    scriptscope scope(keys, db);
+    auto call = [&db, &scope](const std::vector<std::string>& args, scriptvalue& reply) {
+        return scriptCommand(args, scope, reply, db);
+    };
+    // Running out of memory fails the script, not the server; writes the
+    // script already made stay, as after any other script error
+    try {
+        if (!redisscript::run(chunk, keys, argv, call, redisscript::DEFAULT_BUDGET, result, err))
+            return "-Error: " + err + "\r\n";
+        std::ostringstream oss;
+        scriptToResp(result, oss);
+        return oss.str();
+    }
+    catch (const std::exception& e) {
+        return std::string("-Error: Error running script: ") + e.what() + "\r\n";
+    }
+}
+
+static std::string handleEval(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: EVAL requires script and numkeys\r\n";
+    std::string sha, err;
+    auto chunk = loadScript(tokens[1], sha, err);
+    if (!chunk)
+        return "-Error: " + err + "\r\n";
+    return runScript(*chunk, tokens, db);
+}
+
+static std::string handleEvalsha(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 3)
+        return "-Error: EVALSHA requires sha1 and numkeys\r\n";
+    std::string sha = tokens[1];
+    std::transform(sha.begin(), sha.end(), sha.begin(), ::tolower);
+    std::shared_ptr<const scriptchunk> chunk;
+    {
+        std::lock_guard<std::mutex> lock(scriptMutex);
+        auto it = scriptCache.find(sha);
+        if (it != scriptCache.end())
+            chunk = it->second;
+    }
+    if (!chunk)
+        return "-NOSCRIPT No matching script. Please use EVAL.\r\n";
+    return runScript(*chunk, tokens, db);
+}
+
+static std::string handleScript(const std::vector<std::string>& tokens, redisdatabase& db) {
+    if (tokens.size() < 2)
+        return "-Error: SCRIPT requires a subcommand\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "LOAD" && tokens.size() == 3) {
+        std::string sha, err;
+        if (!loadScript(tokens[2], sha, err))
+            return "-Error: " + err + "\r\n";
+        return bulk(sha);
+    }
+    if (sub == "EXISTS" && tokens.size() >= 3) {
+        std::lock_guard<std::mutex> lock(scriptMutex);
+        std::ostringstream oss;
+        oss << "*" << tokens.size() - 2 << "\r\n";
+        for (size_t i = 2; i < tokens.size(); ++i) {
+            std::string sha = tokens[i];
+            std::transform(sha.begin(), sha.end(), sha.begin(), ::tolower);
+            oss << ":" << scriptCache.count(sha) << "\r\n";
+        }
+        return oss.str();
+    }
+    if (sub == "FLUSH") {
+        std::lock_guard<std::mutex> lock(scriptMutex);
+        scriptCache.clear();
+        return "+OK\r\n";
+    }
+    return "-Error: SCRIPT subcommands are LOAD, EXISTS and FLUSH\r\n";
+}
+
+// Client Operations
+static std::string handleClientTracking(const std::vector<std::string>& tokens, redisclient& client) {
+    if (tokens.size() < 3)
+        return "-Error: CLIENT TRACKING requires ON or OFF\r\n";
+    redistracking& tracking = redistracking::getInstance();
+    std::string mode = tokens[2];
+    std::transform(mode.begin(), mode.end(), mode.begin(), ::toupper);
+    if (mode == "OFF") {
+        tracking.disable(client.id);
+        client.tracking = false;
+        client.trackingBcast = false;
+        return "+OK\r\n";
+    }
+    if (mode != "ON")
+        return "-Error: CLIENT TRACKING requires ON or OFF\r\n";
+
+    bool bcast = false, noloop = false;
+    uint64_t redirect = 0;
+    std::vector<std::string> prefixes;
+    for (size_t i = 3; i < tokens.size(); ++i) {
+        std::string opt = tokens[i];
+        std::transform(opt.begin(), opt.end(), opt.begin(), ::toupper);
+        if (opt == "BCAST")
+            bcast = true;
+        else if (opt == "NOLOOP")
+            noloop = true;
+        else if (opt == "PREFIX" && i + 1 < tokens.size())
+            prefixes.push_back(tokens[++i]);
+        else if (opt == "REDIRECT" && i + 1 < tokens.size())
+            redirect = std::strtoull(tokens[++i].c_str(), nullptr, 10);
+        else
+            return "-Error: syntax error\r\n";
+    }
+    if (!prefixes.empty() && !bcast)
+        return "-Error: PREFIX option requires BCAST mode to be enabled\r\n";
+
+    std::shared_ptr<redisoutput> target;
+    if (redirect && redirect != client.id) {
+        target = tracking.findOutput(redirect);
+        if (!target)
+            return "-Error: The client ID you want redirect to does not exist\r\n";
+    }
+    else {
+        // Invalidations are pushed on this connection, interleaved with replies
+        if (!client.output) {
+            client.output = std::make_shared<redisoutput>();
+            tracking.registerOutput(client.id, client.output);
+        }
+        target = client.output;
+    }
+    tracking.enable(client.id, target, bcast, noloop, prefixes);
+    client.tracking = true;
+    client.trackingBcast = bcast;
+    return "+OK\r\n";
+}
+
+static std::string handleClient(const std::vector<std::string>& tokens, redisclient& client) {
+    if (tokens.size() < 2)
+        return "-Error: CLIENT requires a subcommand\r\n";
+    std::string sub = tokens[1];
+    std::transform(sub.begin(), sub.end(), sub.begin(), ::toupper);
+    if (sub == "ID")
+        return ":" + std::to_string(client.id) + "\r\n";
+    if (sub == "TRACKING")
+        return handleClientTracking(tokens, client);
+    return "-Error: CLIENT subcommands are ID and TRACKING\r\n";
+}
+
+// Default-mode tracking: the keys a read returned are remembered for client.
+// Done under the db lock so a concurrent write is ordered after it and its
+// invalidation is never lost.
+static std::string runTracked(const commanddef& def, const std::vector<std::string>& tokens,
+    redisclient& client, redisdatabase& db) {
+    auto start = std::chrono::steady_clock::now();
+    std::string reply;
+    replyStream = client.streamReplies ? &client.stream : nullptr;
+    if (!client.tracking || client.trackingBcast || !(def.flags & CMD_READONLY)) {
+        reply = def.fn(tokens, db);
+    }
+    else {
+        auto lock = db.acquire();
+        reply = def.fn(tokens, db);
+        for (size_t k : commandKeys(def, tokens))
+            redistracking::getInstance().remember(client.id, tokens[k]);
+    }
+    replyStream = nullptr;
+    if (redismemory::sampleCommand()) {
+        for (size_t k : commandKeys(def, tokens))
+            redismemory::recordAccess(tokens[k]);
+    }
+    redisstats::commandDone(def.statsSlot, tokens, start, !reply.empty() && reply[0] == '-',
+        (def.flags & CMD_WRITE) != 0);
+    return reply;
+}
+
+// Transaction Operations
+static void unwatchAll(redisclient& client, redisdatabase& db) {
+    for (const auto& w : client.watched)
+        db.unwatch(w.first);
+    client.watched.clear();
+}
+
+static std::string handleMulti(redisclient& client) {
+    if (client.inMulti)
+        return "-Error: MULTI calls can not be nested\r\n";
+    client.inMulti = true;
+    client.queueError = false;
+    client.queued.clear();
+    return "+OK\r\n";
+}
+
+static std::string handleDiscard(redisclient& client, redisdatabase& db) {
+    if (!client.inMulti)
+        return "-Error: DISCARD without MULTI\r\n";
+    client.inMulti = false;
+    client.queued.clear();
+    unwatchAll(client, db);
+    txStats.discarded++;
+    return "+OK\r\n";
+}
+
+static std::string handleWatch(const std::vector<std::string>& tokens, redisclient& client, redisdatabase& db) {
+    if (client.inMulti)
+        return "-Error: WATCH inside MULTI is not allowed\r\n";
+    if (tokens.size() < 2)
+        return "-Error: WATCH requires at least one key\r\n";
+    for (size_t i = 1; i < tokens.size(); ++i)
+        client.watched.emplace_back(tokens[i], db.watch(tokens[i]));
+    return "+OK\r\n";
+}
+
+static std::string handleExec(redisclient& client, redisdatabase& db) {
+    if (!client.inMulti)
+        return "-Error: EXEC without MULTI\r\n";
+    std::vector<std::vector<std::string>> queued;
+    queued.swap(client.queued);
+    client.inMulti = false;
+
+    std::string reply;
+    if (client.queueError) {
+        client.queueError = false;
+        txStats.execAborts++;
+        reply = "-EXECABORT Transaction discarded because of previous errors.\r\n";
+    }
+    else {
+        if (client.lastExecAborted)
+            txStats.retries++;
+        // One lock acquisition covers the version check and every queued command
+        auto lock = db.acquire();
+        if (!db.unchanged(client.watched)) {
+            txStats.aborted++;
+            client.lastExecAborted = true;
+            reply = "*-1\r\n";
+        }
+        else {
+            txStats.committed++;
+            client.lastExecAborted = false;
+            const auto& table = commandTable();
+            std::ostringstream oss;
+            oss << "*" << queued.size() << "\r\n";
+            // Replies are nested in EXEC's array, so none may be streamed
+            bool streamReplies = client.streamReplies;
+            client.streamReplies = false;
+            for (const auto& cmdTokens : queued) {
+                std::string name = cmdTokens[0];
+                std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+                oss << runTracked(table.at(name), cmdTokens, client, db);
+            }
+            client.streamReplies = streamReplies;
+            reply = oss.str();
+        }
+    }
+    unwatchAll(client, db);
+    return reply;
+}
+
+size_t rediscommandhandler::frameLength(const std::string& buf, size_t pos) {
+    if (pos >= buf.size())
+        return 0;
+    if (buf[pos] != '*') {
+        // Inline command: one line
+        size_t nl = buf.find('\n', pos);
+        return nl == std::string::npos ? 0 : nl + 1 - pos;
+    }
+    size_t start = pos;
+    size_t crlf = buf.find("\r\n", pos);
+    if (crlf == std::string::npos)
+        return 0;
+    long long count = std::atoll(buf.c_str() + pos + 1);
+    pos = crlf + 2;
+    for (long long i = 0; i < count; ++i) {
+        if (pos >= buf.size())
+            return 0;
+        if (buf[pos] != '$')
+            return buf.size() - start; // malformed; hand everything to the parser
+        crlf = buf.find("\r\n", pos);
+        if (crlf == std::string::npos)
+            return 0;
+        long long len = std::atoll(buf.c_str() + pos + 1);
+        pos = crlf + 2 + static_cast<size_t>(len < 0 ? 0 : len) + 2;
+        if (pos > buf.size())
+            return 0;
+    }
+    return pos - start;
+}
+
+static thread_local redisdatabase* threadDb = nullptr;
+
+void rediscommandhandler::bindDatabase(redisdatabase* db) {
+    threadDb = db;
+}
+
+redisdatabase& rediscommandhandler::boundDatabase() {
+    return threadDb ? *threadDb : redisdatabase::getInstance();
+}
+
+bool rediscommandhandler::keysOf(const std::vector<std::string>& tokens, std::vector<std::string>& keys) {
+    if (tokens.empty())
+        return false;
+    std::string cmd = tokens[0];
+    std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    const auto& table = commandTable();
+    auto it = table.find(cmd);
+    if (it == table.end())
+        return false;
+    for (size_t k : commandKeys(it->second, tokens))
+        keys.push_back(tokens[k]);
+    return true;
+}
+
+rediscommandhandler::rediscommandhandler() {
+    redisdatabase::getInstance().setKeyspaceListener(onKeyspaceEvent);
+}
+
+std::string rediscommandhandler::processCommand(const std::string& commandLine) {
+    redisclient client;
+    std::string reply = processCommand(commandLine, client);
+    closeClient(client);
+    return reply;
+}
+
+std::string rediscommandhandler::processCommand(const std::string& commandLine, redisclient& client) {
+	auto tokens = parseRespcommand(commandLine);
+	return processCommand(tokens, client);
+}
+
+std::vector<std::string> rediscommandhandler::parseCommand(const std::string& frame) {
+    return parseRespcommand(frame);
+}
+
+static const char* const SUBSCRIBED_ONLY =
+    "-Error: only (P)SUBSCRIBE / (P)UNSUBSCRIBE / PING are allowed in this context\r\n";
+
+// Commands that act on the connection rather than the keyspace; false for
+// anything else.
+static bool runConnectionCommand(const std::string& cmd, std::vector<std::string>& tokens, redisclient& client,
+    redisdatabase& db, std::string& reply) {
+    // Transaction Operations
+    if (cmd == "MULTI")
+        reply = handleMulti(client);
+    else if (cmd == "EXEC")
+        reply = handleExec(client, db);
+    else if (cmd == "DISCARD")
+        reply = handleDiscard(client, db);
+    else if (cmd == "WATCH")
+        reply = handleWatch(tokens, client, db);
+    else if (cmd == "UNWATCH") {
+        unwatchAll(client, db);
+        reply = "+OK\r\n";
+    }
+    // Pub/Sub Operations
+    else if (cmd == "SUBSCRIBE" || cmd == "PSUBSCRIBE")
+        reply = handleSubscribe(tokens, client, cmd == "PSUBSCRIBE");
+    else if (cmd == "UNSUBSCRIBE" || cmd == "PUNSUBSCRIBE")
+        reply = handleUnsubscribe(tokens, client, cmd == "PUNSUBSCRIBE");
+    else if (cmd != "CLIENT" && cmd != "ASKING")
+        return false;
+    else if (client.subscriptions() > 0)
+        reply = SUBSCRIBED_ONLY;
+    // Client Operations
+    else if (cmd == "CLIENT")
+        reply = handleClient(tokens, client);
+    else {
+        client.asking = true;
+        reply = "+OK\r\n";
+    }
+    return true;
+}
+
+std::string rediscommandhandler::processCommand(std::vector<std::string>& tokens, redisclient& client) {
+	if (tokens.empty())return "error empty command";
+	std::string cmd = tokens[0];
+	std::transform(cmd.begin(), cmd.end(), cmd.begin(), ::toupper);
+    redisdatabase& db = boundDatabase();
+    redistracking::setCaller(client.id);
+    const auto& table = commandTable();
+    auto it = table.find(cmd);
+    if (it == table.end()) {
+        auto start = std::chrono::steady_clock::now();
+        std::string reply;
+        if (runConnectionCommand(cmd, tokens, client, db, reply)) {
+            redisstats::commandDone(redisstats::commandSlot(cmd), tokens, start,
+                !reply.empty() && reply[0] == '-', false);
+            return reply;
+        }
+        if (client.subscriptions() > 0)
+            return SUBSCRIBED_ONLY;
+        if (client.inMulti)
+            client.queueError = true;
+        return "-Error: Unknown command\r\n";
+    }
+    if (client.subscriptions() > 0 && cmd != "PING")
+        return SUBSCRIBED_ONLY;
+    std::unique_lock<std::recursive_mutex> migrationLock;
+    if (rediscluster::getInstance().enabled()) {
+        bool asking = client.asking || cmd == "RESTORE-ASKING";
+        client.asking = false;
+        std::string redirect = clusterRoute(it->second, tokens, asking, db, migrationLock);
+        if (!redirect.empty()) {
+            if (client.inMulti)
+                client.queueError = true;
+            return redirect;
+        }
+    }
+    if (client.inMulti) {
+        client.queued.push_back(std::move(tokens));
+        return "+QUEUED\r\n";
+    }
+    return runTracked(it->second, tokens, client, db);
+}
+
+void rediscommandhandler::closeClient(redisclient& client) {
+    unwatchAll(client, boundDatabase());
+    redistracking& tracking = redistracking::getInstance();
+    if (client.tracking)
+        tracking.disable(client.id);
+    redispubsub& pubsub = redispubsub::getInstance();
+    if (client.output) {
+        for (const auto& c : client.channels)
+            pubsub.unsubscribe(c, client.output);
+        for (const auto& p : client.patterns)
+            pubsub.punsubscribe(p, client.output);
+        tracking.unregisterOutput(client.id);
+        client.output->close();
+    }
+    client = redisclient();
 }
@@ -8,403 +8,2655 @@
 #include <mutex>
 #include <chrono>
 #include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <thread>
+#include <random>
+#include <filesystem>
+#include <cstring>
 #include "../include/redisdatabase.h"
+#include "../include/hyperloglog.h"
+#include "../include/redisserialize.h"
+#include "../include/redisstats.h"
+#include "../include/redislz.h"
+
+// Snapshot helpers: 'K' lines hold whitespace free tokens, anything else is
+// written as "<tag> <key> <len>\n<bytes>\n".
+static bool isPlainToken(const std::string& value) {
+    if (value.empty())
+        return false;
+    for (unsigned char c : value) {
+        if (c <= ' ' || c >= 0x7f)
+            return false;
+    }
+    return true;
+}
+
+static void writeBlob(std::ofstream& ofs, char tag, const std::string& key, const std::string& value) {
+    ofs << tag << " " << key << " " << value.size() << "\n";
+    ofs.write(value.data(), value.size());
+    ofs << "\n";
+}
+
+static bool readBlob(std::istringstream& header, std::ifstream& ifs, std::string& key, std::string& value) {
+    size_t len = 0;
+    if (!(header >> key >> len))
+        return false;
+    value.resize(len);
+    if (len > 0 && !ifs.read(&value[0], len))
+        return false;
+    ifs.get(); // trailing newline
+    return true;
+}
+
+// Compression
+// A stored string value, list element or hash value that starts with NUL
+// carries a header: "\0\1" + varint raw length + an LZ block, or "\0\0" +
+// the raw bytes of a value that itself starts with NUL. Anything else is
+// stored as it is, so a value below the threshold costs one byte test.
+// The totals cover compressed values in memory across all shards.
+static std::atomic<uint64_t> compressMin{ 0 };
+static std::atomic<uint64_t> packedValues{ 0 };
+static std::atomic<uint64_t> packedRaw{ 0 };
+static std::atomic<uint64_t> packedStored{ 0 };
+
+static const char PACK_ESCAPED = '\0';
+static const char PACK_LZ = '\1';
+static const size_t PACK_HEADER_MAX = 12; // marker, kind and a 10-byte varint
+
+static inline bool isPacked(const std::string& stored) {
+    return !stored.empty() && stored[0] == '\0';
+}
+
+static inline bool isCompressed(const std::string& stored) {
+    return stored.size() >= 2 && stored[0] == '\0' && stored[1] == PACK_LZ;
+}
+
+static uint64_t nanosSince(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count());
+}
+
+// Fills out and returns true when raw cannot be stored as it is. Callers
+// pack before taking the db lock.
+static bool packValue(const std::string& raw, std::string& out) {
+    uint64_t minSize = compressMin.load(std::memory_order_relaxed);
+    if (minSize && raw.size() >= minSize) {
+        auto start = std::chrono::steady_clock::now();
+        out.assign(1, '\0');
+        out.push_back(PACK_LZ);
+        putVarint(out, raw.size());
+        bool smaller = redislz::compress(raw.data(), raw.size(), out) && out.size() < raw.size();
+        redisstats::add(redisstats::COMPRESS_CALLS);
+        redisstats::add(redisstats::COMPRESS_NS, nanosSince(start));
+        if (smaller) {
+            // compress() reserved room for incompressible input
+            out.shrink_to_fit();
+            return true;
+        }
+        redisstats::add(redisstats::COMPRESS_SKIPPED);
+    }
+    if (!isPacked(raw))
+        return false;
+    out.assign(2, '\0');
+    out += raw;
+    return true;
+}
+
+// Turns a stored value back into the raw one; false (value unchanged) when
+// its header is malformed.
+static bool unpackValue(std::string& value) {
+    if (!isPacked(value))
+        return true;
+    if (value.size() < 2)
+        return false;
+    if (value[1] == PACK_ESCAPED) {
+        value.erase(0, 2);
+        return true;
+    }
+    size_t pos = 2;
+    uint64_t rawLength = 0;
+    if (value[1] != PACK_LZ || !getVarint(value, pos, rawLength) || rawLength > 0xFFFFFFFFu)
+        return false;
+    auto start = std::chrono::steady_clock::now();
+    std::string raw(static_cast<size_t>(rawLength), '\0');
+    bool ok = redislz::decompress(value.data() + pos, value.size() - pos, &raw[0], raw.size());
+    redisstats::add(redisstats::DECOMPRESS_CALLS);
+    redisstats::add(redisstats::DECOMPRESS_NS, nanosSince(start));
+    if (!ok)
+        return false;
+    value.swap(raw);
+    return true;
+}
+
+// Raw length from the header alone; stored may be just the first
+// PACK_HEADER_MAX bytes of a packed value.
+static uint64_t rawLengthOf(const std::string& stored) {
+    if (!isPacked(stored))
+        return stored.size();
+    if (stored.size() < 2)
+        return 0;
+    if (stored[1] == PACK_ESCAPED)
+        return stored.size() - 2;
+    size_t pos = 2;
+    uint64_t rawLength = 0;
+    return getVarint(stored, pos, rawLength) ? rawLength : 0;
+}
+
+static bool rawEquals(const std::string& stored, const std::string& raw) {
+    if (!isPacked(stored))
+        return stored == raw;
+    if (rawLengthOf(stored) != raw.size())
+        return false;
+    std::string value = stored;
+    return unpackValue(value) && value == raw;
+}
+
+// Adds a stored value to the compression totals, or removes it
+static void countPacked(const std::string& stored, bool add) {
+    if (!isCompressed(stored))
+        return;
+    uint64_t raw = rawLengthOf(stored);
+    if (add) {
+        packedValues++;
+        packedRaw += raw;
+        packedStored += stored.size();
+    }
+    else {
+        packedValues--;
+        packedRaw -= raw;
+        packedStored -= stored.size();
+    }
+}
+
+static void unpackAll(std::vector<std::string>& values) {
+    for (auto& value : values)
+        unpackValue(value);
+}
 
 redisdatabase& redisdatabase::getInstance() {
     static redisdatabase instance;
     return instance;
 }
 
+// Shards
+static std::mutex shardsMutex;
+static std::vector<redisdatabase*> extraShards; // shards 1..n-1, never freed
+
+redisdatabase& redisdatabase::shard(size_t index) {
+    if (index == 0)
+        return getInstance();
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    while (extraShards.size() < index) {
+        redisdatabase* db = new redisdatabase();
+        db->keyspace_listener = getInstance().keyspace_listener;
+        extraShards.push_back(db);
+    }
+    return *extraShards[index - 1];
+}
+
+size_t redisdatabase::shardCount() {
+    std::lock_guard<std::mutex> lock(shardsMutex);
+    return extraShards.size() + 1;
+}
+
+void redisdatabase::moveKeyTo(const std::string& name, redisdatabase& target) {
+    if (&target == this)
+        return;
+    std::scoped_lock lock(db_mutex, target.db_mutex);
+    purgeexpire();
+    target.eraseString(name);
+    target.eraseList(name);
+    target.eraseHash(name);
+    target.stream_store.erase(name);
+    target.vector_store.erase(name);
+    target.chat_store.erase(name);
+    target.expiry_map.erase(name);
+
+    auto kv = kv_store.find(name);
+    if (kv != kv_store.end()) {
+        string_bytes -= kv->second.size();
+        countPacked(kv->second, false);
+        target.storeString(name, std::move(kv->second));
+        kv_store.erase(kv);
+    }
+    // The tier log is shared by every shard, so a cold ref moves as it is
+    auto cold = cold_store.find(name);
+    if (cold != cold_store.end()) {
+        target.cold_store[name] = cold->second;
+        cold_store.erase(cold);
+    }
+    auto list = list_store.find(name);
+    if (list != list_store.end()) {
+        target.list_store[name] = std::move(list->second);
+        list_store.erase(list);
+    }
+    auto hash = hash_store.find(name);
+    if (hash != hash_store.end()) {
+        target.hash_store[name] = std::move(hash->second);
+        hash_store.erase(hash);
+    }
+    auto stream = stream_store.find(name);
+    if (stream != stream_store.end()) {
+        target.stream_store[name] = std::move(stream->second);
+        stream_store.erase(stream);
+    }
+    auto vec = vector_store.find(name);
+    if (vec != vector_store.end()) {
+        target.vector_store[name] = std::move(vec->second);
+        vector_store.erase(vec);
+    }
+    auto chat = chat_store.find(name);
+    if (chat != chat_store.end()) {
+        target.chat_store[name] = std::move(chat->second);
+        chat_store.erase(chat);
+    }
+    auto exp = expiry_map.find(name);
+    if (exp != expiry_map.end()) {
+        target.expiry_map[name] = exp->second;
+        expiry_map.erase(exp);
+    }
+    auto cache = semcache_store.find(name);
+    if (cache != semcache_store.end()) {
+        target.semcache_store[name] = std::move(cache->second);
+        semcache_store.erase(cache);
+    }
+    auto entry = semcache_entries.find(name);
+    if (entry != semcache_entries.end()) {
+        target.semcache_entries[name] = entry->second;
+        semcache_entries.erase(entry);
+    }
+}
+
+std::vector<std::string> redisdatabase::storedNames() {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    std::vector<std::string> names = keys();
+    for (const auto& cache : semcache_store)
+        names.push_back(cache.first);
+    return names;
+}
+
+bool redisdatabase::dumpAll(const std::string& filename) {
+    auto start = std::chrono::steady_clock::now();
+    bool ok = true;
+    size_t n = shardCount();
+    for (size_t i = 0; i < n && ok; ++i)
+        ok = shard(i).dump(filename, i > 0);
+    // Each shard is locked while it is written, so this is also the stall
+    uint64_t ms = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    redisstats::recordSave(ok, ms);
+    redisstats::latencySample("persistence-dump", ms);
+    return ok;
+}
+
 bool redisdatabase::flushall() {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    uncountAll();
+    for (const auto& cold : cold_store)
+        releaseCold(cold.first, cold.second);
+    cold_store.clear();
     kv_store.clear();
+    string_bytes = 0;
     list_store.clear();
     hash_store.clear();
+    stream_store.clear();
+    vector_store.clear();
+    chat_store.clear();
     expiry_map.clear();
+    semcache_store.clear();
+    semcache_entries.clear();
+    touchAll();
     return true;
 }
 
-// Key/Value Operations
-void redisdatabase::set(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    kv_store[key] = value;
+// Transaction Support
+std::unique_lock<std::recursive_mutex> redisdatabase::acquire() {
+    return std::unique_lock<std::recursive_mutex>(db_mutex);
 }
 
-bool redisdatabase::get(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+uint64_t redisdatabase::watch(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    watchedkey& w = watched_keys[key];
+    w.watchers++;
+    return w.version;
+}
+
+void redisdatabase::unwatch(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    auto it = watched_keys.find(key);
+    if (it != watched_keys.end() && --it->second.watchers == 0)
+        watched_keys.erase(it);
+}
+
+bool redisdatabase::unchanged(const std::vector<std::pair<std::string, uint64_t>>& watched) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
+    for (const auto& w : watched) {
+        auto it = watched_keys.find(w.first);
+        if (it == watched_keys.end() || it->second.version != w.second)
+            return false;
+    }
+    return true;
+}
+
+void redisdatabase::setKeyspaceListener(keyspacelistener listener) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    keyspace_listener = listener;
+}
+
+void redisdatabase::touch(const std::string& key, const char* event) {
+    // Any write but a TTL change makes a cache entry's key stop being the
+    // cached completion
+    if (!semcache_entries.empty() && std::strcmp(event, "expire") != 0)
+        dropCacheEntry(key);
+    if (keyspace_listener)
+        keyspace_listener(key, event);
+    if (watched_keys.empty())
+        return;
+    auto it = watched_keys.find(key);
+    if (it != watched_keys.end())
+        it->second.version++;
+}
+
+void redisdatabase::touchAll() {
+    if (keyspace_listener)
+        keyspace_listener(std::string(), "flushall");
+    for (auto& w : watched_keys)
+        w.second.version++;
+}
+
+// Tiered Storage
+// One log serves every shard, so a key moved between shards keeps its ref.
+// tierLog is set before tierOn and never reset while the server runs.
+static std::mutex tierMutex;
+static std::unique_ptr<redistier> tierLog;
+static std::string tierDir;
+static std::atomic<bool> tierOn{ false };
+static std::atomic<uint64_t> tierBudget{ 0 };
+static std::atomic<uint64_t> tierDemotions{ 0 };
+static std::atomic<uint64_t> tierPromotions{ 0 };
+
+static const size_t TIER_MIN_VALUE = 64;        // smaller values save less than a disk read costs
+static const uint32_t TIER_PROMOTE_HITS = 3;    // recent accesses that bring a cold value back
+static const int TIER_SAMPLES = 16;             // keys sampled per demotion round; the coldest quarter go
+static const int TIER_ROUNDS = 16;              // sampling rounds per demotion batch
+static const size_t TIER_BATCH_BYTES = 1 << 20; // values copied per demotion or compaction batch
+static const std::chrono::milliseconds TIER_PERIOD(100);
+static const std::chrono::milliseconds TIER_SLICE(25); // work per period
+
+static bool sameRef(const redistier::ref& a, const redistier::ref& b) {
+    return a.segment == b.segment && a.offset == b.offset;
+}
+
+static uint64_t accessHash(const std::string& key) {
+    return std::hash<std::string>()(key);
+}
+
+bool redisdatabase::enableTier(const std::string& dir, uint64_t maxMemory, std::string& err) {
+    std::lock_guard<std::mutex> lock(tierMutex);
+    if (tierOn) {
+        err = "tiering is already enabled";
+        return false;
+    }
+    tierLog.reset(new redistier(dir, "tier"));
+    std::error_code ec;
+    if (!std::filesystem::is_directory(dir, ec)) {
+        tierLog.reset();
+        err = "cannot create directory " + dir;
+        return false;
+    }
+    tierDir = dir;
+    tierBudget = maxMemory;
+    tierOn = true;
+    std::thread([]() {
+        while (true) {
+            std::this_thread::sleep_for(TIER_PERIOD);
+            tierCycle();
+        }
+        }).detach();
+    return true;
+}
+
+bool redisdatabase::tierEnabled() {
+    return tierOn;
+}
+
+void redisdatabase::setTierMaxMemory(uint64_t bytes) {
+    tierBudget = bytes;
+}
+
+uint64_t redisdatabase::tierMaxMemory() {
+    return tierBudget;
+}
+
+redisdatabase::tierstats redisdatabase::tierStatistics() {
+    tierstats t;
+    if (!tierOn)
+        return t;
+    {
+        std::lock_guard<std::mutex> lock(tierMutex);
+        t.dir = tierDir;
+    }
+    t.maxMemory = tierBudget;
+    t.demotions = tierDemotions;
+    t.promotions = tierPromotions;
+    for (size_t i = 0; i < shardCount(); ++i) {
+        redisdatabase& db = shard(i);
+        std::lock_guard<std::recursive_mutex> lock(db.db_mutex);
+        t.hotBytes += db.string_bytes;
+        t.coldKeys += db.cold_store.size();
+    }
+    t.log = tierLog->statistics();
+    return t;
+}
+
+uint32_t redisdatabase::recordAccess(const std::string& key) {
+    if (!access) {
+        if (!tierOn.load(std::memory_order_relaxed))
+            return 0;
+        access.reset(new accesssketch());
+    }
+    return access->record(accessHash(key));
+}
+
+void redisdatabase::releaseCold(const std::string& key, const redistier::ref& where) {
+    tierLog->release(where, key.size());
+}
+
+std::string& redisdatabase::stringSlot(const std::string& key) {
+    if (!cold_store.empty()) {
+        auto cold = cold_store.find(key);
+        if (cold != cold_store.end()) {
+            releaseCold(key, cold->second);
+            cold_store.erase(cold);
+        }
+    }
+    std::string& slot = kv_store[key];
+    string_bytes -= slot.size();
+    countPacked(slot, false);
+    return slot;
+}
+
+// Copy-assigning keeps the old value's buffer when it is big enough
+void redisdatabase::storeString(const std::string& key, const std::string& value) {
+    stringSlot(key) = value;
+    string_bytes += value.size();
+    countPacked(value, true);
+}
+
+void redisdatabase::storeString(const std::string& key, std::string&& value) {
+    string_bytes += value.size();
+    countPacked(value, true);
+    stringSlot(key) = std::move(value);
+}
+
+bool redisdatabase::eraseString(const std::string& key) {
     auto it = kv_store.find(key);
     if (it != kv_store.end()) {
-        value = it->second;
+        string_bytes -= it->second.size();
+        countPacked(it->second, false);
+        kv_store.erase(it);
         return true;
     }
-    return false;
+    if (cold_store.empty())
+        return false;
+    auto cold = cold_store.find(key);
+    if (cold == cold_store.end())
+        return false;
+    releaseCold(key, cold->second);
+    cold_store.erase(cold);
+    return true;
 }
 
-std::vector<std::string> redisdatabase::keys() {
-    std::lock_guard<std::mutex> lock(db_mutex);
+void redisdatabase::promote(const std::string& key) {
+    if (!tierOn.load(std::memory_order_relaxed))
+        return;
+    redistier::ref where;
+    redistier::handle segment;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        auto found = cold_store.empty() ? cold_store.end() : cold_store.find(key);
+        if (found == cold_store.end())
+            return;
+        where = found->second;
+        segment = tierLog->open(where.segment);
+    }
+    // As in get(), the record is immutable and the handle keeps its segment
+    std::string value;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = redistier::read(segment, where, value);
+    redisstats::coldRead(nanosSince(start));
+    redisstats::add(redisstats::TIER_DISK_READS);
+    if (!ok)
+        return; // warm() reports it and drops the key
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    auto found = cold_store.find(key);
+    if (found != cold_store.end() && sameRef(found->second, where)) {
+        releaseCold(key, where);
+        cold_store.erase(found);
+        storeString(key, std::move(value));
+        tierPromotions++;
+    }
+}
+
+void redisdatabase::warm(const std::string& key) {
+    auto cold = cold_store.empty() ? cold_store.end() : cold_store.find(key);
+    if (cold != cold_store.end()) {
+        redistier::ref where = cold->second;
+        std::string value;
+        auto start = std::chrono::steady_clock::now();
+        bool ok = redistier::read(tierLog->open(where.segment), where, value);
+        redisstats::coldRead(nanosSince(start));
+        redisstats::add(redisstats::TIER_DISK_READS);
+        releaseCold(key, where);
+        cold_store.erase(cold);
+        if (!ok) {
+            // Nothing better to do with an unreadable record than drop the key
+            std::cerr << "Tier read failed for key " << key << "; key dropped\n";
+            return;
+        }
+        storeString(key, std::move(value));
+        tierPromotions++;
+    }
+
+    // A raw value that starts with NUL stays escaped: no in-place command
+    // works on one
+    auto it = kv_store.find(key);
+    if (it == kv_store.end() || !isPacked(it->second))
+        return;
+    if (!isCompressed(it->second)) {
+        // Escaped: checked in place, since a bitmap is read here on every
+        // SETBIT
+        if (it->second.size() > 2 && it->second[2] != '\0') {
+            it->second.erase(0, 2);
+            string_bytes -= 2;
+        }
+        return;
+    }
+    std::string raw = it->second;
+    if (!unpackValue(raw) || isPacked(raw))
+        return;
+    string_bytes -= it->second.size();
+    countPacked(it->second, false);
+    string_bytes += raw.size();
+    it->second = std::move(raw);
+}
+
+bool redisdatabase::readString(const std::string& key, std::string& value) {
+    auto it = kv_store.find(key);
+    if (it != kv_store.end()) {
+        value = it->second;
+        return unpackValue(value);
+    }
+    auto cold = cold_store.empty() ? cold_store.end() : cold_store.find(key);
+    if (cold == cold_store.end())
+        return false;
+    auto start = std::chrono::steady_clock::now();
+    bool ok = redistier::read(tierLog->open(cold->second.segment), cold->second, value);
+    redisstats::coldRead(nanosSince(start));
+    redisstats::add(redisstats::TIER_DISK_READS);
+    return ok && unpackValue(value);
+}
+
+void redisdatabase::loadString(const std::string& key, std::string value) {
+    if (tierOn && value.size() >= TIER_MIN_VALUE && string_bytes + value.size() > tierBudget) {
+        redistier::ref where;
+        std::string err;
+        if (tierLog->append(key, value, where, err)) {
+            eraseString(key);
+            cold_store[key] = where;
+            tierDemotions++;
+            return;
+        }
+        std::cerr << "Tier write failed: " << err << "\n";
+    }
+    storeString(key, std::move(value));
+}
+
+bool redisdatabase::demoteColdest(uint64_t budget) {
+    static std::mt19937_64 rng(std::random_device{}()); // tier thread only
+    std::vector<std::pair<std::string, std::string>> victims;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        if (string_bytes <= budget)
+            return false;
+        std::unordered_set<std::string> picked;
+        std::vector<std::pair<uint32_t, const std::pair<std::string, std::string>*>> sample;
+        uint64_t bytes = 0;
+        for (int round = 0; round < TIER_ROUNDS && bytes < TIER_BATCH_BYTES && string_bytes - bytes > budget; ++round) {
+            sample.clear();
+            for (int i = 0; i < TIER_SAMPLES; ++i) {
+                auto it = kv_store.sample(rng());
+                if (it == kv_store.end())
+                    break;
+                if (it->second.size() >= TIER_MIN_VALUE && !picked.count(it->first))
+                    sample.emplace_back(access ? access->estimate(accessHash(it->first)) : 0, &*it);
+            }
+            std::sort(sample.begin(), sample.end(),
+                [](const auto& a, const auto& b) { return a.first < b.first; });
+            size_t take = (sample.size() + 3) / 4;
+            for (size_t i = 0; i < take; ++i) {
+                if (!picked.insert(sample[i].second->first).second)
+                    continue;
+                victims.emplace_back(sample[i].second->first, sample[i].second->second);
+                bytes += sample[i].second->second.size();
+            }
+        }
+    }
+    if (victims.empty())
+        return false;
+
+    // Written without the lock; a value changed meanwhile stays in memory
+    // and its fresh record is released
+    std::vector<redistier::ref> refs(victims.size());
+    size_t written = 0;
+    std::string err;
+    while (written < victims.size() && tierLog->append(victims[written].first, victims[written].second, refs[written], err))
+        written++;
+    if (written < victims.size())
+        std::cerr << "Tier write failed: " << err << "\n";
+
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    for (size_t i = 0; i < written; ++i) {
+        const std::string& key = victims[i].first;
+        auto it = kv_store.find(key);
+        if (it == kv_store.end() || it->second != victims[i].second) {
+            tierLog->release(refs[i], key.size());
+            continue;
+        }
+        string_bytes -= it->second.size();
+        countPacked(it->second, false);
+        kv_store.erase(it);
+        cold_store[key] = refs[i];
+        tierDemotions++;
+    }
+    return written == victims.size();
+}
+
+void redisdatabase::tierCycle() {
+    auto deadline = std::chrono::steady_clock::now() + TIER_SLICE;
+    size_t shards = shardCount();
+    uint64_t budget = tierBudget / shards;
+
+    // Demotion, starting from a different shard each time
+    static size_t firstShard = 0;
+    firstShard = (firstShard + 1) % shards;
+    for (size_t n = 0; n < shards; ++n) {
+        redisdatabase& db = shard((firstShard + n) % shards);
+        while (std::chrono::steady_clock::now() < deadline && db.demoteColdest(budget)) {
+        }
+    }
+
+    // Compaction copies a mostly dead segment's live records forward and
+    // then drops it. Every shard is locked (in order, as multi-key commands
+    // lock them) while records are checked and while refs are swapped, so a
+    // key that moves between shards meanwhile is still found.
+    static redistier::handle compacting;
+    static uint32_t compactingId = 0;
+    static uint64_t compactPos = 0;
+    std::vector<redistier::record> records;
+    auto lockAll = [&]() {
+        std::vector<std::unique_lock<std::recursive_mutex>> locks;
+        for (size_t i = 0; i < shards; ++i)
+            locks.push_back(shard(i).acquire());
+        return locks;
+    };
+    auto findLive = [&](const redistier::record& rec) -> redistier::ref* {
+        for (size_t i = 0; i < shards; ++i) {
+            redisdatabase& db = shard(i);
+            auto it = db.cold_store.find(rec.key);
+            if (it != db.cold_store.end() && sameRef(it->second, rec.where))
+                return &it->second;
+        }
+        return nullptr;
+    };
+    while (std::chrono::steady_clock::now() < deadline) {
+        if (!compacting) {
+            compactingId = tierLog->compactionCandidate();
+            if (compactingId == 0 || !(compacting = tierLog->open(compactingId)))
+                break;
+            compactPos = 0;
+        }
+        if (!redistier::scan(compacting, compactPos, TIER_BATCH_BYTES, records)) {
+            std::cerr << "Tier compaction read failed; retrying later\n";
+            compacting.reset();
+            break;
+        }
+        if (records.empty()) {
+            compacting.reset();
+            tierLog->drop(compactingId);
+            continue;
+        }
+
+        std::vector<bool> live(records.size(), false);
+        {
+            auto locks = lockAll();
+            for (size_t r = 0; r < records.size(); ++r)
+                live[r] = findLive(records[r]) != nullptr;
+        }
+        std::vector<redistier::ref> fresh(records.size());
+        std::string err;
+        bool failed = false;
+        uint64_t bytes = 0;
+        for (size_t r = 0; r < records.size() && !failed; ++r) {
+            if (!live[r])
+                continue;
+            if (tierLog->append(records[r].key, records[r].value, fresh[r], err)) {
+                bytes += redistier::HEADER_BYTES + records[r].key.size() + records[r].value.size();
+            }
+            else {
+                std::cerr << "Tier write failed: " << err << "\n";
+                live[r] = false;
+                failed = true;
+            }
+        }
+        {
+            auto locks = lockAll();
+            for (size_t r = 0; r < records.size(); ++r) {
+                if (!live[r])
+                    continue;
+                redistier::ref* current = findLive(records[r]);
+                if (current) {
+                    tierLog->release(*current, records[r].key.size());
+                    *current = fresh[r];
+                }
+                else {
+                    tierLog->release(fresh[r], records[r].key.size());
+                }
+            }
+        }
+        tierLog->moved(bytes);
+        if (failed) {
+            compacting.reset();
+            break;
+        }
+    }
+}
+
+// Compression
+void redisdatabase::setCompressionMinSize(uint64_t bytes) {
+    compressMin = bytes;
+}
+
+uint64_t redisdatabase::compressionMinSize() {
+    return compressMin;
+}
+
+redisdatabase::compressionstats redisdatabase::compressionStatistics() {
+    compressionstats c;
+    c.minSize = compressMin;
+    c.values = packedValues;
+    c.rawBytes = packedRaw;
+    c.storedBytes = packedStored;
+    return c;
+}
+
+// Memory Analysis
+// Heap bytes a string owns outside its own object: none while it fits the
+// small-string buffer
+static uint64_t heapBytes(const std::string& s) {
+    const char* p = s.data();
+    const char* self = reinterpret_cast<const char*>(&s);
+    return p >= self && p < self + sizeof(s) ? 0 : s.capacity() + 1;
+}
+
+// One entry's share of a redisdict's slots and control bytes
+template <typename Dict>
+static uint64_t slotShare(const Dict& d) {
+    return d.empty() ? 0 : d.memoryUsage() / d.size();
+}
+
+// A std::unordered_map node: the entry, the next link and the cached hash,
+// plus a bucket pointer
+template <typename Map>
+static uint64_t nodeBytes(const Map&) {
+    return sizeof(typename Map::value_type) + 3 * sizeof(void*);
+}
+
+// A make_shared block adds its reference counts to the container
+static const uint64_t SHARED_BLOCK = 2 * sizeof(long) + sizeof(void*);
+
+// Elements past the first samples are taken to average what those did
+static uint64_t scaled(uint64_t sampledBytes, size_t sampled, size_t total) {
+    return sampled == 0 || sampled == total ? sampledBytes : sampledBytes * total / sampled;
+}
+
+static uint64_t listBytes(const std::vector<std::string>& items, size_t samples) {
+    size_t n = samples == 0 ? items.size() : std::min<size_t>(samples, items.size());
+    uint64_t heap = 0;
+    for (size_t i = 0; i < n; ++i)
+        heap += heapBytes(items[i]);
+    return SHARED_BLOCK + sizeof(items) + items.capacity() * sizeof(std::string) + scaled(heap, n, items.size());
+}
+
+static uint64_t hashBytes(const redisdatabase::fieldmap& fields, size_t samples) {
+    size_t n = 0;
+    uint64_t heap = 0;
+    for (auto it = fields.begin(); it != fields.end() && (samples == 0 || n < samples); ++it, ++n)
+        heap += heapBytes(it->first) + heapBytes(it->second);
+    return SHARED_BLOCK + sizeof(fields) + fields.memoryUsage() + scaled(heap, n, fields.size());
+}
+
+const char* redisdatabase::typeName(keytype t) {
+    static const char* const NAMES[KEY_TYPES] = { "string", "list", "hash", "stream", "vectorset", "chat" };
+    return NAMES[t];
+}
+
+bool redisdatabase::memoryUsage(const std::string& key, size_t samples, uint64_t& bytes) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    std::vector<std::string> result;
-    for (const auto& pair : kv_store) {
-        result.push_back(pair.first);
+    bytes = heapBytes(key);
+    if (auto it = kv_store.find(key); it != kv_store.end())
+        bytes += slotShare(kv_store) + heapBytes(it->second);
+    else if (cold_store.find(key) != cold_store.end())
+        bytes += slotShare(cold_store);
+    else if (auto l = list_store.find(key); l != list_store.end())
+        bytes += slotShare(list_store) + listBytes(l->second.read(), samples);
+    else if (auto h = hash_store.find(key); h != hash_store.end())
+        bytes += slotShare(hash_store) + hashBytes(h->second.read(), samples);
+    else if (auto s = stream_store.find(key); s != stream_store.end())
+        bytes += nodeBytes(stream_store) + s->second.memoryUsage();
+    else if (auto v = vector_store.find(key); v != vector_store.end())
+        bytes += nodeBytes(vector_store) + v->second.memoryUsage();
+    else if (auto c = chat_store.find(key); c != chat_store.end())
+        bytes += nodeBytes(chat_store) + c->second.memoryUsage();
+    else
+        return false;
+    if (expiry_map.contains(key))
+        bytes += slotShare(expiry_map) + heapBytes(key);
+    return true;
+}
+
+redisdatabase::memorystats redisdatabase::memoryStatistics() {
+    thread_local std::mt19937_64 rng(std::random_device{}());
+    memorystats m;
+    // Rows in a fixed order: strings by encoding, then one per other type
+    m.rows = {
+        { KEY_STRING, "raw" }, { KEY_STRING, "compressed" }, { KEY_STRING, "cold" }, { KEY_LIST, "array" },
+        { KEY_HASH, "hashtable" }, { KEY_STREAM, "blocks" }, { KEY_VECTORSET, "hnsw" }, { KEY_CHAT, "segments" }
+    };
+    enum { RAW, COMPRESSED, COLD, LIST, HASH, STREAM, VECTORSET, CHAT };
+    for (size_t i = 0; i < shardCount(); ++i) {
+        redisdatabase& db = shard(i);
+        std::lock_guard<std::recursive_mutex> lock(db.db_mutex);
+        db.purgeexpire();
+        m.expires += db.expiry_map.size();
+        m.tableBytes += db.kv_store.memoryUsage() + db.cold_store.memoryUsage() + db.list_store.memoryUsage() +
+            db.hash_store.memoryUsage() + db.expiry_map.memoryUsage();
+
+        // Sampled keys stand in for the rest of their type. A string's
+        // encoding is sampled too: the compression totals count list and
+        // hash elements along with string values.
+        uint64_t sampledRaw = 0, sampledPacked = 0, rawBytes = 0, packedBytes = 0;
+        for (size_t n = 0; n < MEMORY_STATS_SAMPLES && n < db.kv_store.size(); ++n) {
+            auto it = db.kv_store.sample(rng());
+            uint64_t bytes = heapBytes(it->first) + slotShare(db.kv_store) + heapBytes(it->second);
+            if (isCompressed(it->second)) {
+                sampledPacked++;
+                packedBytes += bytes;
+            }
+            else {
+                sampledRaw++;
+                rawBytes += bytes;
+            }
+        }
+        uint64_t strings = db.kv_store.size(), sampled = sampledRaw + sampledPacked;
+        if (sampled > 0) {
+            uint64_t packedKeys = strings * sampledPacked / sampled;
+            m.rows[RAW].keys += strings - packedKeys;
+            m.rows[COMPRESSED].keys += packedKeys;
+            m.rows[RAW].bytes += scaled(rawBytes, sampled, strings);
+            m.rows[COMPRESSED].bytes += scaled(packedBytes, sampled, strings);
+        }
+        auto sampleDict = [&](auto& dict, memoryrow& row, auto valueBytes) {
+            uint64_t bytes = 0;
+            size_t n = 0;
+            for (; n < MEMORY_STATS_SAMPLES && n < dict.size(); ++n) {
+                auto it = dict.sample(rng());
+                bytes += heapBytes(it->first) + slotShare(dict) + valueBytes(it->second);
+            }
+            row.keys += dict.size();
+            row.bytes += scaled(bytes, n, dict.size());
+        };
+        sampleDict(db.cold_store, m.rows[COLD], [](const redistier::ref&) { return uint64_t(0); });
+        sampleDict(db.list_store, m.rows[LIST], [](const cowvalue<std::vector<std::string>>& items) {
+            return listBytes(items.read(), MEMORY_SAMPLES);
+        });
+        sampleDict(db.hash_store, m.rows[HASH],
+            [](const cowvalue<fieldmap>& fields) { return hashBytes(fields.read(), MEMORY_SAMPLES); });
+
+        // The first keys of an unordered_map are as good a sample as any
+        auto sampleMap = [&](auto& map, memoryrow& row) {
+            uint64_t bytes = 0;
+            size_t n = 0;
+            for (auto it = map.begin(); it != map.end() && n < MEMORY_STATS_SAMPLES; ++it, ++n)
+                bytes += heapBytes(it->first) + nodeBytes(map) + it->second.memoryUsage();
+            row.keys += map.size();
+            row.bytes += scaled(bytes, n, map.size());
+        };
+        sampleMap(db.stream_store, m.rows[STREAM]);
+        sampleMap(db.vector_store, m.rows[VECTORSET]);
+        sampleMap(db.chat_store, m.rows[CHAT]);
     }
-    for (const auto& pair : list_store) {
-        result.push_back(pair.first);
+    for (const auto& row : m.rows)
+        m.keys += row.keys;
+    return m;
+}
+
+// Walks an unordered_map a few buckets at a time. A rehash between calls
+// restarts the walk, which may visit some keys twice but never skips one.
+template <typename Map, typename F>
+static bool walkBuckets(const Map& map, redisdatabase::keycursor& c, size_t count, F&& visit) {
+    if (c.buckets != map.bucket_count()) {
+        c.bucket = 0;
+        c.buckets = map.bucket_count();
     }
-    for (const auto& pair : hash_store) {
-        result.push_back(pair.first);
+    for (; c.bucket < c.buckets && count > 0; ++c.bucket, --count) {
+        for (auto it = map.begin(c.bucket); it != map.end(c.bucket); ++it)
+            visit(*it);
     }
-    return result;
+    return c.bucket < c.buckets;
+}
+
+bool redisdatabase::scanKeys(keycursor& cursor, std::chrono::microseconds budget, const keyvisitor& visit) {
+    // Slots (or buckets) between clock reads
+    const size_t DICT_STEP = 64;
+    const size_t MAP_STEP = 4;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    auto now = std::chrono::steady_clock::now();
+    auto deadline = now + budget;
+    // Expired keys are skipped rather than purged, which would cost a walk
+    // of every TTL
+    auto report = [&](const std::string& key, keytype type, uint64_t bytes, uint64_t elements) {
+        uint64_t ttlBytes = 0;
+        if (!expiry_map.empty()) {
+            auto e = expiry_map.find(key);
+            if (e != expiry_map.end()) {
+                if (now > e->second)
+                    return;
+                ttlBytes = slotShare(expiry_map) + heapBytes(key);
+            }
+        }
+        visit(key, type, heapBytes(key) + bytes + ttlBytes, elements);
+    };
+    while (!cursor.done()) {
+        bool more = false;
+        switch (cursor.store) {
+        case 0:
+            more = kv_store.walk(cursor.dict, DICT_STEP, [&](const auto& e) {
+                report(e.first, KEY_STRING, slotShare(kv_store) + heapBytes(e.second), rawLengthOf(e.second));
+            });
+            break;
+        case 1:
+            more = cold_store.walk(cursor.dict, DICT_STEP, [&](const auto& e) {
+                report(e.first, KEY_STRING, slotShare(cold_store), e.second.length);
+            });
+            break;
+        case 2:
+            more = list_store.walk(cursor.dict, DICT_STEP, [&](const auto& e) {
+                const auto& items = e.second.read();
+                report(e.first, KEY_LIST, slotShare(list_store) + listBytes(items, MEMORY_SAMPLES), items.size());
+            });
+            break;
+        case 3:
+            more = hash_store.walk(cursor.dict, DICT_STEP, [&](const auto& e) {
+                const auto& fields = e.second.read();
+                report(e.first, KEY_HASH, slotShare(hash_store) + hashBytes(fields, MEMORY_SAMPLES), fields.size());
+            });
+            break;
+        case 4:
+            more = walkBuckets(stream_store, cursor, MAP_STEP, [&](const auto& e) {
+                report(e.first, KEY_STREAM, nodeBytes(stream_store) + e.second.memoryUsage(), e.second.length());
+            });
+            break;
+        case 5:
+            more = walkBuckets(vector_store, cursor, MAP_STEP, [&](const auto& e) {
+                report(e.first, KEY_VECTORSET, nodeBytes(vector_store) + e.second.memoryUsage(), e.second.size());
+            });
+            break;
+        default:
+            more = walkBuckets(chat_store, cursor, MAP_STEP, [&](const auto& e) {
+                report(e.first, KEY_CHAT, nodeBytes(chat_store) + e.second.memoryUsage(), e.second.length());
+            });
+            break;
+        }
+        if (!more) {
+            cursor.store++;
+            cursor.dict = dictcursor();
+            cursor.bucket = cursor.buckets = 0;
+        }
+        if (std::chrono::steady_clock::now() >= deadline)
+            break;
+    }
+    return !cursor.done();
+}
+
+bool redisdatabase::eraseList(const std::string& key) {
+    auto it = list_store.find(key);
+    if (it == list_store.end())
+        return false;
+    if (packedValues.load(std::memory_order_relaxed)) {
+        for (const auto& item : it->second.read())
+            countPacked(item, false);
+    }
+    list_store.erase(it);
+    return true;
+}
+
+bool redisdatabase::eraseHash(const std::string& key) {
+    auto it = hash_store.find(key);
+    if (it == hash_store.end())
+        return false;
+    if (packedValues.load(std::memory_order_relaxed)) {
+        for (const auto& fv : it->second.read())
+            countPacked(fv.second, false);
+    }
+    hash_store.erase(it);
+    return true;
+}
+
+// Before this shard's stores are cleared
+void redisdatabase::uncountAll() {
+    if (!packedValues.load(std::memory_order_relaxed))
+        return;
+    for (const auto& kv : kv_store)
+        countPacked(kv.second, false);
+    for (const auto& list : list_store) {
+        for (const auto& item : list.second.read())
+            countPacked(item, false);
+    }
+    for (const auto& hash : hash_store) {
+        for (const auto& fv : hash.second.read())
+            countPacked(fv.second, false);
+    }
+}
+
+// Key/Value Operations
+void redisdatabase::set(const std::string& key, const std::string& value) {
+    std::string packed;
+    bool pack = packValue(value, packed);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "set");
+    if (tierOn.load(std::memory_order_relaxed))
+        recordAccess(key);
+    if (pack)
+        storeString(key, std::move(packed));
+    else
+        storeString(key, value);
+}
+
+bool redisdatabase::get(const std::string& key, std::string& value) {
+    redistier::ref where;
+    redistier::handle segment;
+    uint32_t hits = 0;
+    bool cold = false;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = kv_store.find(key);
+        if (it != kv_store.end()) {
+            value = it->second;
+            if (tierOn.load(std::memory_order_relaxed)) {
+                recordAccess(key);
+                redisstats::add(redisstats::TIER_MEMORY_HITS);
+            }
+        }
+        else {
+            if (cold_store.empty())
+                return false;
+            auto found = cold_store.find(key);
+            if (found == cold_store.end())
+                return false;
+            where = found->second;
+            segment = tierLog->open(where.segment);
+            hits = recordAccess(key);
+            cold = true;
+        }
+    }
+
+    if (cold) {
+        // The disk read runs without the lock; the record is immutable and the
+        // handle keeps its segment open even if compaction drops it meanwhile
+        auto start = std::chrono::steady_clock::now();
+        bool ok = redistier::read(segment, where, value);
+        redisstats::coldRead(nanosSince(start));
+        redisstats::add(redisstats::TIER_DISK_READS);
+        if (!ok) {
+            std::cerr << "Tier read failed for key " << key << "\n";
+            return false;
+        }
+
+        // A value read again soon after is worth memory again; the demoter
+        // makes room by pushing out colder ones
+        if (hits >= TIER_PROMOTE_HITS) {
+            std::lock_guard<std::recursive_mutex> lock(db_mutex);
+            auto found = cold_store.find(key);
+            if (found != cold_store.end() && sameRef(found->second, where)) {
+                releaseCold(key, where);
+                cold_store.erase(found);
+                string_bytes += value.size();
+                countPacked(value, true);
+                kv_store[key] = value;
+                tierPromotions++;
+            }
+        }
+    }
+
+    // Decompressed after the lock is released
+    if (!unpackValue(value)) {
+        std::cerr << "Corrupt compressed value for key " << key << "\n";
+        return false;
+    }
+    return true;
+}
+
+size_t redisdatabase::strlen(const std::string& key) {
+    redistier::ref head;
+    redistier::handle segment;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = kv_store.find(key);
+        if (it != kv_store.end())
+            return static_cast<size_t>(rawLengthOf(it->second));
+        auto cold = cold_store.empty() ? cold_store.end() : cold_store.find(key);
+        if (cold == cold_store.end())
+            return 0;
+        head = cold->second;
+        segment = tierLog->open(head.segment);
+    }
+    // A cold value's header is enough; the read runs without the lock as in get()
+    size_t length = head.length;
+    head.length = static_cast<uint32_t>(std::min<size_t>(length, PACK_HEADER_MAX));
+    std::string prefix;
+    if (!redistier::read(segment, head, prefix))
+        return 0;
+    if (!isPacked(prefix))
+        return length;
+    if (prefix.size() >= 2 && prefix[1] == PACK_ESCAPED)
+        return length - 2;
+    return static_cast<size_t>(rawLengthOf(prefix));
+}
+
+std::vector<std::string> redisdatabase::keys() {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::vector<std::string> result;
+    for (const auto& pair : kv_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : cold_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : list_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : hash_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : stream_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : vector_store) {
+        result.push_back(pair.first);
+    }
+    for (const auto& pair : chat_store) {
+        result.push_back(pair.first);
+    }
+    return result;
+}
+
+size_t redisdatabase::keyCount(size_t& expires) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    expires = expiry_map.size();
+    return kv_store.size() + cold_store.size() + list_store.size() + hash_store.size() + stream_store.size() +
+        vector_store.size() + chat_store.size();
+}
+
+std::string redisdatabase::type(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    if (kv_store.find(key) != kv_store.end() || cold_store.find(key) != cold_store.end())
+        return "string";
+    if (list_store.find(key) != list_store.end())
+        return "list";
+    if (hash_store.find(key) != hash_store.end())
+        return "hash";
+    if (stream_store.find(key) != stream_store.end())
+        return "stream";
+    if (vector_store.find(key) != vector_store.end())
+        return "vectorset";
+    if (chat_store.find(key) != chat_store.end())
+        return "chat";
+    return "none";
+}
+
+bool redisdatabase::del(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    bool erased = false;
+    erased |= eraseString(key);
+    erased |= eraseList(key);
+    erased |= eraseHash(key);
+    erased |= stream_store.erase(key) > 0;
+    erased |= vector_store.erase(key) > 0;
+    erased |= chat_store.erase(key) > 0;
+    expiry_map.erase(key); // Also remove from expiry map
+    dropCacheEntry(key);
+    if (erased)
+        touch(key, "del");
+    return erased; // Fixed: was returning false
+}
+
+bool redisdatabase::expire(const std::string& key, int seconds) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    bool exists = (kv_store.find(key) != kv_store.end()) ||
+        (cold_store.find(key) != cold_store.end()) ||
+        (list_store.find(key) != list_store.end()) ||
+        (hash_store.find(key) != hash_store.end()) ||
+        (stream_store.find(key) != stream_store.end()) ||
+        (vector_store.find(key) != vector_store.end()) ||
+        (chat_store.find(key) != chat_store.end());
+    if (!exists)
+        return false;
+
+    touch(key, "expire");
+    expiry_map[key] = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
+    return true;
+}
+
+void redisdatabase::purgeexpire() {
+    if (expiry_map.empty())
+        return;
+    auto now = std::chrono::steady_clock::now();
+    uint64_t expired = 0;
+    for (auto it = expiry_map.begin(); it != expiry_map.end(); ) {
+        if (now > it->second) {
+            // Remove from all stores
+            eraseString(it->first);
+            eraseList(it->first);
+            eraseHash(it->first);
+            stream_store.erase(it->first);
+            vector_store.erase(it->first);
+            chat_store.erase(it->first);
+            dropCacheEntry(it->first);
+            touch(it->first, "expired");
+            it = expiry_map.erase(it);
+            expired++;
+        }
+        else {
+            ++it;
+        }
+    }
+    if (expired)
+        redisstats::add(redisstats::EXPIRED_KEYS, expired);
+    redisstats::latencySample("expire-cycle", static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - now).count()));
+}
+
+bool redisdatabase::rename(const std::string& oldKey, const std::string& newKey) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    if (oldKey == newKey)
+        return exists(oldKey);
+    bool found = false;
+
+    // Values are moved out before inserting newKey: an insert into a
+    // redisdict may relocate the entry an iterator points at.
+    auto itKv = kv_store.find(oldKey);
+    if (itKv != kv_store.end()) {
+        std::string value = std::move(itKv->second);
+        string_bytes -= value.size();
+        countPacked(value, false);
+        kv_store.erase(itKv);
+        storeString(newKey, std::move(value));
+        found = true;
+    }
+    auto itCold = cold_store.find(oldKey);
+    if (itCold != cold_store.end()) {
+        redistier::ref where = itCold->second;
+        cold_store.erase(itCold);
+        eraseString(newKey);
+        cold_store[newKey] = where;
+        found = true;
+    }
+
+    auto itList = list_store.find(oldKey);
+    if (itList != list_store.end()) {
+        auto list = std::move(itList->second);
+        list_store.erase(itList);
+        eraseList(newKey);
+        list_store[newKey] = std::move(list);
+        found = true;
+    }
+
+    auto itHash = hash_store.find(oldKey);
+    if (itHash != hash_store.end()) {
+        auto hash = std::move(itHash->second);
+        hash_store.erase(itHash);
+        eraseHash(newKey);
+        hash_store[newKey] = std::move(hash);
+        found = true;
+    }
+
+    auto itStream = stream_store.find(oldKey);
+    if (itStream != stream_store.end()) {
+        stream_store[newKey] = std::move(itStream->second);
+        stream_store.erase(itStream);
+        found = true;
+    }
+
+    auto itVector = vector_store.find(oldKey);
+    if (itVector != vector_store.end()) {
+        vector_store[newKey] = std::move(itVector->second);
+        vector_store.erase(itVector);
+        found = true;
+    }
+
+    auto itChat = chat_store.find(oldKey);
+    if (itChat != chat_store.end()) {
+        chat_store[newKey] = std::move(itChat->second);
+        chat_store.erase(itChat);
+        found = true;
+    }
+
+    if (found) {
+        touch(oldKey, "rename_from");
+        touch(newKey, "rename_to");
+    }
+
+    dropCacheEntry(oldKey);
+    dropCacheEntry(newKey);
+
+    auto itExpire = expiry_map.find(oldKey);
+    if (itExpire != expiry_map.end()) {
+        auto when = itExpire->second;
+        expiry_map.erase(itExpire);
+        expiry_map[newKey] = when;
+    }
+
+    return found;
+}
+
+// List and hash elements are packed before the lock is taken and unpacked
+// after it is released.
+std::vector<std::string> redisdatabase::lget(const std::string& key) {
+    std::vector<std::string> values;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = list_store.find(key);
+        if (it == list_store.end())
+            return {};
+        values = it->second.read();
+    }
+    unpackAll(values);
+    return values;
+}
+
+size_t redisdatabase::llen(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = list_store.find(key);
+    if (it != list_store.end())
+        return it->second.read().size();
+    return 0;
+}
+
+void redisdatabase::lpush(const std::string& key, const std::string& value) {
+    std::string packed;
+    const std::string& stored = packValue(value, packed) ? packed : value;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "lpush");
+    auto& list = list_store[key].write();
+    list.insert(list.begin(), stored);
+    countPacked(stored, true);
+}
+
+void redisdatabase::rpush(const std::string& key, const std::string& value) {
+    std::string packed;
+    const std::string& stored = packValue(value, packed) ? packed : value;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "rpush");
+    list_store[key].write().push_back(stored);
+    countPacked(stored, true);
+}
+
+bool redisdatabase::lpop(const std::string& key, std::string& value) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = list_store.find(key);
+        if (it == list_store.end() || it->second.read().empty())
+            return false;
+        auto& list = it->second.write();
+        value = std::move(list.front());
+        list.erase(list.begin());
+        countPacked(value, false);
+        touch(key, "lpop");
+    }
+    unpackValue(value);
+    return true;
+}
+
+bool redisdatabase::rpop(const std::string& key, std::string& value) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = list_store.find(key);
+        if (it == list_store.end() || it->second.read().empty())
+            return false;
+        auto& list = it->second.write();
+        value = std::move(list.back());
+        list.pop_back();
+        countPacked(value, false);
+        touch(key, "rpop");
+    }
+    unpackValue(value);
+    return true;
+}
+
+int redisdatabase::lrem(const std::string& key, int count, const std::string& value) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    int removed = 0;
+    auto it = list_store.find(key);
+    if (it == list_store.end())
+        return 0;
+
+    auto& lst = it->second.write();
+    // Elements are compared as they were pushed; a compressed one is only
+    // decompressed when its raw length matches
+    auto matches = [&](const std::string& stored) {
+        if (!rawEquals(stored, value))
+            return false;
+        countPacked(stored, false);
+        return true;
+    };
+
+    if (count == 0) {
+        // Remove all occurrences
+        auto new_end = std::remove_if(lst.begin(), lst.end(), matches);
+        removed = std::distance(new_end, lst.end());
+        lst.erase(new_end, lst.end());
+    }
+    else if (count > 0) {
+        // Remove from head to tail
+        for (auto iter = lst.begin(); iter != lst.end() && removed < count; ) {
+            if (matches(*iter)) {
+                iter = lst.erase(iter);
+                ++removed;
+            }
+            else {
+                ++iter;
+            }
+        }
+    }
+    else {
+        // Remove from tail to head (count is negative)
+        count = -count; // Make it positive for comparison
+        for (auto riter = lst.rbegin(); riter != lst.rend() && removed < count; ) {
+            if (matches(*riter)) {
+                // Convert reverse iterator to forward iterator
+                auto fwdIter = std::next(riter).base();
+                fwdIter = lst.erase(fwdIter);
+                ++removed;
+                // Update reverse iterator after erase
+                riter = std::reverse_iterator<std::vector<std::string>::iterator>(fwdIter);
+            }
+            else {
+                ++riter;
+            }
+        }
+    }
+    if (removed > 0)
+        touch(key, "lrem");
+    return removed;
+}
+
+bool redisdatabase::lindex(const std::string& key, int index, std::string& value) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = list_store.find(key);
+        if (it == list_store.end())
+            return false;
+
+        const auto& lst = it->second.read();
+        if (index < 0)
+            index = static_cast<int>(lst.size()) + index;
+        if (index < 0 || index >= static_cast<int>(lst.size()))
+            return false;
+
+        value = lst[index];
+    }
+    unpackValue(value);
+    return true;
+}
+
+bool redisdatabase::lset(const std::string& key, int index, const std::string& value) {
+    std::string packed;
+    const std::string& stored = packValue(value, packed) ? packed : value;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = list_store.find(key);
+    if (it == list_store.end())
+        return false;
+
+    if (index < 0)
+        index = static_cast<int>(it->second.read().size()) + index;
+    if (index < 0 || index >= static_cast<int>(it->second.read().size()))
+        return false;
+
+    auto& lst = it->second.write();
+    countPacked(lst[index], false);
+    lst[index] = stored;
+    countPacked(stored, true);
+    touch(key, "lset");
+    return true;
+}
+
+// Hash Operations
+bool redisdatabase::hset(const std::string& key, const std::string& field, const std::string& value) {
+    std::string packed;
+    const std::string& stored = packValue(value, packed) ? packed : value;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "hset");
+    std::string& slot = hash_store[key].write()[field];
+    countPacked(slot, false);
+    slot = stored;
+    countPacked(stored, true);
+    return true;
+}
+
+bool redisdatabase::hget(const std::string& key, const std::string& field, std::string& value) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = hash_store.find(key);
+        if (it == hash_store.end())
+            return false;
+        const fieldmap& hash = it->second.read();
+        auto f = hash.find(field);
+        if (f == hash.end())
+            return false;
+        value = f->second;
+    }
+    unpackValue(value);
+    return true;
+}
+
+bool redisdatabase::hexists(const std::string& key, const std::string& field) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = hash_store.find(key);
+    if (it != hash_store.end())
+        return it->second.read().count(field) > 0;
+    return false;
+}
+
+bool redisdatabase::hdel(const std::string& key, const std::string& field) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = hash_store.find(key);
+    if (it == hash_store.end())
+        return false;
+    if (!it->second.read().count(field))
+        return false;
+    fieldmap& hash = it->second.write();
+    auto f = hash.find(field);
+    countPacked(f->second, false);
+    hash.erase(f);
+    touch(key, "hdel");
+    return true;
+}
+
+std::unordered_map<std::string, std::string> redisdatabase::hgetall(const std::string& key) {
+    std::unordered_map<std::string, std::string> values;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = hash_store.find(key);
+        if (it == hash_store.end())
+            return {};
+        values.insert(it->second.read().begin(), it->second.read().end());
+    }
+    for (auto& fv : values)
+        unpackValue(fv.second);
+    return values;
+}
+
+std::vector<std::string> redisdatabase::hkeys(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::vector<std::string> fields;
+    auto it = hash_store.find(key);
+    if (it != hash_store.end()) {
+        for (const auto& pair : it->second.read())
+            fields.push_back(pair.first);
+    }
+    return fields;
+}
+
+std::vector<std::string> redisdatabase::hvals(const std::string& key) {
+    std::vector<std::string> values;
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = hash_store.find(key);
+        if (it != hash_store.end()) {
+            for (const auto& pair : it->second.read())
+                values.push_back(pair.second);
+        }
+    }
+    unpackAll(values);
+    return values;
+}
+
+size_t redisdatabase::hlen(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = hash_store.find(key);
+    return (it != hash_store.end()) ? it->second.read().size() : 0;
+}
+
+bool redisdatabase::hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fieldValues) {
+    std::vector<std::string> packed(fieldValues.size());
+    std::vector<bool> pack(fieldValues.size());
+    for (size_t i = 0; i < fieldValues.size(); ++i)
+        pack[i] = packValue(fieldValues[i].second, packed[i]);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "hset");
+    fieldmap& hash = hash_store[key].write();
+    for (size_t i = 0; i < fieldValues.size(); ++i) {
+        std::string& slot = hash[fieldValues[i].first];
+        countPacked(slot, false);
+        if (pack[i])
+            slot = std::move(packed[i]);
+        else
+            slot = fieldValues[i].second;
+        countPacked(slot, true);
+    }
+    return true;
+}
+
+// Collection Views
+redisdatabase::listview redisdatabase::listView(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = list_store.find(key);
+    return it == list_store.end() ? nullptr : it->second.view();
+}
+
+redisdatabase::hashview redisdatabase::hashView(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = hash_store.find(key);
+    return it == hash_store.end() ? nullptr : it->second.view();
+}
+
+const std::string& redisdatabase::unpacked(const std::string& stored, std::string& scratch) {
+    if (!isPacked(stored))
+        return stored;
+    scratch = stored;
+    unpackValue(scratch);
+    return scratch;
+}
+
+// HyperLogLog Operations
+bool redisdatabase::pfadd(const std::string& key, const std::vector<std::string>& elements, bool& updated) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    updated = false;
+    warm(key);
+    auto it = kv_store.find(key);
+    if (it == kv_store.end()) {
+        it = kv_store.emplace(key, hyperloglog::create()).first;
+        string_bytes += it->second.size();
+        updated = true;
+    }
+    else if (!hyperloglog::isValid(it->second)) {
+        return false;
+    }
+    size_t before = it->second.size();
+    for (const auto& element : elements) {
+        if (hyperloglog::add(it->second, element))
+            updated = true;
+    }
+    string_bytes += it->second.size() - before;
+    if (updated)
+        touch(key, "pfadd");
+    return true;
+}
+
+bool redisdatabase::pfcount(const std::vector<std::string>& keys, uint64_t& count) {
+    for (const auto& key : keys)
+        promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    count = 0;
+    for (const auto& key : keys)
+        warm(key);
+    if (keys.size() == 1) {
+        auto it = kv_store.find(keys[0]);
+        if (it == kv_store.end())
+            return true;
+        if (!hyperloglog::isValid(it->second))
+            return false;
+        count = hyperloglog::count(it->second);
+        return true;
+    }
+
+    std::vector<uint8_t> raw(hyperloglog::REGISTERS, 0);
+    for (const auto& key : keys) {
+        auto it = kv_store.find(key);
+        if (it == kv_store.end())
+            continue;
+        if (!hyperloglog::isValid(it->second))
+            return false;
+        hyperloglog::mergeInto(raw.data(), it->second);
+    }
+    count = hyperloglog::countRaw(raw.data());
+    return true;
+}
+
+bool redisdatabase::pfmerge(const std::string& destKey, const std::vector<std::string>& sourceKeys) {
+    for (const auto& key : sourceKeys)
+        promote(key);
+    promote(destKey);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::vector<uint8_t> raw(hyperloglog::REGISTERS, 0);
+    std::vector<std::string> all(sourceKeys);
+    all.push_back(destKey);
+    for (const auto& key : all) {
+        warm(key);
+        auto it = kv_store.find(key);
+        if (it == kv_store.end())
+            continue;
+        if (!hyperloglog::isValid(it->second))
+            return false;
+        hyperloglog::mergeInto(raw.data(), it->second);
+    }
+    touch(destKey, "pfadd");
+    storeString(destKey, hyperloglog::fromRaw(raw.data()));
+    return true;
+}
+
+// Bitmap Operations
+std::string* redisdatabase::bitmapSlot(const std::string& key, size_t minLength, size_t& base) {
+    warm(key);
+    auto it = kv_store.find(key);
+    if (it == kv_store.end()) {
+        if (minLength == 0)
+            return nullptr;
+        it = kv_store.emplace(key, std::string()).first;
+    }
+    if (tierOn.load(std::memory_order_relaxed))
+        recordAccess(key);
+    std::string& stored = it->second;
+    if (isCompressed(stored)) {
+        // warm() leaves a value compressed when its raw bytes start with
+        // NUL, as a bitmap's usually do; the bits change in the escaped form
+        std::string raw = stored;
+        if (!unpackValue(raw))
+            return nullptr;
+        string_bytes -= stored.size();
+        countPacked(stored, false);
+        stored.assign(2, PACK_ESCAPED);
+        stored += raw;
+        string_bytes += stored.size();
+    }
+    base = isPacked(stored) ? 2 : 0;
+    size_t want = base + minLength;
+    if (stored.size() < want) {
+        // Geometric growth keeps setting ever higher bits amortized O(1)
+        if (want > stored.capacity())
+            stored.reserve(std::max<size_t>(want, stored.capacity() + stored.capacity() / 2));
+        string_bytes += want - stored.size();
+        stored.resize(want, '\0');
+    }
+    return &stored;
+}
+
+void redisdatabase::sealBitmap(std::string& stored, size_t& base) {
+    if (base == 0 && !stored.empty() && stored[0] == '\0') {
+        stored.insert(0, 2, PACK_ESCAPED);
+        string_bytes += 2;
+        base = 2;
+    }
+}
+
+bool redisdatabase::bitmapBytes(const std::string& key, std::string& scratch, redisbitmap::span& bytes) {
+    auto it = kv_store.find(key);
+    if (it != kv_store.end() && !isCompressed(it->second)) {
+        size_t base = isPacked(it->second) ? 2 : 0;
+        bytes.data = reinterpret_cast<const uint8_t*>(it->second.data()) + base;
+        bytes.size = it->second.size() - base;
+        return true;
+    }
+    if (!readString(key, scratch))
+        return false;
+    bytes.data = reinterpret_cast<const uint8_t*>(scratch.data());
+    bytes.size = scratch.size();
+    return true;
+}
+
+int redisdatabase::setbit(const std::string& key, uint64_t offset, int value) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    size_t base = 0;
+    std::string* stored = bitmapSlot(key, static_cast<size_t>(offset / 8 + 1), base);
+    if (!stored)
+        return 0;
+    int old = redisbitmap::setBit(reinterpret_cast<uint8_t*>(&(*stored)[base]), offset, value);
+    sealBitmap(*stored, base);
+    touch(key, "setbit");
+    return old;
+}
+
+int redisdatabase::getbit(const std::string& key, uint64_t offset) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::string scratch;
+    redisbitmap::span bytes{ nullptr, 0 };
+    if (!bitmapBytes(key, scratch, bytes))
+        return 0;
+    return redisbitmap::getBit(bytes.data, bytes.size, offset);
+}
+
+uint64_t redisdatabase::bitcount(const std::string& key, int64_t start, int64_t end, bool bitUnits) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::string scratch;
+    redisbitmap::span bytes{ nullptr, 0 };
+    if (!bitmapBytes(key, scratch, bytes))
+        return 0;
+    return redisbitmap::count(bytes.data, bytes.size, start, end, bitUnits);
+}
+
+int64_t redisdatabase::bitpos(const std::string& key, int bit, int64_t start, int64_t end, bool endGiven,
+    bool bitUnits) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::string scratch;
+    redisbitmap::span bytes{ nullptr, 0 };
+    if (!bitmapBytes(key, scratch, bytes))
+        return bit ? -1 : 0;
+    return redisbitmap::position(bytes.data, bytes.size, bit, start, end, endGiven, bitUnits);
+}
+
+size_t redisdatabase::bitop(redisbitmap::op o, const std::string& destKey, const std::vector<std::string>& keys) {
+    for (const auto& key : keys)
+        promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    // A missing key reads as an empty string
+    std::vector<std::string> scratch(keys.size());
+    std::vector<redisbitmap::span> sources;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        redisbitmap::span bytes{ reinterpret_cast<const uint8_t*>(""), 0 };
+        bitmapBytes(keys[i], scratch[i], bytes);
+        sources.push_back(bytes);
+    }
+    // Stored uncompressed, as compressing a big result would hold the lock.
+    // The first byte alone says whether the result needs escaping, so the
+    // header is left room for rather than inserted in front of it.
+    std::vector<redisbitmap::span> heads;
+    for (const auto& s : sources)
+        heads.push_back({ s.data, std::min<size_t>(s.size, 1) });
+    std::string head = redisbitmap::combine(o, heads);
+    size_t base = !head.empty() && head[0] == '\0' ? 2 : 0;
+    std::string result = redisbitmap::combine(o, sources, base);
+    size_t length = result.size() - base;
+    touch(destKey, "set");
+    if (length == 0) {
+        eraseString(destKey);
+        return 0;
+    }
+    static_assert(PACK_ESCAPED == '\0', "headroom is zero-filled");
+    storeString(destKey, std::move(result));
+    return length;
+}
+
+std::vector<std::pair<int64_t, bool>> redisdatabase::bitfield(const std::string& key,
+    const std::vector<redisbitmap::fieldop>& ops) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    std::vector<std::pair<int64_t, bool>> results;
+    results.reserve(ops.size());
+    size_t need = 0;
+    for (const auto& op : ops) {
+        if (op.kind != redisbitmap::fieldop::GET)
+            need = std::max(need, redisbitmap::fieldEnd(op));
+    }
+    if (need == 0) {
+        std::string scratch;
+        redisbitmap::span bytes{ nullptr, 0 };
+        bitmapBytes(key, scratch, bytes);
+        for (const auto& op : ops)
+            results.emplace_back(redisbitmap::get(bytes.data, bytes.size, op), true);
+        return results;
+    }
+
+    size_t base = 0;
+    std::string* stored = bitmapSlot(key, need, base);
+    if (!stored) {
+        results.assign(ops.size(), std::make_pair(int64_t(0), false));
+        return results;
+    }
+    uint8_t* p = reinterpret_cast<uint8_t*>(&(*stored)[base]);
+    size_t n = stored->size() - base;
+    for (const auto& op : ops) {
+        int64_t value = 0;
+        bool ok = redisbitmap::apply(p, n, op, value);
+        results.emplace_back(value, ok);
+    }
+    sealBitmap(*stored, base);
+    touch(key, "setbit");
+    return results;
+}
+
+// Stream Operations
+bool redisdatabase::xadd(const std::string& key, const std::string& idSpec, const redisstream::fieldlist& fields,
+    size_t maxlen, bool approx, bool nomkstream, std::string& id, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = stream_store.find(key);
+    if (it == stream_store.end()) {
+        if (nomkstream)
+            return false;
+        it = stream_store.emplace(key, redisstream()).first;
+    }
+    streamid added;
+    if (!it->second.add(idSpec, fields, added, err)) {
+        if (it->second.length() == 0 && it->second.lastId() == streamid::min())
+            stream_store.erase(it);
+        return false;
+    }
+    if (maxlen != SIZE_MAX)
+        it->second.trim(maxlen, approx);
+    touch(key, "xadd");
+    id = added.toString();
+    return true;
 }
 
-std::string redisdatabase::type(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+std::vector<redisstream::entry> redisdatabase::xrange(const std::string& key, const streamid& start, const streamid& end,
+    size_t count, bool reverse) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    if (kv_store.find(key) != kv_store.end())
-        return "string";
-    if (list_store.find(key) != list_store.end())
-        return "list";
-    if (hash_store.find(key) != hash_store.end())
-        return "hash";
-    return "none";
+    auto it = stream_store.find(key);
+    if (it == stream_store.end())
+        return {};
+    return it->second.range(start, end, count, reverse);
 }
 
-bool redisdatabase::del(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::xlen(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    bool erased = false;
-    erased |= kv_store.erase(key) > 0;
-    erased |= list_store.erase(key) > 0;
-    erased |= hash_store.erase(key) > 0;
-    expiry_map.erase(key); // Also remove from expiry map
-    return erased; // Fixed: was returning false
+    auto it = stream_store.find(key);
+    return (it != stream_store.end()) ? it->second.length() : 0;
 }
 
-bool redisdatabase::expire(const std::string& key, int seconds) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::xtrim(const std::string& key, size_t maxlen, bool approx) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    bool exists = (kv_store.find(key) != kv_store.end()) ||
-        (list_store.find(key) != list_store.end()) ||
-        (hash_store.find(key) != hash_store.end());
-    if (!exists)
-        return false;
-
-    expiry_map[key] = std::chrono::steady_clock::now() + std::chrono::seconds(seconds);
-    return true;
+    auto it = stream_store.find(key);
+    size_t trimmed = (it != stream_store.end()) ? it->second.trim(maxlen, approx) : 0;
+    if (trimmed > 0)
+        touch(key, "xtrim");
+    return trimmed;
 }
 
-void redisdatabase::purgeexpire() {
-    auto now = std::chrono::steady_clock::now();
-    for (auto it = expiry_map.begin(); it != expiry_map.end(); ) {
-        if (now > it->second) {
-            // Remove from all stores
-            kv_store.erase(it->first);
-            list_store.erase(it->first);
-            hash_store.erase(it->first);
-            it = expiry_map.erase(it);
-        }
-        else {
-            ++it;
+bool redisdatabase::xread(const std::vector<std::string>& keys, const std::vector<std::string>& ids, size_t count,
+    std::vector<std::pair<std::string, std::vector<redisstream::entry>>>& result, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    for (size_t i = 0; i < keys.size(); ++i) {
+        // "$" only matches entries added after this call, which needs BLOCK
+        if (ids[i] == "$")
+            continue;
+        streamid from;
+        if (!streamid::parseRange("(" + ids[i], true, from)) {
+            err = "Invalid stream ID specified as stream command argument";
+            return false;
         }
+        auto it = stream_store.find(keys[i]);
+        if (it == stream_store.end())
+            continue;
+        auto entries = it->second.range(from, streamid::max(), count, false);
+        if (!entries.empty())
+            result.emplace_back(keys[i], std::move(entries));
     }
+    return true;
 }
 
-bool redisdatabase::rename(const std::string& oldKey, const std::string& newKey) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::xgroupCreate(const std::string& key, const std::string& group, const std::string& id, bool mkstream, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    bool found = false;
-
-    auto itKv = kv_store.find(oldKey);
-    if (itKv != kv_store.end()) {
-        kv_store[newKey] = itKv->second;
-        kv_store.erase(itKv);
-        found = true;
-    }
-
-    auto itList = list_store.find(oldKey);
-    if (itList != list_store.end()) {
-        list_store[newKey] = itList->second;
-        list_store.erase(itList);
-        found = true;
+    auto it = stream_store.find(key);
+    if (it == stream_store.end()) {
+        if (!mkstream) {
+            err = "The XGROUP subcommand requires the key to exist";
+            return false;
+        }
+        it = stream_store.emplace(key, redisstream()).first;
     }
-
-    auto itHash = hash_store.find(oldKey);
-    if (itHash != hash_store.end()) {
-        hash_store[newKey] = itHash->second;
-        hash_store.erase(itHash);
-        found = true;
+    streamid start;
+    if (id == "$")
+        start = it->second.lastId();
+    else if (!streamid::parse(id, start, 0)) {
+        err = "Invalid stream ID specified as stream command argument";
+        return false;
     }
-
-    auto itExpire = expiry_map.find(oldKey);
-    if (itExpire != expiry_map.end()) {
-        expiry_map[newKey] = itExpire->second;
-        expiry_map.erase(itExpire);
+    if (!it->second.createGroup(group, start)) {
+        err = "BUSYGROUP Consumer Group name already exists";
+        return false;
     }
+    touch(key, "xgroup-create");
+    return true;
+}
 
-    return found;
+bool redisdatabase::xgroupDestroy(const std::string& key, const std::string& group) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = stream_store.find(key);
+    if (it == stream_store.end() || !it->second.destroyGroup(group))
+        return false;
+    touch(key, "xgroup-destroy");
+    return true;
 }
-std::vector<std::string> redisdatabase::lget(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+
+bool redisdatabase::xreadgroup(const std::string& group, const std::string& consumer, const std::vector<std::string>& keys,
+    const std::vector<std::string>& ids, size_t count, bool noack,
+    std::vector<std::pair<std::string, std::vector<redisstream::entry>>>& result, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it != list_store.end()) {
-        return it->second;
+    for (size_t i = 0; i < keys.size(); ++i) {
+        auto it = stream_store.find(keys[i]);
+        if (it == stream_store.end() || !it->second.hasGroup(group)) {
+            err = "NOGROUP No such key '" + keys[i] + "' or consumer group '" + group + "'";
+            return false;
+        }
     }
-    return {};
+    for (size_t i = 0; i < keys.size(); ++i) {
+        std::vector<redisstream::entry> entries;
+        if (!stream_store[keys[i]].readGroup(group, consumer, ids[i], count, noack, entries, err))
+            return false;
+        touch(keys[i], "xreadgroup");
+        // History reads always report the stream, even when nothing is pending
+        if (!entries.empty() || ids[i] != ">")
+            result.emplace_back(keys[i], std::move(entries));
+    }
+    return true;
 }
 
-size_t redisdatabase::llen(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::xack(const std::string& key, const std::string& group, const std::vector<streamid>& ids) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it != list_store.end())
-        return it->second.size();
-    return 0;
+    auto it = stream_store.find(key);
+    size_t acked = (it != stream_store.end()) ? it->second.ack(group, ids) : 0;
+    if (acked > 0)
+        touch(key, "xack");
+    return acked;
 }
 
-void redisdatabase::lpush(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    list_store[key].insert(list_store[key].begin(), value);
+bool redisdatabase::xpending(const std::string& key, const std::string& group, redisstream::pendingsummary& summary) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = stream_store.find(key);
+    return it != stream_store.end() && it->second.pending(group, summary);
 }
 
-void redisdatabase::rpush(const std::string& key, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    list_store[key].push_back(value);
+bool redisdatabase::xpending(const std::string& key, const std::string& group, const streamid& start, const streamid& end,
+    size_t count, const std::string& consumer, std::vector<redisstream::pendingdetail>& out) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = stream_store.find(key);
+    return it != stream_store.end() && it->second.pending(group, start, end, count, consumer, out);
 }
 
-bool redisdatabase::lpop(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+// Vector Set Operations
+bool redisdatabase::vadd(const std::string& key, const std::vector<float>& vec, const std::string& element,
+    const redisvectorset::config& cfg, bool& added, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it != list_store.end() && !it->second.empty()) {
-        value = it->second.front();
-        it->second.erase(it->second.begin());
-        return true;
+    auto it = vector_store.find(key);
+    bool created = it == vector_store.end();
+    if (created)
+        it = vector_store.emplace(key, redisvectorset(cfg)).first;
+    if (!it->second.add(element, vec, added, err)) {
+        if (created)
+            vector_store.erase(it);
+        return false;
     }
-    return false;
+    touch(key, "vadd");
+    return true;
 }
 
-bool redisdatabase::rpop(const std::string& key, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::vsim(const std::string& key, const std::vector<float>& query, const std::string& element, size_t k,
+    size_t ef, bool exact, std::vector<std::pair<std::string, float>>& result, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it != list_store.end() && !it->second.empty()) {
-        value = it->second.back();
-        it->second.pop_back();
+    auto it = vector_store.find(key);
+    if (it == vector_store.end())
         return true;
+    std::vector<float> q(query);
+    if (!element.empty() && !it->second.get(element, q)) {
+        err = "element not found in set";
+        return false;
     }
-    return false;
+    if (q.size() != it->second.dimension()) {
+        err = "Vector dimension mismatch - got " + std::to_string(q.size()) + " but set has " +
+            std::to_string(it->second.dimension());
+        return false;
+    }
+    result = it->second.search(q, k, ef, exact);
+    return true;
 }
 
-int redisdatabase::lrem(const std::string& key, int count, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::vrem(const std::string& key, const std::string& element) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    int removed = 0;
-    auto it = list_store.find(key);
-    if (it == list_store.end())
-        return 0;
-
-    auto& lst = it->second;
+    auto it = vector_store.find(key);
+    if (it == vector_store.end() || !it->second.remove(element))
+        return false;
+    touch(key, "vrem");
+    if (it->second.size() == 0)
+        vector_store.erase(it);
+    return true;
+}
 
-    if (count == 0) {
-        // Remove all occurrences
-        auto new_end = std::remove(lst.begin(), lst.end(), value);
-        removed = std::distance(new_end, lst.end());
-        lst.erase(new_end, lst.end());
-    }
-    else if (count > 0) {
-        // Remove from head to tail
-        for (auto iter = lst.begin(); iter != lst.end() && removed < count; ) {
-            if (*iter == value) {
-                iter = lst.erase(iter);
-                ++removed;
-            }
-            else {
-                ++iter;
-            }
-        }
-    }
-    else {
-        // Remove from tail to head (count is negative)
-        count = -count; // Make it positive for comparison
-        for (auto riter = lst.rbegin(); riter != lst.rend() && removed < count; ) {
-            if (*riter == value) {
-                // Convert reverse iterator to forward iterator
-                auto fwdIter = std::next(riter).base();
-                fwdIter = lst.erase(fwdIter);
-                ++removed;
-                // Update reverse iterator after erase
-                riter = std::reverse_iterator<std::vector<std::string>::iterator>(fwdIter);
-            }
-            else {
-                ++riter;
-            }
-        }
-    }
-    return removed;
+bool redisdatabase::vemb(const std::string& key, const std::string& element, std::vector<float>& vec) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = vector_store.find(key);
+    return it != vector_store.end() && it->second.get(element, vec);
 }
 
-bool redisdatabase::lindex(const std::string& key, int index, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::vcard(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it == list_store.end())
-        return false;
+    auto it = vector_store.find(key);
+    return (it != vector_store.end()) ? it->second.size() : 0;
+}
 
-    const auto& lst = it->second;
-    if (index < 0)
-        index = static_cast<int>(lst.size()) + index;
-    if (index < 0 || index >= static_cast<int>(lst.size()))
-        return false;
+size_t redisdatabase::vdim(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = vector_store.find(key);
+    return (it != vector_store.end()) ? it->second.dimension() : 0;
+}
 
-    value = lst[index];
-    return true;
+// Semantic Cache Operations
+void redisdatabase::dropCacheEntry(const std::string& key) {
+    if (semcache_entries.empty())
+        return;
+    auto it = semcache_entries.find(key);
+    if (it == semcache_entries.end())
+        return;
+    auto cache = semcache_store.find(it->second);
+    if (cache != semcache_store.end())
+        cache->second.remove(key);
+    semcache_entries.erase(it);
 }
 
-bool redisdatabase::lset(const std::string& key, int index, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::scacheSet(const std::string& cache, const std::vector<float>& embedding, const std::string& completion,
+    int ttlSeconds, std::string& entryKey, std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = list_store.find(key);
-    if (it == list_store.end())
-        return false;
-
-    auto& lst = it->second;
-    if (index < 0)
-        index = static_cast<int>(lst.size()) + index;
-    if (index < 0 || index >= static_cast<int>(lst.size()))
+    semanticcache& sc = semcache_store[cache];
+    // Skips names a client already took for a key of its own
+    do {
+        entryKey = sc.nextEntryKey(cache);
+    } while (exists(entryKey));
+    if (!sc.insert(entryKey, embedding, err)) {
+        if (sc.size() == 0)
+            semcache_store.erase(cache);
         return false;
-
-    lst[index] = value;
+    }
+    touch(entryKey, "set");
+    std::string packed;
+    if (packValue(completion, packed))
+        storeString(entryKey, std::move(packed));
+    else
+        storeString(entryKey, completion);
+    semcache_entries[entryKey] = cache;
+    if (ttlSeconds > 0)
+        expiry_map[entryKey] = std::chrono::steady_clock::now() + std::chrono::seconds(ttlSeconds);
     return true;
 }
 
-// Hash Operations
-bool redisdatabase::hset(const std::string& key, const std::string& field, const std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    hash_store[key][field] = value;
+bool redisdatabase::scacheGet(const std::string& cache, const std::vector<float>& embedding, float threshold,
+    std::string& completion, float& score, std::string& entryKey) {
+    {
+        std::lock_guard<std::recursive_mutex> lock(db_mutex);
+        purgeexpire();
+        auto it = semcache_store.find(cache);
+        if (it == semcache_store.end() || !it->second.lookup(embedding, threshold, entryKey, score))
+            return false;
+    }
+    // get() reads a cold completion with the lock released
+    if (get(entryKey, completion))
+        return true;
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    if (!exists(entryKey))
+        dropCacheEntry(entryKey);
+    return false;
+}
+
+bool redisdatabase::scacheStats(const std::string& cache, semanticcache::stats& stats) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    auto it = semcache_store.find(cache);
+    if (it == semcache_store.end())
+        return false;
+    stats = it->second.getStats();
     return true;
 }
 
-bool redisdatabase::hget(const std::string& key, const std::string& field, std::string& value) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::scacheDrop(const std::string& cache) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = hash_store.find(key);
-    if (it != hash_store.end()) {
-        auto f = it->second.find(field);
-        if (f != it->second.end()) {
-            value = f->second;
-            return true;
-        }
+    auto it = semcache_store.find(cache);
+    if (it == semcache_store.end())
+        return 0;
+    size_t dropped = it->second.size();
+    for (const auto& entryKey : it->second.entryKeys()) {
+        // Out of the index first, so touch() leaves the cache alone
+        semcache_entries.erase(entryKey);
+        touch(entryKey, "del");
+        eraseString(entryKey);
+        expiry_map.erase(entryKey);
     }
-    return false;
+    semcache_store.erase(it);
+    return dropped;
 }
 
-bool redisdatabase::hexists(const std::string& key, const std::string& field) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+// Chat History Operations
+void redisdatabase::refreshChatTtl(const std::string& key, const redischat& chat) {
+    int ttl = chat.getLimits().ttlSeconds;
+    if (ttl > 0)
+        expiry_map[key] = std::chrono::steady_clock::now() + std::chrono::seconds(ttl);
+}
+
+size_t redisdatabase::chatAppend(const std::string& key, const std::vector<std::pair<std::string, std::string>>& messages) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "chat.append");
     purgeexpire();
-    auto it = hash_store.find(key);
-    if (it != hash_store.end())
-        return it->second.find(field) != it->second.end();
-    return false;
+    redischat& chat = chat_store[key];
+    for (const auto& m : messages)
+        chat.append(m.first, m.second);
+    refreshChatTtl(key, chat);
+    return chat.length();
 }
 
-bool redisdatabase::hdel(const std::string& key, const std::string& field) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::chatRead(const std::string& key, size_t lastN, size_t maxTokens, std::vector<redischat::message>& out) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = hash_store.find(key);
-    if (it != hash_store.end())
-        return it->second.erase(field) > 0;
-    return false;
+    auto it = chat_store.find(key);
+    if (it == chat_store.end())
+        return false;
+    out = it->second.tail(lastN, maxTokens);
+    refreshChatTtl(key, it->second);
+    return true;
 }
 
-std::unordered_map<std::string, std::string> redisdatabase::hgetall(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+size_t redisdatabase::chatLen(const std::string& key) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = hash_store.find(key);
-    if (it != hash_store.end())
-        return it->second;
-    return {};
+    auto it = chat_store.find(key);
+    if (it == chat_store.end())
+        return 0;
+    refreshChatTtl(key, it->second);
+    return it->second.length();
 }
 
-std::vector<std::string> redisdatabase::hkeys(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+void redisdatabase::chatConfig(const std::string& key, int64_t maxMessages, int64_t maxBytes, int ttlSeconds) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    touch(key, "chat.config");
     purgeexpire();
-    std::vector<std::string> fields;
-    auto it = hash_store.find(key);
-    if (it != hash_store.end()) {
-        for (const auto& pair : it->second)
-            fields.push_back(pair.first);
+    redischat& chat = chat_store[key];
+    redischat::limits caps = chat.getLimits();
+    if (maxMessages >= 0)
+        caps.maxMessages = static_cast<size_t>(maxMessages);
+    if (maxBytes >= 0)
+        caps.maxBytes = static_cast<size_t>(maxBytes);
+    if (ttlSeconds >= 0) {
+        caps.ttlSeconds = ttlSeconds;
+        if (ttlSeconds == 0)
+            expiry_map.erase(key);
     }
-    return fields;
+    chat.setLimits(caps);
+    refreshChatTtl(key, chat);
 }
 
-std::vector<std::string> redisdatabase::hvals(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::chatInfo(const std::string& key, redischat::summary& info) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    std::vector<std::string> values;
-    auto it = hash_store.find(key);
-    if (it != hash_store.end()) {
-        for (const auto& pair : it->second)
-            values.push_back(pair.second);
-    }
-    return values;
+    auto it = chat_store.find(key);
+    if (it == chat_store.end())
+        return false;
+    info = it->second.getSummary();
+    return true;
 }
 
-size_t redisdatabase::hlen(const std::string& key) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+// Key Migration
+// Payloads are "<tag><body>" with the snapshot's type tags; unlike the
+// snapshot's 'L' and 'H' lines they are binary safe.
+bool redisdatabase::exists(const std::string& key) {
+    return type(key) != "none";
+}
+
+bool redisdatabase::dumpKey(const std::string& key, std::string& payload, int64_t& ttlMs) {
+    promote(key);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    auto it = hash_store.find(key);
-    return (it != hash_store.end()) ? it->second.size() : 0;
+    payload.clear();
+    std::string blob;
+    // Values go out decompressed so any server can restore them
+    if (readString(key, blob)) {
+        payload.push_back('K');
+        putString(payload, blob);
+    }
+    else if (list_store.count(key)) {
+        const auto& list = list_store[key].read();
+        payload.push_back('L');
+        putVarint(payload, list.size());
+        for (const auto& item : list) {
+            blob = item;
+            unpackValue(blob);
+            putString(payload, blob);
+        }
+    }
+    else if (hash_store.count(key)) {
+        const auto& hash = hash_store[key].read();
+        payload.push_back('H');
+        putVarint(payload, hash.size());
+        for (const auto& fv : hash) {
+            putString(payload, fv.first);
+            blob = fv.second;
+            unpackValue(blob);
+            putString(payload, blob);
+        }
+    }
+    else if (stream_store.count(key)) {
+        stream_store[key].serialize(blob);
+        payload.push_back('S');
+        putString(payload, blob);
+    }
+    else if (vector_store.count(key)) {
+        vector_store[key].serialize(blob);
+        payload.push_back('V');
+        putString(payload, blob);
+    }
+    else if (chat_store.count(key)) {
+        chat_store[key].serialize(blob);
+        payload.push_back('M');
+        putString(payload, blob);
+    }
+    else {
+        return false;
+    }
+
+    ttlMs = 0;
+    auto exp = expiry_map.find(key);
+    if (exp != expiry_map.end()) {
+        auto left = std::chrono::duration_cast<std::chrono::milliseconds>(exp->second - std::chrono::steady_clock::now());
+        ttlMs = left.count() > 0 ? left.count() : 1;
+    }
+    return true;
 }
 
-bool redisdatabase::hmset(const std::string& key, const std::vector<std::pair<std::string, std::string>>& fieldValues) {
-    std::lock_guard<std::mutex> lock(db_mutex);
-    for (const auto& pair : fieldValues) {
-        hash_store[key][pair.first] = pair.second;
+bool redisdatabase::restoreKey(const std::string& key, const std::string& payload, int64_t ttlMs, bool replace,
+    std::string& err) {
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
+    purgeexpire();
+    if (payload.empty()) {
+        err = "DUMP payload version or checksum are wrong";
+        return false;
+    }
+    if (type(key) != "none") {
+        if (!replace) {
+            err = "BUSYKEY Target key name already exists.";
+            return false;
+        }
+        del(key);
+    }
+
+    if (!decodePayload(key, payload, false)) {
+        err = "Bad data format";
+        return false;
     }
+
+    if (ttlMs > 0)
+        expiry_map[key] = std::chrono::steady_clock::now() + std::chrono::milliseconds(ttlMs);
+    touch(key, "restore");
     return true;
 }
 
-bool redisdatabase::dump(const std::string& filename) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+bool redisdatabase::decodePayload(const std::string& key, const std::string& payload, bool packed) {
+    size_t pos = 1;
+    bool ok = !payload.empty();
+    std::string blob;
+    auto store = [&](std::string& value) {
+        std::string encoded;
+        if (!packed && packValue(value, encoded))
+            value.swap(encoded);
+        countPacked(value, true);
+    };
+    switch (ok ? payload[0] : '\0') {
+    case 'K':
+        ok = getString(payload, pos, blob);
+        if (ok) {
+            std::string encoded;
+            if (!packed && packValue(blob, encoded))
+                blob.swap(encoded);
+            loadString(key, std::move(blob));
+        }
+        break;
+    case 'L': {
+        uint64_t n = 0;
+        std::vector<std::string> list;
+        ok = getVarint(payload, pos, n);
+        for (uint64_t i = 0; ok && i < n; ++i) {
+            list.emplace_back();
+            ok = getString(payload, pos, list.back());
+        }
+        if (ok) {
+            eraseList(key);
+            for (auto& item : list)
+                store(item);
+            list_store[key] = std::move(list);
+        }
+        break;
+    }
+    case 'H': {
+        uint64_t n = 0;
+        fieldmap hash;
+        ok = getVarint(payload, pos, n);
+        for (uint64_t i = 0; ok && i < n; ++i) {
+            std::string field, value;
+            ok = getString(payload, pos, field) && getString(payload, pos, value);
+            hash[field] = value;
+        }
+        if (ok) {
+            eraseHash(key);
+            for (auto& fv : hash)
+                store(fv.second);
+            hash_store[key] = std::move(hash);
+        }
+        break;
+    }
+    case 'S':
+        ok = getString(payload, pos, blob) && stream_store[key].deserialize(blob);
+        break;
+    case 'V':
+        ok = getString(payload, pos, blob) && vector_store[key].deserialize(blob);
+        break;
+    case 'M':
+        ok = getString(payload, pos, blob) && chat_store[key].deserialize(blob);
+        break;
+    default:
+        ok = false;
+    }
+    if (!ok) {
+        eraseString(key);
+        stream_store.erase(key);
+        vector_store.erase(key);
+        chat_store.erase(key);
+    }
+    return ok;
+}
+
+bool redisdatabase::dump(const std::string& filename, bool append) {
+    std::unique_lock<std::recursive_mutex> lock(db_mutex);
     purgeexpire();
-    std::ofstream ofs(filename, std::ios::binary);
+    std::ofstream ofs(filename, append ? std::ios::binary | std::ios::app : std::ios::binary);
     if (!ofs) return false;
 
-    // Save key-value pairs
+    // Keys holding compressed (or escaped) values are written as 'P'
+    // records: a DUMP payload with the values as stored, so they stay
+    // compressed on disk and are not recompressed on load
+    std::string packedPayload;
+    auto writeString = [&](const std::string& key, const std::string& stored) {
+        if (isPacked(stored)) {
+            packedPayload.assign(1, 'K');
+            putString(packedPayload, stored);
+            writeBlob(ofs, 'P', key, packedPayload);
+        }
+        else {
+            writeBlob(ofs, 'B', key, stored);
+        }
+    };
+
+    // Save key-value pairs; values that would not survive the whitespace
+    // separated format (HyperLogLogs, binary data) are written length-prefixed
     for (const auto& kv : kv_store) {
-        ofs << "K " << kv.first << " " << kv.second << "\n";
+        if (isPlainToken(kv.second))
+            ofs << "K " << kv.first << " " << kv.second << "\n";
+        else
+            writeString(kv.first, kv.second);
     }
+    // Cold values go into the snapshot inline; the tier log is scratch space.
+    // They are read after the lock is released: the records are immutable
+    // and the handles keep their segments, so the snapshot still holds
+    // their values as of now.
+    struct coldvalue {
+        std::string key;
+        redistier::ref where;
+        redistier::handle segment;
+    };
+    std::vector<coldvalue> coldValues;
+    coldValues.reserve(cold_store.size());
+    for (const auto& kv : cold_store)
+        coldValues.push_back({ kv.first, kv.second, tierLog->open(kv.second.segment) });
 
     // Save lists
     for (const auto& kv : list_store) {
+        const auto& list = kv.second.read();
+        if (std::any_of(list.begin(), list.end(), isPacked)) {
+            packedPayload.assign(1, 'L');
+            putVarint(packedPayload, list.size());
+            for (const auto& item : list)
+                putString(packedPayload, item);
+            writeBlob(ofs, 'P', kv.first, packedPayload);
+            continue;
+        }
         ofs << "L " << kv.first;
-        for (const auto& item : kv.second)
+        for (const auto& item : list)
             ofs << " " << item;
         ofs << "\n";
     }
 
     // Save hashes
     for (const auto& kv : hash_store) {
+        const fieldmap& hash = kv.second.read();
+        if (std::any_of(hash.begin(), hash.end(), [](const auto& fv) { return isPacked(fv.second); })) {
+            packedPayload.assign(1, 'H');
+            putVarint(packedPayload, hash.size());
+            for (const auto& fv : hash) {
+                putString(packedPayload, fv.first);
+                putString(packedPayload, fv.second);
+            }
+            writeBlob(ofs, 'P', kv.first, packedPayload);
+            continue;
+        }
         ofs << "H " << kv.first;
-        for (const auto& field_val : kv.second)
+        for (const auto& field_val : hash)
             ofs << " " << field_val.first << ":" << field_val.second;
         ofs << "\n";
     }
 
+    // Save streams
+    for (const auto& kv : stream_store) {
+        std::string blob;
+        kv.second.serialize(blob);
+        writeBlob(ofs, 'S', kv.first, blob);
+    }
+
+    // Save vector sets (graphs are rebuilt on load)
+    for (const auto& kv : vector_store) {
+        std::string blob;
+        kv.second.serialize(blob);
+        writeBlob(ofs, 'V', kv.first, blob);
+    }
+
+    // Save chat histories
+    for (const auto& kv : chat_store) {
+        std::string blob;
+        kv.second.serialize(blob);
+        writeBlob(ofs, 'M', kv.first, blob);
+    }
+
+    // Save semantic cache indexes; their completions are saved as strings above
+    for (const auto& kv : semcache_store) {
+        std::string blob;
+        kv.second.serialize(blob);
+        writeBlob(ofs, 'C', kv.first, blob);
+    }
+
+    lock.unlock();
+    std::string coldValue;
+    for (const auto& cold : coldValues) {
+        if (!redistier::read(cold.segment, cold.where, coldValue))
+            return false;
+        writeString(cold.key, coldValue);
+    }
     return true;
 }
 
 bool redisdatabase::load(const std::string& filename) {
-    std::lock_guard<std::mutex> lock(db_mutex);
+    std::lock_guard<std::recursive_mutex> lock(db_mutex);
     std::ifstream ifs(filename, std::ios::binary);
     if (!ifs) return false;
 
     // Clear existing data
+    uncountAll();
+    for (const auto& cold : cold_store)
+        releaseCold(cold.first, cold.second);
+    cold_store.clear();
     kv_store.clear();
+    string_bytes = 0;
     list_store.clear();
     hash_store.clear();
+    stream_store.clear();
+    vector_store.clear();
+    chat_store.clear();
     expiry_map.clear();
+    semcache_store.clear();
+    semcache_entries.clear();
+    touchAll();
 
     std::string line;
     while (std::getline(ifs, line)) {
@@ -412,34 +2664,76 @@ bool redisdatabase::load(const std::string& filename) {
         char type;
         iss >> type;
 
-        if (type == 'K') {
+        if (type == 'K' || type == 'B') {
+            // Written before compression was on, or below its threshold
             std::string key, value;
-            iss >> key >> value;
-            kv_store[key] = value;
+            if (type == 'K')
+                iss >> key >> value;
+            else if (!readBlob(iss, ifs, key, value))
+                return false;
+            std::string packed;
+            if (packValue(value, packed))
+                value.swap(packed);
+            loadString(key, std::move(value));
+        }
+        else if (type == 'P') {
+            std::string key, payload;
+            if (!readBlob(iss, ifs, key, payload) || !decodePayload(key, payload, true))
+                return false;
         }
         else if (type == 'L') {
             std::string key;
             iss >> key;
-            std::string item;
+            std::string item, packed;
             std::vector<std::string> list;
-            while (iss >> item)
+            while (iss >> item) {
+                if (packValue(item, packed))
+                    item.swap(packed);
+                countPacked(item, true);
                 list.push_back(item);
-            list_store[key] = list;
+            }
+            list_store[key] = std::move(list);
         }
         else if (type == 'H') {
             std::string key;
             iss >> key;
-            std::unordered_map<std::string, std::string> hash;
+            fieldmap hash;
             std::string pair;
             while (iss >> pair) {
                 auto pos = pair.find(':');
                 if (pos != std::string::npos) {
                     std::string field = pair.substr(0, pos);
-                    std::string value = pair.substr(pos + 1);
+                    std::string value = pair.substr(pos + 1), packed;
+                    if (packValue(value, packed))
+                        value.swap(packed);
                     hash[field] = value;
                 }
             }
-            hash_store[key] = hash;
+            for (const auto& fv : hash)
+                countPacked(fv.second, true);
+            hash_store[key] = std::move(hash);
+        }
+        else if (type == 'S') {
+            std::string key, blob;
+            if (!readBlob(iss, ifs, key, blob) || !stream_store[key].deserialize(blob))
+                return false;
+        }
+        else if (type == 'V') {
+            std::string key, blob;
+            if (!readBlob(iss, ifs, key, blob) || !vector_store[key].deserialize(blob))
+                return false;
+        }
+        else if (type == 'M') {
+            std::string key, blob;
+            if (!readBlob(iss, ifs, key, blob) || !chat_store[key].deserialize(blob))
+                return false;
+        }
+        else if (type == 'C') {
+            std::string cache, blob;
+            if (!readBlob(iss, ifs, cache, blob) || !semcache_store[cache].deserialize(blob))
+                return false;
+            for (const auto& entryKey : semcache_store[cache].entryKeys())
+                semcache_entries[entryKey] = cache;
         }
     }
     return true;
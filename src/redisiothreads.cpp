@@ -0,0 +1,407 @@
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include "../include/redisiothreads.h"
+#include "../include/rediscommandhandler.h"
+#include "../include/redisclient.h"
+#include "../include/redisstats.h"
+
+static const size_t RING_SIZE = 65536;
+static const size_t EXEC_BATCH = 256; // commands taken from one I/O thread before moving on
+static const int EXEC_SPINS = 200;   // idle passes before the execution thread sleeps
+
+struct redisiothreads::connection {
+    uint64_t id = 0;
+    SOCKET sock = INVALID_SOCKET;
+    redisclient client;  // execution thread only
+    bool hooked = false; // execution thread: pushed-message notify installed
+
+    // I/O thread only
+    std::string in;
+    std::string out;
+    size_t outPos = 0;
+    bool wantWrite = false;
+    bool isDirty = false;
+    bool closing = false;
+    std::weak_ptr<redisoutput> streaming; // a streamed reply waits for out to drain
+};
+
+redisiothreads::iothread::iothread() : accepted(1024), inbound(RING_SIZE), outbound(RING_SIZE) {}
+
+redisiothreads::redisiothreads(rediscommandhandler& handler, int threads) : cmdHandler(handler) {
+    for (int i = 0; i < threads; ++i)
+        workers.emplace_back(new iothread());
+}
+
+redisiothreads::~redisiothreads() {
+    stop();
+}
+
+void redisiothreads::start() {
+    running = true;
+    for (auto& w : workers) {
+        w->poller.add(w->wakeup.handle(), nullptr, redispoller::READABLE);
+        iothread* t = w.get();
+        w->thread = std::thread([this, t]() { ioLoop(*t); });
+    }
+    executor = std::thread([this]() { execLoop(); });
+}
+
+void redisiothreads::stop() {
+    if (!running.exchange(false))
+        return;
+    for (auto& w : workers)
+        w->wakeup.signal();
+    execCv.notify_all();
+    for (auto& w : workers) {
+        if (w->thread.joinable())
+            w->thread.join();
+    }
+    if (executor.joinable())
+        executor.join();
+    for (auto& w : workers) {
+        for (auto& c : w->conns) {
+            cmdHandler.closeClient(c.second->client);
+            closesocket(c.second->sock);
+            delete c.second;
+        }
+        w->conns.clear();
+    }
+}
+
+void redisiothreads::addConnection(SOCKET sock) {
+    redisnet::setNonBlocking(sock);
+    redisnet::setNoDelay(sock);
+    iothread& t = *workers[nextWorker++ % workers.size()];
+    while (!t.accepted.push(std::move(sock)))
+        std::this_thread::yield();
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (t.polling.load(std::memory_order_relaxed))
+        t.wakeup.signal();
+}
+
+redisiothreads::stats redisiothreads::getStats() const {
+    stats s;
+    s.commands = commands;
+    s.wakeups = wakeups;
+    for (const auto& w : workers) {
+        s.pollCalls += w->pollCalls;
+        s.readCalls += w->readCalls;
+        s.writeCalls += w->writeCalls;
+    }
+    return s;
+}
+
+// I/O Threads
+void redisiothreads::ioLoop(iothread& t) {
+    std::vector<redispoller::event> events;
+    while (running) {
+        t.polling.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = !t.outbound.empty() || !t.accepted.empty();
+        if (!pending) {
+            std::lock_guard<std::mutex> lock(t.readyMutex);
+            pending = !t.ready.empty();
+        }
+        t.poller.wait(events, pending ? 0 : -1);
+        t.pollCalls.fetch_add(1, std::memory_order_relaxed);
+        t.polling.store(false, std::memory_order_relaxed);
+
+        for (const auto& ev : events) {
+            if (!ev.data) {
+                t.wakeup.drain();
+                continue;
+            }
+            connection* c = static_cast<connection*>(ev.data);
+            if (c->closing)
+                continue;
+            if ((ev.events & redispoller::READABLE) || ev.hangup)
+                readConnection(t, c);
+            if (!c->closing && (ev.events & redispoller::WRITABLE))
+                flushConnection(t, c);
+        }
+
+        SOCKET sock;
+        while (t.accepted.pop(sock)) {
+            connection* c = new connection();
+            redisstats::add(redisstats::CONNECTIONS);
+            c->id = ++t.nextConnId;
+            c->sock = sock;
+            c->client.streamReplies = true;
+            t.conns[c->id] = c;
+            t.poller.add(sock, c, redispoller::READABLE);
+        }
+
+        drainReplies(t);
+        flushDirty(t);
+        for (connection* c : t.graveyard)
+            delete c;
+        t.graveyard.clear();
+    }
+}
+
+void redisiothreads::readConnection(iothread& t, connection* c) {
+    char buffer[16384];
+    while (true) {
+        int n = recv(c->sock, buffer, sizeof(buffer), 0);
+        t.readCalls.fetch_add(1, std::memory_order_relaxed);
+        if (n > 0) {
+            c->in.append(buffer, n);
+            if (n < static_cast<int>(sizeof(buffer)))
+                break;
+            continue;
+        }
+        if (n < 0 && redisnet::wouldBlock())
+            break;
+        beginClose(t, c);
+        return;
+    }
+
+    // Framing and parsing happen here, off the execution thread
+    size_t pos = 0, len;
+    bool any = false;
+    while ((len = rediscommandhandler::frameLength(c->in, pos)) > 0) {
+        request r;
+        r.conn = c;
+        r.tokens = rediscommandhandler::parseCommand(c->in.substr(pos, len));
+        pos += len;
+        pushRequest(t, std::move(r));
+        any = true;
+    }
+    c->in.erase(0, pos);
+    if (any)
+        wakeExec();
+}
+
+void redisiothreads::flushConnection(iothread& t, connection* c) {
+    while (c->outPos < c->out.size()) {
+        int n = send(c->sock, c->out.data() + c->outPos, static_cast<int>(c->out.size() - c->outPos),
+            redisnet::SEND_FLAGS);
+        t.writeCalls.fetch_add(1, std::memory_order_relaxed);
+        if (n > 0) {
+            c->outPos += n;
+            continue;
+        }
+        if (n < 0 && redisnet::wouldBlock())
+            break;
+        beginClose(t, c);
+        return;
+    }
+    if (c->outPos == c->out.size()) {
+        c->out.clear();
+        c->outPos = 0;
+        // Come back for the rest of a streamed reply only once the last
+        // piece is on the wire, so a slow reader holds one piece at a time
+        if (std::shared_ptr<redisoutput> output = c->streaming.lock()) {
+            c->streaming.reset();
+            output->resume();
+        }
+    }
+    bool wantWrite = !c->out.empty();
+    if (wantWrite != c->wantWrite) {
+        c->wantWrite = wantWrite;
+        t.poller.modify(c->sock, c, redispoller::READABLE | (wantWrite ? redispoller::WRITABLE : 0));
+    }
+}
+
+// The connection is freed only after the execution thread has released its
+// client state and acknowledged with a close reply.
+void redisiothreads::beginClose(iothread& t, connection* c) {
+    if (c->closing)
+        return;
+    c->closing = true;
+    t.poller.remove(c->sock);
+    request r;
+    r.conn = c;
+    r.close = true;
+    pushRequest(t, std::move(r));
+    wakeExec();
+}
+
+void redisiothreads::pushRequest(iothread& t, request&& r) {
+    // A full ring means the execution thread is behind; keep taking its
+    // replies meanwhile so neither side can wait on the other forever.
+    while (!t.inbound.push(std::move(r))) {
+        wakeExec();
+        drainReplies(t);
+        std::this_thread::yield();
+    }
+}
+
+void redisiothreads::drainReplies(iothread& t) {
+    // Snapshot the ready list before taking replies: a reply queued ahead of
+    // a pushed message is then always seen first.
+    std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> ready;
+    {
+        std::lock_guard<std::mutex> lock(t.readyMutex);
+        ready.swap(t.ready);
+    }
+
+    reply r;
+    while (t.outbound.pop(r)) {
+        connection* c = r.conn;
+        if (r.close) {
+            t.conns.erase(c->id);
+            closesocket(c->sock);
+            t.graveyard.push_back(c);
+            continue;
+        }
+        if (c->closing)
+            continue;
+        c->out += r.data;
+        if (!c->isDirty) {
+            c->isDirty = true;
+            t.dirty.push_back(c);
+        }
+    }
+
+    std::vector<redisoutput::buffer> pushed;
+    for (const auto& entry : ready) {
+        auto it = t.conns.find(entry.first);
+        std::shared_ptr<redisoutput> output = entry.second.lock();
+        if (it == t.conns.end() || it->second->closing || !output)
+            continue;
+        connection* c = it->second;
+        if (output->overflowed()) {
+            beginClose(t, c);
+            continue;
+        }
+        pushed.clear();
+        if (!output->tryTake(pushed))
+            continue;
+        for (const auto& b : pushed)
+            c->out += *b;
+        if (output->pending())
+            c->streaming = output;
+        if (!c->isDirty) {
+            c->isDirty = true;
+            t.dirty.push_back(c);
+        }
+    }
+}
+
+void redisiothreads::flushDirty(iothread& t) {
+    // flushConnection can close a connection, which may add to dirty
+    for (size_t i = 0; i < t.dirty.size(); ++i) {
+        connection* c = t.dirty[i];
+        c->isDirty = false;
+        if (!c->closing)
+            flushConnection(t, c);
+    }
+    t.dirty.clear();
+}
+
+void redisiothreads::wakeExec() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (execSleeping.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(execMutex);
+        execCv.notify_one();
+    }
+}
+
+// Execution Thread
+void redisiothreads::execLoop() {
+    int idle = 0;
+    request r;
+    while (running) {
+        bool worked = false;
+        for (auto& w : workers) {
+            iothread& t = *w;
+            size_t n = 0;
+            while (n < EXEC_BATCH && t.inbound.pop(r)) {
+                execute(t, r);
+                n++;
+            }
+            if (n == 0)
+                continue;
+            worked = true;
+            // One wakeup per batch, and only if the I/O thread is parked in poll
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (t.polling.load(std::memory_order_relaxed)) {
+                t.wakeup.signal();
+                wakeups++;
+            }
+        }
+        if (worked) {
+            idle = 0;
+            continue;
+        }
+        if (++idle < EXEC_SPINS) {
+            std::this_thread::yield();
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(execMutex);
+        execSleeping.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        bool pending = false;
+        for (auto& w : workers)
+            pending = pending || !w->inbound.empty();
+        if (!pending && running)
+            execCv.wait_for(lock, std::chrono::milliseconds(100));
+        execSleeping.store(false, std::memory_order_relaxed);
+        idle = 0;
+    }
+}
+
+void redisiothreads::execute(iothread& t, request& r) {
+    connection* c = r.conn;
+    if (r.close) {
+        if (c->client.output)
+            c->client.output->setNotify(nullptr);
+        cmdHandler.closeClient(c->client);
+        redisstats::add(redisstats::DISCONNECTIONS);
+        reply done;
+        done.conn = c;
+        done.close = true;
+        pushReply(t, std::move(done));
+        return;
+    }
+
+    std::string response = cmdHandler.processCommand(r.tokens, c->client);
+    commands.fetch_add(1, std::memory_order_relaxed);
+    if (c->client.stream && !c->client.output)
+        c->client.output = std::make_shared<redisoutput>();
+    if (!c->client.output) {
+        reply out;
+        out.conn = c;
+        out.data = std::move(response);
+        pushReply(t, std::move(out));
+        return;
+    }
+
+    // Connections that receive pushed messages (pub/sub, tracking) or a
+    // streamed reply send replies through the same queue so all stay ordered.
+    if (!c->hooked) {
+        c->hooked = true;
+        iothread* owner = &t;
+        uint64_t id = c->id;
+        std::weak_ptr<redisoutput> weak = c->client.output;
+        auto notify = [owner, id, weak]() {
+            {
+                std::lock_guard<std::mutex> lock(owner->readyMutex);
+                owner->ready.emplace_back(id, weak);
+            }
+            owner->wakeup.signal();
+        };
+        c->client.output->setNotify(notify);
+        notify(); // anything pushed before the hook was installed
+    }
+    c->client.output->push(std::make_shared<const std::string>(std::move(response)));
+    if (c->client.stream) {
+        c->client.output->push(std::move(c->client.stream));
+        c->client.stream = nullptr;
+    }
+}
+
+void redisiothreads::pushReply(iothread& t, reply&& r) {
+    while (!t.outbound.push(std::move(r))) {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (t.polling.load(std::memory_order_relaxed))
+            t.wakeup.signal();
+        std::this_thread::yield();
+    }
+}
@@ -0,0 +1,146 @@
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include "../include/redislz.h"
+
+static const size_t MIN_MATCH = 4;
+static const size_t LAST_LITERALS = 5; // the block ends in at least this many literals
+static const size_t MATCH_LIMIT = 12;  // no match may start closer than this to the end
+static const size_t MAX_OFFSET = 65535;
+static const int HASH_BITS = 14;
+
+static inline uint32_t read32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+static inline uint32_t hashOf(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static void putLength(std::string& out, size_t len) {
+    while (len >= 255) {
+        out.push_back(static_cast<char>(255));
+        len -= 255;
+    }
+    out.push_back(static_cast<char>(len));
+}
+
+static void putSequence(std::string& out, const char* literals, size_t literalLen, size_t offset, size_t matchLen) {
+    size_t extra = matchLen - MIN_MATCH;
+    uint8_t token = static_cast<uint8_t>((literalLen < 15 ? literalLen : 15) << 4);
+    token |= static_cast<uint8_t>(extra < 15 ? extra : 15);
+    out.push_back(static_cast<char>(token));
+    if (literalLen >= 15)
+        putLength(out, literalLen - 15);
+    out.append(literals, literalLen);
+    out.push_back(static_cast<char>(offset & 0xff));
+    out.push_back(static_cast<char>(offset >> 8));
+    if (extra >= 15)
+        putLength(out, extra - 15);
+}
+
+bool redislz::compress(const char* src, size_t n, std::string& out) {
+    if (n <= MATCH_LIMIT || n > 0xFFFFFFFFu)
+        return false;
+    // Positions from an earlier input may linger in the table; every
+    // candidate is checked against the bytes, so they only cost a miss
+    static thread_local uint32_t table[1 << HASH_BITS];
+
+    size_t start = out.size();
+    out.reserve(start + n + n / 255 + 16);
+    size_t ip = 0, anchor = 0;
+    const size_t limit = n - MATCH_LIMIT;
+    const size_t matchEnd = n - LAST_LITERALS;
+    size_t misses = 0;
+    while (ip < limit) {
+        uint32_t sequence = read32(src + ip);
+        uint32_t h = hashOf(sequence);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(ip);
+        if (candidate >= ip || ip - candidate > MAX_OFFSET || read32(src + candidate) != sequence) {
+            // Step faster through data that does not compress
+            ip += 1 + (misses++ >> 6);
+            continue;
+        }
+        misses = 0;
+        while (ip > anchor && candidate > 0 && src[ip - 1] == src[candidate - 1]) {
+            ip--;
+            candidate--;
+        }
+        size_t len = MIN_MATCH;
+        while (ip + len < matchEnd && src[ip + len] == src[candidate + len])
+            len++;
+        putSequence(out, src + anchor, ip - anchor, ip - candidate, len);
+        if (out.size() - start >= n) {
+            out.resize(start);
+            return false;
+        }
+        ip += len;
+        anchor = ip;
+        if (ip - 2 < limit)
+            table[hashOf(read32(src + ip - 2))] = static_cast<uint32_t>(ip - 2);
+    }
+
+    size_t literalLen = n - anchor;
+    out.push_back(static_cast<char>((literalLen < 15 ? literalLen : 15) << 4));
+    if (literalLen >= 15)
+        putLength(out, literalLen - 15);
+    out.append(src + anchor, literalLen);
+    if (out.size() - start >= n) {
+        out.resize(start);
+        return false;
+    }
+    return true;
+}
+
+bool redislz::decompress(const char* src, size_t n, char* dst, size_t rawLength) {
+    const uint8_t* in = reinterpret_cast<const uint8_t*>(src);
+    size_t ip = 0, op = 0;
+    auto length = [&](size_t& len) {
+        uint8_t b;
+        do {
+            if (ip >= n)
+                return false;
+            b = in[ip++];
+            len += b;
+        } while (b == 255);
+        return true;
+    };
+    while (ip < n) {
+        uint8_t token = in[ip++];
+        size_t literalLen = token >> 4;
+        if (literalLen == 15 && !length(literalLen))
+            return false;
+        if (literalLen > n - ip || literalLen > rawLength - op)
+            return false;
+        std::memcpy(dst + op, in + ip, literalLen);
+        ip += literalLen;
+        op += literalLen;
+        if (ip == n)
+            return op == rawLength; // the last sequence has no match
+
+        if (n - ip < 2)
+            return false;
+        size_t offset = in[ip] | (static_cast<size_t>(in[ip + 1]) << 8);
+        ip += 2;
+        size_t matchLen = token & 15;
+        if (matchLen == 15 && !length(matchLen))
+            return false;
+        matchLen += MIN_MATCH;
+        if (offset == 0 || offset > op || matchLen > rawLength - op)
+            return false;
+        char* out = dst + op;
+        const char* from = out - offset;
+        if (offset >= matchLen) {
+            std::memcpy(out, from, matchLen);
+        }
+        else {
+            for (size_t i = 0; i < matchLen; ++i) // overlapping: a repeated run
+                out[i] = from[i];
+        }
+        op += matchLen;
+    }
+    return false;
+}
@@ -0,0 +1,226 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <thread>
+#include <chrono>
+#include <algorithm>
+#include <functional>
+#include "../include/redismemory.h"
+#include "../include/accesssketch.h"
+
+namespace redismemory {
+
+// Big-Key Scan
+static const std::chrono::microseconds SCAN_SLICE(1000);
+static const std::chrono::milliseconds SCAN_PAUSE(200);
+
+// The biggest keys of one type seen so far, merged by name: a key the
+// walk meets twice keeps one entry.
+struct toplist {
+    std::vector<keyentry> entries;
+    size_t smallest = 0; // index of the smallest entry once full
+
+    void offer(size_t top, const std::string& key, redisdatabase::keytype type, uint64_t bytes, uint64_t elements) {
+        if (entries.size() >= top && bytes <= entries[smallest].bytes)
+            return;
+        auto same = std::find_if(entries.begin(), entries.end(), [&](const keyentry& e) { return e.key == key; });
+        if (same != entries.end()) {
+            same->bytes = bytes;
+            same->elements = elements;
+        }
+        else if (entries.size() < top) {
+            entries.push_back({ key, type, bytes, elements });
+        }
+        else {
+            entries[smallest] = { key, type, bytes, elements };
+        }
+        smallest = 0;
+        for (size_t i = 1; i < entries.size(); ++i) {
+            if (entries[i].bytes < entries[smallest].bytes)
+                smallest = i;
+        }
+    }
+};
+
+struct scanstate {
+    std::mutex mutex;
+    uint64_t run = 0; // bumped by every start and stop; a scan thread whose run is stale exits
+    bool running = false;
+    scanreport report;
+    std::chrono::steady_clock::time_point started;
+    toplist best[redisdatabase::KEY_TYPES];
+};
+
+// Never destroyed: a scan thread may still be running at exit
+static scanstate& scan() {
+    static scanstate* s = new scanstate();
+    return *s;
+}
+
+static uint64_t microsSince(std::chrono::steady_clock::time_point start) {
+    return static_cast<uint64_t>(
+        std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count());
+}
+
+// The thread keeps its own tallies, visited with a shard's lock held, and
+// publishes them after each slice.
+static void scanThread(uint64_t run, size_t top) {
+    scanstate& s = scan();
+    typetotal totals[redisdatabase::KEY_TYPES];
+    toplist best[redisdatabase::KEY_TYPES];
+    uint64_t keys = 0;
+    redisdatabase::keyvisitor visit = [&](const std::string& key, redisdatabase::keytype type, uint64_t bytes,
+        uint64_t elements) {
+        keys++;
+        totals[type].keys++;
+        totals[type].bytes += bytes;
+        totals[type].elements += elements;
+        best[type].offer(top, key, type, bytes, elements);
+    };
+    for (size_t i = 0; i < redisdatabase::shardCount(); ++i) {
+        redisdatabase& db = redisdatabase::shard(i);
+        redisdatabase::keycursor cursor;
+        bool more = true;
+        while (more) {
+            auto start = std::chrono::steady_clock::now();
+            more = db.scanKeys(cursor, SCAN_SLICE, visit);
+            uint64_t us = microsSince(start);
+            bool last = !more && i + 1 == redisdatabase::shardCount();
+            {
+                std::lock_guard<std::mutex> lock(s.mutex);
+                if (s.run != run)
+                    return;
+                s.report.keys = keys;
+                s.report.slices++;
+                s.report.busyUs += us;
+                s.report.maxSliceUs = std::max(s.report.maxSliceUs, us);
+                for (int t = 0; t < redisdatabase::KEY_TYPES; ++t) {
+                    s.report.totals[t] = totals[t];
+                    s.best[t] = best[t];
+                }
+                if (last) {
+                    s.running = false;
+                    s.report.state = "done";
+                    s.report.elapsedMs = microsSince(s.started) / 1000;
+                    return;
+                }
+            }
+            std::this_thread::sleep_for(SCAN_PAUSE);
+        }
+    }
+}
+
+bool startScan(size_t top) {
+    scanstate& s = scan();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.running)
+        return false;
+    s.run++;
+    s.running = true;
+    s.report = scanreport();
+    s.report.state = "running";
+    s.report.startTime = static_cast<int64_t>(
+        std::chrono::duration_cast<std::chrono::seconds>(std::chrono::system_clock::now().time_since_epoch()).count());
+    s.started = std::chrono::steady_clock::now();
+    for (auto& b : s.best)
+        b = toplist();
+    std::thread(scanThread, s.run, top).detach();
+    return true;
+}
+
+bool stopScan() {
+    scanstate& s = scan();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (!s.running)
+        return false;
+    s.run++;
+    s.running = false;
+    s.report.state = "stopped";
+    s.report.elapsedMs = microsSince(s.started) / 1000;
+    return true;
+}
+
+scanreport scanReport() {
+    scanstate& s = scan();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    scanreport r = s.report;
+    if (s.running)
+        r.elapsedMs = microsSince(s.started) / 1000;
+    for (const auto& b : s.best)
+        r.biggest.insert(r.biggest.end(), b.entries.begin(), b.entries.end());
+    std::sort(r.biggest.begin(), r.biggest.end(),
+        [](const keyentry& a, const keyentry& b) { return a.bytes > b.bytes; });
+    return r;
+}
+
+// Hot Keys
+// Candidates hold the sampled accesses they were seen in since they got in,
+// plus the sketch's estimate for them then. A key gets in once the sketch
+// counts it above the coldest candidate. Every HOT_DECAY_EVERY samples the
+// counts halve, in step with the sketch's own aging, so a key that cools
+// off makes room.
+static const size_t HOT_CANDIDATES = 128;
+static const size_t HOT_SKETCH_WIDTH = 1 << 16;
+static const uint64_t HOT_DECAY_EVERY = 10 * HOT_SKETCH_WIDTH;
+
+struct candidate {
+    uint64_t hash = 0;
+    std::string key;
+    uint64_t count = 0;
+};
+
+struct hotstate {
+    std::mutex mutex;
+    accesssketch sketch{ HOT_SKETCH_WIDTH };
+    std::vector<candidate> candidates;
+    uint64_t samples = 0;
+};
+
+static hotstate& hot() {
+    static hotstate* h = new hotstate();
+    return *h;
+}
+
+void recordAccess(const std::string& key) {
+    uint64_t hash = std::hash<std::string>()(key);
+    hotstate& h = hot();
+    std::lock_guard<std::mutex> lock(h.mutex);
+    uint32_t estimate = h.sketch.record(hash);
+    if (++h.samples % HOT_DECAY_EVERY == 0) {
+        for (auto& c : h.candidates)
+            c.count /= 2;
+    }
+    size_t coldest = 0;
+    for (size_t i = 0; i < h.candidates.size(); ++i) {
+        candidate& c = h.candidates[i];
+        if (c.hash == hash && c.key == key) {
+            c.count++;
+            return;
+        }
+        if (c.count < h.candidates[coldest].count)
+            coldest = i;
+    }
+    if (h.candidates.size() < HOT_CANDIDATES)
+        h.candidates.push_back({ hash, key, estimate });
+    else if (estimate > h.candidates[coldest].count)
+        h.candidates[coldest] = { hash, key, estimate };
+}
+
+std::vector<hotkey> hotKeys(size_t count) {
+    std::vector<candidate> candidates;
+    {
+        hotstate& h = hot();
+        std::lock_guard<std::mutex> lock(h.mutex);
+        candidates = h.candidates;
+    }
+    std::sort(candidates.begin(), candidates.end(),
+        [](const candidate& a, const candidate& b) { return a.count > b.count; });
+    std::vector<hotkey> out;
+    for (size_t i = 0; i < candidates.size() && i < count; ++i) {
+        if (candidates[i].count > 0)
+            out.push_back({ candidates[i].key, candidates[i].count * HOT_SAMPLE_EVERY });
+    }
+    return out;
+}
+
+}
@@ -0,0 +1,224 @@
+#include <vector>
+#include <cstring>
+#include <mutex>
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#include "../include/redisnet.h"
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <netinet/tcp.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#endif
+
+namespace redisnet {
+
+bool setNonBlocking(SOCKET sock) {
+#ifdef _WIN32
+    u_long mode = 1;
+    return ioctlsocket(sock, FIONBIO, &mode) == 0;
+#else
+    int flags = fcntl(sock, F_GETFL, 0);
+    return flags != -1 && fcntl(sock, F_SETFL, flags | O_NONBLOCK) == 0;
+#endif
+}
+
+bool setNoDelay(SOCKET sock) {
+    int one = 1;
+    return setsockopt(sock, IPPROTO_TCP, TCP_NODELAY, (const char*)&one, sizeof(one)) == 0;
+}
+
+bool wouldBlock() {
+#ifdef _WIN32
+    return WSAGetLastError() == WSAEWOULDBLOCK;
+#else
+    return errno == EAGAIN || errno == EWOULDBLOCK;
+#endif
+}
+
+static std::mutex sourceMutex;
+static std::function<netstats()> statsSource;
+
+void setStatsSource(std::function<netstats()> source) {
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    statsSource = std::move(source);
+}
+
+netstats currentStats() {
+    std::lock_guard<std::mutex> lock(sourceMutex);
+    return statsSource ? statsSource() : netstats();
+}
+
+}
+
+#ifdef _WIN32
+redispoller::redispoller() {}
+
+redispoller::~redispoller() {}
+
+static SHORT pollFlags(int events) {
+    SHORT flags = 0;
+    if (events & redispoller::READABLE)
+        flags |= POLLRDNORM;
+    if (events & redispoller::WRITABLE)
+        flags |= POLLWRNORM;
+    return flags;
+}
+
+bool redispoller::add(SOCKET sock, void* data, int events) {
+    WSAPOLLFD pfd{};
+    pfd.fd = sock;
+    pfd.events = pollFlags(events);
+    index[sock] = fds.size();
+    fds.push_back(pfd);
+    fdData.push_back(data);
+    return true;
+}
+
+bool redispoller::modify(SOCKET sock, void* data, int events) {
+    auto it = index.find(sock);
+    if (it == index.end())
+        return false;
+    fds[it->second].events = pollFlags(events);
+    fdData[it->second] = data;
+    return true;
+}
+
+void redispoller::remove(SOCKET sock) {
+    auto it = index.find(sock);
+    if (it == index.end())
+        return;
+    // Swap with the last entry to keep the arrays dense
+    size_t i = it->second, last = fds.size() - 1;
+    index.erase(it);
+    if (i != last) {
+        fds[i] = fds[last];
+        fdData[i] = fdData[last];
+        index[fds[i].fd] = i;
+    }
+    fds.pop_back();
+    fdData.pop_back();
+}
+
+int redispoller::wait(std::vector<event>& out, int timeoutMs) {
+    out.clear();
+    if (fds.empty())
+        return 0;
+    int n = WSAPoll(fds.data(), static_cast<ULONG>(fds.size()), timeoutMs);
+    if (n <= 0)
+        return 0;
+    for (size_t i = 0; i < fds.size(); ++i) {
+        SHORT r = fds[i].revents;
+        if (!r)
+            continue;
+        event ev;
+        ev.data = fdData[i];
+        ev.events = ((r & POLLRDNORM) ? READABLE : 0) | ((r & POLLWRNORM) ? WRITABLE : 0);
+        ev.hangup = (r & (POLLHUP | POLLERR | POLLNVAL)) != 0;
+        out.push_back(ev);
+    }
+    return static_cast<int>(out.size());
+}
+
+// Windows has no eventfd; a connected loopback pair does the same job.
+rediswakeup::rediswakeup() {
+    SOCKET listener = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    sockaddr_in addr{};
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    int len = sizeof(addr);
+    bind(listener, (sockaddr*)&addr, sizeof(addr));
+    getsockname(listener, (sockaddr*)&addr, &len);
+    listen(listener, 1);
+    writeEnd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+    connect(writeEnd, (sockaddr*)&addr, sizeof(addr));
+    readEnd = accept(listener, nullptr, nullptr);
+    closesocket(listener);
+    redisnet::setNonBlocking(readEnd);
+    redisnet::setNonBlocking(writeEnd);
+    redisnet::setNoDelay(writeEnd);
+}
+
+rediswakeup::~rediswakeup() {
+    closesocket(readEnd);
+    closesocket(writeEnd);
+}
+
+void rediswakeup::signal() {
+    char b = 1;
+    send(writeEnd, &b, 1, 0);
+}
+
+void rediswakeup::drain() {
+    char buf[256];
+    while (recv(readEnd, buf, sizeof(buf), 0) > 0) {
+    }
+}
+#else
+redispoller::redispoller() : epfd(epoll_create1(0)) {
+    raw.resize(256 * sizeof(epoll_event));
+}
+
+redispoller::~redispoller() {
+    close(epfd);
+}
+
+static uint32_t epollFlags(int events) {
+    return ((events & redispoller::READABLE) ? EPOLLIN : 0u) | ((events & redispoller::WRITABLE) ? EPOLLOUT : 0u);
+}
+
+bool redispoller::add(SOCKET sock, void* data, int events) {
+    epoll_event ev{};
+    ev.events = epollFlags(events);
+    ev.data.ptr = data;
+    return epoll_ctl(epfd, EPOLL_CTL_ADD, sock, &ev) == 0;
+}
+
+bool redispoller::modify(SOCKET sock, void* data, int events) {
+    epoll_event ev{};
+    ev.events = epollFlags(events);
+    ev.data.ptr = data;
+    return epoll_ctl(epfd, EPOLL_CTL_MOD, sock, &ev) == 0;
+}
+
+void redispoller::remove(SOCKET sock) {
+    epoll_ctl(epfd, EPOLL_CTL_DEL, sock, nullptr);
+}
+
+int redispoller::wait(std::vector<event>& out, int timeoutMs) {
+    out.clear();
+    epoll_event* evs = reinterpret_cast<epoll_event*>(raw.data());
+    int n = epoll_wait(epfd, evs, static_cast<int>(raw.size() / sizeof(epoll_event)), timeoutMs);
+    for (int i = 0; i < n; ++i) {
+        event ev;
+        ev.data = evs[i].data.ptr;
+        ev.events = ((evs[i].events & EPOLLIN) ? READABLE : 0) | ((evs[i].events & EPOLLOUT) ? WRITABLE : 0);
+        ev.hangup = (evs[i].events & (EPOLLHUP | EPOLLERR)) != 0;
+        out.push_back(ev);
+    }
+    return n > 0 ? n : 0;
+}
+
+rediswakeup::rediswakeup() {
+    readEnd = writeEnd = eventfd(0, EFD_NONBLOCK);
+}
+
+rediswakeup::~rediswakeup() {
+    close(readEnd);
+}
+
+void rediswakeup::signal() {
+    uint64_t one = 1;
+    ssize_t n = write(writeEnd, &one, sizeof(one));
+    (void)n;
+}
+
+void rediswakeup::drain() {
+    uint64_t count;
+    ssize_t n = read(readEnd, &count, sizeof(count));
+    (void)n;
+}
+#endif
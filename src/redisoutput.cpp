@@ -0,0 +1,141 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include "../include/redisoutput.h"
+
+redisoutput::pushresult redisoutput::push(const buffer& b) {
+    bool overLimit = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (isClosed)
+            return CLOSED;
+        queue.push_back(entry{ b, nullptr });
+        bytes += b->size();
+
+        overLimit = lim.hardBytes && bytes > lim.hardBytes;
+        if (lim.softBytes && bytes > lim.softBytes) {
+            auto now = std::chrono::steady_clock::now();
+            if (!overSoft) {
+                overSoft = true;
+                softSince = now;
+            }
+            else if (now - softSince >= std::chrono::seconds(lim.softSeconds)) {
+                overLimit = true;
+            }
+        }
+        else {
+            overSoft = false;
+        }
+
+        if (overLimit) {
+            isOverflowed = true;
+            isClosed = true;
+            queue.clear();
+            bytes = 0;
+        }
+        if (notify && (overLimit || queue.size() == 1))
+            notify();
+    }
+    cv.notify_one();
+    return overLimit ? OVERFLOWED : QUEUED;
+}
+
+redisoutput::pushresult redisoutput::push(producer p) {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        if (isClosed)
+            return CLOSED;
+        queue.push_back(entry{ nullptr, std::move(p) });
+        if (notify && queue.size() == 1)
+            notify();
+    }
+    cv.notify_one();
+    return QUEUED;
+}
+
+bool redisoutput::collect(std::unique_lock<std::mutex>& lock, std::vector<buffer>& out) {
+    while (!queue.empty() && !queue.front().more) {
+        bytes -= queue.front().data->size();
+        out.push_back(std::move(queue.front().data));
+        queue.pop_front();
+    }
+    if (bytes == 0)
+        overSoft = false;
+    if (!out.empty() || queue.empty())
+        return true;
+
+    // A producer at the front: make its next piece with the lock released,
+    // since producing reads the database. Anything pushed meanwhile queues
+    // behind it, and only the taking thread ever runs it.
+    producer p = std::move(queue.front().more);
+    queue.pop_front();
+    lock.unlock();
+    std::string chunk;
+    bool more = p(chunk);
+    lock.lock();
+    if (isClosed)
+        return false;
+    if (more)
+        queue.push_front(entry{ nullptr, std::move(p) });
+    if (!chunk.empty())
+        out.push_back(std::make_shared<const std::string>(std::move(chunk)));
+    return true;
+}
+
+bool redisoutput::take(std::vector<buffer>& out) {
+    std::unique_lock<std::mutex> lock(mtx);
+    cv.wait(lock, [this]() { return isClosed || !queue.empty(); });
+    if (isClosed)
+        return false;
+    out.clear();
+    return collect(lock, out);
+}
+
+bool redisoutput::tryTake(std::vector<buffer>& out) {
+    std::unique_lock<std::mutex> lock(mtx);
+    if (isClosed || queue.empty())
+        return false;
+    return collect(lock, out);
+}
+
+void redisoutput::resume() {
+    std::lock_guard<std::mutex> lock(mtx);
+    if (notify && !isClosed && !queue.empty())
+        notify();
+}
+
+bool redisoutput::pending() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return !queue.empty();
+}
+
+void redisoutput::setNotify(std::function<void()> fn) {
+    std::lock_guard<std::mutex> lock(mtx);
+    notify = std::move(fn);
+}
+
+void redisoutput::close() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        isClosed = true;
+        queue.clear();
+        bytes = 0;
+    }
+    cv.notify_all();
+}
+
+bool redisoutput::closed() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return isClosed;
+}
+
+bool redisoutput::overflowed() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return isOverflowed;
+}
+
+size_t redisoutput::pendingBytes() const {
+    std::lock_guard<std::mutex> lock(mtx);
+    return bytes;
+}
@@ -0,0 +1,242 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <shared_mutex>
+#include <utility>
+#include "../include/redispubsub.h"
+
+static redisoutput::buffer encodeMessage(const std::vector<const std::string*>& parts) {
+    std::string out = "*" + std::to_string(parts.size()) + "\r\n";
+    for (const std::string* p : parts) {
+        out += "$" + std::to_string(p->size()) + "\r\n";
+        out += *p;
+        out += "\r\n";
+    }
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+redispubsub& redispubsub::getInstance() {
+    static redispubsub instance;
+    return instance;
+}
+
+size_t redispubsub::literalPrefix(const std::string& pattern) {
+    size_t i = 0;
+    while (i < pattern.size() && pattern[i] != '*' && pattern[i] != '?' && pattern[i] != '[' && pattern[i] != '\\')
+        i++;
+    return i;
+}
+
+bool redispubsub::subscribe(const std::string& channel, const subscriber& s) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    return channelSubs[channel].emplace(s.get(), s).second;
+}
+
+bool redispubsub::unsubscribe(const std::string& channel, const subscriber& s) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    auto it = channelSubs.find(channel);
+    if (it == channelSubs.end() || it->second.erase(s.get()) == 0)
+        return false;
+    if (it->second.empty())
+        channelSubs.erase(it);
+    return true;
+}
+
+bool redispubsub::psubscribe(const std::string& pattern, const subscriber& s) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    patternnode* node = &patternRoot;
+    size_t prefix = literalPrefix(pattern);
+    for (size_t i = 0; i < prefix; ++i) {
+        auto& child = node->children[pattern[i]];
+        if (!child)
+            child.reset(new patternnode());
+        node = child.get();
+    }
+    auto it = node->patterns.find(pattern);
+    if (it == node->patterns.end()) {
+        it = node->patterns.emplace(pattern, subscriberset()).first;
+        patternCount++;
+    }
+    return it->second.emplace(s.get(), s).second;
+}
+
+bool redispubsub::punsubscribe(const std::string& pattern, const subscriber& s) {
+    std::unique_lock<std::shared_mutex> lock(mtx);
+    std::vector<patternnode*> path{ &patternRoot };
+    size_t prefix = literalPrefix(pattern);
+    for (size_t i = 0; i < prefix; ++i) {
+        auto child = path.back()->children.find(pattern[i]);
+        if (child == path.back()->children.end())
+            return false;
+        path.push_back(child->second.get());
+    }
+    patternnode* node = path.back();
+    auto it = node->patterns.find(pattern);
+    if (it == node->patterns.end() || it->second.erase(s.get()) == 0)
+        return false;
+    if (it->second.empty()) {
+        node->patterns.erase(it);
+        patternCount--;
+        // Prune nodes left without patterns or children
+        for (size_t i = prefix; i > 0; --i) {
+            patternnode* n = path[i];
+            if (!n->patterns.empty() || !n->children.empty())
+                break;
+            path[i - 1]->children.erase(pattern[i - 1]);
+        }
+    }
+    return true;
+}
+
+size_t redispubsub::deliver(const subscriberset& subs, const redisoutput::buffer& msg) {
+    size_t n = 0;
+    for (const auto& s : subs) {
+        redisoutput::pushresult r = s.second->push(msg);
+        if (r == redisoutput::QUEUED)
+            n++;
+        else if (r == redisoutput::OVERFLOWED)
+            droppedClients++;
+    }
+    return n;
+}
+
+size_t redispubsub::publish(const std::string& channel, const std::string& message) {
+    static const std::string messageTag = "message";
+    static const std::string pmessageTag = "pmessage";
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    size_t receivers = 0;
+
+    auto it = channelSubs.find(channel);
+    if (it != channelSubs.end())
+        receivers += deliver(it->second, encodeMessage({ &messageTag, &channel, &message }));
+
+    // Walk the trie along the channel name; only patterns hanging off the
+    // visited nodes can possibly match.
+    const patternnode* node = &patternRoot;
+    for (size_t i = 0; node; ++i) {
+        for (const auto& p : node->patterns) {
+            if (globmatch(p.first.data(), p.first.size(), channel.data(), channel.size()))
+                receivers += deliver(p.second, encodeMessage({ &pmessageTag, &p.first, &channel, &message }));
+        }
+        if (i == channel.size())
+            break;
+        auto child = node->children.find(channel[i]);
+        node = child != node->children.end() ? child->second.get() : nullptr;
+    }
+
+    published++;
+    delivered += receivers;
+    return receivers;
+}
+
+std::vector<std::string> redispubsub::channels(const std::string& pattern) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    std::vector<std::string> result;
+    for (const auto& c : channelSubs) {
+        if (pattern.empty() || globmatch(pattern.data(), pattern.size(), c.first.data(), c.first.size()))
+            result.push_back(c.first);
+    }
+    return result;
+}
+
+size_t redispubsub::numsub(const std::string& channel) {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    auto it = channelSubs.find(channel);
+    return it != channelSubs.end() ? it->second.size() : 0;
+}
+
+size_t redispubsub::numpat() {
+    std::shared_lock<std::shared_mutex> lock(mtx);
+    return patternCount;
+}
+
+redispubsub::stats redispubsub::getStats() const {
+    stats s;
+    s.published = published;
+    s.delivered = delivered;
+    s.droppedClients = droppedClients;
+    return s;
+}
+
+bool redispubsub::globmatch(const char* pattern, size_t plen, const char* str, size_t slen) {
+    while (plen > 0) {
+        switch (pattern[0]) {
+        case '*':
+            while (plen > 1 && pattern[1] == '*') {
+                pattern++;
+                plen--;
+            }
+            if (plen == 1)
+                return true;
+            for (size_t i = 0; i <= slen; ++i) {
+                if (globmatch(pattern + 1, plen - 1, str + i, slen - i))
+                    return true;
+            }
+            return false;
+        case '?':
+            if (slen == 0)
+                return false;
+            str++;
+            slen--;
+            break;
+        case '[': {
+            if (slen == 0)
+                return false;
+            pattern++;
+            plen--;
+            bool negate = plen > 0 && pattern[0] == '^';
+            if (negate) {
+                pattern++;
+                plen--;
+            }
+            bool match = false;
+            while (plen > 0 && pattern[0] != ']') {
+                if (pattern[0] == '\\' && plen >= 2) {
+                    pattern++;
+                    plen--;
+                    if (pattern[0] == str[0])
+                        match = true;
+                }
+                else if (plen >= 3 && pattern[1] == '-') {
+                    char lo = pattern[0], hi = pattern[2];
+                    if (lo > hi)
+                        std::swap(lo, hi);
+                    if (str[0] >= lo && str[0] <= hi)
+                        match = true;
+                    pattern += 2;
+                    plen -= 2;
+                }
+                else if (pattern[0] == str[0]) {
+                    match = true;
+                }
+                pattern++;
+                plen--;
+            }
+            if (plen == 0)
+                return false; // unterminated class
+            if (negate)
+                match = !match;
+            if (!match)
+                return false;
+            str++;
+            slen--;
+            break;
+        }
+        case '\\':
+            if (plen >= 2) {
+                pattern++;
+                plen--;
+            }
+            [[fallthrough]];
+        default:
+            if (slen == 0 || pattern[0] != str[0])
+                return false;
+            str++;
+            slen--;
+            break;
+        }
+        pattern++;
+        plen--;
+    }
+    return slen == 0;
+}
@@ -0,0 +1,1230 @@
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <unordered_map>
+#include "../include/redisscript.h"
+
+// Values and tables
+
+scriptvalue scriptvalue::table() {
+    scriptvalue r;
+    r.type = TABLE;
+    r.t = std::make_shared<scripttable>();
+    return r;
+}
+
+scripttable::~scripttable() {
+    // Nested tables are released from a worklist rather than by recursive
+    // destructors, so a script-built chain like t = {t} cannot overflow the
+    // stack when it goes away
+    std::vector<std::shared_ptr<scripttable>> pending;
+    auto detach = [&pending](scripttable& t) {
+        auto take = [&pending](scriptvalue& v) {
+            if (v.t && v.t.use_count() == 1)
+                pending.push_back(std::move(v.t));
+        };
+        for (auto& v : t.array)
+            take(v);
+        for (auto& kv : t.hash)
+            take(kv.second);
+    };
+    detach(*this);
+    while (!pending.empty()) {
+        std::shared_ptr<scripttable> t = std::move(pending.back());
+        pending.pop_back();
+        detach(*t);
+    }
+}
+
+scriptvalue scriptvalue::errorReply(const std::string& msg) {
+    scriptvalue r = table();
+    r.t->hash["err"] = string(msg);
+    return r;
+}
+
+scriptvalue scriptvalue::statusReply(const std::string& msg) {
+    scriptvalue r = table();
+    r.t->hash["ok"] = string(msg);
+    return r;
+}
+
+static std::string formatNumber(double n) {
+    char buf[32];
+    if (std::isfinite(n) && std::floor(n) == n && std::fabs(n) < 1e15)
+        std::snprintf(buf, sizeof(buf), "%lld", static_cast<long long>(n));
+    else
+        std::snprintf(buf, sizeof(buf), "%.14g", n);
+    return buf;
+}
+
+static bool toNumber(const scriptvalue& v, double& out) {
+    if (v.type == scriptvalue::NUMBER) {
+        out = v.n;
+        return true;
+    }
+    if (v.type != scriptvalue::STRING || v.s.empty())
+        return false;
+    const char* begin = v.s.c_str();
+    char* end = nullptr;
+    out = std::strtod(begin, &end);
+    while (*end && std::isspace(static_cast<unsigned char>(*end)))
+        end++;
+    return end != begin && *end == '\0';
+}
+
+std::string scriptvalue::toString() const {
+    switch (type) {
+    case NIL: return "nil";
+    case BOOLEAN: return b ? "true" : "false";
+    case NUMBER: return formatNumber(n);
+    case STRING: return s;
+    case TABLE: {
+        char buf[32];
+        std::snprintf(buf, sizeof(buf), "table: %p", static_cast<const void*>(t.get()));
+        return buf;
+    }
+    }
+    return "nil";
+}
+
+int64_t scriptvalue::toInteger() const {
+    if (std::isnan(n))
+        return 0;
+    // 2^63 is the first double past INT64_MAX
+    if (n >= 9223372036854775808.0)
+        return INT64_MAX;
+    if (n <= -9223372036854775808.0)
+        return INT64_MIN;
+    return static_cast<int64_t>(n);
+}
+
+// Hash keys: strings as-is, everything else tagged so "1" and 1 differ.
+static bool hashKey(const scriptvalue& key, std::string& out) {
+    switch (key.type) {
+    case scriptvalue::STRING: out = key.s; return true;
+    case scriptvalue::NUMBER: out = "\x01" + formatNumber(key.n); return true;
+    case scriptvalue::BOOLEAN: out = key.b ? "\x02" "true" : "\x02" "false"; return true;
+    default: return false;
+    }
+}
+
+static bool arrayIndex(const scriptvalue& key, size_t& idx) {
+    if (key.type != scriptvalue::NUMBER || key.n < 1 || std::floor(key.n) != key.n || key.n > 1e15)
+        return false;
+    idx = static_cast<size_t>(key.n);
+    return true;
+}
+
+scriptvalue scripttable::get(const scriptvalue& key) const {
+    size_t idx;
+    if (arrayIndex(key, idx) && idx <= array.size())
+        return array[idx - 1];
+    std::string hk;
+    if (!hashKey(key, hk))
+        return scriptvalue();
+    auto it = hash.find(hk);
+    return it != hash.end() ? it->second : scriptvalue();
+}
+
+const scriptvalue* scripttable::field(const std::string& name) const {
+    auto it = hash.find(name);
+    return it != hash.end() ? &it->second : nullptr;
+}
+
+bool scripttable::set(const scriptvalue& key, const scriptvalue& value, std::string& err) {
+    size_t idx;
+    if (arrayIndex(key, idx)) {
+        if (idx <= array.size()) {
+            array[idx - 1] = value;
+            while (!array.empty() && array.back().type == scriptvalue::NIL)
+                array.pop_back();
+            return true;
+        }
+        if (idx == array.size() + 1) {
+            if (value.type == scriptvalue::NIL)
+                return true;
+            array.push_back(value);
+            // Pull any following integer keys out of the hash part
+            std::string hk;
+            while (hashKey(scriptvalue::number(static_cast<double>(array.size() + 1)), hk)) {
+                auto it = hash.find(hk);
+                if (it == hash.end())
+                    break;
+                array.push_back(std::move(it->second));
+                hash.erase(it);
+            }
+            return true;
+        }
+    }
+    std::string hk;
+    if (!hashKey(key, hk)) {
+        err = key.type == scriptvalue::NIL ? "table index is nil" : "unsupported table key type";
+        return false;
+    }
+    if (value.type == scriptvalue::NIL)
+        hash.erase(hk);
+    else
+        hash[hk] = value;
+    return true;
+}
+
+// Bytecode
+
+enum opcode : uint8_t {
+    OP_CONST, OP_NIL, OP_TRUE, OP_FALSE,
+    OP_GETLOCAL, OP_SETLOCAL, OP_GETGLOBAL, OP_SETGLOBAL,
+    OP_GETINDEX, OP_SETINDEX, OP_NEWTABLE, OP_APPEND, OP_SETFIELD,
+    OP_ADD, OP_SUB, OP_MUL, OP_DIV, OP_MOD, OP_POW, OP_CONCAT,
+    OP_EQ, OP_NE, OP_LT, OP_LE, OP_GT, OP_GE,
+    OP_NOT, OP_NEG, OP_LEN,
+    OP_JMP, OP_JMPIFNOT, OP_ANDJMP, OP_ORJMP, OP_POP,
+    OP_CALL, OP_FORTEST, OP_FORSTEP,
+    OP_RETURN, OP_RETURNNIL
+};
+
+enum builtin {
+    B_CALL, B_PCALL, B_ERROR_REPLY, B_STATUS_REPLY, B_SHA1HEX,
+    B_TONUMBER, B_TOSTRING, B_TYPE, B_TABLE_INSERT
+};
+
+static const std::unordered_map<std::string, int>& builtinTable() {
+    static const std::unordered_map<std::string, int> table = {
+        { "redis.call", B_CALL },
+        { "redis.pcall", B_PCALL },
+        { "redis.error_reply", B_ERROR_REPLY },
+        { "redis.status_reply", B_STATUS_REPLY },
+        { "redis.sha1hex", B_SHA1HEX },
+        { "tonumber", B_TONUMBER },
+        { "tostring", B_TOSTRING },
+        { "type", B_TYPE },
+        { "table.insert", B_TABLE_INSERT },
+    };
+    return table;
+}
+
+// Lexer
+
+namespace {
+
+enum tokenkind { T_EOF, T_NAME, T_NUMBER, T_STRING, T_KEYWORD, T_SYMBOL };
+
+struct token {
+    tokenkind kind;
+    std::string text;
+    double num;
+    int line;
+};
+
+struct compileerror {
+    std::string msg;
+};
+
+bool isKeyword(const std::string& s) {
+    static const char* words[] = { "and", "break", "do", "else", "elseif", "end", "false", "for", "function",
+        "if", "in", "local", "nil", "not", "or", "repeat", "return", "then", "true", "until", "while" };
+    for (const char* w : words) {
+        if (s == w)
+            return true;
+    }
+    return false;
+}
+
+std::vector<token> tokenize(const std::string& src) {
+    std::vector<token> out;
+    size_t i = 0;
+    int line = 1;
+    auto fail = [&line](const std::string& msg) {
+        throw compileerror{ std::to_string(line) + ": " + msg };
+    };
+    auto longBracket = [&](size_t& p, std::string* text) {
+        // p points at the first '['; returns false if this is not [[ or [=[
+        size_t q = p + 1;
+        size_t level = 0;
+        while (q < src.size() && src[q] == '=')
+            level++, q++;
+        if (q >= src.size() || src[q] != '[')
+            return false;
+        std::string close = "]" + std::string(level, '=') + "]";
+        size_t end = src.find(close, q + 1);
+        if (end == std::string::npos)
+            fail("unfinished long string or comment");
+        size_t start = q + 1;
+        if (start < src.size() && src[start] == '\n')
+            start++;
+        for (size_t k = p; k < end; ++k) {
+            if (src[k] == '\n')
+                line++;
+        }
+        if (text)
+            *text = src.substr(start, end - start);
+        p = end + close.size();
+        return true;
+    };
+
+    while (i < src.size()) {
+        char c = src[i];
+        if (c == '\n') {
+            line++;
+            i++;
+            continue;
+        }
+        if (std::isspace(static_cast<unsigned char>(c))) {
+            i++;
+            continue;
+        }
+        if (c == '-' && i + 1 < src.size() && src[i + 1] == '-') {
+            i += 2;
+            if (i < src.size() && src[i] == '[' && longBracket(i, nullptr))
+                continue;
+            while (i < src.size() && src[i] != '\n')
+                i++;
+            continue;
+        }
+        token t{ T_EOF, "", 0, line };
+        if (std::isalpha(static_cast<unsigned char>(c)) || c == '_') {
+            size_t start = i;
+            while (i < src.size() && (std::isalnum(static_cast<unsigned char>(src[i])) || src[i] == '_'))
+                i++;
+            t.text = src.substr(start, i - start);
+            t.kind = isKeyword(t.text) ? T_KEYWORD : T_NAME;
+        }
+        else if (std::isdigit(static_cast<unsigned char>(c)) ||
+            (c == '.' && i + 1 < src.size() && std::isdigit(static_cast<unsigned char>(src[i + 1])))) {
+            const char* begin = src.c_str() + i;
+            char* end = nullptr;
+            if (c == '0' && i + 1 < src.size() && (src[i + 1] == 'x' || src[i + 1] == 'X'))
+                t.num = static_cast<double>(std::strtoull(begin, &end, 16));
+            else
+                t.num = std::strtod(begin, &end);
+            if (end == begin)
+                fail("malformed number");
+            i += end - begin;
+            t.kind = T_NUMBER;
+        }
+        else if (c == '"' || c == '\'') {
+            i++;
+            while (i < src.size() && src[i] != c) {
+                char ch = src[i++];
+                if (ch == '\n')
+                    fail("unfinished string");
+                if (ch == '\\' && i < src.size()) {
+                    char e = src[i++];
+                    switch (e) {
+                    case 'n': t.text += '\n'; break;
+                    case 't': t.text += '\t'; break;
+                    case 'r': t.text += '\r'; break;
+                    case '0': t.text += '\0'; break;
+                    case '\\': case '"': case '\'': t.text += e; break;
+                    case '\n': t.text += '\n'; line++; break;
+                    default: fail(std::string("invalid escape sequence \\") + e);
+                    }
+                }
+                else {
+                    t.text += ch;
+                }
+            }
+            if (i >= src.size())
+                fail("unfinished string");
+            i++;
+            t.kind = T_STRING;
+        }
+        else if (c == '[' && longBracket(i, &t.text)) {
+            t.kind = T_STRING;
+        }
+        else {
+            static const char* symbols[] = { "...", "..", "==", "~=", "<=", ">=",
+                "+", "-", "*", "/", "%", "^", "#", "<", ">", "=", "(", ")", "{", "}", "[", "]", ";", ",", "." };
+            for (const char* sym : symbols) {
+                size_t len = std::strlen(sym);
+                if (src.compare(i, len, sym) == 0) {
+                    t.text = sym;
+                    break;
+                }
+            }
+            if (t.text.empty())
+                fail(std::string("unexpected symbol '") + c + "'");
+            i += t.text.size();
+            t.kind = T_SYMBOL;
+        }
+        out.push_back(t);
+    }
+    out.push_back(token{ T_EOF, "<eof>", 0, line });
+    return out;
+}
+
+// Compiler: single-pass recursive descent straight to bytecode
+
+class compiler {
+public:
+    compiler(const std::vector<token>& toks, scriptchunk& chunk) : toks(toks), chunk(chunk) {}
+
+    void compileChunk() {
+        block();
+        if (peek().kind != T_EOF)
+            fail("'<eof>' expected near '" + peek().text + "'");
+        emit(OP_RETURNNIL);
+    }
+
+private:
+    struct expdesc {
+        enum kind { VALUE, LOCAL, GLOBAL, INDEXED, NAMESPACE, FUNCTION };
+        kind k = VALUE;
+        int arg = 0;        // local slot / global constant / builtin id
+        std::string name;   // namespace prefix
+        bool call = false;  // produced by a call; valid as a statement
+    };
+
+    struct localvar {
+        std::string name;
+        int slot;
+    };
+
+    const std::vector<token>& toks;
+    scriptchunk& chunk;
+    size_t pos = 0;
+    std::vector<localvar> locals;
+    int nextSlot = 0;
+    std::vector<std::vector<size_t>> breaks;
+    int depth = 0;
+
+    // Bounds the recursion of nested blocks and expressions, as Lua does
+    static const int MAX_DEPTH = 200;
+
+    struct nesting {
+        compiler& c;
+        explicit nesting(compiler& c) : c(c) {
+            if (++c.depth > MAX_DEPTH)
+                c.fail("chunk has too many syntax levels");
+        }
+        ~nesting() { c.depth--; }
+    };
+
+    const token& peek(size_t ahead = 0) const { return toks[std::min(pos + ahead, toks.size() - 1)]; }
+    const token& advance() { return toks[pos < toks.size() - 1 ? pos++ : pos]; }
+    bool check(const char* text) const {
+        const token& t = peek();
+        return (t.kind == T_SYMBOL || t.kind == T_KEYWORD) && t.text == text;
+    }
+    bool accept(const char* text) {
+        if (!check(text))
+            return false;
+        advance();
+        return true;
+    }
+    void expect(const char* text) {
+        if (!accept(text))
+            fail(std::string("'") + text + "' expected near '" + peek().text + "'");
+    }
+    std::string expectName() {
+        if (peek().kind != T_NAME)
+            fail("<name> expected near '" + peek().text + "'");
+        return advance().text;
+    }
+    [[noreturn]] void fail(const std::string& msg) const {
+        throw compileerror{ std::to_string(peek().line) + ": " + msg };
+    }
+
+    size_t emit(uint8_t op, int32_t a = 0, int32_t b = 0) {
+        chunk.code.push_back(scriptchunk::instr{ op, a, b });
+        chunk.lines.push_back(peek().line);
+        return chunk.code.size() - 1;
+    }
+    void patch(size_t at) { chunk.code[at].a = static_cast<int32_t>(chunk.code.size()); }
+    int constant(const scriptvalue& v) {
+        chunk.constants.push_back(v);
+        return static_cast<int>(chunk.constants.size() - 1);
+    }
+
+    int declareLocal(const std::string& name) {
+        int slot = nextSlot++;
+        locals.push_back(localvar{ name, slot });
+        chunk.localSlots = std::max<size_t>(chunk.localSlots, static_cast<size_t>(nextSlot));
+        return slot;
+    }
+    int findLocal(const std::string& name) const {
+        for (size_t i = locals.size(); i > 0; --i) {
+            if (locals[i - 1].name == name)
+                return locals[i - 1].slot;
+        }
+        return -1;
+    }
+
+    bool blockEnds() const {
+        const token& t = peek();
+        return t.kind == T_EOF || (t.kind == T_KEYWORD &&
+            (t.text == "end" || t.text == "else" || t.text == "elseif" || t.text == "until"));
+    }
+
+    void block() {
+        nesting guard(*this);
+        size_t savedLocals = locals.size();
+        int savedSlot = nextSlot;
+        while (!blockEnds()) {
+            if (check("return")) {
+                returnStat();
+                break;
+            }
+            statement();
+        }
+        locals.resize(savedLocals);
+        nextSlot = savedSlot;
+    }
+
+    void statement() {
+        if (accept(";"))
+            return;
+        if (accept("local")) {
+            localStat();
+        }
+        else if (accept("if")) {
+            ifStat();
+        }
+        else if (accept("while")) {
+            whileStat();
+        }
+        else if (accept("for")) {
+            forStat();
+        }
+        else if (accept("do")) {
+            block();
+            expect("end");
+        }
+        else if (accept("break")) {
+            if (breaks.empty())
+                fail("no loop to break");
+            breaks.back().push_back(emit(OP_JMP));
+        }
+        else if (check("function") || check("repeat")) {
+            fail("'" + peek().text + "' is not supported in scripts");
+        }
+        else {
+            exprStat();
+        }
+    }
+
+    void returnStat() {
+        advance();
+        if (blockEnds() || check(";")) {
+            emit(OP_RETURNNIL);
+        }
+        else {
+            expression();
+            emit(OP_RETURN);
+        }
+        accept(";");
+        if (!blockEnds())
+            fail("'return' must be the last statement in a block");
+    }
+
+    void localStat() {
+        std::vector<std::string> names;
+        do {
+            names.push_back(expectName());
+        } while (accept(","));
+        size_t values = 0;
+        if (accept("=")) {
+            do {
+                expression();
+                values++;
+            } while (accept(","));
+        }
+        for (; values > names.size(); --values)
+            emit(OP_POP);
+        for (; values < names.size(); ++values)
+            emit(OP_NIL);
+        std::vector<int> slots;
+        for (const auto& name : names)
+            slots.push_back(declareLocal(name));
+        for (size_t i = slots.size(); i > 0; --i)
+            emit(OP_SETLOCAL, slots[i - 1]);
+    }
+
+    void ifStat() {
+        std::vector<size_t> exits;
+        expression();
+        expect("then");
+        size_t skip = emit(OP_JMPIFNOT);
+        block();
+        while (check("elseif") || check("else")) {
+            exits.push_back(emit(OP_JMP));
+            patch(skip);
+            if (accept("elseif")) {
+                expression();
+                expect("then");
+                skip = emit(OP_JMPIFNOT);
+                block();
+            }
+            else {
+                advance();
+                block();
+                skip = SIZE_MAX;
+                break;
+            }
+        }
+        expect("end");
+        if (skip != SIZE_MAX)
+            patch(skip);
+        for (size_t e : exits)
+            patch(e);
+    }
+
+    void loopBody(size_t loopStart) {
+        breaks.emplace_back();
+        block();
+        expect("end");
+        emit(OP_JMP, static_cast<int32_t>(loopStart));
+    }
+
+    void closeLoop() {
+        for (size_t b : breaks.back())
+            patch(b);
+        breaks.pop_back();
+    }
+
+    void whileStat() {
+        size_t loopStart = chunk.code.size();
+        expression();
+        expect("do");
+        size_t exit = emit(OP_JMPIFNOT);
+        loopBody(loopStart);
+        patch(exit);
+        closeLoop();
+    }
+
+    void forStat() {
+        std::string var = expectName();
+        if (!check("="))
+            fail("only numeric for loops are supported");
+        advance();
+        size_t savedLocals = locals.size();
+        int savedSlot = nextSlot;
+        expression();
+        expect(",");
+        expression();
+        if (accept(","))
+            expression();
+        else
+            emit(OP_CONST, constant(scriptvalue::number(1)));
+        expect("do");
+        int base = declareLocal(var);
+        declareLocal("(for limit)");
+        declareLocal("(for step)");
+        emit(OP_SETLOCAL, base + 2);
+        emit(OP_SETLOCAL, base + 1);
+        emit(OP_SETLOCAL, base);
+        size_t loopStart = emit(OP_FORTEST, base);
+        breaks.emplace_back();
+        block();
+        expect("end");
+        emit(OP_FORSTEP, base);
+        emit(OP_JMP, static_cast<int32_t>(loopStart));
+        chunk.code[loopStart].b = static_cast<int32_t>(chunk.code.size());
+        closeLoop();
+        locals.resize(savedLocals);
+        nextSlot = savedSlot;
+    }
+
+    void exprStat() {
+        expdesc e = suffixedExp();
+        if (accept("=")) {
+            if (e.k != expdesc::LOCAL && e.k != expdesc::GLOBAL && e.k != expdesc::INDEXED)
+                fail("cannot assign to this expression");
+            expression();
+            if (e.k == expdesc::LOCAL)
+                emit(OP_SETLOCAL, e.arg);
+            else if (e.k == expdesc::GLOBAL)
+                emit(OP_SETGLOBAL, e.arg);
+            else
+                emit(OP_SETINDEX);
+            return;
+        }
+        if (!e.call)
+            fail("syntax error near '" + peek().text + "'");
+        emit(OP_POP);
+    }
+
+    void discharge(expdesc& e) {
+        switch (e.k) {
+        case expdesc::LOCAL: emit(OP_GETLOCAL, e.arg); break;
+        case expdesc::GLOBAL: emit(OP_GETGLOBAL, e.arg); break;
+        case expdesc::INDEXED: emit(OP_GETINDEX); break;
+        case expdesc::NAMESPACE:
+        case expdesc::FUNCTION: fail("functions are not values in scripts");
+        case expdesc::VALUE: break;
+        }
+        e.k = expdesc::VALUE;
+    }
+
+    expdesc primaryExp() {
+        expdesc e;
+        if (accept("(")) {
+            expression();
+            expect(")");
+            return e;
+        }
+        std::string name = expectName();
+        int slot = findLocal(name);
+        if (slot >= 0) {
+            e.k = expdesc::LOCAL;
+            e.arg = slot;
+            return e;
+        }
+        if (name == "redis" || name == "table") {
+            e.k = expdesc::NAMESPACE;
+            e.name = name;
+            return e;
+        }
+        auto b = builtinTable().find(name);
+        if (b != builtinTable().end()) {
+            e.k = expdesc::FUNCTION;
+            e.arg = b->second;
+            return e;
+        }
+        e.k = expdesc::GLOBAL;
+        e.arg = constant(scriptvalue::string(name));
+        return e;
+    }
+
+    expdesc suffixedExp() {
+        expdesc e = primaryExp();
+        while (true) {
+            if (accept(".")) {
+                std::string field = expectName();
+                if (e.k == expdesc::NAMESPACE) {
+                    auto b = builtinTable().find(e.name + "." + field);
+                    if (b == builtinTable().end())
+                        fail("unknown function " + e.name + "." + field);
+                    e.k = expdesc::FUNCTION;
+                    e.arg = b->second;
+                    continue;
+                }
+                discharge(e);
+                emit(OP_CONST, constant(scriptvalue::string(field)));
+                e.k = expdesc::INDEXED;
+                e.call = false;
+            }
+            else if (accept("[")) {
+                discharge(e);
+                expression();
+                expect("]");
+                e.k = expdesc::INDEXED;
+                e.call = false;
+            }
+            else if (check("(")) {
+                if (e.k != expdesc::FUNCTION)
+                    fail("attempt to call a non-function value");
+                advance();
+                int nargs = 0;
+                if (!check(")")) {
+                    do {
+                        expression();
+                        nargs++;
+                    } while (accept(","));
+                }
+                expect(")");
+                emit(OP_CALL, e.arg, nargs);
+                e.k = expdesc::VALUE;
+                e.call = true;
+            }
+            else {
+                return e;
+            }
+        }
+    }
+
+    void tableConstructor() {
+        emit(OP_NEWTABLE);
+        while (!check("}")) {
+            if (accept("[")) {
+                expression();
+                expect("]");
+                expect("=");
+                expression();
+                emit(OP_SETFIELD);
+            }
+            else if (peek().kind == T_NAME && peek(1).kind == T_SYMBOL && peek(1).text == "=") {
+                emit(OP_CONST, constant(scriptvalue::string(advance().text)));
+                advance();
+                expression();
+                emit(OP_SETFIELD);
+            }
+            else {
+                expression();
+                emit(OP_APPEND);
+            }
+            if (!accept(",") && !accept(";"))
+                break;
+        }
+        expect("}");
+    }
+
+    expdesc simpleExp() {
+        expdesc e;
+        const token& t = peek();
+        if (t.kind == T_NUMBER) {
+            emit(OP_CONST, constant(scriptvalue::number(t.num)));
+            advance();
+        }
+        else if (t.kind == T_STRING) {
+            emit(OP_CONST, constant(scriptvalue::string(t.text)));
+            advance();
+        }
+        else if (accept("nil")) {
+            emit(OP_NIL);
+        }
+        else if (accept("true")) {
+            emit(OP_TRUE);
+        }
+        else if (accept("false")) {
+            emit(OP_FALSE);
+        }
+        else if (accept("{")) {
+            tableConstructor();
+        }
+        else {
+            return suffixedExp();
+        }
+        return e;
+    }
+
+    struct binop {
+        const char* text;
+        int left;
+        int right;
+        uint8_t op;
+    };
+
+    const binop* currentBinop() const {
+        static const binop ops[] = {
+            { "or", 1, 1, OP_ORJMP }, { "and", 2, 2, OP_ANDJMP },
+            { "==", 3, 3, OP_EQ }, { "~=", 3, 3, OP_NE }, { "<", 3, 3, OP_LT },
+            { "<=", 3, 3, OP_LE }, { ">", 3, 3, OP_GT }, { ">=", 3, 3, OP_GE },
+            { "..", 9, 8, OP_CONCAT },
+            { "+", 10, 10, OP_ADD }, { "-", 10, 10, OP_SUB },
+            { "*", 11, 11, OP_MUL }, { "/", 11, 11, OP_DIV }, { "%", 11, 11, OP_MOD },
+            { "^", 14, 13, OP_POW },
+        };
+        for (const auto& op : ops) {
+            if (check(op.text))
+                return &op;
+        }
+        return nullptr;
+    }
+
+    static const int UNARY_PRIORITY = 12;
+
+    expdesc subExpr(int limit) {
+        nesting guard(*this);
+        expdesc e;
+        if (check("not") || check("-") || check("#")) {
+            std::string op = advance().text;
+            expdesc operand = subExpr(UNARY_PRIORITY);
+            discharge(operand);
+            emit(op == "not" ? OP_NOT : op == "-" ? OP_NEG : OP_LEN);
+        }
+        else {
+            e = simpleExp();
+        }
+        const binop* op;
+        while ((op = currentBinop()) != nullptr && op->left > limit) {
+            advance();
+            discharge(e);
+            if (op->op == OP_ANDJMP || op->op == OP_ORJMP) {
+                size_t jump = emit(op->op);
+                expdesc rhs = subExpr(op->right);
+                discharge(rhs);
+                patch(jump);
+            }
+            else {
+                uint8_t code = op->op;
+                expdesc rhs = subExpr(op->right);
+                discharge(rhs);
+                emit(code);
+            }
+            e = expdesc();
+        }
+        return e;
+    }
+
+    void expression() {
+        expdesc e = subExpr(0);
+        discharge(e);
+    }
+};
+
+// VM helpers
+
+const char* typeName(const scriptvalue& v) {
+    switch (v.type) {
+    case scriptvalue::NIL: return "nil";
+    case scriptvalue::BOOLEAN: return "boolean";
+    case scriptvalue::NUMBER: return "number";
+    case scriptvalue::STRING: return "string";
+    case scriptvalue::TABLE: return "table";
+    }
+    return "nil";
+}
+
+bool valuesEqual(const scriptvalue& a, const scriptvalue& b) {
+    if (a.type != b.type)
+        return false;
+    switch (a.type) {
+    case scriptvalue::NIL: return true;
+    case scriptvalue::BOOLEAN: return a.b == b.b;
+    case scriptvalue::NUMBER: return a.n == b.n;
+    case scriptvalue::STRING: return a.s == b.s;
+    case scriptvalue::TABLE: return a.t == b.t;
+    }
+    return false;
+}
+
+scriptvalue stringTable(const std::vector<std::string>& items) {
+    scriptvalue t = scriptvalue::table();
+    t.t->array.reserve(items.size());
+    for (const auto& s : items)
+        t.t->array.push_back(scriptvalue::string(s));
+    return t;
+}
+
+} // namespace
+
+bool redisscript::compile(const std::string& source, scriptchunk& chunk, std::string& err) {
+    chunk = scriptchunk();
+    try {
+        std::vector<token> toks = tokenize(source);
+        compiler c(toks, chunk);
+        c.compileChunk();
+    }
+    catch (const compileerror& e) {
+        err = "Error compiling script: user_script:" + e.msg;
+        return false;
+    }
+    return true;
+}
+
+bool redisscript::run(const scriptchunk& chunk, const std::vector<std::string>& keys, const std::vector<std::string>& argv,
+    const commandcallback& call, uint64_t budget, scriptvalue& result, std::string& err) {
+    std::vector<scriptvalue> stack;
+    stack.reserve(32);
+    std::vector<scriptvalue> locals(chunk.localSlots);
+    std::unordered_map<std::string, scriptvalue> globals;
+    globals["KEYS"] = stringTable(keys);
+    globals["ARGV"] = stringTable(argv);
+
+    const auto& code = chunk.code;
+    size_t pc = 0;
+    uint64_t steps = 0;
+    auto fail = [&](const std::string& msg) {
+        size_t at = pc > 0 ? pc - 1 : 0;
+        err = "Error running script: user_script:" + std::to_string(at < chunk.lines.size() ? chunk.lines[at] : 0) + ": " + msg;
+        return false;
+    };
+    auto pop = [&stack]() {
+        scriptvalue v = std::move(stack.back());
+        stack.pop_back();
+        return v;
+    };
+
+    while (pc < code.size()) {
+        if (++steps > budget)
+            return fail("script exceeded the instruction budget of " + std::to_string(budget));
+        const scriptchunk::instr& in = code[pc++];
+        switch (in.op) {
+        case OP_CONST: stack.push_back(chunk.constants[in.a]); break;
+        case OP_NIL: stack.emplace_back(); break;
+        case OP_TRUE: stack.push_back(scriptvalue::boolean(true)); break;
+        case OP_FALSE: stack.push_back(scriptvalue::boolean(false)); break;
+        case OP_GETLOCAL: stack.push_back(locals[in.a]); break;
+        case OP_SETLOCAL: locals[in.a] = pop(); break;
+        case OP_GETGLOBAL: {
+            auto it = globals.find(chunk.constants[in.a].s);
+            stack.push_back(it != globals.end() ? it->second : scriptvalue());
+            break;
+        }
+        case OP_SETGLOBAL: globals[chunk.constants[in.a].s] = pop(); break;
+        case OP_GETINDEX: {
+            scriptvalue key = pop();
+            scriptvalue t = pop();
+            if (t.type != scriptvalue::TABLE)
+                return fail(std::string("attempt to index a ") + typeName(t) + " value");
+            stack.push_back(t.t->get(key));
+            break;
+        }
+        case OP_SETINDEX: {
+            scriptvalue v = pop();
+            scriptvalue key = pop();
+            scriptvalue t = pop();
+            if (t.type != scriptvalue::TABLE)
+                return fail(std::string("attempt to index a ") + typeName(t) + " value");
+            std::string e;
+            if (!t.t->set(key, v, e))
+                return fail(e);
+            break;
+        }
+        case OP_NEWTABLE: stack.push_back(scriptvalue::table()); break;
+        case OP_APPEND: {
+            scriptvalue v = pop();
+            stack.back().t->array.push_back(std::move(v));
+            break;
+        }
+        case OP_SETFIELD: {
+            scriptvalue v = pop();
+            scriptvalue key = pop();
+            std::string e;
+            if (!stack.back().t->set(key, v, e))
+                return fail(e);
+            break;
+        }
+        case OP_ADD: case OP_SUB: case OP_MUL: case OP_DIV: case OP_MOD: case OP_POW: {
+            scriptvalue b = pop();
+            scriptvalue a = pop();
+            double x, y;
+            if (!toNumber(a, x) || !toNumber(b, y))
+                return fail(std::string("attempt to perform arithmetic on a ") +
+                    typeName(toNumber(a, x) ? b : a) + " value");
+            double r = 0;
+            switch (in.op) {
+            case OP_ADD: r = x + y; break;
+            case OP_SUB: r = x - y; break;
+            case OP_MUL: r = x * y; break;
+            case OP_DIV: r = x / y; break;
+            case OP_MOD: r = x - std::floor(x / y) * y; break;
+            case OP_POW: r = std::pow(x, y); break;
+            }
+            stack.push_back(scriptvalue::number(r));
+            break;
+        }
+        case OP_CONCAT: {
+            scriptvalue b = pop();
+            scriptvalue a = pop();
+            for (const scriptvalue* v : { &a, &b }) {
+                if (v->type != scriptvalue::STRING && v->type != scriptvalue::NUMBER)
+                    return fail(std::string("attempt to concatenate a ") + typeName(*v) + " value");
+            }
+            std::string left = a.toString(), right = b.toString();
+            if (left.size() + right.size() > MAX_STRING)
+                return fail("string length overflow");
+            stack.push_back(scriptvalue::string(left + right));
+            break;
+        }
+        case OP_EQ: case OP_NE: {
+            scriptvalue b = pop();
+            scriptvalue a = pop();
+            bool eq = valuesEqual(a, b);
+            stack.push_back(scriptvalue::boolean(in.op == OP_EQ ? eq : !eq));
+            break;
+        }
+        case OP_LT: case OP_LE: case OP_GT: case OP_GE: {
+            scriptvalue b = pop();
+            scriptvalue a = pop();
+            int cmp;
+            if (a.type == scriptvalue::NUMBER && b.type == scriptvalue::NUMBER)
+                cmp = a.n < b.n ? -1 : (a.n > b.n ? 1 : 0);
+            else if (a.type == scriptvalue::STRING && b.type == scriptvalue::STRING)
+                cmp = a.s.compare(b.s);
+            else
+                return fail(std::string("attempt to compare ") + typeName(a) + " with " + typeName(b));
+            bool r = in.op == OP_LT ? cmp < 0 : in.op == OP_LE ? cmp <= 0 : in.op == OP_GT ? cmp > 0 : cmp >= 0;
+            stack.push_back(scriptvalue::boolean(r));
+            break;
+        }
+        case OP_NOT: stack.back() = scriptvalue::boolean(!stack.back().truthy()); break;
+        case OP_NEG: {
+            double x;
+            if (!toNumber(stack.back(), x))
+                return fail(std::string("attempt to perform arithmetic on a ") + typeName(stack.back()) + " value");
+            stack.back() = scriptvalue::number(-x);
+            break;
+        }
+        case OP_LEN: {
+            scriptvalue v = pop();
+            if (v.type == scriptvalue::STRING)
+                stack.push_back(scriptvalue::number(static_cast<double>(v.s.size())));
+            else if (v.type == scriptvalue::TABLE)
+                stack.push_back(scriptvalue::number(static_cast<double>(v.t->length())));
+            else
+                return fail(std::string("attempt to get length of a ") + typeName(v) + " value");
+            break;
+        }
+        case OP_JMP: pc = in.a; break;
+        case OP_JMPIFNOT:
+            if (!pop().truthy())
+                pc = in.a;
+            break;
+        case OP_ANDJMP:
+            if (!stack.back().truthy())
+                pc = in.a;
+            else
+                stack.pop_back();
+            break;
+        case OP_ORJMP:
+            if (stack.back().truthy())
+                pc = in.a;
+            else
+                stack.pop_back();
+            break;
+        case OP_POP: stack.pop_back(); break;
+        case OP_FORTEST: {
+            double v, limit, step;
+            if (!toNumber(locals[in.a], v) || !toNumber(locals[in.a + 1], limit) || !toNumber(locals[in.a + 2], step))
+                return fail("'for' initial value, limit and step must be numbers");
+            if (step == 0)
+                return fail("'for' step is zero");
+            locals[in.a] = scriptvalue::number(v);
+            if (step > 0 ? v > limit : v < limit)
+                pc = in.b;
+            break;
+        }
+        case OP_FORSTEP: {
+            double v, step;
+            if (!toNumber(locals[in.a], v) || !toNumber(locals[in.a + 2], step))
+                return fail("'for' control variable must stay a number");
+            locals[in.a] = scriptvalue::number(v + step);
+            break;
+        }
+        case OP_CALL: {
+            std::vector<scriptvalue> args(stack.end() - in.b, stack.end());
+            stack.resize(stack.size() - in.b);
+            scriptvalue ret;
+            switch (in.a) {
+            case B_CALL:
+            case B_PCALL: {
+                if (args.empty())
+                    return fail("Please specify at least one argument for redis.call()");
+                std::vector<std::string> cmd;
+                cmd.reserve(args.size());
+                for (const auto& a : args) {
+                    if (a.type != scriptvalue::STRING && a.type != scriptvalue::NUMBER)
+                        return fail("Lua redis() command arguments must be strings or integers");
+                    cmd.push_back(a.toString());
+                }
+                if (!call(cmd, ret)) {
+                    if (in.a == B_CALL)
+                        return fail(ret.s);
+                    ret = scriptvalue::errorReply(ret.s);
+                }
+                break;
+            }
+            case B_ERROR_REPLY:
+            case B_STATUS_REPLY: {
+                std::string msg = args.empty() ? "" : args[0].toString();
+                ret = in.a == B_ERROR_REPLY ? scriptvalue::errorReply(msg) : scriptvalue::statusReply(msg);
+                break;
+            }
+            case B_SHA1HEX:
+                ret = scriptvalue::string(sha1hex(args.empty() ? "" : args[0].toString()));
+                break;
+            case B_TONUMBER: {
+                double x;
+                if (!args.empty() && toNumber(args[0], x))
+                    ret = scriptvalue::number(x);
+                break;
+            }
+            case B_TOSTRING:
+                ret = scriptvalue::string(args.empty() ? "nil" : args[0].toString());
+                break;
+            case B_TYPE:
+                ret = scriptvalue::string(typeName(args.empty() ? scriptvalue() : args[0]));
+                break;
+            case B_TABLE_INSERT: {
+                if (args.empty() || args[0].type != scriptvalue::TABLE || args.size() < 2 || args.size() > 3)
+                    return fail("wrong arguments to 'table.insert'");
+                auto& arr = args[0].t->array;
+                if (args.size() == 2) {
+                    arr.push_back(args[1]);
+                }
+                else {
+                    double p;
+                    if (!toNumber(args[1], p) || !(p >= 1 && p <= static_cast<double>(arr.size() + 1)))
+                        return fail("bad argument #2 to 'insert' (position out of bounds)");
+                    arr.insert(arr.begin() + static_cast<size_t>(p) - 1, args[2]);
+                }
+                break;
+            }
+            }
+            stack.push_back(std::move(ret));
+            break;
+        }
+        case OP_RETURN:
+            result = pop();
+            return true;
+        case OP_RETURNNIL:
+            result = scriptvalue();
+            return true;
+        }
+    }
+    result = scriptvalue();
+    return true;
+}
+
+// SHA1 (FIPS 180-1), used to name cached scripts
+
+static uint32_t rotl32(uint32_t x, int n) {
+    return (x << n) | (x >> (32 - n));
+}
+
+std::string redisscript::sha1hex(const std::string& data) {
+    uint32_t h[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+    std::string msg = data;
+    uint64_t bitLen = static_cast<uint64_t>(data.size()) * 8;
+    msg.push_back(static_cast<char>(0x80));
+    while (msg.size() % 64 != 56)
+        msg.push_back('\0');
+    for (int i = 7; i >= 0; --i)
+        msg.push_back(static_cast<char>((bitLen >> (i * 8)) & 0xff));
+
+    for (size_t off = 0; off < msg.size(); off += 64) {
+        uint32_t w[80];
+        for (int i = 0; i < 16; ++i) {
+            const unsigned char* p = reinterpret_cast<const unsigned char*>(msg.data() + off + i * 4);
+            w[i] = (uint32_t(p[0]) << 24) | (uint32_t(p[1]) << 16) | (uint32_t(p[2]) << 8) | uint32_t(p[3]);
+        }
+        for (int i = 16; i < 80; ++i)
+            w[i] = rotl32(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+        uint32_t a = h[0], b = h[1], c = h[2], d = h[3], e = h[4];
+        for (int i = 0; i < 80; ++i) {
+            uint32_t f, k;
+            if (i < 20) {
+                f = (b & c) | (~b & d);
+                k = 0x5A827999;
+            }
+            else if (i < 40) {
+                f = b ^ c ^ d;
+                k = 0x6ED9EBA1;
+            }
+            else if (i < 60) {
+                f = (b & c) | (b & d) | (c & d);
+                k = 0x8F1BBCDC;
+            }
+            else {
+                f = b ^ c ^ d;
+                k = 0xCA62C1D6;
+            }
+            uint32_t temp = rotl32(a, 5) + f + e + k + w[i];
+            e = d;
+            d = c;
+            c = rotl32(b, 30);
+            b = a;
+            a = temp;
+        }
+        h[0] += a;
+        h[1] += b;
+        h[2] += c;
+        h[3] += d;
+        h[4] += e;
+    }
+
+    static const char hex[] = "0123456789abcdef";
+    std::string out;
+    out.reserve(40);
+    for (uint32_t v : h) {
+        for (int i = 28; i >= 0; i -= 4)
+            out.push_back(hex[(v >> i) & 0xf]);
+    }
+    return out;
+}
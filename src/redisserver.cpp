@@ -1,17 +1,55 @@
 #include "../include/redisserver.h"
 #include "../include/rediscommandhandler.h"
 #include "../include/redisdatabase.h"
+#include "../include/redisoutput.h"
+#include "../include/redisiothreads.h"
+#include "../include/redisuring.h"
+#include "../include/redisshards.h"
+#include "../include/redisnet.h"
+#include "../include/redisstats.h"
 
 #include <iostream>
 #include <vector>
 #include <thread>
 #include <cstring>
+#include <memory>
 
 #include <winsock2.h>
 #include <ws2tcpip.h>
 
 redisserver* globalServer = nullptr;
 
+static bool sendAll(SOCKET sock, const std::string& data) {
+    size_t sent = 0;
+    while (sent < data.size()) {
+        int n = send(sock, data.data() + sent, static_cast<int>(data.size() - sent), 0);
+        if (n == SOCKET_ERROR || n == 0)
+            return false;
+        sent += n;
+    }
+    return true;
+}
+
+// Drains a connection's output queue once it can receive pushed messages.
+// A client dropped for exceeding its output limits is shut down here, which
+// also wakes the connection thread blocked in recv.
+static std::thread startWriter(SOCKET sock, std::shared_ptr<redisoutput> output) {
+    return std::thread([sock, output]() {
+        std::vector<redisoutput::buffer> batch;
+        while (output->take(batch)) {
+            for (const auto& b : batch) {
+                if (!sendAll(sock, *b)) {
+                    output->close();
+                    break;
+                }
+            }
+            batch.clear();
+        }
+        if (output->overflowed())
+            ::shutdown(sock, SD_BOTH);
+    });
+}
+
 void signalHandler(int signum) {
     if (globalServer) {
         std::cout << "\nCaught signal " << signum << ", shutting down...\n";
@@ -33,7 +71,7 @@ redisserver::redisserver(int port)
 void redisserver::shutdown() {
     running = false;
 
-    if (redisdatabase::getInstance().dump("dump.my_rdb")) {
+    if (redisdatabase::dumpAll("dump.my_rdb")) {
         std::cout << "Database dumped to dump.my_rdb\n";
     }
     else {
@@ -90,10 +128,96 @@ void redisserver::run() {
     }
 
     std::cout << "redis Server Listening On Port " << port << "\n";
+    redisstats::setPort(port);
 
     std::vector<std::thread> threads;
     rediscommandhandler cmdHandler;
 
+    if (shardCount > 0) {
+        std::cout << "Serving with " << shardCount << " shards\n";
+        redisshards shards(cmdHandler, shardCount);
+        redisnet::setStatsSource([&shards]() {
+            redisshards::stats s = shards.getStats();
+            redisnet::netstats n;
+            n.backend = "shards";
+            n.threads = shards.shardCount();
+            n.commands = s.commands;
+            n.syscalls = s.syscalls;
+            n.forwarded = s.forwarded;
+            n.coordinated = s.coordinated;
+            return n;
+        });
+        shards.start();
+        while (running) {
+            SOCKET client_socket = accept(server_socket, nullptr, nullptr);
+            if (client_socket == INVALID_SOCKET) {
+                if (running) {
+                    std::cerr << "Error accepting client connection. Error: " << WSAGetLastError() << "\n";
+                }
+                break;
+            }
+            shards.addConnection(client_socket);
+        }
+        shards.stop();
+        redisnet::setStatsSource(nullptr);
+        WSACleanup();
+        return;
+    }
+
+    if (ioBackend == "uring") {
+        if (redisuring::available()) {
+            redisuring loop(cmdHandler);
+            redisnet::setStatsSource([&loop]() {
+                redisuring::stats s = loop.getStats();
+                redisnet::netstats n;
+                n.backend = "io_uring";
+                n.threads = 1;
+                n.commands = s.commands;
+                n.syscalls = s.enters + s.otherCalls;
+                return n;
+            });
+            std::cout << "Serving with io_uring\n";
+            bool served = loop.run(server_socket);
+            redisnet::setStatsSource(nullptr);
+            if (served) {
+                WSACleanup();
+                return;
+            }
+        }
+        std::cout << "io_uring not available; falling back to epoll\n";
+        if (ioThreads == 0)
+            ioThreads = 1;
+    }
+
+    if (ioThreads > 0) {
+        std::cout << "Serving with " << ioThreads << " I/O threads\n";
+        redisiothreads pool(cmdHandler, ioThreads);
+        redisnet::setStatsSource([&pool]() {
+            redisiothreads::stats s = pool.getStats();
+            redisnet::netstats n;
+            n.backend = "epoll";
+            n.threads = pool.threadCount();
+            n.commands = s.commands;
+            n.syscalls = s.pollCalls + s.readCalls + s.writeCalls + s.wakeups;
+            return n;
+        });
+        pool.start();
+        while (running) {
+            SOCKET client_socket = accept(server_socket, nullptr, nullptr);
+            if (client_socket == INVALID_SOCKET) {
+                if (running) {
+                    std::cerr << "Error accepting client connection. Error: " << WSAGetLastError() << "\n";
+                }
+                break;
+            }
+            pool.addConnection(client_socket);
+        }
+        pool.stop();
+        redisnet::setStatsSource(nullptr);
+        WSACleanup();
+        return;
+    }
+
     while (running) {
         SOCKET client_socket = accept(server_socket, nullptr, nullptr);
         if (client_socket == INVALID_SOCKET) {
@@ -104,19 +228,63 @@ void redisserver::run() {
         }
 
         threads.emplace_back([client_socket, &cmdHandler]() {
-            char buffer[1024];
+            redisstats::add(redisstats::CONNECTIONS);
+            redisclient client;
+            client.streamReplies = true;
+            std::thread writer;
+            char buffer[16384];
+            std::string pending;
             while (true) {
-                memset(buffer, 0, sizeof(buffer));
-                int bytes = recv(client_socket, buffer, sizeof(buffer) - 1, 0);
+                int bytes = recv(client_socket, buffer, sizeof(buffer), 0);
                 if (bytes <= 0) {
                     if (bytes == SOCKET_ERROR) {
                     }
                     break;
                 }
-                std::string request(buffer, bytes);
-                std::string response = cmdHandler.processCommand(request);
-                send(client_socket, response.c_str(), response.size(), 0);
+                // Commands may arrive split across reads or several per read
+                pending.append(buffer, bytes);
+                std::string response;
+                size_t pos = 0, len;
+                bool lost = false;
+                while ((len = rediscommandhandler::frameLength(pending, pos)) > 0) {
+                    response += cmdHandler.processCommand(pending.substr(pos, len), client);
+                    pos += len;
+                    if (!client.stream)
+                        continue;
+                    // A streamed reply is produced by the writer thread as it
+                    // sends, behind whatever this batch has answered so far
+                    if (!client.output)
+                        client.output = std::make_shared<redisoutput>();
+                    if (!writer.joinable())
+                        writer = startWriter(client_socket, client.output);
+                    lost = client.output->push(std::make_shared<const std::string>(std::move(response))) != redisoutput::QUEUED
+                        || client.output->push(std::move(client.stream)) != redisoutput::QUEUED;
+                    client.stream = nullptr;
+                    response.clear();
+                    if (lost)
+                        break;
+                }
+                pending.erase(0, pos);
+                if (lost)
+                    break;
+                if (response.empty())
+                    continue;
+                if (client.output) {
+                    // Replies share the output queue with pushed messages so they stay ordered
+                    if (!writer.joinable())
+                        writer = startWriter(client_socket, client.output);
+                    if (client.output->push(std::make_shared<const std::string>(std::move(response))) != redisoutput::QUEUED)
+                        break;
+                }
+                else {
+                    if (!sendAll(client_socket, response))
+                        break;
+                }
             }
+            cmdHandler.closeClient(client);
+            redisstats::add(redisstats::DISCONNECTIONS);
+            if (writer.joinable())
+                writer.join();
             closesocket(client_socket);
             });
     }
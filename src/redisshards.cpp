@@ -0,0 +1,578 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <algorithm>
+#include <cstdlib>
+#include "../include/redisshards.h"
+#include "../include/rediscommandhandler.h"
+#include "../include/redisdatabase.h"
+#include "../include/rediscluster.h"
+#include "../include/redisclient.h"
+#include "../include/redisstats.h"
+
+static const size_t LINK_SLOTS = 128; // batches in flight per shard pair
+
+// Runs commands forwarded from other shards; they carry no client state.
+static thread_local redisclient forwardedClient;
+
+static std::string upper(const std::string& s) {
+    std::string u = s;
+    std::transform(u.begin(), u.end(), u.begin(), ::toupper);
+    return u;
+}
+
+struct redisshards::connection {
+    struct slot {
+        bool ready = false;
+        std::string data;
+    };
+
+    uint64_t id = 0;
+    SOCKET sock = INVALID_SOCKET;
+    redisclient client;
+    bool hooked = false;
+    std::string in;
+    std::string out;
+    size_t outPos = 0;
+    bool wantWrite = false;
+    bool isDirty = false;
+    bool closing = false;
+
+    // Replies are released in command order; slots hold those still
+    // waiting on another shard, starting at sequence number baseSeq.
+    std::deque<slot> slots;
+    uint64_t baseSeq = 0;
+    size_t outstanding = 0; // forwarded, not yet answered
+    size_t target = 0;      // the shard they went to
+    // A command that could not be dispatched yet without running ahead of
+    // earlier ones on another shard.
+    bool stalled = false;
+    bool hasHeld = false;
+    std::vector<std::string> held;
+};
+
+redisshards::link::link() : requests(LINK_SLOTS), replies(LINK_SLOTS) {}
+
+redisshards::shard::shard() : accepted(1024) {}
+
+redisshards::redisshards(rediscommandhandler& handler, int count) : cmdHandler(handler) {
+    size_t n = static_cast<size_t>(count);
+    for (size_t i = 0; i < n; ++i) {
+        shards.emplace_back(new shard());
+        shards[i]->index = i;
+        shards[i]->db = &redisdatabase::shard(i);
+        shards[i]->outbox.resize(n);
+        shards[i]->replyBox.resize(n);
+    }
+    for (size_t from = 0; from < n; ++from) {
+        for (size_t to = 0; to < n; ++to)
+            links.emplace_back(from == to ? nullptr : new link());
+    }
+}
+
+redisshards::~redisshards() {
+    stop();
+}
+
+size_t redisshards::ownerOf(const std::string& key) const {
+    return static_cast<size_t>(rediscluster::keySlot(key)) % shards.size();
+}
+
+void redisshards::start() {
+    // A snapshot loads into shard 0; hand every key to its owner
+    redisdatabase& first = *shards[0]->db;
+    for (const auto& name : first.storedNames()) {
+        size_t owner = ownerOf(name);
+        if (owner != 0)
+            first.moveKeyTo(name, *shards[owner]->db);
+    }
+
+    running = true;
+    for (auto& s : shards) {
+        s->poller.add(s->wakeup.handle(), nullptr, redispoller::READABLE);
+        shard* sp = s.get();
+        s->thread = std::thread([this, sp]() { loop(*sp); });
+    }
+}
+
+void redisshards::stop() {
+    if (!running.exchange(false))
+        return;
+    for (auto& s : shards)
+        s->wakeup.signal();
+    for (auto& s : shards) {
+        if (s->thread.joinable())
+            s->thread.join();
+    }
+    for (auto& s : shards) {
+        rediscommandhandler::bindDatabase(s->db);
+        for (auto& c : s->conns) {
+            cmdHandler.closeClient(c.second->client);
+            closesocket(c.second->sock);
+            delete c.second;
+        }
+        s->conns.clear();
+    }
+    rediscommandhandler::bindDatabase(nullptr);
+}
+
+void redisshards::addConnection(SOCKET sock) {
+    redisnet::setNonBlocking(sock);
+    redisnet::setNoDelay(sock);
+    shard& s = *shards[nextShard++ % shards.size()];
+    while (!s.accepted.push(std::move(sock)))
+        std::this_thread::yield();
+    signal(s);
+}
+
+redisshards::stats redisshards::getStats() const {
+    stats total;
+    for (const auto& s : shards) {
+        total.commands += s->stats.commands;
+        total.forwarded += s->stats.forwarded;
+        total.batches += s->stats.batches;
+        total.coordinated += s->stats.coordinated;
+        total.stalls += s->stats.stalls;
+        total.syscalls += s->stats.syscalls;
+    }
+    return total;
+}
+
+void redisshards::signal(shard& target) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (target.polling.load(std::memory_order_relaxed)) {
+        target.wakeup.signal();
+        target.stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+// Event Loop
+void redisshards::loop(shard& s) {
+    rediscommandhandler::bindDatabase(s.db);
+    std::vector<redispoller::event> events;
+    while (running) {
+        s.polling.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        s.poller.wait(events, hasWork(s) ? 0 : -1);
+        s.polling.store(false, std::memory_order_relaxed);
+        s.stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+
+        for (const auto& ev : events) {
+            if (!ev.data) {
+                s.wakeup.drain();
+                continue;
+            }
+            connection* c = static_cast<connection*>(ev.data);
+            if (c->closing)
+                continue;
+            if ((ev.events & redispoller::READABLE) || ev.hangup)
+                readConnection(s, c);
+            if (!c->closing && (ev.events & redispoller::WRITABLE))
+                flushConnection(s, c);
+        }
+
+        SOCKET sock;
+        while (s.accepted.pop(sock)) {
+            connection* c = new connection();
+            redisstats::add(redisstats::CONNECTIONS);
+            c->id = ++s.nextConnId;
+            c->sock = sock;
+            s.conns[c->id] = c;
+            s.poller.add(sock, c, redispoller::READABLE);
+        }
+
+        serviceLinks(s);
+        std::vector<connection*> resume;
+        resume.swap(s.resumable);
+        for (connection* c : resume)
+            dispatch(s, c);
+        drainPushed(s);
+        sendBatches(s);
+
+        for (size_t i = 0; i < s.dirty.size(); ++i) {
+            connection* c = s.dirty[i];
+            c->isDirty = false;
+            if (!c->closing)
+                flushConnection(s, c);
+        }
+        s.dirty.clear();
+        for (connection* c : s.graveyard)
+            delete c;
+        s.graveyard.clear();
+    }
+    rediscommandhandler::bindDatabase(nullptr);
+}
+
+bool redisshards::hasWork(shard& s) {
+    if (!s.accepted.empty() || !s.resumable.empty())
+        return true;
+    for (size_t other = 0; other < shards.size(); ++other) {
+        if (other == s.index)
+            continue;
+        if (!s.outbox[other].empty() || !s.replyBox[other].empty())
+            return true;
+        if (!linkFor(other, s.index).requests.empty() || !linkFor(s.index, other).replies.empty())
+            return true;
+    }
+    std::lock_guard<std::mutex> lock(s.readyMutex);
+    return !s.ready.empty();
+}
+
+void redisshards::readConnection(shard& s, connection* c) {
+    char buffer[16384];
+    while (true) {
+        int n = recv(c->sock, buffer, sizeof(buffer), 0);
+        s.stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n > 0) {
+            c->in.append(buffer, n);
+            if (n < static_cast<int>(sizeof(buffer)))
+                break;
+            continue;
+        }
+        if (n < 0 && redisnet::wouldBlock())
+            break;
+        closeConnection(s, c);
+        return;
+    }
+    if (!c->stalled)
+        dispatch(s, c);
+}
+
+void redisshards::dispatch(shard& s, connection* c) {
+    if (c->closing)
+        return;
+    if (c->hasHeld) {
+        if (!route(s, c, c->held))
+            return;
+        c->hasHeld = false;
+        c->held.clear();
+    }
+    size_t pos = 0, len;
+    while ((len = rediscommandhandler::frameLength(c->in, pos)) > 0) {
+        std::vector<std::string> tokens = rediscommandhandler::parseCommand(c->in.substr(pos, len));
+        pos += len;
+        if (!route(s, c, tokens)) {
+            c->held = std::move(tokens);
+            c->hasHeld = true;
+            break;
+        }
+    }
+    c->in.erase(0, pos);
+}
+
+// Decides where a command runs. Returns false, leaving tokens untouched,
+// when it has to wait for this connection's commands on another shard.
+bool redisshards::route(shard& s, connection* c, std::vector<std::string>& tokens) {
+    enum { LOCAL, FORWARD, COORDINATE } kind = LOCAL;
+    size_t target = s.index;
+    std::string cmd = tokens.empty() ? std::string() : upper(tokens[0]);
+    std::string refused;
+    std::vector<std::string> keys;
+
+    if (cmd == "WATCH") {
+        refused = "-Error: WATCH is not supported in shard mode\r\n";
+    }
+    else if (cmd == "CLIENT" && tokens.size() > 1 && upper(tokens[1]) == "TRACKING") {
+        refused = "-Error: CLIENT TRACKING is not supported in shard mode\r\n";
+    }
+    else if ((c->client.inMulti && cmd != "EXEC") || c->client.subscriptions() > 0) {
+        // Queued on this connection (keys are routed at EXEC), or refused
+        // by the subscribed context
+    }
+    else if (cmd == "EXEC" || cmd == "KEYS" || cmd == "FLUSHALL") {
+        kind = COORDINATE;
+        if (cmd == "EXEC") {
+            for (const auto& queued : c->client.queued)
+                rediscommandhandler::keysOf(queued, keys);
+        }
+    }
+    else if (rediscommandhandler::keysOf(tokens, keys) && !keys.empty()) {
+        target = ownerOf(keys[0]);
+        for (size_t i = 1; i < keys.size() && kind == LOCAL; ++i) {
+            if (ownerOf(keys[i]) != target)
+                kind = COORDINATE;
+        }
+        if (kind == LOCAL && target != s.index)
+            kind = FORWARD;
+    }
+
+    // Commands of one connection run in order: only more commands for the
+    // same shard may join those already in flight.
+    if (c->outstanding > 0 && !(kind == FORWARD && target == c->target)) {
+        if (!c->stalled)
+            s.stats.stalls.fetch_add(1, std::memory_order_relaxed);
+        c->stalled = true;
+        return false;
+    }
+
+    s.stats.commands.fetch_add(1, std::memory_order_relaxed);
+    uint64_t seq = c->baseSeq + c->slots.size();
+    c->slots.emplace_back();
+    if (kind == FORWARD) {
+        envelope e;
+        e.conn = c->id;
+        e.seq = seq;
+        e.tokens = std::move(tokens);
+        s.outbox[target].push_back(std::move(e));
+        c->outstanding++;
+        c->target = target;
+        s.stats.forwarded.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    std::string reply;
+    if (!refused.empty()) {
+        reply = refused;
+    }
+    else if (kind == COORDINATE) {
+        reply = coordinate(s, c, tokens, keys, cmd);
+        s.stats.coordinated.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        reply = cmdHandler.processCommand(tokens, c->client);
+    }
+    complete(s, c, seq, std::move(reply));
+    return true;
+}
+
+// Cross-Shard Commands
+// Runs on the connection's shard with the other shards' databases locked,
+// lowest index first so two coordinators cannot deadlock. Owner threads
+// only ever lock their own database, one command at a time.
+std::string redisshards::coordinate(shard& s, connection* c, std::vector<std::string>& tokens,
+    const std::vector<std::string>& keys, const std::string& cmd) {
+    if (cmd == "KEYS" || cmd == "FLUSHALL") {
+        std::string body, first;
+        long long total = 0;
+        for (auto& other : shards) {
+            std::vector<std::string> copy = tokens;
+            rediscommandhandler::bindDatabase(other->db);
+            std::string part = cmdHandler.processCommand(copy, c->client);
+            if (first.empty())
+                first = part;
+            size_t eol = part.find("\r\n");
+            if (cmd == "KEYS" && !part.empty() && part[0] == '*' && eol != std::string::npos) {
+                total += std::atoll(part.c_str() + 1);
+                body.append(part, eol + 2, std::string::npos);
+            }
+        }
+        rediscommandhandler::bindDatabase(s.db);
+        if (cmd == "KEYS" && !first.empty() && first[0] == '*')
+            return "*" + std::to_string(total) + "\r\n" + body;
+        return first;
+    }
+
+    if (cmd == "EXEC") {
+        for (const auto& queued : c->client.queued) {
+            std::string name = queued.empty() ? std::string() : upper(queued[0]);
+            if (name == "KEYS" || name == "FLUSHALL") {
+                std::vector<std::string> discard = { "DISCARD" };
+                cmdHandler.processCommand(discard, c->client);
+                return "-Error: " + name + " cannot run inside MULTI in shard mode\r\n";
+            }
+        }
+    }
+
+    if (keys.empty())
+        return cmdHandler.processCommand(tokens, c->client);
+    size_t exec = ownerOf(keys[0]);
+    std::vector<std::string> names = keys;
+    std::sort(names.begin(), names.end());
+    names.erase(std::unique(names.begin(), names.end()), names.end());
+    std::vector<size_t> owners;
+    for (const auto& key : names)
+        owners.push_back(ownerOf(key));
+    std::sort(owners.begin(), owners.end());
+    owners.erase(std::unique(owners.begin(), owners.end()), owners.end());
+
+    std::vector<std::unique_lock<std::recursive_mutex>> locks;
+    for (size_t o : owners)
+        locks.push_back(shards[o]->db->acquire());
+    redisdatabase& home = *shards[exec]->db;
+    for (const auto& key : names) {
+        size_t owner = ownerOf(key);
+        if (owner != exec)
+            shards[owner]->db->moveKeyTo(key, home);
+    }
+    rediscommandhandler::bindDatabase(&home);
+    std::string reply = cmdHandler.processCommand(tokens, c->client);
+    rediscommandhandler::bindDatabase(s.db);
+    for (const auto& key : names) {
+        size_t owner = ownerOf(key);
+        if (owner != exec)
+            home.moveKeyTo(key, *shards[owner]->db);
+    }
+    return reply;
+}
+
+void redisshards::complete(shard& s, connection* c, uint64_t seq, std::string&& reply) {
+    connection::slot& slot = c->slots[seq - c->baseSeq];
+    slot.ready = true;
+    slot.data = std::move(reply);
+    while (!c->slots.empty() && c->slots.front().ready) {
+        emit(s, c, std::move(c->slots.front().data));
+        c->slots.pop_front();
+        c->baseSeq++;
+    }
+}
+
+void redisshards::emit(shard& s, connection* c, std::string&& data) {
+    if (c->client.output) {
+        // Pushed messages share the output queue so replies stay ordered
+        if (!c->hooked) {
+            c->hooked = true;
+            shard* owner = &s;
+            uint64_t id = c->id;
+            std::weak_ptr<redisoutput> weak = c->client.output;
+            auto notify = [owner, id, weak]() {
+                {
+                    std::lock_guard<std::mutex> lock(owner->readyMutex);
+                    owner->ready.emplace_back(id, weak);
+                }
+                owner->wakeup.signal();
+            };
+            c->client.output->setNotify(notify);
+            notify();
+        }
+        c->client.output->push(std::make_shared<const std::string>(std::move(data)));
+        return;
+    }
+    c->out += data;
+    if (!c->isDirty) {
+        c->isDirty = true;
+        s.dirty.push_back(c);
+    }
+}
+
+// Shard Links
+void redisshards::serviceLinks(shard& s) {
+    batch b;
+    for (size_t other = 0; other < shards.size(); ++other) {
+        if (other == s.index)
+            continue;
+        // Commands other shards forwarded here
+        link& in = linkFor(other, s.index);
+        while (in.requests.pop(b)) {
+            for (auto& e : b)
+                e.reply = cmdHandler.processCommand(e.tokens, forwardedClient);
+            std::vector<envelope>& pending = s.replyBox[other];
+            if (pending.empty() && in.replies.push(std::move(b))) {
+                signal(*shards[other]);
+            }
+            else {
+                for (auto& e : b)
+                    pending.push_back(std::move(e));
+            }
+            b.clear();
+        }
+
+        // Replies to what this shard forwarded
+        link& out = linkFor(s.index, other);
+        while (out.replies.pop(b)) {
+            for (auto& e : b) {
+                auto it = s.conns.find(e.conn);
+                if (it == s.conns.end() || it->second->closing)
+                    continue;
+                connection* c = it->second;
+                c->outstanding--;
+                complete(s, c, e.seq, std::move(e.reply));
+                if (c->outstanding == 0 && c->stalled) {
+                    c->stalled = false;
+                    s.resumable.push_back(c);
+                }
+            }
+            b.clear();
+        }
+    }
+}
+
+void redisshards::sendBatches(shard& s) {
+    for (size_t other = 0; other < shards.size(); ++other) {
+        if (other == s.index)
+            continue;
+        batch& replies = s.replyBox[other];
+        if (!replies.empty() && linkFor(other, s.index).replies.push(std::move(replies))) {
+            replies.clear();
+            signal(*shards[other]);
+        }
+        batch& requests = s.outbox[other];
+        if (!requests.empty() && linkFor(s.index, other).requests.push(std::move(requests))) {
+            requests.clear();
+            s.stats.batches.fetch_add(1, std::memory_order_relaxed);
+            signal(*shards[other]);
+        }
+    }
+}
+
+void redisshards::drainPushed(shard& s) {
+    std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> ready;
+    {
+        std::lock_guard<std::mutex> lock(s.readyMutex);
+        ready.swap(s.ready);
+    }
+    std::vector<redisoutput::buffer> pushed;
+    for (const auto& entry : ready) {
+        auto it = s.conns.find(entry.first);
+        std::shared_ptr<redisoutput> output = entry.second.lock();
+        if (it == s.conns.end() || it->second->closing || !output)
+            continue;
+        connection* c = it->second;
+        if (output->overflowed()) {
+            closeConnection(s, c);
+            continue;
+        }
+        pushed.clear();
+        if (!output->tryTake(pushed))
+            continue;
+        for (const auto& b : pushed)
+            c->out += *b;
+        if (!c->isDirty) {
+            c->isDirty = true;
+            s.dirty.push_back(c);
+        }
+    }
+}
+
+void redisshards::flushConnection(shard& s, connection* c) {
+    while (c->outPos < c->out.size()) {
+        int n = send(c->sock, c->out.data() + c->outPos, static_cast<int>(c->out.size() - c->outPos),
+            redisnet::SEND_FLAGS);
+        s.stats.syscalls.fetch_add(1, std::memory_order_relaxed);
+        if (n > 0) {
+            c->outPos += n;
+            continue;
+        }
+        if (n < 0 && redisnet::wouldBlock())
+            break;
+        closeConnection(s, c);
+        return;
+    }
+    if (c->outPos == c->out.size()) {
+        c->out.clear();
+        c->outPos = 0;
+    }
+    bool wantWrite = !c->out.empty();
+    if (wantWrite != c->wantWrite) {
+        c->wantWrite = wantWrite;
+        s.poller.modify(c->sock, c, redispoller::READABLE | (wantWrite ? redispoller::WRITABLE : 0));
+    }
+}
+
+// Replies still in flight for a closed connection are dropped when they
+// arrive; the connection is freed at the end of the loop pass.
+void redisshards::closeConnection(shard& s, connection* c) {
+    if (c->closing)
+        return;
+    c->closing = true;
+    s.poller.remove(c->sock);
+    if (c->client.output)
+        c->client.output->setNotify(nullptr);
+    cmdHandler.closeClient(c->client);
+    redisstats::add(redisstats::DISCONNECTIONS);
+    closesocket(c->sock);
+    s.conns.erase(c->id);
+    s.graveyard.push_back(c);
+}
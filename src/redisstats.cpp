@@ -0,0 +1,395 @@
+#include <string>
+#include <vector>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include <algorithm>
+#include <fstream>
+#include <cctype>
+#include "../include/redisstats.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#pragma comment(lib, "psapi.lib")
+#else
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+namespace redisstats {
+
+static const int MAX_COMMANDS = 256;
+
+// Per-thread Counters
+struct alignas(64) threadblock {
+    std::atomic<uint64_t> counters[COUNTER_COUNT];
+    std::atomic<uint64_t> calls[MAX_COMMANDS];
+    std::atomic<uint64_t> usec[MAX_COMMANDS];
+    std::atomic<uint64_t> failed[MAX_COMMANDS];
+    // Too big to keep in atomics; the lock is only ever contended by a
+    // reader merging the blocks
+    std::mutex coldMutex;
+    latencyhistogram coldReads;
+};
+
+// Only the owning thread writes a block, so a relaxed load and store is
+// enough and avoids a locked read-modify-write per counter.
+static inline void bump(std::atomic<uint64_t>& c, uint64_t n) {
+    c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+}
+
+static inline uint64_t read(const std::atomic<uint64_t>& c) {
+    return c.load(std::memory_order_relaxed);
+}
+
+struct blockregistry {
+    std::mutex mutex;
+    std::vector<threadblock*> live;
+    threadblock retired; // totals of threads that have exited
+};
+
+// Never destroyed: threads still running at exit may retire into it.
+static blockregistry& blocks() {
+    static blockregistry* r = new blockregistry();
+    return *r;
+}
+
+static void fold(threadblock& into, threadblock& from) {
+    for (int i = 0; i < COUNTER_COUNT; ++i)
+        bump(into.counters[i], read(from.counters[i]));
+    for (int i = 0; i < MAX_COMMANDS; ++i) {
+        bump(into.calls[i], read(from.calls[i]));
+        bump(into.usec[i], read(from.usec[i]));
+        bump(into.failed[i], read(from.failed[i]));
+    }
+    std::lock_guard<std::mutex> lock(from.coldMutex);
+    into.coldReads.merge(from.coldReads);
+}
+
+struct threadslot {
+    threadblock* block = nullptr;
+    ~threadslot() {
+        if (!block)
+            return;
+        blockregistry& r = blocks();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        fold(r.retired, *block);
+        r.live.erase(std::find(r.live.begin(), r.live.end(), block));
+        delete block;
+    }
+};
+
+static thread_local threadslot local;
+
+static threadblock& mine() {
+    if (!local.block) {
+        local.block = new threadblock();
+        blockregistry& r = blocks();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        r.live.push_back(local.block);
+    }
+    return *local.block;
+}
+
+void add(counter c, uint64_t n) {
+    bump(mine().counters[c], n);
+}
+
+uint64_t total(counter c) {
+    blockregistry& r = blocks();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    uint64_t sum = read(r.retired.counters[c]);
+    for (threadblock* b : r.live)
+        sum += read(b->counters[c]);
+    return sum;
+}
+
+// Command Statistics
+static std::mutex namesMutex;
+static std::vector<std::string> slotNames;
+static std::unordered_map<std::string, int> slotIndex; // upper-case name -> slot
+
+int registerCommand(const std::string& name) {
+    std::lock_guard<std::mutex> lock(namesMutex);
+    auto it = slotIndex.find(name);
+    if (it != slotIndex.end())
+        return it->second;
+    if (slotNames.size() >= static_cast<size_t>(MAX_COMMANDS))
+        return -1;
+    std::string lower = name;
+    std::transform(lower.begin(), lower.end(), lower.begin(), ::tolower);
+    slotNames.push_back(lower);
+    int slot = static_cast<int>(slotNames.size()) - 1;
+    slotIndex[name] = slot;
+    return slot;
+}
+
+int commandSlot(const std::string& name) {
+    auto it = slotIndex.find(name);
+    return it == slotIndex.end() ? -1 : it->second;
+}
+
+std::vector<commandstat> commandStats() {
+    std::vector<std::string> names;
+    {
+        std::lock_guard<std::mutex> lock(namesMutex);
+        names = slotNames;
+    }
+    std::vector<commandstat> out(names.size());
+    {
+        blockregistry& r = blocks();
+        std::lock_guard<std::mutex> lock(r.mutex);
+        std::vector<const threadblock*> all(r.live.begin(), r.live.end());
+        all.push_back(&r.retired);
+        for (const threadblock* b : all) {
+            for (size_t i = 0; i < out.size(); ++i) {
+                out[i].calls += read(b->calls[i]);
+                out[i].usec += read(b->usec[i]);
+                out[i].failed += read(b->failed[i]);
+            }
+        }
+    }
+    std::vector<commandstat> used;
+    for (size_t i = 0; i < out.size(); ++i) {
+        if (out[i].calls == 0)
+            continue;
+        out[i].name = names[i];
+        used.push_back(std::move(out[i]));
+    }
+    std::sort(used.begin(), used.end(), [](const commandstat& a, const commandstat& b) { return a.name < b.name; });
+    return used;
+}
+
+static int64_t unixNow() {
+    return std::chrono::duration_cast<std::chrono::seconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+// Slow Log
+static const size_t SLOWLOG_MAX_ARGS = 32;
+static const size_t SLOWLOG_MAX_ARG_LEN = 128;
+
+static std::atomic<int64_t> slowThreshold{ 10000 };
+static std::atomic<size_t> slowMaxLen{ 128 };
+static std::mutex slowMutex;
+static std::deque<slowentry> slowEntries; // newest first
+static uint64_t slowNextId = 0;
+
+static void logSlow(const std::vector<std::string>& tokens, uint64_t usec) {
+    slowentry e;
+    e.time = unixNow();
+    e.usec = usec;
+    size_t argc = std::min<size_t>(tokens.size(), SLOWLOG_MAX_ARGS);
+    for (size_t i = 0; i < argc; ++i) {
+        if (argc < tokens.size() && i == argc - 1) {
+            e.args.push_back("... (" + std::to_string(tokens.size() - argc + 1) + " more arguments)");
+            break;
+        }
+        const std::string& t = tokens[i];
+        if (t.size() > SLOWLOG_MAX_ARG_LEN)
+            e.args.push_back(t.substr(0, SLOWLOG_MAX_ARG_LEN) + "... (" +
+                std::to_string(t.size() - SLOWLOG_MAX_ARG_LEN) + " more bytes)");
+        else
+            e.args.push_back(t);
+    }
+    std::lock_guard<std::mutex> lock(slowMutex);
+    e.id = slowNextId++;
+    slowEntries.push_front(std::move(e));
+    while (slowEntries.size() > slowMaxLen.load(std::memory_order_relaxed))
+        slowEntries.pop_back();
+}
+
+void setSlowlogThreshold(int64_t usec) { slowThreshold = usec; }
+int64_t slowlogThreshold() { return slowThreshold; }
+
+void setSlowlogMaxLen(size_t n) {
+    slowMaxLen = n;
+    std::lock_guard<std::mutex> lock(slowMutex);
+    while (slowEntries.size() > n)
+        slowEntries.pop_back();
+}
+
+size_t slowlogMaxLen() { return slowMaxLen; }
+
+std::vector<slowentry> slowlog(int64_t count) {
+    std::lock_guard<std::mutex> lock(slowMutex);
+    size_t n = count < 0 ? slowEntries.size() : std::min<size_t>(slowEntries.size(), static_cast<size_t>(count));
+    return std::vector<slowentry>(slowEntries.begin(), slowEntries.begin() + n);
+}
+
+size_t slowlogLen() {
+    std::lock_guard<std::mutex> lock(slowMutex);
+    return slowEntries.size();
+}
+
+void slowlogReset() {
+    std::lock_guard<std::mutex> lock(slowMutex);
+    slowEntries.clear();
+}
+
+// Latency Monitor
+static const size_t LATENCY_HISTORY = 160;
+
+static std::atomic<uint64_t> latencyMs{ 0 };
+static std::mutex latencyMutex;
+static std::map<std::string, latencyevent> latencyLog;
+
+void setLatencyThreshold(uint64_t ms) { latencyMs = ms; }
+uint64_t latencyThreshold() { return latencyMs; }
+
+void latencySample(const char* event, uint64_t ms) {
+    uint64_t threshold = latencyMs.load(std::memory_order_relaxed);
+    if (threshold == 0 || ms < threshold)
+        return;
+    int64_t now = unixNow();
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    latencyevent& e = latencyLog[event];
+    e.name = event;
+    e.latestTime = now;
+    e.latestMs = ms;
+    e.maxMs = std::max<uint64_t>(e.maxMs, ms);
+    // Samples in the same second are merged, keeping the worst
+    if (!e.history.empty() && e.history.back().first == now)
+        e.history.back().second = std::max<uint64_t>(e.history.back().second, ms);
+    else
+        e.history.emplace_back(now, ms);
+    if (e.history.size() > LATENCY_HISTORY)
+        e.history.erase(e.history.begin());
+}
+
+std::vector<latencyevent> latencyEvents() {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    std::vector<latencyevent> out;
+    for (const auto& e : latencyLog)
+        out.push_back(e.second);
+    return out;
+}
+
+size_t latencyReset(const std::vector<std::string>& names) {
+    std::lock_guard<std::mutex> lock(latencyMutex);
+    if (names.empty()) {
+        size_t n = latencyLog.size();
+        latencyLog.clear();
+        return n;
+    }
+    size_t n = 0;
+    for (const auto& name : names)
+        n += latencyLog.erase(name);
+    return n;
+}
+
+void commandDone(int slot, const std::vector<std::string>& tokens,
+    std::chrono::steady_clock::time_point start, bool failed, bool write) {
+    uint64_t usec = static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::microseconds>(
+        std::chrono::steady_clock::now() - start).count());
+    threadblock& b = mine();
+    if (slot >= 0 && slot < MAX_COMMANDS) {
+        bump(b.calls[slot], 1);
+        bump(b.usec[slot], usec);
+        if (failed)
+            bump(b.failed[slot], 1);
+    }
+    bump(b.counters[COMMANDS], 1);
+    if (failed)
+        bump(b.counters[ERROR_REPLIES], 1);
+    else if (write)
+        bump(b.counters[WRITES], 1);
+
+    int64_t threshold = slowThreshold.load(std::memory_order_relaxed);
+    if (threshold >= 0 && static_cast<int64_t>(usec) >= threshold)
+        logSlow(tokens, usec);
+    latencySample("command", usec / 1000);
+}
+
+// Server
+static std::atomic<int> serverPort{ 0 };
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+void setPort(int p) { serverPort = p; }
+int port() { return serverPort; }
+
+int processId() {
+#ifdef _WIN32
+    return static_cast<int>(GetCurrentProcessId());
+#else
+    return static_cast<int>(getpid());
+#endif
+}
+
+int64_t uptimeSeconds() {
+    return std::chrono::duration_cast<std::chrono::seconds>(std::chrono::steady_clock::now() - startTime).count();
+}
+
+// Persistence
+static std::mutex saveMutex;
+static persistence saveStats;
+static uint64_t writesAtSave = 0;
+
+void recordSave(bool ok, uint64_t ms) {
+    uint64_t writes = total(WRITES);
+    std::lock_guard<std::mutex> lock(saveMutex);
+    saveStats.lastSaveOk = ok;
+    saveStats.lastSaveMs = ms;
+    if (ok) {
+        saveStats.saves++;
+        saveStats.lastSaveTime = unixNow();
+        writesAtSave = writes;
+    }
+    else {
+        saveStats.failedSaves++;
+    }
+}
+
+persistence persistenceStats() {
+    uint64_t writes = total(WRITES);
+    std::lock_guard<std::mutex> lock(saveMutex);
+    persistence p = saveStats;
+    p.changesSinceSave = writes - std::min<uint64_t>(writes, writesAtSave);
+    return p;
+}
+
+// Tiered Storage
+void coldRead(uint64_t ns) {
+    threadblock& b = mine();
+    {
+        std::lock_guard<std::mutex> lock(b.coldMutex);
+        b.coldReads.record(ns);
+    }
+    latencySample("cold-read", ns / 1000000);
+}
+
+latencyhistogram coldReadLatency() {
+    blockregistry& r = blocks();
+    std::lock_guard<std::mutex> lock(r.mutex);
+    latencyhistogram h = r.retired.coldReads;
+    for (threadblock* b : r.live) {
+        std::lock_guard<std::mutex> blockLock(b->coldMutex);
+        h.merge(b->coldReads);
+    }
+    return h;
+}
+
+void memoryUsage(uint64_t& rss, uint64_t& peakRss) {
+    rss = peakRss = 0;
+#ifdef _WIN32
+    PROCESS_MEMORY_COUNTERS pmc;
+    if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+        rss = pmc.WorkingSetSize;
+        peakRss = pmc.PeakWorkingSetSize;
+    }
+#else
+    std::ifstream statm("/proc/self/statm");
+    uint64_t pages = 0, resident = 0;
+    if (statm >> pages >> resident)
+        rss = resident * static_cast<uint64_t>(sysconf(_SC_PAGESIZE));
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) == 0)
+        peakRss = static_cast<uint64_t>(usage.ru_maxrss) * 1024; // kilobytes on Linux
+    peakRss = std::max<uint64_t>(peakRss, rss);
+#endif
+}
+
+}
@@ -0,0 +1,466 @@
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <algorithm>
+#include "../include/redisstream.h"
+#include "../include/redisserialize.h"
+
+static int64_t nowMs() {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static bool parseUint64(const std::string& s, uint64_t& v) {
+    if (s.empty() || s.size() > 20)
+        return false;
+    for (char c : s) {
+        if (c < '0' || c > '9')
+            return false;
+    }
+    try {
+        v = std::stoull(s);
+    }
+    catch (const std::exception&) {
+        return false;
+    }
+    return true;
+}
+
+static bool incrId(streamid& id) {
+    if (id.seq == UINT64_MAX) {
+        if (id.ms == UINT64_MAX)
+            return false;
+        id.ms++;
+        id.seq = 0;
+    }
+    else {
+        id.seq++;
+    }
+    return true;
+}
+
+static bool decrId(streamid& id) {
+    if (id.seq == 0) {
+        if (id.ms == 0)
+            return false;
+        id.ms--;
+        id.seq = UINT64_MAX;
+    }
+    else {
+        id.seq--;
+    }
+    return true;
+}
+
+std::string streamid::toString() const {
+    return std::to_string(ms) + "-" + std::to_string(seq);
+}
+
+bool streamid::parse(const std::string& s, streamid& id, uint64_t missingSeq) {
+    auto dash = s.find('-');
+    if (dash == std::string::npos) {
+        id.seq = missingSeq;
+        return parseUint64(s, id.ms);
+    }
+    return parseUint64(s.substr(0, dash), id.ms) && parseUint64(s.substr(dash + 1), id.seq);
+}
+
+bool streamid::parseRange(const std::string& s, bool isStart, streamid& id) {
+    if (s == "-") {
+        id = streamid::min();
+        return true;
+    }
+    if (s == "+") {
+        id = streamid::max();
+        return true;
+    }
+    bool exclusive = !s.empty() && s[0] == '(';
+    if (!parse(exclusive ? s.substr(1) : s, id, isStart ? 0 : UINT64_MAX))
+        return false;
+    if (exclusive)
+        return isStart ? incrId(id) : decrId(id);
+    return true;
+}
+
+void redisstream::append(const streamid& id, const fieldlist& fields) {
+    if (blocks.empty() || blocks.rbegin()->second.ids.size() >= BLOCK_MAX_ENTRIES ||
+        blocks.rbegin()->second.data.size() >= BLOCK_MAX_BYTES)
+        blocks.emplace(id, block());
+
+    block& b = blocks.rbegin()->second;
+    b.ids.push_back(id);
+    b.offsets.push_back(static_cast<uint32_t>(b.data.size()));
+    putVarint(b.data, fields.size());
+    for (const auto& fv : fields) {
+        putString(b.data, fv.first);
+        putString(b.data, fv.second);
+    }
+    entries++;
+    last_id = id;
+}
+
+void redisstream::decode(const block& b, size_t i, entry& out) {
+    out.id = b.ids[i];
+    out.fields.clear();
+    out.deleted = false;
+    size_t pos = b.offsets[i];
+    uint64_t n = 0;
+    getVarint(b.data, pos, n);
+    out.fields.resize(n);
+    for (auto& fv : out.fields) {
+        getString(b.data, pos, fv.first);
+        getString(b.data, pos, fv.second);
+    }
+}
+
+bool redisstream::lookup(const streamid& id, entry& out) const {
+    auto it = blocks.upper_bound(id);
+    if (it == blocks.begin())
+        return false;
+    --it;
+    const block& b = it->second;
+    auto pos = std::lower_bound(b.ids.begin() + b.head, b.ids.end(), id);
+    if (pos == b.ids.end() || *pos != id)
+        return false;
+    decode(b, pos - b.ids.begin(), out);
+    return true;
+}
+
+bool redisstream::add(const std::string& idSpec, const fieldlist& fields, streamid& added, std::string& err) {
+    streamid id;
+    if (idSpec == "*") {
+        uint64_t now = static_cast<uint64_t>(nowMs());
+        if (now > last_id.ms) {
+            id = streamid{ now, 0 };
+        }
+        else {
+            id = last_id;
+            if (!incrId(id)) {
+                err = "The stream has exhausted the last possible ID, unable to add more items";
+                return false;
+            }
+        }
+    }
+    else if (idSpec.size() > 2 && idSpec.compare(idSpec.size() - 2, 2, "-*") == 0) {
+        if (!parseUint64(idSpec.substr(0, idSpec.size() - 2), id.ms)) {
+            err = "Invalid stream ID specified as stream command argument";
+            return false;
+        }
+        if (id.ms == last_id.ms) {
+            if (last_id.seq == UINT64_MAX) {
+                err = "The ID specified in XADD is equal or smaller than the target stream top item";
+                return false;
+            }
+            id.seq = last_id.seq + 1;
+        }
+    }
+    else if (!streamid::parse(idSpec, id, 0)) {
+        err = "Invalid stream ID specified as stream command argument";
+        return false;
+    }
+
+    if (id == streamid::min()) {
+        err = "The ID specified in XADD must be greater than 0-0";
+        return false;
+    }
+    if (id <= last_id) {
+        err = "The ID specified in XADD is equal or smaller than the target stream top item";
+        return false;
+    }
+
+    append(id, fields);
+    added = id;
+    return true;
+}
+
+size_t redisstream::trim(size_t maxlen, bool approx) {
+    size_t removed = 0;
+    while (entries > maxlen && !blocks.empty()) {
+        block& b = blocks.begin()->second;
+        size_t live = b.ids.size() - b.head;
+        if (entries - live >= maxlen) {
+            entries -= live;
+            removed += live;
+            blocks.erase(blocks.begin());
+            continue;
+        }
+        // With "~" only whole blocks are dropped
+        if (approx)
+            break;
+        size_t n = entries - maxlen;
+        b.head += n;
+        entries -= n;
+        removed += n;
+    }
+    return removed;
+}
+
+std::vector<redisstream::entry> redisstream::range(const streamid& start, const streamid& end, size_t count, bool reverse) const {
+    std::vector<entry> result;
+    if (end < start || blocks.empty())
+        return result;
+
+    if (!reverse) {
+        auto it = blocks.upper_bound(start);
+        if (it != blocks.begin())
+            --it;
+        for (; it != blocks.end(); ++it) {
+            const block& b = it->second;
+            size_t i = std::lower_bound(b.ids.begin() + b.head, b.ids.end(), start) - b.ids.begin();
+            for (; i < b.ids.size(); ++i) {
+                if (b.ids[i] > end)
+                    return result;
+                result.emplace_back();
+                decode(b, i, result.back());
+                if (count && result.size() >= count)
+                    return result;
+            }
+        }
+        return result;
+    }
+
+    auto it = blocks.upper_bound(end);
+    while (it != blocks.begin()) {
+        --it;
+        const block& b = it->second;
+        size_t i = std::upper_bound(b.ids.begin() + b.head, b.ids.end(), end) - b.ids.begin();
+        for (; i > b.head; --i) {
+            if (b.ids[i - 1] < start)
+                return result;
+            result.emplace_back();
+            decode(b, i - 1, result.back());
+            if (count && result.size() >= count)
+                return result;
+        }
+    }
+    return result;
+}
+
+bool redisstream::createGroup(const std::string& name, const streamid& start) {
+    if (groups.count(name))
+        return false;
+    groups[name].lastDelivered = start;
+    return true;
+}
+
+bool redisstream::destroyGroup(const std::string& name) {
+    return groups.erase(name) > 0;
+}
+
+bool redisstream::readGroup(const std::string& groupName, const std::string& consumer, const std::string& startId,
+    size_t count, bool noack, std::vector<entry>& out, std::string& err) {
+    auto git = groups.find(groupName);
+    if (git == groups.end()) {
+        err = "NOGROUP No such consumer group '" + groupName + "' for the key";
+        return false;
+    }
+    group& g = git->second;
+    int64_t now = nowMs();
+    g.consumers[consumer] = now;
+
+    if (startId == ">") {
+        streamid from = g.lastDelivered;
+        if (!incrId(from))
+            return true;
+        out = range(from, streamid::max(), count, false);
+        for (const auto& e : out) {
+            g.lastDelivered = e.id;
+            if (noack)
+                continue;
+            pendingentry& p = g.pel[e.id];
+            p.consumer = consumer;
+            p.deliveryTime = now;
+            p.deliveryCount = 1;
+        }
+        return true;
+    }
+
+    streamid after;
+    if (!streamid::parse(startId, after, 0)) {
+        err = "Invalid stream ID specified as stream command argument";
+        return false;
+    }
+    // Replay this consumer's history: pending entries strictly after the ID
+    for (auto it = g.pel.upper_bound(after); it != g.pel.end(); ++it) {
+        if (it->second.consumer != consumer)
+            continue;
+        entry e;
+        if (!lookup(it->first, e)) {
+            e.id = it->first;
+            e.deleted = true;
+        }
+        it->second.deliveryTime = now;
+        it->second.deliveryCount++;
+        out.push_back(std::move(e));
+        if (count && out.size() >= count)
+            break;
+    }
+    return true;
+}
+
+size_t redisstream::ack(const std::string& groupName, const std::vector<streamid>& ids) {
+    auto git = groups.find(groupName);
+    if (git == groups.end())
+        return 0;
+    size_t acked = 0;
+    for (const auto& id : ids)
+        acked += git->second.pel.erase(id);
+    return acked;
+}
+
+bool redisstream::pending(const std::string& groupName, pendingsummary& summary) const {
+    auto git = groups.find(groupName);
+    if (git == groups.end())
+        return false;
+    const group& g = git->second;
+    summary.count = g.pel.size();
+    if (g.pel.empty())
+        return true;
+    summary.smallest = g.pel.begin()->first;
+    summary.greatest = g.pel.rbegin()->first;
+    std::map<std::string, size_t> perConsumer;
+    for (const auto& p : g.pel)
+        perConsumer[p.second.consumer]++;
+    summary.consumers.assign(perConsumer.begin(), perConsumer.end());
+    return true;
+}
+
+bool redisstream::pending(const std::string& groupName, const streamid& start, const streamid& end, size_t count,
+    const std::string& consumer, std::vector<pendingdetail>& out) const {
+    auto git = groups.find(groupName);
+    if (git == groups.end())
+        return false;
+    int64_t now = nowMs();
+    const group& g = git->second;
+    for (auto it = g.pel.lower_bound(start); it != g.pel.end() && it->first <= end; ++it) {
+        if (count && out.size() >= count)
+            break;
+        if (!consumer.empty() && it->second.consumer != consumer)
+            continue;
+        pendingdetail d;
+        d.id = it->first;
+        d.consumer = it->second.consumer;
+        d.idle = now - it->second.deliveryTime;
+        d.deliveryCount = it->second.deliveryCount;
+        out.push_back(d);
+    }
+    return true;
+}
+
+size_t redisstream::memoryUsage() const {
+    // A std::map node is the value plus three links and a color word
+    const size_t NODE = 4 * sizeof(void*);
+    size_t bytes = sizeof(*this);
+    for (const auto& b : blocks) {
+        bytes += sizeof(b) + NODE;
+        bytes += b.second.ids.capacity() * sizeof(streamid) + b.second.offsets.capacity() * sizeof(uint32_t);
+        bytes += b.second.data.capacity();
+    }
+    for (const auto& g : groups) {
+        bytes += sizeof(g) + NODE + g.first.capacity();
+        for (const auto& p : g.second.pel)
+            bytes += sizeof(p) + NODE + p.second.consumer.capacity();
+        for (const auto& c : g.second.consumers)
+            bytes += sizeof(c) + NODE + c.first.capacity();
+    }
+    return bytes;
+}
+
+void redisstream::serialize(std::string& out) const {
+    putVarint(out, last_id.ms);
+    putVarint(out, last_id.seq);
+    putVarint(out, entries);
+    entry e;
+    for (const auto& kv : blocks) {
+        const block& b = kv.second;
+        for (size_t i = b.head; i < b.ids.size(); ++i) {
+            decode(b, i, e);
+            putVarint(out, e.id.ms);
+            putVarint(out, e.id.seq);
+            putVarint(out, e.fields.size());
+            for (const auto& fv : e.fields) {
+                putString(out, fv.first);
+                putString(out, fv.second);
+            }
+        }
+    }
+
+    putVarint(out, groups.size());
+    for (const auto& gkv : groups) {
+        const group& g = gkv.second;
+        putString(out, gkv.first);
+        putVarint(out, g.lastDelivered.ms);
+        putVarint(out, g.lastDelivered.seq);
+        putVarint(out, g.pel.size());
+        for (const auto& p : g.pel) {
+            putVarint(out, p.first.ms);
+            putVarint(out, p.first.seq);
+            putString(out, p.second.consumer);
+            putVarint(out, static_cast<uint64_t>(p.second.deliveryTime));
+            putVarint(out, p.second.deliveryCount);
+        }
+        putVarint(out, g.consumers.size());
+        for (const auto& c : g.consumers) {
+            putString(out, c.first);
+            putVarint(out, static_cast<uint64_t>(c.second));
+        }
+    }
+}
+
+bool redisstream::deserialize(const std::string& in) {
+    blocks.clear();
+    groups.clear();
+    entries = 0;
+    size_t pos = 0;
+    uint64_t n, lastMs, lastSeq;
+    if (!getVarint(in, pos, lastMs) || !getVarint(in, pos, lastSeq) || !getVarint(in, pos, n))
+        return false;
+    for (uint64_t i = 0; i < n; ++i) {
+        streamid id;
+        uint64_t nfields;
+        if (!getVarint(in, pos, id.ms) || !getVarint(in, pos, id.seq) || !getVarint(in, pos, nfields))
+            return false;
+        fieldlist fields(nfields);
+        for (auto& fv : fields) {
+            if (!getString(in, pos, fv.first) || !getString(in, pos, fv.second))
+                return false;
+        }
+        append(id, fields);
+    }
+    last_id = streamid{ lastMs, lastSeq };
+
+    uint64_t ngroups;
+    if (!getVarint(in, pos, ngroups))
+        return false;
+    for (uint64_t i = 0; i < ngroups; ++i) {
+        std::string name;
+        uint64_t npel, nconsumers;
+        if (!getString(in, pos, name))
+            return false;
+        group& g = groups[name];
+        if (!getVarint(in, pos, g.lastDelivered.ms) || !getVarint(in, pos, g.lastDelivered.seq) ||
+            !getVarint(in, pos, npel))
+            return false;
+        for (uint64_t j = 0; j < npel; ++j) {
+            streamid id;
+            pendingentry p;
+            uint64_t t;
+            if (!getVarint(in, pos, id.ms) || !getVarint(in, pos, id.seq) || !getString(in, pos, p.consumer) ||
+                !getVarint(in, pos, t) || !getVarint(in, pos, p.deliveryCount))
+                return false;
+            p.deliveryTime = static_cast<int64_t>(t);
+            g.pel[id] = p;
+        }
+        if (!getVarint(in, pos, nconsumers))
+            return false;
+        for (uint64_t j = 0; j < nconsumers; ++j) {
+            std::string cname;
+            uint64_t seen;
+            if (!getString(in, pos, cname) || !getVarint(in, pos, seen))
+                return false;
+            g.consumers[cname] = static_cast<int64_t>(seen);
+        }
+    }
+    return true;
+}
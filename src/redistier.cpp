@@ -0,0 +1,283 @@
+#include <string>
+#include <vector>
+#include <atomic>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+#include <filesystem>
+#include "../include/redistier.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#endif
+
+// Segment Files
+class redistier::segment {
+public:
+    segment(uint32_t segmentId, const std::string& filePath) : id(segmentId), path(filePath) {}
+    ~segment() {
+#ifdef _WIN32
+        if (file != INVALID_HANDLE_VALUE)
+            CloseHandle(file);
+#else
+        if (fd >= 0)
+            ::close(fd);
+#endif
+        if (doomed)
+            std::remove(path.c_str());
+    }
+
+    bool create(std::string& err) {
+#ifdef _WIN32
+        file = CreateFileA(path.c_str(), GENERIC_READ | GENERIC_WRITE, FILE_SHARE_READ | FILE_SHARE_WRITE, nullptr,
+            CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+        if (file == INVALID_HANDLE_VALUE) {
+            err = "cannot create " + path + " (error " + std::to_string(GetLastError()) + ")";
+            return false;
+        }
+#else
+        fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+        if (fd < 0) {
+            err = "cannot create " + path + ": " + std::strerror(errno);
+            return false;
+        }
+#endif
+        return true;
+    }
+
+    // Positional I/O: no shared file offset, so reads need no lock
+    bool readAt(uint64_t offset, char* buf, size_t n) const {
+        while (n > 0) {
+#ifdef _WIN32
+            OVERLAPPED ov = {};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD got = 0;
+            DWORD want = static_cast<DWORD>(std::min<size_t>(n, 1u << 30));
+            if (!ReadFile(file, buf, want, &got, &ov) || got == 0)
+                return false;
+#else
+            ssize_t got = ::pread(fd, buf, n, static_cast<off_t>(offset));
+            if (got < 0 && errno == EINTR)
+                continue;
+            if (got <= 0)
+                return false;
+#endif
+            buf += got;
+            n -= static_cast<size_t>(got);
+            offset += static_cast<uint64_t>(got);
+        }
+        return true;
+    }
+
+    bool writeAt(uint64_t offset, const char* buf, size_t n) {
+        while (n > 0) {
+#ifdef _WIN32
+            OVERLAPPED ov = {};
+            ov.Offset = static_cast<DWORD>(offset);
+            ov.OffsetHigh = static_cast<DWORD>(offset >> 32);
+            DWORD put = 0;
+            DWORD want = static_cast<DWORD>(std::min<size_t>(n, 1u << 30));
+            if (!WriteFile(file, buf, want, &put, &ov) || put == 0)
+                return false;
+#else
+            ssize_t put = ::pwrite(fd, buf, n, static_cast<off_t>(offset));
+            if (put < 0 && errno == EINTR)
+                continue;
+            if (put <= 0)
+                return false;
+#endif
+            buf += put;
+            n -= static_cast<size_t>(put);
+            offset += static_cast<uint64_t>(put);
+        }
+        return true;
+    }
+
+    const uint32_t id;
+    const std::string path;
+    std::atomic<uint64_t> size{ 0 };
+    std::atomic<bool> doomed{ false };
+
+private:
+#ifdef _WIN32
+    HANDLE file = INVALID_HANDLE_VALUE;
+#else
+    int fd = -1;
+#endif
+};
+
+static void putU32(char* p, uint32_t v) { std::memcpy(p, &v, 4); }
+static uint32_t getU32(const char* p) {
+    uint32_t v;
+    std::memcpy(&v, p, 4);
+    return v;
+}
+
+redistier::redistier(const std::string& directory, const std::string& prefix) : dir(directory), name(prefix) {
+    std::error_code ec;
+    std::filesystem::create_directories(dir, ec);
+    // Segments left by an earlier run are unreferenced: the index is not persisted
+    for (const auto& entry : std::filesystem::directory_iterator(dir, ec)) {
+        std::string file = entry.path().filename().string();
+        if (file.rfind(name + "-", 0) == 0 && file.size() > 4 && file.compare(file.size() - 4, 4, ".log") == 0)
+            std::filesystem::remove(entry.path(), ec);
+    }
+}
+
+redistier::~redistier() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (auto& s : segments)
+        s.second->doomed = true;
+}
+
+std::string redistier::pathOf(uint32_t id) const {
+    return (std::filesystem::path(dir) / (name + "-" + std::to_string(id) + ".log")).string();
+}
+
+bool redistier::roll(std::string& err) {
+    uint32_t id = nextId++;
+    handle seg = std::make_shared<segment>(id, pathOf(id));
+    if (!seg->create(err))
+        return false;
+    segments[id] = seg;
+    live[id] = 0;
+    active = seg;
+    return true;
+}
+
+bool redistier::append(const std::string& key, const std::string& value, ref& out, std::string& err) {
+    size_t bytes = HEADER_BYTES + key.size() + value.size();
+    std::string record(bytes, '\0');
+    putU32(&record[0], static_cast<uint32_t>(key.size()));
+    putU32(&record[4], static_cast<uint32_t>(value.size()));
+    std::memcpy(&record[HEADER_BYTES], key.data(), key.size());
+    std::memcpy(&record[HEADER_BYTES + key.size()], value.data(), value.size());
+
+    std::lock_guard<std::mutex> lock(mtx);
+    if ((!active || active->size + bytes > SEGMENT_BYTES) && !roll(err))
+        return false;
+    uint64_t at = active->size;
+    if (!active->writeAt(at, record.data(), bytes)) {
+        err = "write to " + active->path + " failed";
+        return false;
+    }
+    active->size = at + bytes;
+    live[active->id] += bytes;
+    out.segment = active->id;
+    out.length = static_cast<uint32_t>(value.size());
+    out.offset = at + HEADER_BYTES + key.size();
+    return true;
+}
+
+redistier::handle redistier::open(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = segments.find(id);
+    return it == segments.end() ? nullptr : it->second;
+}
+
+bool redistier::read(const handle& h, const ref& r, std::string& value) {
+    if (!h)
+        return false;
+    value.resize(r.length);
+    return r.length == 0 || h->readAt(r.offset, &value[0], r.length);
+}
+
+void redistier::release(const ref& r, size_t keyBytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = live.find(r.segment);
+    if (it != live.end())
+        it->second -= std::min<uint64_t>(it->second, HEADER_BYTES + keyBytes + r.length);
+}
+
+// Compaction
+uint32_t redistier::compactionCandidate() {
+    std::lock_guard<std::mutex> lock(mtx);
+    for (const auto& s : segments) {
+        if (s.second == active)
+            continue;
+        if (live[s.first] * 2 < s.second->size)
+            return s.first;
+    }
+    return 0;
+}
+
+bool redistier::scan(const handle& h, uint64_t& pos, size_t maxBytes, std::vector<record>& out) {
+    out.clear();
+    if (!h)
+        return false;
+    uint64_t end = h->size;
+    if (pos >= end)
+        return true;
+    std::string buf(static_cast<size_t>(std::min<uint64_t>(maxBytes, end - pos)), '\0');
+    if (!h->readAt(pos, &buf[0], buf.size()))
+        return false;
+    size_t at = 0;
+    while (at + HEADER_BYTES <= buf.size()) {
+        uint32_t klen = getU32(&buf[at]), vlen = getU32(&buf[at + 4]);
+        size_t bytes = HEADER_BYTES + klen + vlen;
+        if (at + bytes > buf.size())
+            break;
+        record rec;
+        rec.key.assign(buf, at + HEADER_BYTES, klen);
+        rec.value.assign(buf, at + HEADER_BYTES + klen, vlen);
+        rec.where.segment = h->id;
+        rec.where.length = vlen;
+        rec.where.offset = pos + at + HEADER_BYTES + klen;
+        out.push_back(std::move(rec));
+        at += bytes;
+    }
+    if (at == 0) {
+        // A single record larger than maxBytes
+        char header[HEADER_BYTES];
+        if (!h->readAt(pos, header, HEADER_BYTES))
+            return false;
+        uint32_t klen = getU32(header), vlen = getU32(header + 4);
+        record rec;
+        rec.key.resize(klen);
+        rec.value.resize(vlen);
+        if ((klen && !h->readAt(pos + HEADER_BYTES, &rec.key[0], klen)) ||
+            (vlen && !h->readAt(pos + HEADER_BYTES + klen, &rec.value[0], vlen)))
+            return false;
+        rec.where.segment = h->id;
+        rec.where.length = vlen;
+        rec.where.offset = pos + HEADER_BYTES + klen;
+        out.push_back(std::move(rec));
+        at = HEADER_BYTES + klen + vlen;
+    }
+    pos += at;
+    return true;
+}
+
+void redistier::moved(uint64_t bytes) {
+    std::lock_guard<std::mutex> lock(mtx);
+    compactedBytes += bytes;
+}
+
+void redistier::drop(uint32_t id) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = segments.find(id);
+    if (it == segments.end() || it->second == active)
+        return;
+    it->second->doomed = true;
+    segments.erase(it);
+    live.erase(id);
+    compactions++;
+}
+
+redistier::stats redistier::statistics() {
+    std::lock_guard<std::mutex> lock(mtx);
+    stats s;
+    s.segments = segments.size();
+    for (const auto& seg : segments)
+        s.fileBytes += seg.second->size;
+    for (const auto& l : live)
+        s.liveBytes += l.second;
+    s.compactions = compactions;
+    s.compactedBytes = compactedBytes;
+    return s;
+}
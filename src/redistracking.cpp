@@ -0,0 +1,258 @@
+#include <string>
+#include <vector>
+#include <mutex>
+#include <chrono>
+#include <utility>
+#include "../include/redistracking.h"
+
+// How long the flusher lets invalidations accumulate before sending them.
+static const std::chrono::microseconds FLUSH_INTERVAL(1000);
+
+static thread_local uint64_t caller = 0;
+
+static redisoutput::buffer encodeInvalidation(const std::unordered_set<std::string>* keys) {
+    static const std::string header = "*3\r\n$7\r\nmessage\r\n$20\r\n__redis__:invalidate\r\n";
+    std::string out = header;
+    if (!keys) {
+        out += "*-1\r\n"; // everything is invalid
+    }
+    else {
+        out += "*" + std::to_string(keys->size()) + "\r\n";
+        for (const auto& k : *keys) {
+            out += "$" + std::to_string(k.size()) + "\r\n";
+            out += k;
+            out += "\r\n";
+        }
+    }
+    return std::make_shared<const std::string>(std::move(out));
+}
+
+redistracking& redistracking::getInstance() {
+    static redistracking instance;
+    return instance;
+}
+
+redistracking::~redistracking() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        stopping = true;
+    }
+    cv.notify_all();
+    if (flusher.joinable())
+        flusher.join();
+}
+
+void redistracking::setCaller(uint64_t client) {
+    caller = client;
+}
+
+void redistracking::enable(uint64_t client, const std::shared_ptr<redisoutput>& target, bool bcast, bool noloop,
+    const std::vector<std::string>& prefixes) {
+    disable(client);
+    std::lock_guard<std::mutex> lock(mtx);
+    trackedclient& c = clients[client];
+    c.target = target;
+    c.bcast = bcast;
+    c.noloop = noloop;
+    if (bcast) {
+        c.prefixes = prefixes;
+        if (c.prefixes.empty())
+            c.prefixes.push_back(std::string()); // BCAST without PREFIX covers every key
+        for (const auto& p : c.prefixes) {
+            auto& subs = prefixTable[p];
+            if (subs.empty())
+                prefixLengths[p.size()]++;
+            subs.insert(client);
+        }
+    }
+    trackingClients = clients.size();
+    if (!flusher.joinable())
+        flusher = std::thread(&redistracking::flushLoop, this);
+}
+
+void redistracking::disable(uint64_t client) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = clients.find(client);
+    if (it == clients.end())
+        return;
+    for (const auto& p : it->second.prefixes) {
+        auto pt = prefixTable.find(p);
+        if (pt == prefixTable.end())
+            continue;
+        pt->second.erase(client);
+        if (pt->second.empty()) {
+            prefixTable.erase(pt);
+            if (--prefixLengths[p.size()] == 0)
+                prefixLengths.erase(p.size());
+        }
+    }
+    // Entries in the key table still naming this client are dropped lazily
+    // when the key is next invalidated or evicted.
+    clients.erase(it);
+    trackingClients = clients.size();
+}
+
+void redistracking::remember(uint64_t client, const std::string& key) {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        auto it = table.find(key);
+        if (it == table.end()) {
+            size_t before = dirty.size();
+            while (max && table.size() >= max)
+                evict();
+            wake = before == 0 && !dirty.empty();
+            it = table.emplace(key, std::unordered_set<uint64_t>()).first;
+        }
+        it->second.insert(client);
+    }
+    if (wake)
+        cv.notify_one();
+}
+
+void redistracking::evict() {
+    // Readers of an evicted key must drop it too, or they could keep serving
+    // a value nobody will tell them about.
+    auto it = table.begin();
+    for (uint64_t client : it->second)
+        queue(client, it->first);
+    table.erase(it);
+    evictions++;
+}
+
+void redistracking::queue(uint64_t client, const std::string& key) {
+    auto it = clients.find(client);
+    if (it == clients.end())
+        return;
+    trackedclient& c = it->second;
+    if (c.noloop && client == caller)
+        return;
+    if (c.pendingAll) {
+        coalesced++;
+        return;
+    }
+    if (c.pending.empty())
+        dirty.push_back(client);
+    if (!c.pending.insert(key).second)
+        coalesced++;
+}
+
+void redistracking::invalidate(const std::string& key) {
+    bool wake = false;
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        size_t before = dirty.size();
+        auto it = table.find(key);
+        if (it != table.end()) {
+            for (uint64_t client : it->second)
+                queue(client, key);
+            table.erase(it);
+        }
+        // One lookup per distinct prefix length instead of one per prefix
+        for (const auto& len : prefixLengths) {
+            if (len.first > key.size())
+                break;
+            auto pt = prefixTable.find(key.substr(0, len.first));
+            if (pt == prefixTable.end())
+                continue;
+            for (uint64_t client : pt->second)
+                queue(client, key);
+        }
+        wake = before == 0 && !dirty.empty();
+    }
+    if (wake)
+        cv.notify_one();
+}
+
+void redistracking::invalidateAll() {
+    {
+        std::lock_guard<std::mutex> lock(mtx);
+        table.clear();
+        for (auto& c : clients) {
+            if (c.second.pending.empty() && !c.second.pendingAll)
+                dirty.push_back(c.first);
+            c.second.pending.clear();
+            c.second.pendingAll = true;
+        }
+    }
+    cv.notify_one();
+}
+
+void redistracking::flushLoop() {
+    std::unique_lock<std::mutex> lock(mtx);
+    std::vector<std::pair<std::shared_ptr<redisoutput>, redisoutput::buffer>> batch;
+    while (true) {
+        cv.wait(lock, [this]() { return stopping || !dirty.empty(); });
+        if (stopping)
+            return;
+        // Let writes arriving right behind the first one join this batch
+        lock.unlock();
+        std::this_thread::sleep_for(FLUSH_INTERVAL);
+        lock.lock();
+
+        for (uint64_t client : dirty) {
+            auto it = clients.find(client);
+            if (it == clients.end() || (it->second.pending.empty() && !it->second.pendingAll))
+                continue;
+            trackedclient& c = it->second;
+            std::shared_ptr<redisoutput> target = c.target.lock();
+            if (target) {
+                batch.emplace_back(target, encodeInvalidation(c.pendingAll ? nullptr : &c.pending));
+                invalidatedKeys += c.pending.size();
+                messages++;
+            }
+            c.pending.clear();
+            c.pendingAll = false;
+        }
+        dirty.clear();
+
+        lock.unlock();
+        for (const auto& b : batch)
+            b.first->push(b.second);
+        batch.clear();
+        lock.lock();
+    }
+}
+
+void redistracking::registerOutput(uint64_t client, const std::shared_ptr<redisoutput>& output) {
+    std::lock_guard<std::mutex> lock(mtx);
+    outputs[client] = output;
+}
+
+void redistracking::unregisterOutput(uint64_t client) {
+    std::lock_guard<std::mutex> lock(mtx);
+    outputs.erase(client);
+}
+
+std::shared_ptr<redisoutput> redistracking::findOutput(uint64_t client) {
+    std::lock_guard<std::mutex> lock(mtx);
+    auto it = outputs.find(client);
+    return it != outputs.end() ? it->second.lock() : nullptr;
+}
+
+void redistracking::setMaxKeys(size_t n) {
+    std::lock_guard<std::mutex> lock(mtx);
+    max = n;
+    while (max && table.size() > max)
+        evict();
+    if (!dirty.empty())
+        cv.notify_one();
+}
+
+size_t redistracking::maxKeys() {
+    std::lock_guard<std::mutex> lock(mtx);
+    return max;
+}
+
+redistracking::stats redistracking::getStats() {
+    std::lock_guard<std::mutex> lock(mtx);
+    stats s;
+    s.clients = clients.size();
+    s.trackedKeys = table.size();
+    s.prefixes = prefixTable.size();
+    s.invalidatedKeys = invalidatedKeys;
+    s.messages = messages;
+    s.coalesced = coalesced;
+    s.evictions = evictions;
+    return s;
+}
@@ -0,0 +1,731 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <memory>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include "../include/redisuring.h"
+#include "../include/rediscommandhandler.h"
+#include "../include/redisclient.h"
+#include "../include/redisnet.h"
+#include "../include/redisstats.h"
+
+#ifdef REDIS_HAVE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <sys/utsname.h>
+#include <sys/uio.h>
+#include <sys/socket.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <errno.h>
+
+static const unsigned RING_ENTRIES = 4096;
+static const unsigned RECV_BUFFERS = 1024; // power of two, as the buffer ring requires
+static const unsigned RECV_BUFFER_SIZE = 16384;
+// Registered memory is pinned and counts against RLIMIT_MEMLOCK, so the
+// send pool stays small; larger replies fall back to a plain SEND.
+static const unsigned SEND_BUFFERS = 128;
+static const unsigned SEND_BUFFER_SIZE = 32768;
+static const uint16_t RECV_GROUP = 0;
+
+// user_data: operation in the top byte, connection id below
+enum optype : uint64_t { OP_NONE = 0, OP_ACCEPT = 1, OP_RECV = 2, OP_SEND = 3, OP_WAKEUP = 4 };
+
+static uint64_t userData(optype op, uint64_t id = 0) {
+    return (static_cast<uint64_t>(op) << 56) | id;
+}
+
+static int uringSetup(unsigned entries, io_uring_params* p) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, p));
+}
+
+static int uringEnter(int fd, unsigned submit, unsigned wait, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, submit, wait, flags, nullptr, 0));
+}
+
+static int uringRegister(int fd, unsigned op, void* arg, unsigned count) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, op, arg, count));
+}
+
+struct redisuring::ring {
+    int fd = -1;
+
+    unsigned* sqHead = nullptr;
+    unsigned* sqTail = nullptr;
+    unsigned* sqArray = nullptr;
+    unsigned sqMask = 0;
+    unsigned sqEntries = 0;
+    io_uring_sqe* sqes = nullptr;
+    unsigned localTail = 0;
+    unsigned pending = 0; // prepared, not yet submitted
+
+    unsigned* cqHead = nullptr;
+    unsigned* cqTail = nullptr;
+    unsigned cqMask = 0;
+    io_uring_cqe* cqes = nullptr;
+
+    void* sqMap = MAP_FAILED;
+    size_t sqMapSize = 0;
+    void* cqMap = MAP_FAILED;
+    size_t cqMapSize = 0;
+    void* sqeMap = MAP_FAILED;
+    size_t sqeMapSize = 0;
+
+    // Provided buffers for multishot recv: a buffer ring when the kernel
+    // supports it, otherwise returned with PROVIDE_BUFFERS.
+    bool bufferRing = false;
+    io_uring_buf_ring* bufRing = nullptr;
+    char* recvPool = nullptr;
+    uint16_t bufTail = 0;
+    std::vector<uint16_t> returned;
+
+    // Registered buffers for replies
+    char* sendPool = nullptr;
+    std::vector<int> freeSend;
+
+    std::atomic<uint64_t>* enters = nullptr;
+
+    bool setup(std::string& err) {
+        io_uring_params p{};
+        // A single thread submits and reaps, which lets the kernel defer
+        // completion work until we ask for events (6.1+).
+        p.flags = IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+        fd = uringSetup(RING_ENTRIES, &p);
+        if (fd < 0) {
+            p = io_uring_params{};
+            fd = uringSetup(RING_ENTRIES, &p);
+        }
+        if (fd < 0) {
+            err = std::string("io_uring_setup: ") + strerror(errno);
+            return false;
+        }
+
+        sqMapSize = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+        cqMapSize = p.cq_off.cqes + p.cq_entries * sizeof(io_uring_cqe);
+        if (p.features & IORING_FEAT_SINGLE_MMAP)
+            sqMapSize = cqMapSize = std::max(sqMapSize, cqMapSize);
+        sqMap = mmap(nullptr, sqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+        if (sqMap == MAP_FAILED) {
+            err = "mmap of the submission ring failed";
+            return false;
+        }
+        if (p.features & IORING_FEAT_SINGLE_MMAP) {
+            cqMap = sqMap;
+        }
+        else {
+            cqMap = mmap(nullptr, cqMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+            if (cqMap == MAP_FAILED) {
+                err = "mmap of the completion ring failed";
+                return false;
+            }
+        }
+        sqeMapSize = p.sq_entries * sizeof(io_uring_sqe);
+        sqeMap = mmap(nullptr, sqeMapSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+        if (sqeMap == MAP_FAILED) {
+            err = "mmap of the SQE array failed";
+            return false;
+        }
+
+        char* sq = static_cast<char*>(sqMap);
+        sqHead = reinterpret_cast<unsigned*>(sq + p.sq_off.head);
+        sqTail = reinterpret_cast<unsigned*>(sq + p.sq_off.tail);
+        sqArray = reinterpret_cast<unsigned*>(sq + p.sq_off.array);
+        sqMask = *reinterpret_cast<unsigned*>(sq + p.sq_off.ring_mask);
+        sqEntries = p.sq_entries;
+        sqes = static_cast<io_uring_sqe*>(sqeMap);
+        localTail = *sqTail;
+
+        char* cq = static_cast<char*>(cqMap);
+        cqHead = reinterpret_cast<unsigned*>(cq + p.cq_off.head);
+        cqTail = reinterpret_cast<unsigned*>(cq + p.cq_off.tail);
+        cqMask = *reinterpret_cast<unsigned*>(cq + p.cq_off.ring_mask);
+        cqes = reinterpret_cast<io_uring_cqe*>(cq + p.cq_off.cqes);
+
+        // Buffer ring for recv: the kernel picks a buffer per completion
+        size_t ringBytes = RECV_BUFFERS * sizeof(io_uring_buf);
+        void* bufMem = mmap(nullptr, ringBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        void* recvMem = mmap(nullptr, static_cast<size_t>(RECV_BUFFERS) * RECV_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (bufMem == MAP_FAILED || recvMem == MAP_FAILED) {
+            err = "allocating recv buffers failed";
+            return false;
+        }
+        bufRing = static_cast<io_uring_buf_ring*>(bufMem);
+        recvPool = static_cast<char*>(recvMem);
+        io_uring_buf_reg reg{};
+        reg.ring_addr = reinterpret_cast<uint64_t>(bufRing);
+        reg.ring_entries = RECV_BUFFERS;
+        reg.bgid = RECV_GROUP;
+        bufferRing = uringRegister(fd, IORING_REGISTER_PBUF_RING, &reg, 1) == 0;
+        if (bufferRing) {
+            for (unsigned i = 0; i < RECV_BUFFERS; ++i)
+                recycle(static_cast<uint16_t>(i));
+            publish();
+            if (!probeBufferRing()) {
+                uringRegister(fd, IORING_UNREGISTER_PBUF_RING, &reg, 1);
+                bufferRing = false;
+            }
+        }
+        if (!bufferRing) {
+            munmap(bufRing, ringBytes);
+            bufRing = nullptr;
+            // Pre-5.19 style: hand the whole pool to the kernel in one SQE
+            provide(0, RECV_BUFFERS);
+        }
+
+        // Registered send buffers are an optimization only; without them
+        // (e.g. a low memlock limit) every reply uses a plain SEND.
+        void* sendMem = mmap(nullptr, static_cast<size_t>(SEND_BUFFERS) * SEND_BUFFER_SIZE, PROT_READ | PROT_WRITE,
+            MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (sendMem != MAP_FAILED) {
+            std::vector<iovec> iov(SEND_BUFFERS);
+            for (unsigned i = 0; i < SEND_BUFFERS; ++i) {
+                iov[i].iov_base = static_cast<char*>(sendMem) + static_cast<size_t>(i) * SEND_BUFFER_SIZE;
+                iov[i].iov_len = SEND_BUFFER_SIZE;
+            }
+            if (uringRegister(fd, IORING_REGISTER_BUFFERS, iov.data(), SEND_BUFFERS) == 0) {
+                sendPool = static_cast<char*>(sendMem);
+                for (int i = SEND_BUFFERS - 1; i >= 0; --i)
+                    freeSend.push_back(i);
+            }
+            else {
+                munmap(sendMem, static_cast<size_t>(SEND_BUFFERS) * SEND_BUFFER_SIZE);
+            }
+        }
+        return true;
+    }
+
+    ~ring() {
+        if (sendPool)
+            munmap(sendPool, static_cast<size_t>(SEND_BUFFERS) * SEND_BUFFER_SIZE);
+        if (recvPool)
+            munmap(recvPool, static_cast<size_t>(RECV_BUFFERS) * RECV_BUFFER_SIZE);
+        if (bufRing)
+            munmap(bufRing, RECV_BUFFERS * sizeof(io_uring_buf));
+        if (sqeMap != MAP_FAILED)
+            munmap(sqeMap, sqeMapSize);
+        if (cqMap != MAP_FAILED && cqMap != sqMap)
+            munmap(cqMap, cqMapSize);
+        if (sqMap != MAP_FAILED)
+            munmap(sqMap, sqMapSize);
+        if (fd >= 0)
+            close(fd);
+    }
+
+    io_uring_sqe* sqe() {
+        if (localTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE) >= sqEntries)
+            submit(0);
+        unsigned index = localTail & sqMask;
+        io_uring_sqe* e = &sqes[index];
+        memset(e, 0, sizeof(*e));
+        sqArray[index] = index;
+        localTail++;
+        pending++;
+        return e;
+    }
+
+    // Submits everything prepared and, if wait > 0, blocks for completions.
+    void submit(unsigned wait) {
+        __atomic_store_n(sqTail, localTail, __ATOMIC_RELEASE);
+        while (true) {
+            int n = uringEnter(fd, pending, wait, IORING_ENTER_GETEVENTS);
+            enters->fetch_add(1, std::memory_order_relaxed);
+            if (n >= 0) {
+                pending -= std::min<unsigned>(pending, static_cast<unsigned>(n));
+                return;
+            }
+            if (errno != EINTR && errno != EAGAIN && errno != EBUSY)
+                return;
+            if (errno != EINTR)
+                wait = 0;
+        }
+    }
+
+    void recycle(uint16_t bid) {
+        if (!bufferRing) {
+            returned.push_back(bid);
+            return;
+        }
+        io_uring_buf* b = &bufRing->bufs[bufTail & (RECV_BUFFERS - 1)];
+        b->addr = reinterpret_cast<uint64_t>(recvPool + static_cast<size_t>(bid) * RECV_BUFFER_SIZE);
+        b->len = RECV_BUFFER_SIZE;
+        b->bid = bid;
+        bufTail++;
+    }
+
+    // Makes recycled buffers visible to the kernel
+    void publish() {
+        if (bufferRing) {
+            __atomic_store_n(&bufRing->tail, bufTail, __ATOMIC_RELEASE);
+            return;
+        }
+        // One SQE per run of consecutive buffer ids
+        size_t i = 0;
+        while (i < returned.size()) {
+            size_t j = i + 1;
+            while (j < returned.size() && returned[j] == returned[j - 1] + 1)
+                j++;
+            provide(returned[i], static_cast<unsigned>(j - i));
+            i = j;
+        }
+        returned.clear();
+    }
+
+    void provide(uint16_t first, unsigned count) {
+        io_uring_sqe* e = sqe();
+        e->opcode = IORING_OP_PROVIDE_BUFFERS;
+        e->fd = static_cast<int>(count);
+        e->addr = reinterpret_cast<uint64_t>(recvPool + static_cast<size_t>(first) * RECV_BUFFER_SIZE);
+        e->len = RECV_BUFFER_SIZE;
+        e->off = first;
+        e->buf_group = RECV_GROUP;
+        e->user_data = 0;
+    }
+
+    // Some kernels accept the ring registration yet never hand its buffers
+    // out (every recv fails with ENOBUFS); check with a one-byte recv.
+    bool probeBufferRing() {
+        int sv[2];
+        if (socketpair(AF_UNIX, SOCK_STREAM, 0, sv) != 0)
+            return false;
+        char b = 0;
+        bool ok = write(sv[1], &b, 1) == 1;
+        if (ok) {
+            io_uring_sqe* e = sqe();
+            e->opcode = IORING_OP_RECV;
+            e->fd = sv[0];
+            e->flags = IOSQE_BUFFER_SELECT;
+            e->buf_group = RECV_GROUP;
+            e->user_data = 0;
+            submit(1);
+            unsigned head = *cqHead;
+            ok = head != __atomic_load_n(cqTail, __ATOMIC_ACQUIRE);
+            if (ok) {
+                io_uring_cqe& cqe = cqes[head & cqMask];
+                ok = cqe.res == 1 && (cqe.flags & IORING_CQE_F_BUFFER);
+                if (ok)
+                    recycle(static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT));
+                __atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+            }
+        }
+        close(sv[0]);
+        close(sv[1]);
+        return ok;
+    }
+};
+
+struct redisuring::connection {
+    uint64_t id = 0;
+    int fd = -1;
+    redisclient client;
+    bool hooked = false;
+    std::string in;
+    std::string out;     // waiting for the in-flight write
+    std::string sending; // in flight when not in a registered buffer
+    int fixedBuffer = -1;
+    size_t sendOffset = 0;
+    size_t sendLength = 0;
+    bool writing = false;
+    bool recvArmed = false;
+    bool isDirty = false;
+    bool closed = false;
+    std::weak_ptr<redisoutput> streaming; // a streamed reply waits for out to drain
+};
+
+bool redisuring::available() {
+    // Multishot recv with provided buffer rings arrived in 6.0
+    utsname u;
+    if (uname(&u) != 0)
+        return false;
+    int major = 0, minor = 0;
+    if (sscanf(u.release, "%d.%d", &major, &minor) != 2 || major < 6)
+        return false;
+    io_uring_params p{};
+    int fd = uringSetup(8, &p);
+    if (fd < 0)
+        return false;
+    close(fd);
+    return true;
+}
+
+redisuring::redisuring(rediscommandhandler& handler) : cmdHandler(handler) {}
+
+redisuring::~redisuring() {
+    for (auto& c : conns) {
+        cmdHandler.closeClient(c.second->client);
+        if (!c.second->closed)
+            close(c.second->fd);
+        delete c.second;
+    }
+    if (wakeFd >= 0)
+        close(wakeFd);
+}
+
+redisuring::stats redisuring::getStats() const {
+    stats s;
+    s.commands = commands;
+    s.enters = enters;
+    s.otherCalls = otherCalls;
+    s.fixedSends = fixedSends;
+    s.plainSends = plainSends;
+    return s;
+}
+
+bool redisuring::run(SOCKET listener) {
+    r.reset(new ring());
+    r->enters = &enters;
+    std::string err;
+    if (!r->setup(err)) {
+        std::cerr << "io_uring unavailable: " << err << "\n";
+        r.reset();
+        return false;
+    }
+    std::cout << "io_uring: " << (r->bufferRing ? "buffer ring" : "PROVIDE_BUFFERS") << " for recv, "
+        << r->freeSend.size() << " registered send buffers\n";
+    // Writes go through write(2) semantics, so a vanished peer raises SIGPIPE
+    signal(SIGPIPE, SIG_IGN);
+    listenSock = listener;
+    wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    armAccept();
+    armWakeup();
+
+    while (true) {
+        for (size_t i = 0; i < dirty.size(); ++i) {
+            connection* c = dirty[i];
+            c->isDirty = false;
+            if (c->closed)
+                release(c);
+            else
+                startSend(c);
+        }
+        dirty.clear();
+        r->publish();
+        for (uint64_t id : starved) {
+            auto it = conns.find(id);
+            if (it != conns.end() && !it->second->closed && !it->second->recvArmed)
+                armRecv(it->second);
+        }
+        starved.clear();
+        r->submit(1);
+
+        unsigned head = *r->cqHead;
+        unsigned tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+        while (head != tail) {
+            io_uring_cqe cqe = r->cqes[head & r->cqMask];
+            head++;
+            uint64_t id = cqe.user_data & ((1ull << 56) - 1);
+            switch (static_cast<optype>(cqe.user_data >> 56)) {
+            case OP_NONE: break;
+            case OP_ACCEPT: onAccept(cqe.res, cqe.flags); break;
+            case OP_RECV: onRecv(id, cqe.res, cqe.flags); break;
+            case OP_SEND: onSend(id, cqe.res); break;
+            case OP_WAKEUP: onWakeup(cqe.flags); break;
+            }
+            if (head == tail) {
+                __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+                tail = __atomic_load_n(r->cqTail, __ATOMIC_ACQUIRE);
+            }
+        }
+        __atomic_store_n(r->cqHead, head, __ATOMIC_RELEASE);
+    }
+    return true;
+}
+
+void redisuring::armAccept() {
+    io_uring_sqe* e = r->sqe();
+    e->opcode = IORING_OP_ACCEPT;
+    e->fd = listenSock;
+    e->ioprio = IORING_ACCEPT_MULTISHOT;
+    e->accept_flags = SOCK_CLOEXEC;
+    e->user_data = userData(OP_ACCEPT);
+}
+
+void redisuring::armRecv(connection* c) {
+    io_uring_sqe* e = r->sqe();
+    e->opcode = IORING_OP_RECV;
+    e->fd = c->fd;
+    e->ioprio = IORING_RECV_MULTISHOT;
+    e->flags = IOSQE_BUFFER_SELECT;
+    e->buf_group = RECV_GROUP;
+    e->user_data = userData(OP_RECV, c->id);
+    c->recvArmed = true;
+}
+
+void redisuring::armWakeup() {
+    io_uring_sqe* e = r->sqe();
+    e->opcode = IORING_OP_POLL_ADD;
+    e->fd = wakeFd;
+    e->poll32_events = POLLIN;
+    e->len = IORING_POLL_ADD_MULTI;
+    e->user_data = userData(OP_WAKEUP);
+}
+
+void redisuring::onAccept(int res, uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE))
+        armAccept();
+    if (res < 0)
+        return;
+    connection* c = new connection();
+    redisstats::add(redisstats::CONNECTIONS);
+    c->id = ++nextConnId;
+    c->fd = res;
+    c->client.streamReplies = true;
+    redisnet::setNoDelay(res);
+    conns[c->id] = c;
+    armRecv(c);
+}
+
+void redisuring::onRecv(uint64_t id, int res, uint32_t flags) {
+    auto it = conns.find(id);
+    connection* c = it == conns.end() ? nullptr : it->second;
+    if (flags & IORING_CQE_F_BUFFER) {
+        uint16_t bid = static_cast<uint16_t>(flags >> IORING_CQE_BUFFER_SHIFT);
+        if (c && !c->closed && res > 0)
+            c->in.append(r->recvPool + static_cast<size_t>(bid) * RECV_BUFFER_SIZE, res);
+        r->recycle(bid);
+    }
+    if (!c)
+        return;
+    if (!(flags & IORING_CQE_F_MORE))
+        c->recvArmed = false;
+    if (c->closed) {
+        release(c);
+        return;
+    }
+    if (res > 0) {
+        execute(c);
+        // The multishot can end after data (e.g. a full completion queue)
+        if (!c->recvArmed && !c->closed)
+            armRecv(c);
+    }
+    else if (res == -ENOBUFS) {
+        // Out of recv buffers; re-armed once this pass's are handed back
+        starved.push_back(c->id);
+    }
+    else {
+        closeConnection(c);
+    }
+}
+
+void redisuring::onSend(uint64_t id, int res) {
+    auto it = conns.find(id);
+    if (it == conns.end())
+        return;
+    connection* c = it->second;
+    if (res > 0 && !c->closed) {
+        c->sendOffset += res;
+        if (c->sendOffset < c->sendLength) {
+            // Short write: send the rest of the same buffer
+            io_uring_sqe* e = r->sqe();
+            if (c->fixedBuffer >= 0) {
+                e->opcode = IORING_OP_WRITE_FIXED;
+                e->addr = reinterpret_cast<uint64_t>(r->sendPool + static_cast<size_t>(c->fixedBuffer) * SEND_BUFFER_SIZE + c->sendOffset);
+                e->buf_index = static_cast<uint16_t>(c->fixedBuffer);
+                e->off = static_cast<uint64_t>(-1);
+            }
+            else {
+                e->opcode = IORING_OP_SEND;
+                e->addr = reinterpret_cast<uint64_t>(c->sending.data() + c->sendOffset);
+                e->msg_flags = MSG_NOSIGNAL;
+            }
+            e->fd = c->fd;
+            e->len = static_cast<uint32_t>(c->sendLength - c->sendOffset);
+            e->user_data = userData(OP_SEND, c->id);
+            return;
+        }
+    }
+    c->writing = false;
+    if (c->fixedBuffer >= 0) {
+        r->freeSend.push_back(c->fixedBuffer);
+        c->fixedBuffer = -1;
+    }
+    c->sending.clear();
+    if (c->closed) {
+        release(c);
+        return;
+    }
+    if (res <= 0) {
+        closeConnection(c);
+        return;
+    }
+    if (!c->out.empty()) {
+        markDirty(c);
+    }
+    else if (std::shared_ptr<redisoutput> output = c->streaming.lock()) {
+        // The last piece of a streamed reply is written; come back for the rest
+        c->streaming.reset();
+        output->resume();
+    }
+}
+
+void redisuring::onWakeup(uint32_t flags) {
+    if (!(flags & IORING_CQE_F_MORE))
+        armWakeup();
+    uint64_t count;
+    ssize_t n = read(wakeFd, &count, sizeof(count));
+    (void)n;
+    otherCalls.fetch_add(1, std::memory_order_relaxed);
+
+    std::vector<std::pair<uint64_t, std::weak_ptr<redisoutput>>> batch;
+    {
+        std::lock_guard<std::mutex> lock(readyMutex);
+        batch.swap(ready);
+    }
+    std::vector<redisoutput::buffer> pushed;
+    for (const auto& entry : batch) {
+        auto it = conns.find(entry.first);
+        std::shared_ptr<redisoutput> output = entry.second.lock();
+        if (it == conns.end() || it->second->closed || !output)
+            continue;
+        connection* c = it->second;
+        if (output->overflowed()) {
+            closeConnection(c);
+            continue;
+        }
+        pushed.clear();
+        if (!output->tryTake(pushed))
+            continue;
+        for (const auto& b : pushed)
+            c->out += *b;
+        if (output->pending()) {
+            if (c->out.empty() && !c->writing)
+                output->resume(); // nothing to wait for
+            else
+                c->streaming = output;
+        }
+        markDirty(c);
+    }
+}
+
+// Commands run inline on the ring thread, in arrival order per connection.
+void redisuring::execute(connection* c) {
+    size_t pos = 0, len;
+    while ((len = rediscommandhandler::frameLength(c->in, pos)) > 0) {
+        std::vector<std::string> tokens = rediscommandhandler::parseCommand(c->in.substr(pos, len));
+        pos += len;
+        std::string response = cmdHandler.processCommand(tokens, c->client);
+        commands.fetch_add(1, std::memory_order_relaxed);
+        if (c->client.stream && !c->client.output)
+            c->client.output = std::make_shared<redisoutput>();
+        if (!c->client.output) {
+            c->out += response;
+            continue;
+        }
+        // Pushed messages, streamed replies and other replies share the
+        // output queue to stay ordered
+        if (!c->hooked) {
+            c->hooked = true;
+            redisuring* self = this;
+            uint64_t id = c->id;
+            std::weak_ptr<redisoutput> weak = c->client.output;
+            auto notify = [self, id, weak]() {
+                {
+                    std::lock_guard<std::mutex> lock(self->readyMutex);
+                    self->ready.emplace_back(id, weak);
+                }
+                uint64_t one = 1;
+                ssize_t n = write(self->wakeFd, &one, sizeof(one));
+                (void)n;
+                self->otherCalls.fetch_add(1, std::memory_order_relaxed);
+            };
+            c->client.output->setNotify(notify);
+            notify();
+        }
+        c->client.output->push(std::make_shared<const std::string>(std::move(response)));
+        if (c->client.stream) {
+            c->client.output->push(std::move(c->client.stream));
+            c->client.stream = nullptr;
+        }
+    }
+    c->in.erase(0, pos);
+    if (!c->out.empty())
+        markDirty(c);
+}
+
+void redisuring::markDirty(connection* c) {
+    if (!c->isDirty) {
+        c->isDirty = true;
+        dirty.push_back(c);
+    }
+}
+
+// One write in flight per connection keeps replies in order; whatever
+// accumulates meanwhile goes out together when it completes.
+void redisuring::startSend(connection* c) {
+    if (c->closed || c->writing || c->out.empty())
+        return;
+    io_uring_sqe* e = r->sqe();
+    c->sendOffset = 0;
+    c->sendLength = c->out.size();
+    if (c->out.size() <= SEND_BUFFER_SIZE && !r->freeSend.empty()) {
+        c->fixedBuffer = r->freeSend.back();
+        r->freeSend.pop_back();
+        char* dest = r->sendPool + static_cast<size_t>(c->fixedBuffer) * SEND_BUFFER_SIZE;
+        memcpy(dest, c->out.data(), c->out.size());
+        e->opcode = IORING_OP_WRITE_FIXED;
+        e->addr = reinterpret_cast<uint64_t>(dest);
+        e->buf_index = static_cast<uint16_t>(c->fixedBuffer);
+        e->off = static_cast<uint64_t>(-1);
+        c->out.clear();
+        fixedSends.fetch_add(1, std::memory_order_relaxed);
+    }
+    else {
+        c->sending.swap(c->out);
+        c->out.clear();
+        e->opcode = IORING_OP_SEND;
+        e->addr = reinterpret_cast<uint64_t>(c->sending.data());
+        e->msg_flags = MSG_NOSIGNAL;
+        plainSends.fetch_add(1, std::memory_order_relaxed);
+    }
+    e->fd = c->fd;
+    e->len = static_cast<uint32_t>(c->sendLength);
+    e->user_data = userData(OP_SEND, c->id);
+    c->writing = true;
+}
+
+// In-flight operations hold their own reference to the socket, so the fd
+// is closed at once; the connection itself lives until they complete.
+void redisuring::closeConnection(connection* c) {
+    if (c->closed)
+        return;
+    c->closed = true;
+    if (c->client.output)
+        c->client.output->setNotify(nullptr);
+    cmdHandler.closeClient(c->client);
+    redisstats::add(redisstats::DISCONNECTIONS);
+    shutdown(c->fd, SHUT_RDWR);
+    close(c->fd);
+    release(c);
+}
+
+void redisuring::release(connection* c) {
+    if (c->recvArmed || c->writing || c->isDirty)
+        return;
+    conns.erase(c->id);
+    delete c;
+}
+#else
+struct redisuring::ring {};
+struct redisuring::connection {};
+
+bool redisuring::available() {
+    return false;
+}
+
+redisuring::redisuring(rediscommandhandler& handler) : cmdHandler(handler) {}
+
+redisuring::~redisuring() {}
+
+bool redisuring::run(SOCKET listener) {
+    return false;
+}
+
+redisuring::stats redisuring::getStats() const {
+    return stats();
+}
+#endif
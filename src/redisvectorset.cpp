@@ -0,0 +1,418 @@
+#include <string>
+#include <vector>
+#include <queue>
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+#include <functional>
+#include "../include/redisvectorset.h"
+#include "../include/redisserialize.h"
+#include "../include/simdkernels.h"
+
+static void normalize(std::vector<float>& v) {
+    float norm = std::sqrt(simdkernels::dot(v.data(), v.data(), v.size()));
+    if (norm > 0) {
+        for (auto& x : v)
+            x /= norm;
+    }
+}
+
+const char* redisvectorset::metricName(metric m) {
+    switch (m) {
+    case L2: return "l2";
+    case IP: return "ip";
+    default: return "cosine";
+    }
+}
+
+bool redisvectorset::parseMetric(const std::string& name, metric& m) {
+    std::string upper = name;
+    std::transform(upper.begin(), upper.end(), upper.begin(), ::toupper);
+    if (upper == "COSINE")
+        m = COSINE;
+    else if (upper == "L2")
+        m = L2;
+    else if (upper == "IP")
+        m = IP;
+    else
+        return false;
+    return true;
+}
+
+float redisvectorset::distance(const float* a, const float* b) const {
+    switch (cfg.kind) {
+    case L2: return simdkernels::l2sq(a, b, dim);
+    case IP: return -simdkernels::dot(a, b, dim);
+    default: return 1.0f - simdkernels::dot(a, b, dim); // vectors are stored normalized
+    }
+}
+
+float redisvectorset::scoreOf(float dist) const {
+    switch (cfg.kind) {
+    case L2: return std::sqrt(std::max(dist, 0.0f));
+    case IP: return -dist;
+    default: return 1.0f - dist;
+    }
+}
+
+uint32_t* redisvectorset::linksOf(uint32_t node, int level) {
+    if (level == 0)
+        return &links0[static_cast<size_t>(node) * (2 * cfg.m + 1)];
+    return &upperLinks[node][static_cast<size_t>(level - 1) * (cfg.m + 1)];
+}
+
+const uint32_t* redisvectorset::linksOf(uint32_t node, int level) const {
+    if (level == 0)
+        return &links0[static_cast<size_t>(node) * (2 * cfg.m + 1)];
+    return &upperLinks[node][static_cast<size_t>(level - 1) * (cfg.m + 1)];
+}
+
+int redisvectorset::randomLevel() {
+    // xorshift64*; levels follow the usual exponential decay with mL = 1/ln(M)
+    rngState ^= rngState >> 12;
+    rngState ^= rngState << 25;
+    rngState ^= rngState >> 27;
+    uint64_t r = rngState * 0x2545F4914F6CDD1DULL;
+    double u = (static_cast<double>(r >> 11) + 1.0) / 9007199254740993.0;
+    int level = static_cast<int>(-std::log(u) / std::log(static_cast<double>(cfg.m)));
+    return std::min(level, 16);
+}
+
+bool redisvectorset::add(const std::string& element, const std::vector<float>& vec, bool& added, std::string& err) {
+    if (vec.empty()) {
+        err = "vector must have at least one dimension";
+        return false;
+    }
+    if (dim == 0) {
+        dim = vec.size();
+    }
+    else if (vec.size() != dim) {
+        err = "Vector dimension mismatch - got " + std::to_string(vec.size()) + " but set has " + std::to_string(dim);
+        return false;
+    }
+
+    std::vector<float> v(vec);
+    if (cfg.kind == COSINE)
+        normalize(v);
+
+    // An update is a tombstone plus a fresh insert, so the graph never keeps
+    // links that were chosen for the old position.
+    added = !remove(element);
+
+    uint32_t node = static_cast<uint32_t>(names.size());
+    data.insert(data.end(), v.begin(), v.end());
+    names.push_back(element);
+    deleted.push_back(0);
+    levels.push_back(0);
+    links0.resize(links0.size() + 2 * cfg.m + 1, 0);
+    upperLinks.emplace_back();
+    index[element] = node;
+    insertNode(node);
+    return true;
+}
+
+bool redisvectorset::remove(const std::string& element) {
+    auto it = index.find(element);
+    if (it == index.end())
+        return false;
+    deleted[it->second] = 1;
+    index.erase(it);
+    tombstones++;
+    if (index.empty()) {
+        size_t keepDim = dim;
+        *this = redisvectorset(cfg);
+        dim = keepDim;
+    }
+    else if (tombstones > EXACT_THRESHOLD && tombstones > names.size() / 2) {
+        rebuild();
+    }
+    return true;
+}
+
+bool redisvectorset::get(const std::string& element, std::vector<float>& vec) const {
+    auto it = index.find(element);
+    if (it == index.end())
+        return false;
+    const float* v = vectorOf(it->second);
+    vec.assign(v, v + dim);
+    return true;
+}
+
+void redisvectorset::insertNode(uint32_t node) {
+    int level = randomLevel();
+    levels[node] = level;
+    upperLinks[node].assign(static_cast<size_t>(level) * (cfg.m + 1), 0);
+
+    if (maxLevel < 0) {
+        entryPoint = node;
+        maxLevel = level;
+        return;
+    }
+
+    const float* q = vectorOf(node);
+    uint32_t ep = entryPoint;
+    if (level < maxLevel)
+        ep = greedyClosest(q, ep, maxLevel, level + 1);
+
+    for (int l = std::min(level, maxLevel); l >= 0; --l) {
+        std::vector<candidate> cands = searchLayer(q, ep, cfg.efConstruction, l);
+        std::vector<uint32_t> neighbors = selectNeighbors(q, cands, cfg.m);
+        uint32_t* links = linksOf(node, l);
+        links[0] = static_cast<uint32_t>(neighbors.size());
+        for (size_t i = 0; i < neighbors.size(); ++i) {
+            links[i + 1] = neighbors[i];
+            connect(neighbors[i], node, l);
+        }
+        ep = cands.front().second;
+    }
+
+    if (level > maxLevel) {
+        maxLevel = level;
+        entryPoint = node;
+    }
+}
+
+uint32_t redisvectorset::greedyClosest(const float* q, uint32_t entry, int fromLevel, int toLevel) const {
+    uint32_t cur = entry;
+    float curDist = distance(q, vectorOf(cur));
+    for (int l = fromLevel; l >= toLevel; --l) {
+        bool changed = true;
+        while (changed) {
+            changed = false;
+            const uint32_t* links = linksOf(cur, l);
+            for (uint32_t i = 1; i <= links[0]; ++i) {
+                float d = distance(q, vectorOf(links[i]));
+                if (d < curDist) {
+                    curDist = d;
+                    cur = links[i];
+                    changed = true;
+                }
+            }
+        }
+    }
+    return cur;
+}
+
+std::vector<redisvectorset::candidate> redisvectorset::searchLayer(const float* q, uint32_t entry, size_t ef, int level) const {
+    if (visitedTag.size() < names.size())
+        visitedTag.resize(names.size(), 0);
+    if (++visitedEpoch == 0) {
+        std::fill(visitedTag.begin(), visitedTag.end(), 0);
+        visitedEpoch = 1;
+    }
+
+    std::priority_queue<candidate, std::vector<candidate>, std::greater<candidate>> frontier;
+    std::priority_queue<candidate> best;
+    float d = distance(q, vectorOf(entry));
+    frontier.emplace(d, entry);
+    best.emplace(d, entry);
+    visitedTag[entry] = visitedEpoch;
+
+    while (!frontier.empty()) {
+        candidate c = frontier.top();
+        if (c.first > best.top().first && best.size() >= ef)
+            break;
+        frontier.pop();
+        const uint32_t* links = linksOf(c.second, level);
+        for (uint32_t i = 1; i <= links[0]; ++i) {
+            uint32_t n = links[i];
+            if (visitedTag[n] == visitedEpoch)
+                continue;
+            visitedTag[n] = visitedEpoch;
+            float dn = distance(q, vectorOf(n));
+            if (best.size() < ef || dn < best.top().first) {
+                frontier.emplace(dn, n);
+                best.emplace(dn, n);
+                if (best.size() > ef)
+                    best.pop();
+            }
+        }
+    }
+
+    std::vector<candidate> result(best.size());
+    for (size_t i = best.size(); i > 0; --i) {
+        result[i - 1] = best.top();
+        best.pop();
+    }
+    return result;
+}
+
+// HNSW neighbour heuristic: keep a candidate only if it is closer to the base
+// than to any neighbour already kept, which spreads links across directions.
+std::vector<uint32_t> redisvectorset::selectNeighbors(const float*, std::vector<candidate> candidates, size_t m) const {
+    std::sort(candidates.begin(), candidates.end());
+    std::vector<uint32_t> selected;
+    if (candidates.size() <= m) {
+        for (const auto& c : candidates)
+            selected.push_back(c.second);
+        return selected;
+    }
+    for (const auto& c : candidates) {
+        bool keep = true;
+        for (uint32_t s : selected) {
+            if (distance(vectorOf(c.second), vectorOf(s)) < c.first) {
+                keep = false;
+                break;
+            }
+        }
+        if (keep)
+            selected.push_back(c.second);
+        if (selected.size() >= m)
+            break;
+    }
+    return selected;
+}
+
+void redisvectorset::connect(uint32_t node, uint32_t neighbor, int level) {
+    uint32_t* links = linksOf(node, level);
+    size_t cap = maxLinks(level);
+    if (links[0] < cap) {
+        links[++links[0]] = neighbor;
+        return;
+    }
+    const float* base = vectorOf(node);
+    std::vector<candidate> cands;
+    cands.reserve(cap + 1);
+    cands.emplace_back(distance(base, vectorOf(neighbor)), neighbor);
+    for (uint32_t i = 1; i <= links[0]; ++i)
+        cands.emplace_back(distance(base, vectorOf(links[i])), links[i]);
+    std::vector<uint32_t> kept = selectNeighbors(base, cands, cap);
+    links[0] = static_cast<uint32_t>(kept.size());
+    for (size_t i = 0; i < kept.size(); ++i)
+        links[i + 1] = kept[i];
+}
+
+void redisvectorset::rebuild() {
+    std::vector<float> oldData;
+    std::vector<std::string> oldNames;
+    oldData.swap(data);
+    oldNames.swap(names);
+    std::vector<uint8_t> oldDeleted;
+    oldDeleted.swap(deleted);
+
+    levels.clear();
+    links0.clear();
+    upperLinks.clear();
+    index.clear();
+    visitedTag.clear();
+    maxLevel = -1;
+    entryPoint = 0;
+    tombstones = 0;
+
+    for (size_t i = 0; i < oldNames.size(); ++i) {
+        if (oldDeleted[i])
+            continue;
+        uint32_t node = static_cast<uint32_t>(names.size());
+        data.insert(data.end(), oldData.begin() + i * dim, oldData.begin() + (i + 1) * dim);
+        names.push_back(oldNames[i]);
+        deleted.push_back(0);
+        levels.push_back(0);
+        links0.resize(links0.size() + 2 * cfg.m + 1, 0);
+        upperLinks.emplace_back();
+        index[oldNames[i]] = node;
+        insertNode(node);
+    }
+}
+
+std::vector<std::pair<std::string, float>> redisvectorset::search(const std::vector<float>& query, size_t k, size_t ef, bool exact) const {
+    std::vector<std::pair<std::string, float>> out;
+    if (k == 0 || index.empty() || query.size() != dim)
+        return out;
+
+    std::vector<float> q(query);
+    if (cfg.kind == COSINE)
+        normalize(q);
+
+    std::vector<candidate> hits;
+    if (exact || index.size() < EXACT_THRESHOLD) {
+        // Brute force over the contiguous array with a bounded max-heap
+        std::priority_queue<candidate> best;
+        for (uint32_t node = 0; node < names.size(); ++node) {
+            if (deleted[node])
+                continue;
+            float d = distance(q.data(), vectorOf(node));
+            if (best.size() < k) {
+                best.emplace(d, node);
+            }
+            else if (d < best.top().first) {
+                best.pop();
+                best.emplace(d, node);
+            }
+        }
+        hits.resize(best.size());
+        for (size_t i = best.size(); i > 0; --i) {
+            hits[i - 1] = best.top();
+            best.pop();
+        }
+    }
+    else {
+        uint32_t ep = greedyClosest(q.data(), entryPoint, maxLevel, 1);
+        // Widen the beam by the tombstone ratio so deleted nodes do not eat
+        // into the k results.
+        size_t beam = std::max(ef, k) + tombstones * std::max(ef, k) / names.size();
+        hits = searchLayer(q.data(), ep, beam, 0);
+    }
+
+    for (const auto& h : hits) {
+        if (deleted[h.second])
+            continue;
+        out.emplace_back(names[h.second], scoreOf(h.first));
+        if (out.size() >= k)
+            break;
+    }
+    return out;
+}
+
+size_t redisvectorset::memoryUsage() const {
+    size_t bytes = sizeof(*this);
+    bytes += data.capacity() * sizeof(float);
+    bytes += links0.capacity() * sizeof(uint32_t);
+    bytes += levels.capacity() * sizeof(int) + deleted.capacity();
+    for (const auto& l : upperLinks)
+        bytes += sizeof(l) + l.capacity() * sizeof(uint32_t);
+    for (const auto& n : names)
+        bytes += sizeof(n) + n.capacity();
+    bytes += index.size() * (sizeof(std::string) + sizeof(uint32_t) + 2 * sizeof(void*));
+    return bytes;
+}
+
+void redisvectorset::serialize(std::string& out) const {
+    putVarint(out, dim);
+    putVarint(out, static_cast<uint64_t>(cfg.kind));
+    putVarint(out, cfg.m);
+    putVarint(out, cfg.efConstruction);
+    putVarint(out, index.size());
+    for (uint32_t node = 0; node < names.size(); ++node) {
+        if (deleted[node])
+            continue;
+        putString(out, names[node]);
+        out.append(reinterpret_cast<const char*>(vectorOf(node)), dim * sizeof(float));
+    }
+}
+
+bool redisvectorset::deserialize(const std::string& in) {
+    size_t pos = 0;
+    uint64_t d, kind, m, efc, n;
+    if (!getVarint(in, pos, d) || !getVarint(in, pos, kind) || !getVarint(in, pos, m) ||
+        !getVarint(in, pos, efc) || !getVarint(in, pos, n) || kind > IP || m < 2)
+        return false;
+    config c;
+    c.kind = static_cast<metric>(kind);
+    c.m = m;
+    c.efConstruction = efc;
+    *this = redisvectorset(c);
+
+    std::vector<float> v(d);
+    for (uint64_t i = 0; i < n; ++i) {
+        std::string name;
+        if (!getString(in, pos, name) || in.size() - pos < d * sizeof(float))
+            return false;
+        std::memcpy(v.data(), in.data() + pos, d * sizeof(float));
+        pos += d * sizeof(float);
+        bool added;
+        std::string err;
+        if (!add(name, v, added, err))
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,193 @@
+#include <string>
+#include <vector>
+#include <cmath>
+#include <cctype>
+#include <chrono>
+#include <cstring>
+#include <algorithm>
+#include "../include/semanticcache.h"
+#include "../include/simdkernels.h"
+#include "../include/hyperloglog.h"
+#include "../include/redisserialize.h"
+
+static semanticcache::embedder& currentEmbedder() {
+    static semanticcache::embedder fn = semanticcache::hashEmbedding;
+    return fn;
+}
+
+std::vector<float> semanticcache::hashEmbedding(const std::string& text) {
+    std::vector<float> v(DEFAULT_DIMENSION, 0.0f);
+    std::string word;
+    auto flush = [&v, &word]() {
+        if (word.empty())
+            return;
+        uint64_t h = hyperloglog::murmurhash64a(word.data(), word.size(), 0x5eed);
+        v[h % DEFAULT_DIMENSION] += (h >> 63) ? -1.0f : 1.0f;
+        word.clear();
+    };
+    for (unsigned char c : text) {
+        if (std::isalnum(c))
+            word.push_back(static_cast<char>(std::tolower(c)));
+        else
+            flush();
+    }
+    flush();
+    return v;
+}
+
+void semanticcache::setEmbedder(embedder fn) {
+    currentEmbedder() = fn ? fn : embedder(hashEmbedding);
+}
+
+std::vector<float> semanticcache::embed(const std::string& text) {
+    return currentEmbedder()(text);
+}
+
+void semanticcache::quantize(const std::vector<float>& v, std::vector<int8_t>& out, float& scale) {
+    float norm = std::sqrt(simdkernels::dot(v.data(), v.data(), v.size()));
+    float maxAbs = 0;
+    for (float x : v)
+        maxAbs = std::fmax(maxAbs, std::fabs(x));
+    out.resize(v.size());
+    if (norm == 0 || maxAbs == 0) {
+        std::fill(out.begin(), out.end(), 0);
+        scale = 0;
+        return;
+    }
+    // Normalized vector mapped so its largest component becomes +-127
+    float q = 127.0f / maxAbs;
+    for (size_t i = 0; i < v.size(); ++i)
+        out[i] = static_cast<int8_t>(std::lround(v[i] * q));
+    scale = maxAbs / (127.0f * norm);
+}
+
+std::string semanticcache::nextEntryKey(const std::string& cacheName) {
+    return "scache:{" + cacheName + "}:" + std::to_string(++nextId);
+}
+
+bool semanticcache::insert(const std::string& entryKey, const std::vector<float>& embedding, std::string& err) {
+    if (embedding.empty()) {
+        err = "embedding must have at least one dimension";
+        return false;
+    }
+    if (dim == 0) {
+        dim = embedding.size();
+    }
+    else if (embedding.size() != dim) {
+        err = "Embedding dimension mismatch - got " + std::to_string(embedding.size()) + " but cache has " + std::to_string(dim);
+        return false;
+    }
+    remove(entryKey);
+
+    std::vector<int8_t> q;
+    float scale;
+    quantize(embedding, q, scale);
+    slots[entryKey] = keys.size();
+    keys.push_back(entryKey);
+    scales.push_back(scale);
+    codes.insert(codes.end(), q.begin(), q.end());
+    return true;
+}
+
+bool semanticcache::remove(const std::string& entryKey) {
+    auto it = slots.find(entryKey);
+    if (it == slots.end())
+        return false;
+    // Swap the last entry into the hole so codes stay one packed array
+    size_t slot = it->second;
+    size_t last = keys.size() - 1;
+    if (slot != last) {
+        keys[slot] = keys[last];
+        scales[slot] = scales[last];
+        std::memcpy(&codes[slot * dim], &codes[last * dim], dim);
+        slots[keys[slot]] = slot;
+    }
+    keys.pop_back();
+    scales.pop_back();
+    codes.resize(last * dim);
+    slots.erase(entryKey);
+    return true;
+}
+
+bool semanticcache::lookup(const std::vector<float>& embedding, float threshold, std::string& entryKey, float& score) {
+    auto start = std::chrono::steady_clock::now();
+    bool found = false;
+    if (!keys.empty() && embedding.size() == dim) {
+        std::vector<int8_t> q;
+        float qscale;
+        quantize(embedding, q, qscale);
+        int64_t bestIdx = -1;
+        float best = -2.0f;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            float s = qscale * scales[i] * static_cast<float>(simdkernels::dotInt8(q.data(), &codes[i * dim], dim));
+            if (s > best) {
+                best = s;
+                bestIdx = static_cast<int64_t>(i);
+            }
+        }
+        if (bestIdx >= 0 && best >= threshold) {
+            entryKey = keys[bestIdx];
+            score = best;
+            found = true;
+        }
+    }
+    found ? hits++ : misses++;
+    lookupLatency.record(static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now() - start).count()));
+    return found;
+}
+
+size_t semanticcache::memoryUsage() const {
+    size_t bytes = sizeof(*this) + codes.capacity() + scales.capacity() * sizeof(float);
+    for (const auto& k : keys)
+        bytes += sizeof(k) + k.capacity();
+    bytes += slots.size() * (sizeof(std::string) + sizeof(size_t) + 2 * sizeof(void*));
+    return bytes;
+}
+
+semanticcache::stats semanticcache::getStats() const {
+    stats s;
+    s.entries = keys.size();
+    s.dimension = dim;
+    s.hits = hits;
+    s.misses = misses;
+    s.p50 = lookupLatency.percentile(50);
+    s.p95 = lookupLatency.percentile(95);
+    s.p99 = lookupLatency.percentile(99);
+    s.indexBytes = memoryUsage();
+    return s;
+}
+
+void semanticcache::serialize(std::string& out) const {
+    putVarint(out, nextId);
+    putVarint(out, dim);
+    putVarint(out, keys.size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+        putString(out, keys[i]);
+        out.append(reinterpret_cast<const char*>(&scales[i]), sizeof(float));
+        out.append(reinterpret_cast<const char*>(&codes[i * dim]), dim);
+    }
+}
+
+bool semanticcache::deserialize(const std::string& in) {
+    *this = semanticcache();
+    size_t pos = 0;
+    uint64_t n, d;
+    if (!getVarint(in, pos, nextId) || !getVarint(in, pos, d) || !getVarint(in, pos, n))
+        return false;
+    dim = d;
+    for (uint64_t i = 0; i < n; ++i) {
+        std::string key;
+        float scale;
+        if (!getString(in, pos, key) || in.size() - pos < sizeof(float) + dim)
+            return false;
+        std::memcpy(&scale, in.data() + pos, sizeof(float));
+        pos += sizeof(float);
+        slots[key] = keys.size();
+        keys.push_back(key);
+        scales.push_back(scale);
+        codes.insert(codes.end(), in.begin() + pos, in.begin() + pos + dim);
+        pos += dim;
+    }
+    return true;
+}
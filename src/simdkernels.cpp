@@ -0,0 +1,637 @@
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <bit>
+#include "../include/simdkernels.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define SIMD_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#else
+#include <cpuid.h>
+#endif
+#elif defined(__aarch64__) || defined(_M_ARM64)
+#define SIMD_NEON 1
+#include <arm_neon.h>
+#endif
+
+// MSVC lets any intrinsic be used in any function; GCC and Clang need the
+// instruction set enabled per function.
+#if defined(SIMD_X86) && !defined(_MSC_VER)
+#define SIMD_TARGET(isa) __attribute__((target(isa)))
+#else
+#define SIMD_TARGET(isa)
+#endif
+
+#if defined(SIMD_X86)
+static void cpuid(int leaf, int subleaf, unsigned regs[4]) {
+#if defined(_MSC_VER)
+    int r[4];
+    __cpuidex(r, leaf, subleaf);
+    for (int i = 0; i < 4; ++i)
+        regs[i] = static_cast<unsigned>(r[i]);
+#else
+    __cpuid_count(leaf, subleaf, regs[0], regs[1], regs[2], regs[3]);
+#endif
+}
+
+static uint64_t xgetbv0() {
+#if defined(_MSC_VER)
+    return _xgetbv(0);
+#else
+    unsigned lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return (static_cast<uint64_t>(hi) << 32) | lo;
+#endif
+}
+#endif
+
+const cpufeatures& cpufeatures::get() {
+    static const cpufeatures features = []() {
+        cpufeatures f;
+#if defined(SIMD_X86)
+        unsigned regs[4];
+        cpuid(0, 0, regs);
+        unsigned maxLeaf = regs[0];
+        cpuid(1, 0, regs);
+        f.sse42 = (regs[2] >> 20) & 1;
+        bool osxsave = (regs[2] >> 27) & 1;
+        bool avx = (regs[2] >> 28) & 1;
+        f.fma = (regs[2] >> 12) & 1;
+        uint64_t xcr0 = osxsave ? xgetbv0() : 0;
+        bool ymmState = (xcr0 & 0x6) == 0x6;
+        bool zmmState = (xcr0 & 0xe6) == 0xe6;
+        if (maxLeaf >= 7) {
+            cpuid(7, 0, regs);
+            f.avx2 = avx && ymmState && ((regs[1] >> 5) & 1);
+            f.avx512f = zmmState && ((regs[1] >> 16) & 1);
+            f.avx512bw = f.avx512f && ((regs[1] >> 30) & 1);
+            f.avx512vpopcntdq = f.avx512f && ((regs[2] >> 14) & 1);
+        }
+        f.fma = f.fma && ymmState;
+#elif defined(SIMD_NEON)
+        f.neon = true;
+#endif
+        return f;
+    }();
+    return features;
+}
+
+// Scalar kernels, four accumulators so the compiler can keep them in flight.
+static float dotScalar(const float* a, const float* b, size_t n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        s0 += a[i] * b[i];
+        s1 += a[i + 1] * b[i + 1];
+        s2 += a[i + 2] * b[i + 2];
+        s3 += a[i + 3] * b[i + 3];
+    }
+    for (; i < n; ++i)
+        s0 += a[i] * b[i];
+    return (s0 + s1) + (s2 + s3);
+}
+
+static float l2sqScalar(const float* a, const float* b, size_t n) {
+    float s0 = 0, s1 = 0, s2 = 0, s3 = 0;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        float d0 = a[i] - b[i], d1 = a[i + 1] - b[i + 1];
+        float d2 = a[i + 2] - b[i + 2], d3 = a[i + 3] - b[i + 3];
+        s0 += d0 * d0;
+        s1 += d1 * d1;
+        s2 += d2 * d2;
+        s3 += d3 * d3;
+    }
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        s0 += d * d;
+    }
+    return (s0 + s1) + (s2 + s3);
+}
+
+static int32_t dotInt8Scalar(const int8_t* a, const int8_t* b, size_t n) {
+    int32_t s0 = 0, s1 = 0;
+    size_t i = 0;
+    for (; i + 2 <= n; i += 2) {
+        s0 += static_cast<int32_t>(a[i]) * b[i];
+        s1 += static_cast<int32_t>(a[i + 1]) * b[i + 1];
+    }
+    if (i < n)
+        s0 += static_cast<int32_t>(a[i]) * b[i];
+    return s0 + s1;
+}
+
+#if defined(SIMD_X86)
+SIMD_TARGET("avx2,fma")
+static float hsum256(__m256 v) {
+    __m128 lo = _mm256_castps256_ps128(v);
+    __m128 hi = _mm256_extractf128_ps(v, 1);
+    lo = _mm_add_ps(lo, hi);
+    lo = _mm_add_ps(lo, _mm_movehl_ps(lo, lo));
+    lo = _mm_add_ss(lo, _mm_shuffle_ps(lo, lo, 0x55));
+    return _mm_cvtss_f32(lo);
+}
+
+SIMD_TARGET("avx2,fma")
+static float dotAvx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+        acc1 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8), acc1);
+    }
+    for (; i + 8 <= n; i += 8)
+        acc0 = _mm256_fmadd_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i), acc0);
+    float s = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i)
+        s += a[i] * b[i];
+    return s;
+}
+
+SIMD_TARGET("avx2,fma")
+static float l2sqAvx2(const float* a, const float* b, size_t n) {
+    __m256 acc0 = _mm256_setzero_ps(), acc1 = _mm256_setzero_ps();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256 d0 = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        __m256 d1 = _mm256_sub_ps(_mm256_loadu_ps(a + i + 8), _mm256_loadu_ps(b + i + 8));
+        acc0 = _mm256_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm256_fmadd_ps(d1, d1, acc1);
+    }
+    for (; i + 8 <= n; i += 8) {
+        __m256 d = _mm256_sub_ps(_mm256_loadu_ps(a + i), _mm256_loadu_ps(b + i));
+        acc0 = _mm256_fmadd_ps(d, d, acc0);
+    }
+    float s = hsum256(_mm256_add_ps(acc0, acc1));
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        s += d * d;
+    }
+    return s;
+}
+
+// int8 products are widened to int16 and pair-summed into int32 lanes by
+// madd, which cannot overflow for |x| <= 127.
+SIMD_TARGET("avx2")
+static int32_t dotInt8Avx2(const int8_t* a, const int8_t* b, size_t n) {
+    __m256i acc = _mm256_setzero_si256();
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        __m256i va = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(a + i)));
+        __m256i vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(b + i)));
+        acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+    }
+    __m128i s = _mm_add_epi32(_mm256_castsi256_si128(acc), _mm256_extracti128_si256(acc, 1));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0x4e));
+    s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 0xb1));
+    return _mm_cvtsi128_si32(s) + dotInt8Scalar(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+static int32_t dotInt8Avx512(const int8_t* a, const int8_t* b, size_t n) {
+    __m512i acc = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512i va = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i)));
+        __m512i vb = _mm512_cvtepi8_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + i)));
+        acc = _mm512_add_epi32(acc, _mm512_madd_epi16(va, vb));
+    }
+    alignas(64) int32_t lanes[16];
+    _mm512_store_si512(reinterpret_cast<__m512i*>(lanes), acc);
+    int32_t s = 0;
+    for (int j = 0; j < 16; ++j)
+        s += lanes[j];
+    return s + dotInt8Scalar(a + i, b + i, n - i);
+}
+
+SIMD_TARGET("avx512f")
+static float hsum512(__m512 v) {
+    alignas(64) float lanes[16];
+    _mm512_store_ps(lanes, v);
+    float s = 0;
+    for (int i = 0; i < 16; ++i)
+        s += lanes[i];
+    return s;
+}
+
+SIMD_TARGET("avx512f")
+static float dotAvx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        acc1 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16), acc1);
+    }
+    acc0 = _mm512_add_ps(acc0, acc1);
+    if (i + 16 <= n) {
+        acc0 = _mm512_fmadd_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i), acc0);
+        i += 16;
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        acc0 = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i), acc0);
+    }
+    return hsum512(acc0);
+}
+
+SIMD_TARGET("avx512f")
+static float l2sqAvx512(const float* a, const float* b, size_t n) {
+    __m512 acc0 = _mm512_setzero_ps(), acc1 = _mm512_setzero_ps();
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m512 d0 = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        __m512 d1 = _mm512_sub_ps(_mm512_loadu_ps(a + i + 16), _mm512_loadu_ps(b + i + 16));
+        acc0 = _mm512_fmadd_ps(d0, d0, acc0);
+        acc1 = _mm512_fmadd_ps(d1, d1, acc1);
+    }
+    acc0 = _mm512_add_ps(acc0, acc1);
+    if (i + 16 <= n) {
+        __m512 d = _mm512_sub_ps(_mm512_loadu_ps(a + i), _mm512_loadu_ps(b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+        i += 16;
+    }
+    if (i < n) {
+        __mmask16 m = static_cast<__mmask16>((1u << (n - i)) - 1);
+        __m512 d = _mm512_sub_ps(_mm512_maskz_loadu_ps(m, a + i), _mm512_maskz_loadu_ps(m, b + i));
+        acc0 = _mm512_fmadd_ps(d, d, acc0);
+    }
+    return hsum512(acc0);
+}
+#endif
+
+#if defined(SIMD_NEON)
+static float dotNeon(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        acc0 = vfmaq_f32(acc0, vld1q_f32(a + i), vld1q_f32(b + i));
+        acc1 = vfmaq_f32(acc1, vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+    }
+    float s = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i)
+        s += a[i] * b[i];
+    return s;
+}
+
+static float l2sqNeon(const float* a, const float* b, size_t n) {
+    float32x4_t acc0 = vdupq_n_f32(0), acc1 = vdupq_n_f32(0);
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        float32x4_t d0 = vsubq_f32(vld1q_f32(a + i), vld1q_f32(b + i));
+        float32x4_t d1 = vsubq_f32(vld1q_f32(a + i + 4), vld1q_f32(b + i + 4));
+        acc0 = vfmaq_f32(acc0, d0, d0);
+        acc1 = vfmaq_f32(acc1, d1, d1);
+    }
+    float s = vaddvq_f32(vaddq_f32(acc0, acc1));
+    for (; i < n; ++i) {
+        float d = a[i] - b[i];
+        s += d * d;
+    }
+    return s;
+}
+
+static int32_t dotInt8Neon(const int8_t* a, const int8_t* b, size_t n) {
+    int32x4_t acc = vdupq_n_s32(0);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        int8x16_t va = vld1q_s8(a + i), vb = vld1q_s8(b + i);
+        acc = vpadalq_s16(acc, vmull_s8(vget_low_s8(va), vget_low_s8(vb)));
+        acc = vpadalq_s16(acc, vmull_s8(vget_high_s8(va), vget_high_s8(vb)));
+    }
+    return vaddvq_s32(acc) + dotInt8Scalar(a + i, b + i, n - i);
+}
+#endif
+
+// Bitmap kernels. The scalar ones work a 64-bit word at a time; bytes are
+// loaded with memcpy, so neither alignment nor byte order matters.
+static inline uint64_t popcount64(uint64_t x) {
+    x = x - ((x >> 1) & 0x5555555555555555ull);
+    x = (x & 0x3333333333333333ull) + ((x >> 2) & 0x3333333333333333ull);
+    x = (x + (x >> 4)) & 0x0f0f0f0f0f0f0f0full;
+    return (x * 0x0101010101010101ull) >> 56;
+}
+
+static uint64_t popcountScalar(const uint8_t* p, size_t n) {
+    uint64_t count = 0;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        count += popcount64(w);
+    }
+    if (i < n) {
+        uint64_t w = 0;
+        std::memcpy(&w, p + i, n - i);
+        count += popcount64(w);
+    }
+    return count;
+}
+
+static void bitwiseScalar(simdkernels::bitop op, uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t a, b;
+        std::memcpy(&a, dst + i, 8);
+        std::memcpy(&b, src + i, 8);
+        a = op == simdkernels::BIT_AND ? a & b : op == simdkernels::BIT_OR ? a | b : a ^ b;
+        std::memcpy(dst + i, &a, 8);
+    }
+    for (; i < n; ++i)
+        dst[i] = op == simdkernels::BIT_AND ? dst[i] & src[i] : op == simdkernels::BIT_OR ? dst[i] | src[i] : dst[i] ^ src[i];
+}
+
+static void bitNotScalar(uint8_t* dst, const uint8_t* src, size_t n) {
+    for (size_t i = 0; i < n; ++i)
+        dst[i] = static_cast<uint8_t>(~src[i]);
+}
+
+static size_t findNotScalar(const uint8_t* p, size_t n, uint8_t skip) {
+    uint64_t pattern = 0x0101010101010101ull * skip;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        uint64_t w;
+        std::memcpy(&w, p + i, 8);
+        if (w != pattern)
+            break;
+    }
+    for (; i < n; ++i) {
+        if (p[i] != skip)
+            return i;
+    }
+    return n;
+}
+
+#if defined(SIMD_X86)
+// Nibble lookup (Mula): pshufb counts each half-byte, byte lanes add up for
+// at most 31 blocks before psadbw folds them into 64-bit totals.
+SIMD_TARGET("avx2")
+static uint64_t popcountAvx2(const uint8_t* p, size_t n) {
+    const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+        0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+    const __m256i low = _mm256_set1_epi8(0x0f);
+    __m256i total = _mm256_setzero_si256();
+    size_t i = 0;
+    while (n - i >= 32) {
+        size_t blocks = std::min<size_t>((n - i) / 32, 31);
+        __m256i bytes = _mm256_setzero_si256();
+        for (size_t b = 0; b < blocks; ++b, i += 32) {
+            __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+            __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, low));
+            __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), low));
+            bytes = _mm256_add_epi8(bytes, _mm256_add_epi8(lo, hi));
+        }
+        total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+    }
+    alignas(32) uint64_t lanes[4];
+    _mm256_store_si256(reinterpret_cast<__m256i*>(lanes), total);
+    return lanes[0] + lanes[1] + lanes[2] + lanes[3] + popcountScalar(p + i, n - i);
+}
+
+SIMD_TARGET("avx512f,avx512vpopcntdq")
+static uint64_t popcountAvx512(const uint8_t* p, size_t n) {
+    __m512i acc0 = _mm512_setzero_si512(), acc1 = _mm512_setzero_si512();
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(_mm512_loadu_si512(p + i)));
+        acc1 = _mm512_add_epi64(acc1, _mm512_popcnt_epi64(_mm512_loadu_si512(p + i + 64)));
+    }
+    acc0 = _mm512_add_epi64(acc0, acc1);
+    if (i + 64 <= n) {
+        acc0 = _mm512_add_epi64(acc0, _mm512_popcnt_epi64(_mm512_loadu_si512(p + i)));
+        i += 64;
+    }
+    return static_cast<uint64_t>(_mm512_reduce_add_epi64(acc0)) + popcountScalar(p + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+static void bitwiseAvx2(simdkernels::bitop op, uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i a = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(dst + i));
+        __m256i b = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        a = op == simdkernels::BIT_AND ? _mm256_and_si256(a, b)
+            : op == simdkernels::BIT_OR ? _mm256_or_si256(a, b) : _mm256_xor_si256(a, b);
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), a);
+    }
+    bitwiseScalar(op, dst + i, src + i, n - i);
+}
+
+SIMD_TARGET("avx512f")
+static void bitwiseAvx512(simdkernels::bitop op, uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m512i a = _mm512_loadu_si512(dst + i);
+        __m512i b = _mm512_loadu_si512(src + i);
+        a = op == simdkernels::BIT_AND ? _mm512_and_si512(a, b)
+            : op == simdkernels::BIT_OR ? _mm512_or_si512(a, b) : _mm512_xor_si512(a, b);
+        _mm512_storeu_si512(dst + i, a);
+    }
+    bitwiseScalar(op, dst + i, src + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+static void bitNotAvx2(uint8_t* dst, const uint8_t* src, size_t n) {
+    const __m256i ones = _mm256_set1_epi8(-1);
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(dst + i), _mm256_xor_si256(v, ones));
+    }
+    bitNotScalar(dst + i, src + i, n - i);
+}
+
+SIMD_TARGET("avx512f")
+static void bitNotAvx512(uint8_t* dst, const uint8_t* src, size_t n) {
+    const __m512i ones = _mm512_set1_epi64(-1);
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64)
+        _mm512_storeu_si512(dst + i, _mm512_xor_si512(_mm512_loadu_si512(src + i), ones));
+    bitNotScalar(dst + i, src + i, n - i);
+}
+
+SIMD_TARGET("avx2")
+static size_t findNotAvx2(const uint8_t* p, size_t n, uint8_t skip) {
+    const __m256i pattern = _mm256_set1_epi8(static_cast<char>(skip));
+    size_t i = 0;
+    for (; i + 32 <= n; i += 32) {
+        __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p + i));
+        uint32_t differ = ~static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(v, pattern)));
+        if (differ)
+            return i + std::countr_zero(differ);
+    }
+    return i + findNotScalar(p + i, n - i, skip);
+}
+
+SIMD_TARGET("avx512f,avx512bw")
+static size_t findNotAvx512(const uint8_t* p, size_t n, uint8_t skip) {
+    const __m512i pattern = _mm512_set1_epi8(static_cast<char>(skip));
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        uint64_t differ = _mm512_cmpneq_epu8_mask(_mm512_loadu_si512(p + i), pattern);
+        if (differ)
+            return i + std::countr_zero(differ);
+    }
+    return i + findNotScalar(p + i, n - i, skip);
+}
+#endif
+
+#if defined(SIMD_NEON)
+// vcnt gives per-byte counts; pairwise widening adds keep them in 16-bit
+// lanes for up to 2048 blocks before they are folded into 64 bits.
+static uint64_t popcountNeon(const uint8_t* p, size_t n) {
+    uint64x2_t total = vdupq_n_u64(0);
+    size_t i = 0;
+    while (n - i >= 16) {
+        size_t blocks = std::min<size_t>((n - i) / 16, 2048);
+        uint16x8_t acc = vdupq_n_u16(0);
+        for (size_t b = 0; b < blocks; ++b, i += 16)
+            acc = vpadalq_u8(acc, vcntq_u8(vld1q_u8(p + i)));
+        total = vpadalq_u32(total, vpaddlq_u16(acc));
+    }
+    return vaddvq_u64(total) + popcountScalar(p + i, n - i);
+}
+
+static void bitwiseNeon(simdkernels::bitop op, uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint8x16_t a = vld1q_u8(dst + i), b = vld1q_u8(src + i);
+        a = op == simdkernels::BIT_AND ? vandq_u8(a, b) : op == simdkernels::BIT_OR ? vorrq_u8(a, b) : veorq_u8(a, b);
+        vst1q_u8(dst + i, a);
+    }
+    bitwiseScalar(op, dst + i, src + i, n - i);
+}
+
+static void bitNotNeon(uint8_t* dst, const uint8_t* src, size_t n) {
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16)
+        vst1q_u8(dst + i, vmvnq_u8(vld1q_u8(src + i)));
+    bitNotScalar(dst + i, src + i, n - i);
+}
+
+static size_t findNotNeon(const uint8_t* p, size_t n, uint8_t skip) {
+    const uint8x16_t pattern = vdupq_n_u8(skip);
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        if (vminvq_u8(vceqq_u8(vld1q_u8(p + i), pattern)) != 0xff)
+            break;
+    }
+    return i + findNotScalar(p + i, n - i, skip);
+}
+#endif
+
+namespace {
+
+typedef float (*floatkernel)(const float*, const float*, size_t);
+typedef int32_t (*int8kernel)(const int8_t*, const int8_t*, size_t);
+typedef uint64_t (*popcountkernel)(const uint8_t*, size_t);
+typedef void (*bitwisekernel)(simdkernels::bitop, uint8_t*, const uint8_t*, size_t);
+typedef void (*bitnotkernel)(uint8_t*, const uint8_t*, size_t);
+typedef size_t (*findkernel)(const uint8_t*, size_t, uint8_t);
+
+struct kernelset {
+    floatkernel dot = dotScalar;
+    floatkernel l2sq = l2sqScalar;
+    int8kernel dotInt8 = dotInt8Scalar;
+    const char* name = "scalar";
+    popcountkernel popcount = popcountScalar;
+    bitwisekernel bitwise = bitwiseScalar;
+    bitnotkernel bitNot = bitNotScalar;
+    findkernel findNot = findNotScalar;
+    const char* bitName = "scalar";
+};
+
+const kernelset& selectKernels() {
+    static const kernelset k = []() {
+        kernelset r;
+        const cpufeatures& f = cpufeatures::get();
+        (void)f;
+#if defined(SIMD_X86)
+        if (f.avx512f) {
+            r.dot = dotAvx512;
+            r.l2sq = l2sqAvx512;
+            r.name = "avx512";
+        }
+        else if (f.avx2 && f.fma) {
+            r.dot = dotAvx2;
+            r.l2sq = l2sqAvx2;
+            r.name = "avx2";
+        }
+        if (f.avx512bw)
+            r.dotInt8 = dotInt8Avx512;
+        else if (f.avx2)
+            r.dotInt8 = dotInt8Avx2;
+
+        if (f.avx2) {
+            r.popcount = popcountAvx2;
+            r.bitwise = bitwiseAvx2;
+            r.bitNot = bitNotAvx2;
+            r.findNot = findNotAvx2;
+            r.bitName = "avx2";
+        }
+        if (f.avx512vpopcntdq) {
+            r.popcount = popcountAvx512;
+            r.bitName = "avx512";
+        }
+        if (f.avx512f) {
+            r.bitwise = bitwiseAvx512;
+            r.bitNot = bitNotAvx512;
+        }
+        if (f.avx512bw)
+            r.findNot = findNotAvx512;
+#elif defined(SIMD_NEON)
+        r.dot = dotNeon;
+        r.l2sq = l2sqNeon;
+        r.dotInt8 = dotInt8Neon;
+        r.name = "neon";
+        r.popcount = popcountNeon;
+        r.bitwise = bitwiseNeon;
+        r.bitNot = bitNotNeon;
+        r.findNot = findNotNeon;
+        r.bitName = "neon";
+#endif
+        return r;
+    }();
+    return k;
+}
+
+} // namespace
+
+float simdkernels::dot(const float* a, const float* b, size_t n) {
+    return selectKernels().dot(a, b, n);
+}
+
+float simdkernels::l2sq(const float* a, const float* b, size_t n) {
+    return selectKernels().l2sq(a, b, n);
+}
+
+int32_t simdkernels::dotInt8(const int8_t* a, const int8_t* b, size_t n) {
+    return selectKernels().dotInt8(a, b, n);
+}
+
+const char* simdkernels::floatKernelName() {
+    return selectKernels().name;
+}
+
+uint64_t simdkernels::popcount(const uint8_t* p, size_t n) {
+    return selectKernels().popcount(p, n);
+}
+
+void simdkernels::bitwise(bitop op, uint8_t* dst, const uint8_t* src, size_t n) {
+    selectKernels().bitwise(op, dst, src, n);
+}
+
+void simdkernels::bitNot(uint8_t* dst, const uint8_t* src, size_t n) {
+    selectKernels().bitNot(dst, src, n);
+}
+
+size_t simdkernels::findNot(const uint8_t* p, size_t n, uint8_t skip) {
+    return selectKernels().findNot(p, n, skip);
+}
+
+const char* simdkernels::bitKernelName() {
+    return selectKernels().bitName;
+}
@@ -0,0 +1,129 @@
+#include <iostream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <chrono>
+#include "redisdatabase.h"
+#include "rediscommandhandler.h"
+#include "redisclient.h"
+#include "semanticcache.h"
+
+// semanticcache-test: drives SCACHE.* through the command handler with a
+// fixed embedder, so every similarity below is known in advance. Exits
+// non-zero when a check fails.
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { \
+        if (!(cond)) { \
+            std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK failed: " #cond "\n"; \
+            failures++; \
+        } \
+    } while (0)
+
+static std::string command(const std::vector<std::string>& args) {
+    std::string out = "*" + std::to_string(args.size()) + "\r\n";
+    for (const auto& a : args)
+        out += "$" + std::to_string(a.size()) + "\r\n" + a + "\r\n";
+    return out;
+}
+
+static std::string bulk(const std::string& s) {
+    return "$" + std::to_string(s.size()) + "\r\n" + s + "\r\n";
+}
+
+static const std::string NIL = "$-1\r\n";
+
+// Unit vectors in 4 dimensions; cos(capital, capital-near) = 0.95,
+// cos(capital, weather) = 0
+static std::vector<float> stubEmbedding(const std::string& prompt) {
+    static const std::map<std::string, std::vector<float>> table = {
+        { "capital", { 1.0f, 0.0f, 0.0f, 0.0f } },
+        { "capital-near", { 0.95f, 0.3122499f, 0.0f, 0.0f } },
+        { "weather", { 0.0f, 1.0f, 0.0f, 0.0f } },
+        { "stocks", { 0.0f, 0.0f, 1.0f, 0.0f } },
+        { "recipes", { 0.0f, 0.0f, 0.0f, 1.0f } },
+    };
+    auto it = table.find(prompt);
+    return it != table.end() ? it->second : std::vector<float>{ 0.5f, 0.5f, 0.5f, 0.5f };
+}
+
+// SCACHE.STATS field as a string, or "" when missing
+static std::string statField(rediscommandhandler& handler, redisclient& client, const std::string& cache,
+    const std::string& field) {
+    std::string reply = handler.processCommand(command({ "SCACHE.STATS", cache }), client);
+    size_t at = reply.find(bulk(field));
+    if (at == std::string::npos)
+        return "";
+    at += bulk(field).size();
+    size_t start = reply.find("\r\n", at) + 2;
+    return reply.substr(start, reply.find("\r\n", start) - start);
+}
+
+int main() {
+    semanticcache::setEmbedder(stubEmbedding);
+    rediscommandhandler handler;
+    redisclient client;
+    auto run = [&](const std::vector<std::string>& args) { return handler.processCommand(command(args), client); };
+
+    // Threshold hit and miss
+    CHECK(run({ "SCACHE.SET", "t", "capital", "Paris" }) == bulk("scache:{t}:1"));
+    CHECK(run({ "SCACHE.GET", "t", "capital" }) == bulk("Paris"));
+    CHECK(run({ "SCACHE.GET", "t", "capital-near" }) == bulk("Paris"));
+    CHECK(run({ "SCACHE.GET", "t", "capital-near", "THRESHOLD", "0.99" }) == NIL);
+    CHECK(run({ "SCACHE.GET", "t", "weather" }) == NIL);
+    CHECK(statField(handler, client, "t", "hits") == "2");
+    CHECK(statField(handler, client, "t", "misses") == "2");
+    CHECK(statField(handler, client, "t", "entries") == "1");
+    CHECK(statField(handler, client, "t", "dimension") == "4");
+    CHECK(statField(handler, client, "t", "hit_rate") == "0.500000");
+
+    // TTL expiry takes the entry out of the index
+    CHECK(run({ "SCACHE.SET", "t", "weather", "Sunny", "TTL", "1" }) == bulk("scache:{t}:2"));
+    CHECK(run({ "SCACHE.GET", "t", "weather" }) == bulk("Sunny"));
+    CHECK(statField(handler, client, "t", "entries") == "2");
+    std::this_thread::sleep_for(std::chrono::milliseconds(1100));
+    CHECK(run({ "SCACHE.GET", "t", "weather" }) == NIL);
+    CHECK(statField(handler, client, "t", "entries") == "1");
+    CHECK(run({ "TYPE", "scache:{t}:2" }) == "+none\r\n");
+
+    // A TTL change keeps the entry; overwriting its key drops it
+    CHECK(run({ "EXPIRE", "scache:{t}:1", "100" }) == "+OK\r\n");
+    CHECK(run({ "SCACHE.GET", "t", "capital" }) == bulk("Paris"));
+    CHECK(run({ "SET", "scache:{t}:1", "clobbered" }) == "+OK\r\n");
+    CHECK(run({ "SCACHE.GET", "t", "capital" }) == NIL);
+    CHECK(statField(handler, client, "t", "entries") == "0");
+
+    // DEL drops the entry
+    CHECK(run({ "SCACHE.SET", "d", "stocks", "Up" }) == bulk("scache:{d}:1"));
+    CHECK(run({ "DEL", "scache:{d}:1" }) == ":1\r\n");
+    CHECK(run({ "SCACHE.GET", "d", "stocks" }) == NIL);
+    CHECK(statField(handler, client, "d", "entries") == "0");
+
+    // RENAME drops it too, and the renamed key keeps the value
+    CHECK(run({ "SCACHE.SET", "r", "recipes", "Soup" }) == bulk("scache:{r}:1"));
+    CHECK(run({ "RENAME", "scache:{r}:1", "kept" }) == "+OK\r\n");
+    CHECK(run({ "SCACHE.GET", "r", "recipes" }) == NIL);
+    CHECK(run({ "GET", "kept" }) == bulk("Soup"));
+
+    // An entry name a client already took is skipped, not overwritten
+    CHECK(run({ "SET", "scache:{u}:1", "mine" }) == "+OK\r\n");
+    CHECK(run({ "SCACHE.SET", "u", "capital", "Paris" }) == bulk("scache:{u}:2"));
+    CHECK(run({ "GET", "scache:{u}:1" }) == bulk("mine"));
+    CHECK(run({ "SCACHE.GET", "u", "capital" }) == bulk("Paris"));
+
+    // DROP removes the entries and their keys
+    CHECK(run({ "SCACHE.DROP", "u" }) == ":1\r\n");
+    CHECK(run({ "TYPE", "scache:{u}:2" }) == "+none\r\n");
+    CHECK(run({ "SCACHE.STATS", "u" }) == "*-1\r\n");
+
+    handler.closeClient(client);
+    if (failures) {
+        std::cerr << failures << " check(s) failed\n";
+        return 1;
+    }
+    std::cout << "semanticcache-test passed\n";
+    return 0;
+}